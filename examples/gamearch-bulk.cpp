@@ -0,0 +1,603 @@
+/**
+ * @file  gamearch-bulk.cpp
+ * @brief Extract or convert many archive files at once, on multiple threads.
+ *
+ * Copyright (C) 2010-2016 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <iomanip>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <boost/program_options.hpp>
+#include <camoto/stream_file.hpp>
+#include <camoto/stream_string.hpp>
+#include <camoto/util.hpp>
+#include <camoto/gamearchive.hpp>
+
+namespace po = boost::program_options;
+namespace fs = camoto::filesystem; // until C++17, then std::filesystem
+namespace ga = camoto::gamearchive;
+namespace stream = camoto::stream;
+
+#define PROGNAME "gamearch-bulk"
+
+/*** Return values ***/
+/// All is good
+#define RET_OK                 0
+/// Bad arguments (missing/invalid parameters)
+#define RET_BADARGS            1
+/// One or more archives could not be processed
+#define RET_NONCRITICAL_FAILURE 4
+
+/// Default for --io-limit.
+#define BULK_DEFAULT_IO_LIMIT  4
+
+/// Use any decompression filters? (unset with -u option)
+bool bUseFilters = true;
+
+/// Limit on how many threads can read or write files at the same time.
+/**
+ * Decoding and encoding files can use every core, but having every thread
+ * hit the disk at once just makes them all wait longer, especially when
+ * reading from optical media.  Threads hold an IOSlot while doing I/O and
+ * release it again before doing any filtering.
+ */
+class IOLimit
+{
+	public:
+		IOLimit(unsigned int limit)
+			:	available(limit)
+		{
+		}
+
+		void acquire()
+		{
+			std::unique_lock<std::mutex> lk(this->lock);
+			this->cvFree.wait(lk, [this]() { return this->available > 0; });
+			this->available--;
+			return;
+		}
+
+		void release()
+		{
+			{
+				std::lock_guard<std::mutex> lk(this->lock);
+				this->available++;
+			}
+			this->cvFree.notify_one();
+			return;
+		}
+
+	protected:
+		std::mutex lock;
+		std::condition_variable cvFree;
+		unsigned int available;
+};
+
+/// Hold one of the IOLimit slots until going out of scope.
+class IOSlot
+{
+	public:
+		IOSlot(IOLimit& limit)
+			:	limit(limit)
+		{
+			this->limit.acquire();
+		}
+
+		~IOSlot()
+		{
+			this->limit.release();
+		}
+
+	protected:
+		IOLimit& limit;
+};
+
+/// Totals shared between all the jobs, for progress reporting.
+struct Progress
+{
+	std::mutex lock;              ///< Protects everything here, and std::cout
+	unsigned int numArchives;     ///< Number of archives given
+	unsigned int numDone;         ///< Archives finished, successfully or not
+	unsigned int numFailed;       ///< Archives that could not be processed
+	unsigned long numFiles;       ///< Files extracted or converted
+	stream::len lenData;          ///< Bytes of (unfiltered) file data handled
+	std::chrono::steady_clock::time_point start;
+};
+
+/// What to do with each archive.
+struct Job
+{
+	std::string strInput;         ///< Archive filename
+	std::string strOutput;        ///< Folder or archive to write to
+};
+
+/// Settings common to all jobs.
+struct Settings
+{
+	std::string strType;          ///< Input archive type, empty to autodetect
+	ga::ArchiveManager::handler_t pConvertType; ///< Convert to this, or null
+	IOLimit *io;                  ///< Shared I/O limit
+};
+
+/// Number of seconds since the start, for progress messages.
+double elapsed(const Progress& progress)
+{
+	return std::chrono::duration<double>(
+		std::chrono::steady_clock::now() - progress.start).count();
+}
+
+/// Print a line of output from any thread, without it getting mixed up.
+void report(Progress& progress, const Job& job, bool ok,
+	unsigned long numFiles, stream::len lenData, const std::string& msg)
+{
+	std::lock_guard<std::mutex> lk(progress.lock);
+	progress.numDone++;
+	if (!ok) progress.numFailed++;
+	progress.numFiles += numFiles;
+	progress.lenData += lenData;
+
+	double secs = elapsed(progress);
+	std::cout << '[' << progress.numDone << '/' << progress.numArchives << "] "
+		<< job.strInput << ": ";
+	if (ok) {
+		std::cout << numFiles << " files, " << lenData << " bytes";
+	} else {
+		std::cout << "failed; " << msg;
+	}
+	std::cout << std::fixed << std::setprecision(1)
+		<< " (" << (secs > 0 ? progress.lenData / secs / 1048576 : 0)
+		<< " MB/s overall)" << std::endl;
+	return;
+}
+
+/// Make a folder and any parent folders it needs.
+void makeFolders(const std::string& path)
+{
+	std::string::size_type pos = 0;
+	do {
+		pos = path.find('/', pos + 1);
+		std::string part = path.substr(0, pos);
+		if (!part.empty() && !fs::exists(part)) fs::create_directory(part);
+	} while (pos != std::string::npos);
+	return;
+}
+
+/// Turn a filename from inside an archive into one that is safe to write to.
+std::string sanitiseName(const std::string& name, unsigned int index)
+{
+	if (name.empty()) {
+		// The format has no filenames, so make one up
+		return createString("@" << index);
+	}
+	std::string out = name;
+	for (auto& c : out) {
+		switch (c) {
+			case '/':
+#ifdef __WIN32
+			case '\\':
+			case ':':
+#endif
+				c = '_';
+				break;
+		}
+	}
+	if ((out.compare(".") == 0) || (out.compare("..") == 0)) out.insert(0, "_");
+	return out;
+}
+
+/// Read a file's data into memory, unfiltering it if needed.
+/**
+ * Only reading the data from the archive counts towards the I/O limit, the
+ * filter is run afterwards so other threads can use the disk in the meantime.
+ */
+std::string readFile(const Settings& settings, ga::Archive& archive,
+	const ga::Archive::FileHandle& id)
+{
+	stream::string raw;
+	{
+		IOSlot slot(*settings.io);
+		auto in = archive.open(id, false);
+		stream::copy(raw, *in);
+	}
+	if (!bUseFilters || id->filter.empty()) return std::move(raw.data);
+
+	auto pFilterType = ga::FilterManager::byCode(id->filter);
+	if (!pFilterType) {
+		throw stream::error(createString(
+			"could not find filter \"" << id->filter << "\""
+		));
+	}
+	auto in = pFilterType->apply(
+		std::make_unique<stream::input_string>(raw.data));
+	stream::string decoded;
+	stream::copy(decoded, *in);
+	return std::move(decoded.data);
+}
+
+/// Extract every file in an archive (and any subfolders) into a folder.
+void extractAll(const Settings& settings, ga::Archive& archive,
+	const std::string& folder, unsigned long *numFiles, stream::len *lenData)
+{
+	{
+		IOSlot slot(*settings.io);
+		makeFolders(folder);
+	}
+	unsigned int index = 0;
+	for (const auto& i : archive.files()) {
+		std::string strLocal = folder + '/' + sanitiseName(i->strName, index++);
+		if (i->fAttr & ga::Archive::File::Attribute::Folder) {
+			auto sub = archive.openFolder(i);
+			extractAll(settings, *sub, strLocal, numFiles, lenData);
+			continue;
+		}
+		std::string data = readFile(settings, archive, i);
+		{
+			IOSlot slot(*settings.io);
+			stream::output_file out(strLocal, true);
+			out.write(data);
+			out.flush();
+		}
+		(*numFiles)++;
+		*lenData += data.length();
+	}
+	return;
+}
+
+/// Open an archive, working out its type if needed.
+std::shared_ptr<ga::Archive> openArchive(const Settings& settings,
+	const std::string& filename)
+{
+	IOSlot slot(*settings.io);
+	auto content = std::make_unique<stream::file>(filename, false);
+
+	ga::ArchiveManager::handler_t pArchType;
+	std::unique_ptr<ga::ArchiveType::ProbeResult> parsed;
+	if (settings.strType.empty()) {
+		// Take the most certain match, or the first one if there's a tie
+		auto best = ga::ArchiveType::Certainty::DefinitelyNo;
+		for (const auto& i : ga::ArchiveManager::formats()) {
+			std::unique_ptr<ga::ArchiveType::ProbeResult> probed;
+			auto cert = i->probe(*content, &probed);
+			if (cert <= best) continue;
+			pArchType = i;
+			parsed = std::move(probed);
+			best = cert;
+			// Don't bother checking any other formats if we got a 100% match
+			if (cert == ga::ArchiveType::Certainty::DefinitelyYes) break;
+		}
+		if (!pArchType) {
+			throw stream::error("unable to work out the archive type, use --type");
+		}
+	} else {
+		pArchType = ga::ArchiveManager::byCode(settings.strType);
+		if (pArchType->probe(*content, &parsed)
+			== ga::ArchiveType::Certainty::DefinitelyNo
+		) {
+			throw stream::error("not a " + pArchType->friendlyName());
+		}
+	}
+
+	camoto::SuppData suppData;
+	for (const auto& s : pArchType->getRequiredSupps(*content, filename)) {
+		suppData[s.first] = std::make_unique<stream::file>(s.second, false);
+	}
+	return pArchType->openProbed(std::move(content), suppData, std::move(parsed));
+}
+
+/// Copy every file in an archive into a newly created one.
+void convert(const Settings& settings, ga::Archive& archive,
+	const std::string& filename, unsigned long *numFiles, stream::len *lenData)
+{
+	// Read and unfilter everything first, so the I/O is done in a few large
+	// chunks and the new archive's filters can run without holding a slot.
+	auto pType = settings.pConvertType;
+	std::vector<ga::NewFile> files;
+	for (const auto& i : archive.files()) {
+		if (i->fAttr & ga::Archive::File::Attribute::Folder) {
+			throw stream::error("archives with folders cannot be converted");
+		}
+		ga::NewFile f;
+		f.name = i->strName;
+		f.type = i->type;
+		f.attr = i->fAttr;
+		f.content = readFile(settings, archive, i);
+		files.push_back(std::move(f));
+	}
+
+	// Every file created for the new archive, so they can be removed again if
+	// the conversion fails instead of leaving a broken archive behind.
+	std::vector<std::string> created;
+	std::shared_ptr<ga::Archive> dest;
+	try {
+		{
+			IOSlot slot(*settings.io);
+			makeFolders(filename.substr(0, filename.rfind('/')));
+			auto content = std::make_unique<stream::file>(filename, true);
+			created.push_back(filename);
+			camoto::SuppData suppData;
+			for (const auto& s : pType->getRequiredSupps(*content, filename)) {
+				suppData[s.first] = std::make_unique<stream::file>(s.second, true);
+				created.push_back(s.second);
+			}
+			dest = pType->create(std::move(content), suppData);
+		}
+
+		// Only keep the attributes the new format can store
+		auto allowed = dest->getSupportedAttributes();
+		stream::len lenConverted = 0;
+		for (auto& f : files) {
+			f.attr &= allowed;
+			lenConverted += f.content.length();
+		}
+
+		// Every thread is already busy with its own archive, so don't start any
+		// more for the filters.
+		ga::insertFiles(*dest, nullptr, files, 1, ga::CompressPolicy::Smallest);
+
+		IOSlot slot(*settings.io);
+		dest->flush();
+		*numFiles += files.size();
+		*lenData += lenConverted;
+	} catch (...) {
+		// Close the files before removing them, otherwise Windows won't allow it
+		dest.reset();
+		IOSlot slot(*settings.io);
+		for (const auto& i : created) std::remove(i.c_str());
+		throw;
+	}
+	return;
+}
+
+/// Process one archive, reporting the result.
+void runJob(const Settings& settings, Progress& progress, const Job& job)
+{
+	unsigned long numFiles = 0;
+	stream::len lenData = 0;
+	try {
+		auto archive = openArchive(settings, job.strInput);
+		if (settings.pConvertType) {
+			convert(settings, *archive, job.strOutput, &numFiles, &lenData);
+		} else {
+			extractAll(settings, *archive, job.strOutput, &numFiles, &lenData);
+		}
+	} catch (const camoto::error& e) {
+		report(progress, job, false, numFiles, lenData, e.what());
+		return;
+	} catch (const fs::filesystem_error&) {
+		report(progress, job, false, numFiles, lenData,
+			"unable to create output folder");
+		return;
+	} catch (const std::exception& e) {
+		report(progress, job, false, numFiles, lenData, e.what());
+		return;
+	}
+	report(progress, job, true, numFiles, lenData, std::string());
+	return;
+}
+
+/// Work out where the output for an input archive should go.
+/**
+ * The input path is kept, so archives with the same name in different
+ * folders don't overwrite each other.  Any leading slash and ".." are removed
+ * so the output always ends up under the output folder.
+ */
+std::string outputName(const std::string& dest, const std::string& input,
+	const std::string& ext)
+{
+	std::string out = dest;
+	std::istringstream parts(input);
+	std::string part;
+	while (std::getline(parts, part, '/')) {
+		if (part.empty() || (part.compare(".") == 0) || (part.compare("..") == 0)) {
+			continue;
+		}
+		out += '/';
+		out += part;
+	}
+	if (!ext.empty()) {
+		auto posDot = out.rfind('.');
+		if ((posDot != std::string::npos) && (posDot > out.rfind('/'))) {
+			out.erase(posDot);
+		}
+		out += '.';
+		out += ext;
+	}
+	return out;
+}
+
+int main(int iArgC, char *cArgV[])
+{
+#ifdef __GLIBCXX__
+	// Set a better exception handler
+	std::set_terminate(__gnu_cxx::__verbose_terminate_handler);
+#endif
+
+	// Disable stdin/printf/etc. sync for a speed boost
+	std::ios_base::sync_with_stdio(false);
+
+	// Declare the supported options.
+	po::options_description poActions("Actions");
+	poActions.add_options()
+		("extract-to,x", po::value<std::string>(),
+			"extract all the files in each archive into a folder here")
+
+		("convert-to,c", po::value<std::string>(),
+			"convert each archive into this archive type")
+	;
+
+	po::options_description poOptions("Options");
+	poOptions.add_options()
+		("output,o", po::value<std::string>(),
+			"[with -c only] folder to write the converted archives into")
+		("type,t", po::value<std::string>(),
+			"specify the type of the input archives (default is autodetect)")
+		("jobs,j", po::value<unsigned int>(),
+			"number of archives to process at once (default is one per CPU core)")
+		("io-limit,I", po::value<unsigned int>(),
+			"number of threads allowed to read or write files at once")
+		("unfiltered,u",
+			"[with -x only] do not filter files (no decrypt/decompress)")
+	;
+
+	po::options_description poHidden("Hidden parameters");
+	poHidden.add_options()
+		("archive", po::value<std::vector<std::string>>(), "archive files to read")
+		("help", "produce help message")
+	;
+
+	po::options_description poVisible("");
+	poVisible.add(poActions).add(poOptions);
+
+	po::options_description poComplete("Parameters");
+	poComplete.add(poActions).add(poOptions).add(poHidden);
+
+	po::positional_options_description poPositional;
+	poPositional.add("archive", -1);
+
+	po::variables_map mpArgs;
+	try {
+		po::store(po::command_line_parser(iArgC, cArgV)
+			.options(poComplete).positional(poPositional).run(), mpArgs);
+		po::notify(mpArgs);
+	} catch (const po::error& e) {
+		std::cerr << PROGNAME ": " << e.what()
+			<< ".  Use --help for help." << std::endl;
+		return RET_BADARGS;
+	}
+
+	if (mpArgs.count("help") || !mpArgs.count("archive")) {
+		std::cout <<
+			"Copyright (C) 2010-2016 Adam Nielsen <malvineous@shikadi.net>\n"
+			"This program comes with ABSOLUTELY NO WARRANTY.  This is free software,\n"
+			"and you are welcome to change and redistribute it under certain conditions;\n"
+			"see <http://www.gnu.org/licenses/> for details.\n"
+			"\n"
+			"Utility to extract or convert many game archives at once.\n"
+			"Build date " __DATE__ " " __TIME__ << "\n"
+			"\n"
+			"Usage: gamearch-bulk <action> [options] <archive> [archive...]\n"
+			<< poVisible << "\n" << std::endl;
+		return mpArgs.count("help") ? RET_OK : RET_BADARGS;
+	}
+
+	Settings settings;
+	std::string strDest;
+	std::string strExt;
+	settings.pConvertType = nullptr;
+	if (mpArgs.count("type")) {
+		settings.strType = mpArgs["type"].as<std::string>();
+		if (!ga::ArchiveManager::byCode(settings.strType)) {
+			std::cerr << "Unknown file type given to -t/--type: "
+				<< settings.strType << std::endl;
+			return RET_BADARGS;
+		}
+	}
+	if (mpArgs.count("extract-to") == mpArgs.count("convert-to")) {
+		std::cerr << PROGNAME ": exactly one of -x/--extract-to or "
+			"-c/--convert-to must be given" << std::endl;
+		return RET_BADARGS;
+	}
+	if (mpArgs.count("extract-to")) {
+		strDest = mpArgs["extract-to"].as<std::string>();
+	} else {
+		std::string strConvertType = mpArgs["convert-to"].as<std::string>();
+		settings.pConvertType = ga::ArchiveManager::byCode(strConvertType);
+		if (!settings.pConvertType) {
+			std::cerr << "Unknown file type given to -c/--convert-to: "
+				<< strConvertType << std::endl;
+			return RET_BADARGS;
+		}
+		if (!mpArgs.count("output")) {
+			std::cerr << PROGNAME ": -c/--convert-to needs -o/--output too"
+				<< std::endl;
+			return RET_BADARGS;
+		}
+		strDest = mpArgs["output"].as<std::string>();
+		auto exts = settings.pConvertType->fileExtensions();
+		strExt = exts.empty() ? std::string("dat") : exts[0];
+	}
+	if (mpArgs.count("unfiltered")) {
+		if (settings.pConvertType) {
+			// The new archive would have no way of knowing the data is still
+			// compressed or encrypted with the old archive's algorithm.
+			std::cerr << PROGNAME ": -u/--unfiltered cannot be used with "
+				"-c/--convert-to" << std::endl;
+			return RET_BADARGS;
+		}
+		bUseFilters = false;
+	}
+
+	unsigned int numJobs = std::thread::hardware_concurrency();
+	if (mpArgs.count("jobs")) numJobs = mpArgs["jobs"].as<unsigned int>();
+	numJobs = std::max(numJobs, 1u);
+	unsigned int ioLimit = BULK_DEFAULT_IO_LIMIT;
+	if (mpArgs.count("io-limit")) ioLimit = mpArgs["io-limit"].as<unsigned int>();
+	IOLimit io(std::max(ioLimit, 1u));
+	settings.io = &io;
+
+	std::vector<Job> jobs;
+	for (const auto& i : mpArgs["archive"].as<std::vector<std::string>>()) {
+		Job job;
+		job.strInput = i;
+		job.strOutput = outputName(strDest, i, strExt);
+		jobs.push_back(std::move(job));
+	}
+
+	Progress progress;
+	progress.numArchives = jobs.size();
+	progress.numDone = 0;
+	progress.numFailed = 0;
+	progress.numFiles = 0;
+	progress.lenData = 0;
+	progress.start = std::chrono::steady_clock::now();
+
+	// Load the format and filter lists before starting any threads
+	ga::ArchiveManager::formats();
+	ga::FilterManager::formats();
+
+	// Each thread takes the next archive that hasn't been started yet, so a few
+	// large archives don't hold up the rest.
+	std::atomic<std::size_t> next(0);
+	auto worker = [&]() {
+		for (;;) {
+			std::size_t i = next++;
+			if (i >= jobs.size()) break;
+			runJob(settings, progress, jobs[i]);
+		}
+		return;
+	};
+	numJobs = std::min<unsigned int>(numJobs, jobs.size());
+	std::vector<std::thread> pool;
+	for (unsigned int t = 1; t < numJobs; t++) pool.emplace_back(worker);
+	worker(); // this thread helps out too
+	for (auto& t : pool) t.join();
+
+	double secs = elapsed(progress);
+	std::cout << std::fixed << std::setprecision(1)
+		<< "Processed " << progress.numArchives << " archives ("
+		<< progress.numFailed << " failed), " << progress.numFiles << " files, "
+		<< progress.lenData << " bytes in " << secs << " s ("
+		<< (secs > 0 ? progress.lenData / secs / 1048576 : 0) << " MB/s) using "
+		<< numJobs << " threads" << std::endl;
+
+	return progress.numFailed ? RET_NONCRITICAL_FAILURE : RET_OK;
+}
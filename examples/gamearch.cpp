@@ -18,11 +18,13 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <fstream>
 #include <functional>
 #include <boost/program_options.hpp>
 #include <camoto/stream_file.hpp>
 #include <camoto/util.hpp>
 #include <camoto/gamearchive.hpp>
+#include <camoto/gamearchive/archive-fat.hpp>
 
 namespace po = boost::program_options;
 namespace fs = camoto::filesystem; // until C++17, then std::filesystem
@@ -53,6 +55,41 @@ int iRet = RET_OK;
 /// Use any decompression filters? (unset with -u option)
 bool bUseFilters = true;
 
+/// Pick whichever of two return values describes the more serious problem.
+int worstRet(int a, int b)
+{
+	auto rank = [](int r) {
+		switch (r) {
+			case RET_OK: return 0;
+			case RET_NONCRITICAL_FAILURE: return 1;
+			case RET_UNCOMMON_FAILURE: return 2;
+			case RET_BE_MORE_SPECIFIC: return 3;
+			case RET_BADARGS: return 4;
+			default: return 5; // RET_SHOWSTOPPER
+		}
+	};
+	return (rank(b) > rank(a)) ? b : a;
+}
+
+/// Send everything written to std::cout somewhere else until out of scope.
+class RedirectCout
+{
+	public:
+		RedirectCout(std::ostream& dest)
+			:	orig(std::cout.rdbuf(dest.rdbuf()))
+		{
+		}
+
+		~RedirectCout()
+		{
+			std::cout.flush();
+			std::cout.rdbuf(this->orig);
+		}
+
+	protected:
+		std::streambuf *orig; ///< Where std::cout was going before
+};
+
 // Split a string in two at a delimiter, e.g. "one=two" becomes "one" and "two"
 // and true is returned.  If there is no delimiter both output strings will be
 // the same as the input string and false will be returned.
@@ -214,6 +251,18 @@ void listFiles(const std::string& idPrefix, const std::string& path,
 	return;
 }
 
+/// Open a file in the archive for extracting.
+/**
+ * Filtered files are decoded on a helper thread, so decompression overlaps
+ * with writing the data out.
+ */
+std::unique_ptr<stream::input> openForExtract(
+	std::shared_ptr<ga::Archive> archive, const ga::Archive::FileHandle& id)
+{
+	if (!bUseFilters) return archive->open(id, false);
+	return ga::openDecodeAhead(archive, id);
+}
+
 /// Extract all the files in the archive.
 /**
  * Calls itself recursively to extract any subfolders as well.
@@ -291,7 +340,7 @@ void extractAll(std::shared_ptr<ga::Archive> archive, bool bScript)
 
 			// Open on disk
 			try {
-				auto pfsIn = archive->open(i, bUseFilters);
+				auto pfsIn = openForExtract(archive, i);
 
 				// If the file exists, add .1 .2 .3 etc. onto the end until an
 				// unused name is found.  This allows extracting files with the
@@ -375,6 +424,25 @@ int main(int iArgC, char *cArgV[])
 		("delete,d", po::value<std::string>(),
 			"remove a file from the archive")
 
+		("resize,R", po::value<std::string>(),
+			"change the size of a file in the archive (file=size)")
+
+		("dedup,D",
+			"store identical files only once, if the format allows it")
+
+		("align", po::value<std::string>(),
+			"pad files so each one starts on a multiple of this many bytes (0 for "
+			"the filesystem block size), so later changes move less data")
+
+		("sync-from", po::value<std::string>(),
+			"make the archive match another one of the same type, only changing "
+			"the files that differ")
+
+		("batch", po::value<std::string>(),
+			"read more actions from a file (or - for stdin), one command line per "
+			"line, and report the result of each on stdout (everything else goes "
+			"to stderr)")
+
 		("uncompressed-size,z", po::value<int>(),
 			"[with -u only] specify the uncompressed size to use with -i")
 	;
@@ -397,6 +465,9 @@ int main(int iArgC, char *cArgV[])
 			"force open even if the archive is not in the given format")
 		("create,c",
 			"create a new archive file instead of opening an existing one")
+		("memory-limit", po::value<std::string>(),
+			"keep at most this many bytes of unsaved changes in memory before "
+			"moving them to a temporary file (0 for no limit)")
 	;
 
 	po::options_description poHidden("Hidden parameters");
@@ -417,7 +488,9 @@ int main(int iArgC, char *cArgV[])
 
 	bool bScript = false; // show output suitable for script parsing?
 	bool bForceOpen = false; // open anyway even if archive not in given format?
+	stream::len lenMemoryLimit = PIECE_DEFAULT_MEMORY_LIMIT; // --memory-limit
 	bool bCreate = false; // create a new archive?
+	bool bBatch = false; // stdout only for --batch results?
 	try {
 		po::parsed_options pa = po::parse_command_line(iArgC, cArgV, poComplete);
 
@@ -487,15 +560,34 @@ int main(int iArgC, char *cArgV[])
 				(i->string_key.compare("create") == 0)
 			) {
 				bCreate = true;
+			} else if (i->string_key.compare("batch") == 0) {
+				bBatch = true;
+			} else if (i->string_key.compare("memory-limit") == 0) {
+				const char *strLimit = i->value[0].c_str();
+				char *end;
+				lenMemoryLimit = strtoull(strLimit, &end, 0);
+				if (!*strLimit || *end) {
+					std::cerr << PROGNAME ": --memory-limit requires a number of bytes "
+						"(e.g. --memory-limit=67108864)" << std::endl;
+					return RET_BADARGS;
+				}
 			}
 		}
 
+		// With --batch, stdout only gets the result of each action so another
+		// program can read them, and everything else goes to stderr instead.
+		std::ostream batchOut(std::cout.rdbuf());
+		std::unique_ptr<RedirectCout> redirect;
+		if (bBatch) redirect = std::make_unique<RedirectCout>(std::cerr);
+
 		if (strFilename.empty()) {
 			std::cerr << "Error: no game archive filename given" << std::endl;
 			return RET_BADARGS;
 		}
 
-		std::unique_ptr<stream::file> psArchive;
+		// Use a stream that can shift block-aligned data without copying it, for
+		// filesystems that support it.
+		std::unique_ptr<ga::extent_file> psArchive;
 		if (bCreate && strType.empty()) {
 			std::cerr << "Error: You must specify the --type of archive to create"
 				<< std::endl;
@@ -504,20 +596,26 @@ int main(int iArgC, char *cArgV[])
 		std::cout << (bCreate ? "Creating " : "Opening ") << strFilename
 			<< " as type " << (strType.empty() ? "<autodetect>" : strType)
 			<< std::endl;
+		ga::extent_file *pExtentFile = nullptr; // for --align
 		try {
-			psArchive = std::make_unique<stream::file>(strFilename, bCreate);
+			psArchive = std::make_unique<ga::extent_file>(strFilename, bCreate);
+			pExtentFile = psArchive.get();
 		} catch (const stream::open_error& e) {
 			std::cerr << "Error " << (bCreate ? "creating" : "opening")
 				<< " archive file " << strFilename << ": " << e.what() << std::endl;
 			return RET_SHOWSTOPPER;
 		}
 
-		// Get the format handler for this file format
+		// Get the format handler for this file format.  Whatever the handler read
+		// while checking the file is kept in parsed, so opening the archive
+		// doesn't have to read it all again.
 		ga::ArchiveManager::handler_t pArchType;
+		std::unique_ptr<ga::ArchiveType::ProbeResult> parsed;
 		if (strType.empty()) {
 			// Need to autodetect the file format.
 			for (const auto& i : ga::ArchiveManager::formats()) {
-				ga::ArchiveType::Certainty cert = i->isInstance(*psArchive);
+				std::unique_ptr<ga::ArchiveType::ProbeResult> probed;
+				ga::ArchiveType::Certainty cert = i->probe(*psArchive, &probed);
 				switch (cert) {
 
 					case ga::ArchiveType::Certainty::DefinitelyNo:
@@ -528,7 +626,10 @@ int main(int iArgC, char *cArgV[])
 						std::cout << "File could be a " << i->friendlyName()
 							<< " [" << i->code() << "]" << std::endl;
 						// If we haven't found a match already, use this one
-						if (!pArchType) pArchType = i;
+						if (!pArchType) {
+							pArchType = i;
+							parsed = std::move(probed);
+						}
 						break;
 
 					case ga::ArchiveType::Certainty::PossiblyYes:
@@ -536,12 +637,14 @@ int main(int iArgC, char *cArgV[])
 							<< " [" << i->code() << "]" << std::endl;
 						// Take this one as it's better than an uncertain match
 						pArchType = i;
+						parsed = std::move(probed);
 						break;
 
 					case ga::ArchiveType::Certainty::DefinitelyYes:
 						std::cout << "File is definitely a " << i->friendlyName()
 							<< " [" << i->code() << "]" << std::endl;
 						pArchType = i;
+						parsed = std::move(probed);
 						// Don't bother checking any other formats if we got a 100% match
 						goto finishTesting;
 				}
@@ -568,7 +671,10 @@ int main(int iArgC, char *cArgV[])
 							std::cout << "  * All supp files present, archive is likely "
 								<< i->code() << std::endl;
 							// Set this as the most likely format
-							pArchType = i;
+							if (pArchType != i) {
+								pArchType = i;
+								parsed = std::move(probed);
+							}
 						}
 					}
 				}
@@ -591,9 +697,10 @@ finishTesting:
 
 		assert(pArchType != NULL);
 
-		if (!bCreate) {
-			// Check to see if the file is actually in this format
-			if (pArchType->isInstance(*psArchive) == ga::ArchiveType::Certainty::DefinitelyNo) {
+		if (!bCreate && !strType.empty()) {
+			// Check to see if the file is actually in this format.  Autodetected
+			// formats have already been checked above.
+			if (pArchType->probe(*psArchive, &parsed) == ga::ArchiveType::Certainty::DefinitelyNo) {
 				if (bForceOpen) {
 					std::cerr << "Warning: " << strFilename << " is not a "
 						<< pArchType->friendlyName() << ", open forced." << std::endl;
@@ -625,9 +732,11 @@ finishTesting:
 		std::shared_ptr<ga::Archive> pArchive;
 		try {
 			if (bCreate) {
-				pArchive = pArchType->create(std::move(psArchive), suppData);
+				pArchive = pArchType->createBuffered(std::move(psArchive), suppData,
+					lenMemoryLimit);
 			} else {
-				pArchive = pArchType->open(std::move(psArchive), suppData);
+				pArchive = pArchType->openBuffered(std::move(psArchive), suppData,
+					lenMemoryLimit, std::move(parsed));
 			}
 			assert(pArchive);
 		} catch (const camoto::error& e) {
@@ -645,8 +754,11 @@ finishTesting:
 		// Last value set with -z
 		stream::len lenReal = 0;
 
-		// Run through the actions on the command line
-		for (auto& i : pa.options) {
+		// Carry out one action.  This returns RET_OK to carry on with the next
+		// action, or an error code if the program should stop (e.g. bad
+		// arguments.)  Less serious problems are reported by setting iRet.
+		std::function<int(po::option&)> runAction;
+		runAction = [&](po::option& i) -> int {
 			if (i.string_key.compare("list") == 0) {
 				listFiles(std::string(), std::string(), *pArchive, bScript);
 
@@ -685,7 +797,7 @@ finishTesting:
 						iRet = RET_NONCRITICAL_FAILURE; // one or more files failed
 					} else {
 						// Found it, open on disk
-						auto pfsIn = destArch->open(id, bUseFilters);
+						auto pfsIn = openForExtract(destArch, id);
 						try {
 							auto fsOut = std::make_shared<stream::output_file>(strLocalFile, true);
 							try {
@@ -725,6 +837,187 @@ finishTesting:
 				}
 				std::cout << std::endl;
 
+			} else if (i.string_key.compare("dedup") == 0) {
+				std::cout << "deduplicating" << std::flush;
+
+				try {
+					auto pFATArchive = std::dynamic_pointer_cast<ga::Archive_FAT>(pArchive);
+					if (!pFATArchive || !pFATArchive->canDeduplicate()) {
+						std::cout << " [failed; archive format cannot share file data]";
+						iRet = RET_NONCRITICAL_FAILURE;
+					} else {
+						stream::len lenSaved = pFATArchive->deduplicate();
+						std::cout << " [saved " << lenSaved << " bytes]";
+					}
+				} catch (const stream::error& e) {
+					std::cout << " [failed; " << e.what() << "]";
+					iRet = RET_UNCOMMON_FAILURE; // some files failed, but not in a usual way
+				}
+				std::cout << std::endl;
+
+			} else if (i.string_key.compare("align") == 0) {
+				const char *strAlign = i.value[0].c_str();
+				char *end;
+				stream::len lenAlign = strtoul(strAlign, &end, 0);
+				if (!*strAlign || *end) {
+					std::cerr << PROGNAME ": --align requires a number of bytes (e.g. "
+						"--align=4096)" << std::endl;
+					return RET_BADARGS;
+				}
+				if (lenAlign == 0) lenAlign = pExtentFile->blockSize();
+				std::cout << "   aligning: files to " << lenAlign << " bytes"
+					<< std::flush;
+
+				try {
+					auto pFATArchive = std::dynamic_pointer_cast<ga::Archive_FAT>(pArchive);
+					if (!pFATArchive || !pFATArchive->canDeduplicate()) {
+						std::cout << " [failed; archive format cannot have gaps between "
+							"files]";
+						iRet = RET_NONCRITICAL_FAILURE;
+					} else if (lenAlign == 0) {
+						std::cout << " [failed; filesystem block size unknown]";
+						iRet = RET_NONCRITICAL_FAILURE;
+					} else {
+						pFATArchive->setAlignment(lenAlign);
+					}
+				} catch (const stream::error& e) {
+					std::cout << " [failed; " << e.what() << "]";
+					iRet = RET_UNCOMMON_FAILURE; // some files failed, but not in a usual way
+				}
+				std::cout << std::endl;
+
+			} else if (i.string_key.compare("sync-from") == 0) {
+				std::string& strSource = i.value[0];
+				std::cout << "    syncing: from " << strSource << std::flush;
+
+				try {
+					auto psSource = std::make_unique<stream::file>(strSource, false);
+					camoto::SuppData suppSource;
+					for (const auto& s : pArchType->getRequiredSupps(*psSource, strSource)) {
+						suppSource[s.first] = std::make_unique<stream::file>(s.second, false);
+					}
+					auto pSource = pArchType->open(std::move(psSource), suppSource);
+
+					ga::ArchiveSync sync;
+					auto result = sync.sync(*pArchive, *pSource);
+					std::cout << " [" << result.inserted << " inserted, "
+						<< result.removed << " removed, "
+						<< result.moved << " moved, "
+						<< result.updated << " updated, "
+						<< result.unchanged << " unchanged, "
+						<< result.lenCopied << " bytes written]";
+				} catch (const stream::open_error& e) {
+					std::cout << " [failed; unable to open source archive: " << e.what()
+						<< "]";
+					iRet = RET_NONCRITICAL_FAILURE; // one or more files failed
+				} catch (const stream::error& e) {
+					std::cout << " [failed; " << e.what() << "]";
+					iRet = RET_UNCOMMON_FAILURE; // some files failed, but not in a usual way
+				}
+				std::cout << std::endl;
+
+			} else if (i.string_key.compare("resize") == 0) {
+				std::string strArchFile, strSize;
+				if (!split(i.value[0], '=', &strArchFile, &strSize)) {
+					std::cerr << PROGNAME ": -R/--resize requires a file and a size "
+						"(e.g. --resize file.dat=1234)" << std::endl;
+					return RET_BADARGS;
+				}
+				const char *strLen = strSize.c_str();
+				char *end;
+				stream::len lenNew = strtoull(strLen, &end, 0);
+				if (!*strLen || *end) {
+					std::cerr << PROGNAME ": -R/--resize requires a size in bytes, not \""
+						<< strSize << "\"" << std::endl;
+					return RET_BADARGS;
+				}
+				std::cout << "   resizing: " << strArchFile << " to " << lenNew
+					<< std::flush;
+
+				try {
+					auto destArch = pArchive;
+					ga::Archive::FileHandle id;
+					findFile(&destArch, &id, strArchFile);
+					if (!id) {
+						std::cout << " [failed; file not found inside archive]";
+						iRet = RET_NONCRITICAL_FAILURE; // one or more files failed
+					} else {
+						// Without a filter both sizes are the same, otherwise keep the
+						// unfiltered size unless -z has given a new one.
+						stream::len lenNewReal = lenNew;
+						if (!id->filter.empty()) {
+							if (!lenReal) destArch->resolveRealSizes({id});
+							lenNewReal = lenReal ? lenReal : id->realSize;
+						}
+						destArch->resize(id, lenNew, lenNewReal);
+					}
+				} catch (const stream::error& e) {
+					std::cout << " [failed; " << e.what() << "]";
+					iRet = RET_UNCOMMON_FAILURE; // some files failed, but not in a usual way
+				}
+				std::cout << std::endl;
+
+			} else if (i.string_key.compare("batch") == 0) {
+				std::istream *psBatch = &std::cin;
+				std::ifstream fsBatch;
+				if (i.value[0].compare("-") != 0) {
+					fsBatch.open(i.value[0]);
+					if (!fsBatch) {
+						std::cerr << PROGNAME ": unable to open batch file "
+							<< i.value[0] << std::endl;
+						return RET_BADARGS;
+					}
+					psBatch = &fsBatch;
+				}
+
+				// Each line holds one or more actions, written the same way as on the
+				// command line.  After each one, a line is printed to batchOut in
+				// --script format giving the result, so callers can match them up.
+				std::string line;
+				unsigned int lineNum = 0;
+				while (std::getline(*psBatch, line)) {
+					lineNum++;
+					if (!line.empty() && (line.back() == '\r')) line.pop_back();
+
+					// Skip blank lines and comments
+					auto start = line.find_first_not_of(" \t");
+					if ((start == std::string::npos) || (line[start] == '#')) continue;
+
+					std::vector<po::option> actions;
+					try {
+						actions = po::command_line_parser(po::split_unix(line))
+							.options(poComplete).run().options;
+					} catch (const po::error& e) {
+						std::cerr << PROGNAME ": batch line " << lineNum << ": "
+							<< e.what() << std::endl;
+						batchOut << "batch_line=" << lineNum
+							<< ";action=;status=fail;code=" << RET_BADARGS << std::endl;
+						iRet = worstRet(iRet, RET_BADARGS);
+						continue;
+					}
+
+					for (auto& a : actions) {
+						int iRetBefore = iRet;
+						iRet = RET_OK;
+						int ret;
+						if (a.string_key.empty() || (a.string_key.compare("batch") == 0)) {
+							std::cerr << PROGNAME ": batch line " << lineNum
+								<< ": only actions can be given in a batch file" << std::endl;
+							ret = RET_BADARGS;
+						} else {
+							ret = runAction(a);
+							if (ret == RET_OK) ret = iRet;
+						}
+						std::cout << std::flush;
+						batchOut << "batch_line=" << lineNum << ";action=" << a.string_key
+							<< ";status=" << (ret == RET_OK ? "ok" : "fail");
+						if (ret != RET_OK) batchOut << ";code=" << ret;
+						batchOut << std::endl;
+						// Keep the most serious problem from any action for the exit code
+						iRet = worstRet(iRetBefore, ret);
+					}
+				}
+
 			} else if (i.string_key.compare("insert") == 0) {
 				std::string strSource, strInsertBefore;
 				if (!split(i.value[0], ':', &strSource, &strInsertBefore)) {
@@ -753,7 +1046,7 @@ finishTesting:
 				if (!idBeforeThis) {
 					std::cout << " [failed; could not find " << strInsertBefore << "]";
 					iRet = RET_NONCRITICAL_FAILURE; // one or more files failed
-					continue;
+					return RET_OK;
 				}
 
 				try {
@@ -821,6 +1114,8 @@ finishTesting:
 			// Ignore --force/-f
 			} else if (i.string_key.compare("force") == 0) {
 			} else if (i.string_key.compare("f") == 0) {
+			// Ignore --memory-limit
+			} else if (i.string_key.compare("memory-limit") == 0) {
 
 			} else if ((!i.string_key.empty()) && (i.value.size() > 0)) {
 				// None of the above (single param) options matched, so it's probably
@@ -906,6 +1201,7 @@ finishTesting:
 									pArchive->resize(id, lenSource, lenReal);
 								} else {
 									// Leave the prefiltered/decompressed size unchanged
+									pArchive->resolveRealSizes({id});
 									pArchive->resize(id, lenSource, id->realSize);
 								}
 							}
@@ -925,6 +1221,13 @@ finishTesting:
 				}
 				// else it's the archive filename, but we already have that
 			}
+			return RET_OK;
+		};
+
+		// Run through the actions on the command line
+		for (auto& i : pa.options) {
+			int ret = runAction(i);
+			if (ret != RET_OK) return ret;
 		} // for (all command line elements)
 		pArchive->flush();
 	} catch (const po::unknown_option& e) {
@@ -91,11 +91,17 @@ Additional information is available from the Camoto homepage
 
 // These are all in the camoto::gamearchive namespace
 #include <camoto/gamearchive/archive.hpp>
+#include <camoto/gamearchive/archive-stack.hpp>
+#include <camoto/gamearchive/archive-sync.hpp>
 #include <camoto/gamearchive/archivetype.hpp>
 #include <camoto/gamearchive/filtertype.hpp>
 #include <camoto/gamearchive/fixedarchive.hpp>
 #include <camoto/gamearchive/manager.hpp>
 #include <camoto/gamearchive/stream_archfile.hpp>
+#include <camoto/gamearchive/stream_extent.hpp>
+#include <camoto/gamearchive/stream_piece.hpp>
+#include <camoto/gamearchive/stream_decode_ahead.hpp>
 #include <camoto/gamearchive/util.hpp>
+#include <camoto/gamearchive/wad-index.hpp>
 
 #endif // _CAMOTO_GAMEARCHIVE_HPP_
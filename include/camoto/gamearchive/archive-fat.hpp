@@ -26,11 +26,15 @@
 #include <camoto/config.hpp>
 #include <camoto/stream_sub.hpp>
 #include <camoto/stream_seg.hpp>
+#include <camoto/gamearchive/stream_piece.hpp>
 #include <camoto/gamearchive/archive.hpp>
+#include <camoto/gamearchive/archivetype.hpp>
 
 namespace camoto {
 namespace gamearchive {
 
+class archfile_reader;
+
 /// Common value for lenMaxFilename in Archive_FAT::Archive_FAT()
 #define ARCH_STD_DOS_FILENAMES  12     // 8.3 + dot
 
@@ -73,6 +77,25 @@ class CAMOTO_GAMEARCHIVE_API Archive_FAT: virtual public Archive,
 			 */
 			stream::len lenHeader;
 
+			/// Does another entry point at the same data as this one?
+			/**
+			 * This is set for every entry in a group of entries with the same offset
+			 * and size, which only happens in formats where canDeduplicate() is
+			 * true.  Writing to or resizing one of these entries gives it its own
+			 * copy of the data first, so the other entries are not affected.
+			 */
+			bool bShared;
+
+			/// Has realSize still to be read from the file data?
+			/**
+			 * Formats that store the real size inside the file data set this when
+			 * opening the archive instead of reading it, and realSize is then only
+			 * a placeholder until resolveRealSizes() calls loadRealSizes().  This
+			 * happens before files() or find() return the entry, so callers
+			 * always see the real value.
+			 */
+			bool bRealSizePending;
+
 			/// Empty constructor
 			FATEntry();
 
@@ -81,6 +104,21 @@ class CAMOTO_GAMEARCHIVE_API Archive_FAT: virtual public Archive,
 
 			virtual std::string getContent() const;
 
+			/// Make an independent copy of this entry, e.g. for a snapshot.
+			/**
+			 * Formats that extend FATEntry must override this to return their own
+			 * type with the extra fields filled in, so nothing is lost when the
+			 * entry is copied.  See fmt-dat-hugo.hpp for an example.
+			 */
+			virtual std::unique_ptr<FATEntry> clone() const;
+
+			/// Copy the File and FATEntry fields into another entry.
+			/**
+			 * @param dest
+			 *   Entry to overwrite, for clone() to pass its new instance to.
+			 */
+			void copyTo(FATEntry *dest) const;
+
 			/// Prevent copying
 			FATEntry(const FATEntry&) = delete;
 
@@ -93,11 +131,68 @@ class CAMOTO_GAMEARCHIVE_API Archive_FAT: virtual public Archive,
 			}
 		};
 
+		/// FAT entries read by ArchiveType::probe().
+		/**
+		 * Formats that read every FAT entry in isInstance() can return one of
+		 * these from probe() and pass it to their constructor via openProbed(),
+		 * which then calls useProbedFAT() instead of reading the FAT again.
+		 *
+		 * Formats that only need the header to recognise the archive can leave
+		 * entries empty and override parse() instead, so the FAT is only read
+		 * if the archive is actually opened.
+		 */
+		struct CAMOTO_GAMEARCHIVE_API ProbedFAT: public ArchiveType::ProbeResult {
+			/// Size of the archive when it was probed.
+			/**
+			 * Used as a quick check that the stream given to open is the same as
+			 * the one that was probed.
+			 */
+			stream::len lenArchive;
+
+			/// First few bytes of the archive when it was probed.
+			/**
+			 * useProbedFAT() reads these again and compares them, so a different
+			 * stream of the same size isn't mistaken for the probed one.  Set
+			 * with readHeader().
+			 */
+			std::string header;
+
+			/// Entries in the order they should appear in vcFAT.
+			std::vector<std::unique_ptr<FATEntry>> entries;
+
+			virtual ~ProbedFAT();
+
+			/// Keep the start of the archive for useProbedFAT() to check.
+			/**
+			 * @param content
+			 *   Archive being probed.  The seek position is changed.
+			 *
+			 * @param len
+			 *   Number of bytes to keep, usually the length of the header.  This
+			 *   is reduced if the archive is shorter.
+			 *
+			 * @throws stream::error on I/O error.
+			 */
+			void readHeader(stream::input& content, stream::len len);
+
+			/// Populate entries, if probe() left it until the archive is opened.
+			/**
+			 * Called by useProbedFAT() once the header has been checked.  The
+			 * default does nothing, for formats that fill in entries in probe().
+			 *
+			 * @param content
+			 *   Archive being opened.
+			 *
+			 * @throws stream::error on I/O error.
+			 */
+			virtual void parse(stream::input& content);
+		};
+
 	protected:
 		/// The archive stream must be mutable, because we need to change it by
 		/// seeking and reading data in our get() functions, which don't logically
 		/// change the archive's state.
-		mutable std::shared_ptr<stream::seg> content;
+		mutable std::shared_ptr<piece_table> content;
 
 		/// Offset of the first file in an empty archive.
 		stream::pos offFirstFile;
@@ -117,6 +212,62 @@ class CAMOTO_GAMEARCHIVE_API Archive_FAT: virtual public Archive,
 		/// Maximum length of filenames in this archive format.
 		unsigned int lenMaxFilename;
 
+		/// Copy of vcFAT handed out by snapshot(), until the FAT next changes.
+		std::shared_ptr<const FileVector> snapshotFAT;
+
+		/// Can more than one FAT entry point at the same data?
+		/**
+		 * Descendent classes set this to true in their constructor if the format
+		 * stores an offset for every file and nothing else depends on the order
+		 * of the data, so deduplicate() can point identical files at the same
+		 * place.  Defaults to false.
+		 */
+		bool bCanShare;
+
+		/// Is the file data no longer in the same order as the FAT?
+		/**
+		 * Once files share data, the offsets can no longer be used to work out
+		 * which files come after a given one, so shiftFiles() goes by the index
+		 * instead.  This is set by deduplicate(), or when an archive is first
+		 * used if it was saved that way.
+		 */
+		bool bUnordered;
+
+		/// Has checkLayout() been run yet?
+		bool bLayoutChecked;
+
+		/// Might any entry still have bRealSizePending set?
+		/**
+		 * Formats that set bRealSizePending on an entry must set this too, so
+		 * files() and find() know to read the real sizes before handing the
+		 * entries out.  Cleared once files() has resolved them all.
+		 */
+		mutable bool bRealSizesPending;
+
+		/// Incremented whenever a file may have moved or changed size.
+		/**
+		 * @see layoutGeneration()
+		 */
+		uint64_t generation;
+
+		/// Number of unused FAT entries after the last one in use.
+		/**
+		 * @see initSpareEntries()
+		 */
+		unsigned int numSpareEntries;
+
+		/// Size of each spare FAT entry, or 0 if the format doesn't keep any.
+		unsigned int lenSpareEntry;
+
+		/// Index of the spare FAT entry count in v_attributes.
+		unsigned int attrSpareEntries;
+
+		/// Each file's data starts on a multiple of this, or 0 if not padded.
+		/**
+		 * @see setAlignment()
+		 */
+		stream::len lenAlign;
+
 		/// Create a new Archive_FAT.
 		/**
 		 * @param content
@@ -141,6 +292,94 @@ class CAMOTO_GAMEARCHIVE_API Archive_FAT: virtual public Archive,
 		// Empty constructor for descendent virtual classes.
 		Archive_FAT();
 
+		/// Populate vcFAT from the entries read by ArchiveType::probe().
+		/**
+		 * Descendent classes call this from their constructor, and only read the
+		 * FAT themselves if it returns false.
+		 *
+		 * @param parsed
+		 *   Value returned by probe(), may be empty.  If it is used, the entries
+		 *   are moved out of it.
+		 *
+		 * @return true if vcFAT has been populated, false if parsed was empty,
+		 *   of a different type, or the archive's size or header is different to
+		 *   when it was probed.
+		 */
+		bool useProbedFAT(std::unique_ptr<ArchiveType::ProbeResult>& parsed);
+
+		/// Find any spare FAT entries and add an attribute to change them.
+		/**
+		 * Formats that store an offset for every file can keep some unused,
+		 * zeroed FAT entries between the last FAT entry and the first file's
+		 * data.  Inserting a file then uses one of these instead of making the
+		 * FAT larger, so no file data has to move.  While there are any, removing
+		 * a file turns its FAT entry into another spare one.
+		 *
+		 * This counts how many whole entries fit between offFATEnd and the first
+		 * file's data, and adds an integer attribute to v_attributes so the
+		 * number can be changed, e.g. when creating or repacking an archive.
+		 * Only the file offsets are used, as no file refers to that space
+		 * whatever it contains.
+		 *
+		 * Descendent classes call this at the end of their constructor, call
+		 * takeSpareEntry() and keepSpareEntry() from preInsertFile() and
+		 * preRemoveFile(), and call setSpareEntries() when the attribute is
+		 * changed.
+		 *
+		 * @param offFATEnd
+		 *   Offset of the end of the last FAT entry in use.
+		 *
+		 * @param lenEntry
+		 *   Size of each FAT entry.
+		 */
+		void initSpareEntries(stream::pos offFATEnd, unsigned int lenEntry);
+
+		/// Use a spare FAT entry for a new file, if there is one.
+		/**
+		 * This removes the first spare entry, so the caller can insert the new
+		 * FAT entry in the usual way without the FAT getting any larger.
+		 *
+		 * @param offFATEnd
+		 *   Offset of the end of the last FAT entry in use, before the new one is
+		 *   inserted.
+		 *
+		 * @param pNewEntry
+		 *   Entry about to be inserted.  Its offset is moved past the spare
+		 *   entries if it is the first file in the archive.
+		 *
+		 * @return true if a spare entry was used, in which case the caller must
+		 *   not shift the new entry or any other files.  false if the FAT has to
+		 *   grow as usual.
+		 */
+		bool takeSpareEntry(stream::pos offFATEnd, FATEntry *pNewEntry);
+
+		/// Keep the FAT entry of a file being removed as a spare one.
+		/**
+		 * This is only done if there are already spare entries.  A zeroed entry
+		 * is inserted at offFATEnd, so once the caller has removed the file's
+		 * FAT entry the FAT takes up the same space as before.
+		 *
+		 * @param offFATEnd
+		 *   Offset of the end of the last FAT entry in use, before the file's
+		 *   entry is removed.
+		 *
+		 * @return true if the entry was kept, in which case the caller must not
+		 *   shift any files.  false if the FAT has to shrink as usual.
+		 */
+		bool keepSpareEntry(stream::pos offFATEnd);
+
+		/// Change the number of spare FAT entries, moving the file data to suit.
+		/**
+		 * @param offFATEnd
+		 *   Offset of the end of the last FAT entry in use.
+		 *
+		 * @param numSpare
+		 *   New number of spare entries.
+		 *
+		 * @throws stream::error on I/O error.
+		 */
+		void setSpareEntries(stream::pos offFATEnd, unsigned int numSpare);
+
 	public:
 		virtual ~Archive_FAT();
 
@@ -159,8 +398,205 @@ class CAMOTO_GAMEARCHIVE_API Archive_FAT: virtual public Archive,
 		virtual void resize(const FileHandle& id, stream::len newStoredSize,
 			stream::len newRealSize);
 		virtual void flush();
+		virtual void resolveRealSizes(const FileVector& ids);
+
+		/// Open a file for reading only, as quickly as possible.
+		/**
+		 * This is for reading many small files, where the overhead of open()
+		 * can outweigh the cost of reading the data.  The returned stream works
+		 * out where the file is once, and only looks again after the archive
+		 * has been changed (see layoutGeneration()), instead of on every read.
+		 *
+		 * The raw stored data is returned, without any filter applied.  Use
+		 * open() if the file needs decoding.
+		 *
+		 * @param id
+		 *   File to open.
+		 *
+		 * @return Read-only stream of the file's data.  It remains valid after
+		 *   the archive is modified, until the file is removed.
+		 *
+		 * @throws stream::error if id is not a valid file in this archive.
+		 *
+		 * @note The archive must be held in a shared_ptr.
+		 */
+		std::unique_ptr<archfile_reader> openReader(const FileHandle& id);
+
+		/// Get a number that changes whenever a file may have moved.
+		/**
+		 * This is incremented by every operation that can change the offset or
+		 * size of any file, so cached positions only need to be looked up again
+		 * when it differs from the value seen when they were cached.
+		 */
+		inline uint64_t layoutGeneration() const
+		{
+			return this->generation;
+		}
+
+		/// Get a read-only view of the archive as it is now.
+		/**
+		 * The returned archive lists the files and their content as they were
+		 * when this function was called, and is not affected by any later changes
+		 * to this archive, including flush().  This allows files to be read on
+		 * other threads while this archive is being modified.
+		 *
+		 * Taking a snapshot is cheap.  The list of files is only copied once
+		 * after each change, and the content is shared with this archive until
+		 * the parts of the underlying stream covered by the snapshot are
+		 * overwritten during flush(), at which point only those parts are kept
+		 * aside for the snapshot to use.
+		 *
+		 * @note This function must be called on the same thread that modifies the
+		 *   archive, but the returned snapshot and any files opened from it may
+		 *   then be used on any thread.  Each file opened from the snapshot must
+		 *   only be used by one thread at a time.
+		 *
+		 * @return Archive instance that throws stream::error if any attempt is
+		 *   made to modify it.  Files can only be opened with useFilter set if the
+		 *   filter is known to FilterManager.
+		 */
+		std::shared_ptr<Archive> snapshot();
+
+		/// Can this format store identical files only once?
+		/**
+		 * @return true if deduplicate() can be used.
+		 */
+		bool canDeduplicate() const;
+
+		/// Store all identical files in the archive only once.
+		/**
+		 * The data of every file is hashed, and where two files have the same
+		 * data one copy is removed and its FAT entry is pointed at the other.
+		 * Files of different sizes are never compared, so usually only a few
+		 * files need to be read.  Matching hashes are confirmed by comparing the
+		 * data itself before anything is removed.
+		 *
+		 * Shared files can still be changed, removed and resized as normal.  A
+		 * file is given its own copy of the data again the first time it is
+		 * written to or resized.
+		 *
+		 * @return Number of bytes removed from the archive.
+		 *
+		 * @throws stream::error if the format doesn't allow files to share data
+		 *   (see canDeduplicate()), or on I/O error.
+		 */
+		stream::len deduplicate();
+
+		/// Store the given file only once if its data is already in the archive.
+		/**
+		 * This is intended to be called after writing a newly inserted file.  It
+		 * works the same way as deduplicate() but only looks for copies of the
+		 * one file, so it doesn't have to read the whole archive.
+		 *
+		 * @param id
+		 *   File to look for.
+		 *
+		 * @return true if another file has the same data, and id now uses that
+		 *   copy.  false if no match was found and nothing has changed.
+		 *
+		 * @throws stream::error if the format doesn't allow files to share data
+		 *   (see canDeduplicate()), or on I/O error.
+		 */
+		bool deduplicate(const FileHandle& id);
+
+		/// Pad the files so each one starts on a multiple of the given size.
+		/**
+		 * Zero bytes are inserted in front of every file whose data does not
+		 * start on a multiple of lenAlign.  After that, files inserted, removed
+		 * or resized keep the padding up to date, so the files following them
+		 * stay aligned.  When the archive is stored in an extent_file and
+		 * lenAlign is the filesystem block size, this lets files whose size is
+		 * a multiple of the block size be inserted and removed without copying
+		 * the rest of the archive.
+		 *
+		 * Alignment is only kept while the FAT does not change size, so for
+		 * formats with the FAT in front of the files, spare FAT entries should
+		 * be reserved as well.  The setting is not saved in the archive.
+		 *
+		 * @param lenAlign
+		 *   Alignment in bytes, or 0 to stop padding files.  Existing padding
+		 *   is left in place either way.
+		 *
+		 * @throws stream::error if the format can't have gaps between files
+		 *   (see canDeduplicate(), which has the same requirement), or on I/O
+		 *   error.
+		 */
+		void setAlignment(stream::len lenAlign);
+
+		/// Get the value last passed to setAlignment().
+		inline stream::len alignment() const
+		{
+			return this->lenAlign;
+		}
+
+		/// Give a file its own copy of any data it shares with other files.
+		/**
+		 * This is called automatically before a shared file is written to or
+		 * resized, so it only needs to be called directly if the data is going to
+		 * be changed some other way.  It does nothing if the file isn't shared.
+		 *
+		 * @param id
+		 *   File to separate.
+		 *
+		 * @throws stream::error on I/O error.
+		 */
+		void unshare(const FileHandle& id);
 
 	protected:
+		/// Insert a block of space into the archive content.
+		/**
+		 * This is used instead of content->insert() for file data.  Like any
+		 * other change it is only written out by flush(), when the piece table
+		 * has the filesystem shift the data instead of copying it if the
+		 * underlying stream is an extent_file and the move is block-aligned.
+		 *
+		 * Formats that keep something other than file data among the files (such
+		 * as a FAT after the last file) can override this and removeContent() to
+		 * keep track of where it ends up, as long as they call the base version.
+		 *
+		 * @param offInsert
+		 *   Offset where the new space should start.
+		 *
+		 * @param lenInsert
+		 *   Number of bytes to insert.
+		 *
+		 * @throws stream::error on I/O error.
+		 */
+		virtual void insertContent(stream::pos offInsert, stream::len lenInsert);
+
+		/// Remove a block of data from the archive content.
+		/**
+		 * @see insertContent()
+		 *
+		 * @param offRemove
+		 *   Offset of the first byte to remove.
+		 *
+		 * @param lenRemove
+		 *   Number of bytes to remove.
+		 *
+		 * @throws stream::error on I/O error.
+		 */
+		virtual void removeContent(stream::pos offRemove, stream::len lenRemove);
+
+		/// Is the given part of the archive only padding between files?
+		/**
+		 * This is called before padding left behind by setAlignment() is
+		 * removed along with the file in front of it.  Formats that keep
+		 * something other than file data among the files must override this and
+		 * return false if that data is in the given range.
+		 *
+		 * @param off
+		 *   Offset of the first byte after the end of a file's data.
+		 *
+		 * @param len
+		 *   Number of bytes until the next file's data, or the end of the
+		 *   archive.
+		 *
+		 * @return true if the range can be removed.  The default implementation
+		 *   always returns true.
+		 */
+		virtual bool isPadding(stream::pos off, stream::len len) const;
+
 		/// Shift any files *starting* at or after offStart by delta bytes.
 		/**
 		 * This updates the internal offsets and index numbers.  The FAT is updated
@@ -169,6 +605,11 @@ class CAMOTO_GAMEARCHIVE_API Archive_FAT: virtual public Archive,
 		 * following it.  This function must notify any open files that their offset
 		 * has moved.
 		 *
+		 * If bUnordered is set, the index numbers are instead changed for every
+		 * file at or after fatSkip's index, whether or not its data has moved.
+		 * updateFileOffset() is called for these files too, so it can write each
+		 * entry into its new place in the FAT.
+		 *
 		 * @param fatSkip
 		 *   Do not alter this entry, even if it is located in the area to be
 		 *   affected.
@@ -351,10 +792,66 @@ class CAMOTO_GAMEARCHIVE_API Archive_FAT: virtual public Archive,
 		 */
 		virtual std::unique_ptr<FATEntry> createNewFATEntry();
 
+		/// Read the real sizes of entries that have bRealSizePending set.
+		/**
+		 * Only override if the format sets bRealSizePending.  This is called by
+		 * resolveRealSizes(), which clears bRealSizePending afterwards.
+		 *
+		 * @param entries
+		 *   Entries to read, sorted by offset so they can be read in a single
+		 *   forward pass through the archive.
+		 *
+		 * @throws stream::error on I/O error.
+		 */
+		virtual void loadRealSizes(const std::vector<FATEntry *>& entries);
+
 	private:
 		/// Should the given entry be moved during an insert/resize operation?
 		bool entryInRange(const FATEntry *fat, stream::pos offStart,
 			const FATEntry *fatSkip);
+
+		/// Work out bUnordered and bShared from the FAT, if not done yet.
+		/**
+		 * This can't be done in the constructor as the FAT is read by the
+		 * descendent class, so it is called at the start of anything that needs
+		 * these values.
+		 */
+		void checkLayout();
+
+		/// Can the given entry's data be shared with another entry?
+		bool shareable(const FATEntry *fat) const;
+
+		/// Do the two entries have identical data?
+		bool sameData(const FATEntry *a, const FATEntry *b) const;
+
+		/// Hash an entry's data, to quickly rule out most non-matching files.
+		uint64_t hashData(const FATEntry *fat) const;
+
+		/// Does any other entry overlap part (but not all) of this one's data?
+		bool overlapsOthers(const FATEntry *fat) const;
+
+		/// Remove the data of pDup and point it at the data in pKeep instead.
+		/**
+		 * All the entries already sharing pDup's data are moved too.
+		 */
+		void shareData(FATEntry *pDup, FATEntry *pKeep);
+
+		/// Clear bShared if only one entry is left using the given data.
+		void releaseShared(stream::pos off, stream::len len);
+
+		/// Round a length up to a multiple of lenAlign.
+		stream::len alignUp(stream::len len) const;
+
+		/// Get the amount of padding after a file's data.
+		/**
+		 * @return Number of bytes between the end of the file's data and the
+		 *   start of the next file's data (or the end of the archive), as long
+		 *   as it is less than lenAlign and isPadding() agrees.  Otherwise 0.
+		 */
+		stream::len paddingAfter(const FATEntry *fat) const;
+
+		/// Copy data from one part of the archive content to another.
+		void copyContent(stream::pos offFrom, stream::pos offTo, stream::len len);
 };
 
 } // namespace gamearchive
@@ -0,0 +1,156 @@
+/**
+ * @file  camoto/gamearchive/archive-stack.hpp
+ * @brief Several archives layered on top of each other, like IWAD + PWADs.
+ *
+ * Copyright (C) 2010-2016 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _CAMOTO_GAMEARCHIVE_ARCHIVE_STACK_HPP_
+#define _CAMOTO_GAMEARCHIVE_ARCHIVE_STACK_HPP_
+
+#include <list>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <camoto/config.hpp>
+#include <camoto/gamearchive/archive.hpp>
+
+namespace camoto {
+namespace gamearchive {
+
+/// Look up files across several archives, with later archives taking priority.
+/**
+ * Games often load a main archive and then any number of patch or mod
+ * archives over the top, such as a Doom IWAD followed by PWADs, or extra
+ * Duke Nukem 3D GRP files.  A file in a later archive replaces any file of the
+ * same name in the earlier ones.
+ *
+ * Rather than calling Archive::find() on each archive in turn, this keeps one
+ * index of every filename in every layer, so finding a file is a single hash
+ * lookup no matter how many archives are loaded.  Filenames are matched
+ * case-insensitively.  If one archive contains the same filename more than
+ * once, the first one is used, just as Archive::find() would.
+ *
+ * The index is kept up to date as layers are added and removed, only touching
+ * the entries for the layer involved.  If the files in a layer are changed
+ * (e.g. inserted, removed or renamed) then refresh() must be called for that
+ * layer, otherwise find() may return files that no longer exist.
+ *
+ * @note Multithreading: Only call one function in this class at a time.
+ */
+class CAMOTO_GAMEARCHIVE_API ArchiveStack
+{
+	public:
+		/// Result of a lookup.
+		struct Match {
+			/// Archive containing the file, or null if the file wasn't found.
+			std::shared_ptr<Archive> archive;
+
+			/// Handle of the file within archive.
+			Archive::FileHandle id;
+		};
+
+		ArchiveStack();
+		~ArchiveStack();
+
+		/// Add an archive on top of all the others.
+		/**
+		 * @param archive
+		 *   Archive to add.  Files in this archive will replace files of the same
+		 *   name in every archive added before it.
+		 *
+		 * @throws stream::error if the archive is already in the stack.
+		 */
+		void add(std::shared_ptr<Archive> archive);
+
+		/// Remove an archive from the stack.
+		/**
+		 * Any files it was replacing become visible again.
+		 *
+		 * @param archive
+		 *   Archive to remove.
+		 *
+		 * @throws stream::error if the archive is not in the stack.
+		 */
+		void remove(const std::shared_ptr<Archive>& archive);
+
+		/// Update the index after the files in one layer have changed.
+		/**
+		 * @param archive
+		 *   Archive whose files have been changed.  Only the index entries for
+		 *   this archive are updated.
+		 *
+		 * @throws stream::error if the archive is not in the stack.
+		 */
+		void refresh(const std::shared_ptr<Archive>& archive);
+
+		/// Find a file in the highest priority archive that contains it.
+		/**
+		 * @param strFilename
+		 *   Name of the file to find.  Case is ignored.
+		 *
+		 * @return The archive and file handle.  Match::archive will be null if no
+		 *   archive contains the file.
+		 */
+		Match find(const std::string& strFilename) const;
+
+		/// Get the archives in the stack, lowest priority first.
+		std::vector<std::shared_ptr<Archive>> layers() const;
+
+	protected:
+		/// One archive in the stack.
+		struct Layer {
+			std::shared_ptr<Archive> archive; ///< Archive in this layer
+			unsigned int rank;                ///< Higher ranks take priority
+
+			/// Index keys and the files they refer to, for removing them again.
+			std::vector<std::pair<std::string, Archive::FileHandle>> names;
+		};
+
+		/// One file providing a name in the index.
+		struct Provider {
+			Layer *layer;            ///< Layer the file is in
+			Archive::FileHandle id;  ///< The file itself
+		};
+
+		/// Layers in priority order, lowest first.
+		std::list<Layer> stack;
+
+		/// Rank to give the next layer added.
+		unsigned int nextRank;
+
+		/// Every file with each name, ordered by layer rank, highest last.
+		std::unordered_map<std::string, std::vector<Provider>> index;
+
+		/// Find the layer for the given archive.
+		/**
+		 * @throws stream::error if the archive is not in the stack.
+		 */
+		Layer& findLayer(const std::shared_ptr<Archive>& archive);
+
+		/// Add a layer's files to the index.
+		void indexLayer(Layer& layer);
+
+		/// Remove a layer's files from the index.
+		void unindexLayer(Layer& layer);
+};
+
+} // namespace gamearchive
+} // namespace camoto
+
+#endif // _CAMOTO_GAMEARCHIVE_ARCHIVE_STACK_HPP_
@@ -0,0 +1,146 @@
+/**
+ * @file  camoto/gamearchive/archive-sync.hpp
+ * @brief Bring one archive up to date with another, changing as little as
+ *        possible.
+ *
+ * Copyright (C) 2010-2016 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _CAMOTO_GAMEARCHIVE_ARCHIVE_SYNC_HPP_
+#define _CAMOTO_GAMEARCHIVE_ARCHIVE_SYNC_HPP_
+
+#include <cstdint>
+#include <map>
+#include <camoto/config.hpp>
+#include <camoto/gamearchive/archive.hpp>
+
+namespace camoto {
+namespace gamearchive {
+
+/// Make one archive hold the same files as another, by changing only the
+/// files that differ.
+/**
+ * This is useful when an updated copy of an archive has to be pushed out to
+ * places that already hold an older copy.  Instead of replacing the whole
+ * archive, sync() works out which files have been added, removed or changed,
+ * and only inserts, removes, resizes or overwrites those ones.  Since
+ * Archive_FAT defers moving data until flush(), the amount of work done is in
+ * proportion to the files that changed, not the size of the archive.
+ *
+ * Files are matched up by name (ignoring case).  A file is considered
+ * unchanged if its type, attributes, filter, both its sizes and its stored
+ * data are the same in both archives.  The data is only compared when
+ * everything else matches, by a 64-bit hash of the stored (unfiltered) data.
+ * The hash of each file is kept, so syncing the same archives again later
+ * only has to read the files that changed in the meantime.
+ *
+ * After a sync the destination holds the files in the same order as the
+ * source.  Files that are still in order are left where they are, and only
+ * the fewest files needed to fix the order are moved.  Those that are
+ * otherwise unchanged keep their existing data, and the rest are removed and
+ * inserted again.
+ *
+ * @note The cached hashes are looked up by file handle.  If a file in either
+ *   archive is written to other than through sync(), forget() must be called
+ *   for it, otherwise the change may not be noticed.
+ *
+ * @note Multithreading: Only call one function in this class at a time.
+ */
+class CAMOTO_GAMEARCHIVE_API ArchiveSync
+{
+	public:
+		/// What sync() did.
+		struct Result {
+			unsigned int inserted;   ///< Files added or put back in a new position
+			unsigned int removed;    ///< Files removed or taken out to move
+			unsigned int moved;      ///< Unchanged files moved to a new position
+			unsigned int updated;    ///< Files overwritten with new data
+			unsigned int unchanged;  ///< Files left alone
+			stream::len lenCopied;   ///< Bytes of file data written
+		};
+
+		ArchiveSync();
+		~ArchiveSync();
+
+		/// Change an archive so it holds the same files as another.
+		/**
+		 * @param dest
+		 *   Archive to change.  flush() is not called, so the caller must do this
+		 *   once it is done with the archive.
+		 *
+		 * @param src
+		 *   Archive to copy files from.  It is only read from.
+		 *
+		 * @return Counts of what was changed.
+		 *
+		 * @throws stream::error if a file could not be read, written or inserted.
+		 *   The destination will have been partly updated, and should be
+		 *   discarded without calling flush().
+		 */
+		Result sync(Archive& dest, Archive& src);
+
+		/// Drop the cached hash for a file.
+		/**
+		 * This must be called if a file has been written to other than through
+		 * sync(), so its data will be read again next time.
+		 *
+		 * @param id
+		 *   File that has changed.
+		 */
+		void forget(const Archive::FileHandle& id);
+
+		/// Drop all the cached hashes.
+		void clear();
+
+	protected:
+		/// Hash of each file's stored data, see hash().
+		std::map<Archive::FileHandle, uint64_t> hashes;
+
+		/// Get the hash of a file's stored data, reading it if not yet known.
+		uint64_t hash(Archive& archive, const Archive::FileHandle& id);
+
+		/// Do two files have exactly the same entry and data?
+		bool same(Archive& dest, const Archive::FileHandle& idDest,
+			Archive& src, const Archive::FileHandle& idSrc);
+
+		/// Copy a file's data into a destination file of the right size.
+		/**
+		 * The stored data is copied as-is when both files use the same filter,
+		 * otherwise it is decoded and encoded again, then the destination file is
+		 * resized to suit.
+		 *
+		 * @return Number of bytes written.
+		 */
+		stream::len copy(Archive& dest, const Archive::FileHandle& idDest,
+			Archive& src, const Archive::FileHandle& idSrc);
+
+		/// Insert a copy of a source file into the destination archive.
+		/**
+		 * @param idBeforeThis
+		 *   The new file is inserted before this one, or at the end if it is
+		 *   null.
+		 *
+		 * @return Number of bytes written.
+		 */
+		stream::len insertCopy(Archive& dest,
+			const Archive::FileHandle& idBeforeThis, Archive& src,
+			const Archive::FileHandle& idSrc);
+};
+
+} // namespace gamearchive
+} // namespace camoto
+
+#endif // _CAMOTO_GAMEARCHIVE_ARCHIVE_SYNC_HPP_
@@ -91,6 +91,10 @@ class CAMOTO_GAMEARCHIVE_API Archive: public HasAttributes
 			 * If fAttr has EA_COMPRESSED set then this indicates the file size after
 			 * decompression.  If the file is not compressed or filtered it will be
 			 * ignored but by convention should be set to the same value as storedSize.
+			 *
+			 * Some formats only store this inside the file data itself, in which
+			 * case it is not read until the file is returned by Archive::files()
+			 * or Archive::find(), or Archive::resolveRealSizes() is called for it.
 			 */
 			stream::len realSize;
 
@@ -396,6 +400,28 @@ class CAMOTO_GAMEARCHIVE_API Archive: public HasAttributes
 		 * @return Zero or more Attribute members OR'd together.
 		 */
 		virtual File::Attribute getSupportedAttributes() const;
+
+		/// Make sure File::realSize is valid for the given files.
+		/**
+		 * Some formats store the real size of a compressed file in front of the
+		 * compressed data, rather than in the FAT.  So that opening the archive
+		 * doesn't have to seek to and read every one of these files, their real
+		 * sizes are only read when needed.  files() and find() call this before
+		 * returning any file, so callers always get a valid realSize and never
+		 * need to call this themselves.
+		 *
+		 * Note to archive format implementors: There is a default implementation
+		 * of this function which does nothing, so it only needs to be overridden
+		 * if the format doesn't know the real sizes when the archive is opened.
+		 * Pass all the files of interest in one call so the sizes can be read in
+		 * a single pass through the archive.
+		 *
+		 * @param ids
+		 *   Files to resolve.  Files whose real size is already known are skipped.
+		 *
+		 * @throws stream::error on I/O error.
+		 */
+		virtual void resolveRealSizes(const FileVector& ids);
 };
 
 /// Allow multiple File::Attribute members to be combined.
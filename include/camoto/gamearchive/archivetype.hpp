@@ -51,6 +51,19 @@ class CAMOTO_GAMEARCHIVE_API ArchiveType
 			DefinitelyYes, ///< This format has a signature and it matched.
 		};
 
+		/// Data read by probe() that can be reused by openProbed().
+		/**
+		 * Formats that have to read through the whole FAT to decide whether a
+		 * file is in their format can derive from this to keep what they read,
+		 * so it doesn't have to be read and decoded a second time when the
+		 * archive is opened.
+		 */
+		class CAMOTO_GAMEARCHIVE_API ProbeResult
+		{
+			public:
+				virtual ~ProbeResult();
+		};
+
 		/// Get a short code to identify this file format, e.g. "grp-duke3d"
 		/**
 		 * This can be useful for command-line arguments.
@@ -87,6 +100,24 @@ class CAMOTO_GAMEARCHIVE_API ArchiveType
 		 */
 		virtual ArchiveType::Certainty isInstance(stream::input& content) const = 0;
 
+		/// Check a stream like isInstance(), keeping what was read for opening it.
+		/**
+		 * @param content
+		 *   The archive file to examine.
+		 *
+		 * @param parsed
+		 *   On return, set to whatever the format was able to read from the
+		 *   archive while checking it, for passing to openProbed().  This will be
+		 *   left empty if the format has nothing to reuse or the result was
+		 *   DefinitelyNo.  May be nullptr to just perform the check.
+		 *
+		 * @return The same value as isInstance().
+		 *
+		 * @note The default implementation just calls isInstance().
+		 */
+		virtual ArchiveType::Certainty probe(stream::input& content,
+			std::unique_ptr<ProbeResult> *parsed) const;
+
 		/// Create a blank archive in this format.
 		/**
 		 * This function writes out the necessary signatures and headers to create
@@ -139,6 +170,83 @@ class CAMOTO_GAMEARCHIVE_API ArchiveType
 		virtual std::shared_ptr<Archive> open(
 			std::unique_ptr<stream::inout> content, SuppData& suppData) const = 0;
 
+		/// Open an archive file using data already read by probe().
+		/**
+		 * @param content
+		 *   The archive file to read and modify.  This must be the same stream
+		 *   passed to probe(), unchanged since then.
+		 *
+		 * @param suppData
+		 *   Any supplemental data required by this format (see getRequiredSupps()).
+		 *
+		 * @param parsed
+		 *   Value returned by probe() for this stream.  May be empty, in which
+		 *   case this behaves the same as open().
+		 *
+		 * @return A pointer to an instance of the Archive class, as per open().
+		 *
+		 * @note The default implementation ignores parsed and calls open().
+		 */
+		virtual std::shared_ptr<Archive> openProbed(
+			std::unique_ptr<stream::inout> content, SuppData& suppData,
+			std::unique_ptr<ProbeResult> parsed) const;
+
+		/// Create a blank archive, limiting how much unsaved data is kept in RAM.
+		/**
+		 * This is the same as create(), except the stream is first wrapped in a
+		 * piece_table with the given memory limit, so large files can be added
+		 * without needing the same amount of memory until the archive is flushed.
+		 *
+		 * @param lenMemoryLimit
+		 *   Maximum number of bytes of unsaved data to keep in memory, after which
+		 *   it is moved to a temporary file.  Zero means no limit.  See
+		 *   piece_table::setMemoryLimit().
+		 */
+		std::shared_ptr<Archive> createBuffered(
+			std::unique_ptr<stream::inout> content, SuppData& suppData,
+			stream::len lenMemoryLimit) const;
+
+		/// Open an archive, limiting how much unsaved data is kept in RAM.
+		/**
+		 * This is the same as openProbed(), except the stream is first wrapped in
+		 * a piece_table with the given memory limit.
+		 *
+		 * @param lenMemoryLimit
+		 *   Maximum number of bytes of unsaved data to keep in memory, after which
+		 *   it is moved to a temporary file.  Zero means no limit.  See
+		 *   piece_table::setMemoryLimit().
+		 *
+		 * @param parsed
+		 *   Optional value returned by probe() for this stream.
+		 */
+		std::shared_ptr<Archive> openBuffered(
+			std::unique_ptr<stream::inout> content, SuppData& suppData,
+			stream::len lenMemoryLimit,
+			std::unique_ptr<ProbeResult> parsed = nullptr) const;
+
+		/// Check a stream is in this format and open it if so.
+		/**
+		 * This is the same as calling probe() followed by openProbed(), so formats
+		 * that read their whole FAT to identify a file only do so once.
+		 *
+		 * @param content
+		 *   The archive file to examine and open.  This is only moved into the
+		 *   returned archive if it is opened, otherwise it is left with the
+		 *   caller.
+		 *
+		 * @param suppData
+		 *   Any supplemental data required by this format (see getRequiredSupps()).
+		 *
+		 * @param cert
+		 *   Optional pointer to receive the result of the check.
+		 *
+		 * @return A pointer to the opened archive, or nullptr if the check returned
+		 *   Certainty::DefinitelyNo.
+		 */
+		std::shared_ptr<Archive> probeAndOpen(
+			std::unique_ptr<stream::inout>& content, SuppData& suppData,
+			Certainty *cert = nullptr) const;
+
 		/// Get a list of any required supplemental files.
 		/**
 		 * For some archive formats, data is stored externally to the archive file
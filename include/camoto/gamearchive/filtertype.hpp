@@ -113,6 +113,18 @@ class CAMOTO_GAMEARCHIVE_API FilterType
 		virtual std::unique_ptr<stream::output> apply(
 			std::unique_ptr<stream::output> target, stream::fn_notify_prefiltered_size resize)
 			const = 0;
+
+		/// Get a new instance of the filter used when reading.
+		/**
+		 * This is the same filter apply() uses for input streams, for callers
+		 * that need to drive the filter themselves, such as
+		 * input_decode_ahead.  Filters that are not a single filter object when
+		 * reading can leave this as the default, which returns nullptr.
+		 *
+		 * @return A filter that decodes (e.g. decompresses) data, or nullptr if
+		 *   this filter type cannot provide one.
+		 */
+		virtual std::shared_ptr<filter> decoder() const; // defined in main.cpp
 };
 
 } // namespace gamearchive
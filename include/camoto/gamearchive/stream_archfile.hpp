@@ -137,6 +137,11 @@ class CAMOTO_GAMEARCHIVE_API output_archfile:
 		output_archfile(std::shared_ptr<Archive> archive, Archive::FileHandle id,
 			std::shared_ptr<stream::output> content);
 
+		/// Write data, first giving the file its own copy if it shares it.
+		/**
+		 * @see Archive_FAT::unshare()
+		 */
+		virtual stream::len try_write(const uint8_t *buffer, stream::len len);
 		virtual void truncate(stream::len size);
 		virtual void flush();
 
@@ -166,6 +171,66 @@ class CAMOTO_GAMEARCHIVE_API archfile:
 			std::shared_ptr<stream::inout> content);
 };
 
+/// Lightweight read-only stream accessing a file within an Archive_FAT.
+/**
+ * Unlike input_archfile, this does not check the file's position and size on
+ * every read.  It caches them, and looks them up again only when the
+ * archive's layoutGeneration() has changed since they were cached.  It has no
+ * virtual base classes, so reading a lot of small files through it costs
+ * little more than reading the archive directly.
+ *
+ * Use Archive_FAT::openReader() to create one.
+ */
+class CAMOTO_GAMEARCHIVE_API archfile_reader final: public stream::input
+{
+	public:
+		/// Substream representing a file within an Archive_FAT.
+		/**
+		 * @param archive
+		 *   Archive containing the file, used to see whether the file may have
+		 *   moved.
+		 *
+		 * @param id
+		 *   File being opened.  Must be a FATEntry belonging to archive.
+		 *
+		 * @param content
+		 *   Stream containing the archive's raw content.  It may be shared with
+		 *   the archive and other files, as it is always seeked before each read.
+		 */
+		archfile_reader(std::shared_ptr<const Archive_FAT> archive,
+			Archive::FileHandle id, std::shared_ptr<stream::input> content);
+
+		virtual stream::len try_read(uint8_t *buffer, stream::len len);
+		virtual void seekg(stream::delta off, stream::seek_from from);
+		virtual stream::pos tellg() const;
+		virtual stream::len size() const;
+
+	private:
+		/// Look up the file's position again if the archive has changed.
+		/**
+		 * @throws stream::error if the file has been removed.
+		 */
+		inline void revalidate() const
+		{
+			if (this->generation != this->archive->layoutGeneration()) {
+				this->refresh();
+			}
+			return;
+		}
+
+		/// Cache the file's current position and size.
+		void refresh() const;
+
+		std::shared_ptr<const Archive_FAT> archive; ///< Archive holding the file
+		Archive::FileHandle id;                     ///< File being read
+		const Archive_FAT::FATEntry *fat;           ///< FATEntry cast of id
+		std::shared_ptr<stream::input> content;     ///< Archive's raw content
+		mutable stream::pos offStart;   ///< Cached offset of file data in content
+		mutable stream::len lenFile;    ///< Cached stored size of file
+		mutable uint64_t generation;    ///< layoutGeneration() when cached
+		stream::pos offPointer;         ///< Current read position within file
+};
+
 std::unique_ptr<stream::inout> CAMOTO_GAMEARCHIVE_API applyFilter(
 	std::unique_ptr<archfile> s, const std::string& filter);
 
@@ -0,0 +1,183 @@
+/**
+ * @file  camoto/gamearchive/stream_decode_ahead.hpp
+ * @brief Read-only stream that decodes filtered data on a helper thread.
+ *
+ * Copyright (C) 2010-2016 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _CAMOTO_GAMEARCHIVE_STREAM_DECODE_AHEAD_HPP_
+#define _CAMOTO_GAMEARCHIVE_STREAM_DECODE_AHEAD_HPP_
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <camoto/config.hpp>
+#include <camoto/filter.hpp>
+#include <camoto/stream.hpp>
+#include <camoto/gamearchive/archive.hpp>
+
+namespace camoto {
+namespace gamearchive {
+
+/// Default number of buffers decoded ahead of the reader.
+#define DECODE_AHEAD_BUFFERS     4
+
+/// Default size of each decoded buffer, in bytes.
+#define DECODE_AHEAD_BUFFER_LEN  65536
+
+/// Read-only stream that runs a filter on a helper thread.
+/**
+ * This gives the same data as an input_filtered, but instead of decoding on
+ * the caller's thread as data is requested, a helper thread runs the filter
+ * and fills a small ring of buffers ahead of the reader.  This lets decoding
+ * overlap with whatever the caller does with the data, which helps when
+ * streaming large compressed files.
+ *
+ * The helper thread stops when the ring is full, and carries on once the
+ * reader has used up a buffer, so only a fixed amount of memory is used no
+ * matter how large the file is.  Seeking forwards reads and discards the data
+ * in between, while seeking backwards stops the helper thread and starts
+ * decoding again from the beginning.
+ *
+ * @note The source stream is read from the helper thread.  Streams opened
+ *   directly from an archive share the archive's underlying stream, so use
+ *   openDecodeAhead(), which reads from a snapshot of the archive instead.
+ */
+class CAMOTO_GAMEARCHIVE_API input_decode_ahead: virtual public stream::input
+{
+	public:
+		/// Start decoding a stream in the background.
+		/**
+		 * @param source
+		 *   Encoded data to read.
+		 *
+		 * @param decoder
+		 *   Filter to run over the data.
+		 *
+		 * @param lenDecoded
+		 *   Size of the decoded data, as returned by size().  This is usually the
+		 *   file's realSize.
+		 *
+		 * @param numBuffers
+		 *   Number of buffers to decode ahead of the reader.
+		 *
+		 * @param lenBuffer
+		 *   Size of each buffer.
+		 */
+		input_decode_ahead(std::unique_ptr<stream::input> source,
+			std::shared_ptr<filter> decoder, stream::len lenDecoded,
+			unsigned int numBuffers = DECODE_AHEAD_BUFFERS,
+			stream::len lenBuffer = DECODE_AHEAD_BUFFER_LEN);
+
+		/// Stop the helper thread and wait for it to finish.
+		virtual ~input_decode_ahead();
+
+		virtual stream::len try_read(uint8_t *buffer, stream::len len);
+		virtual void seekg(stream::delta off, stream::seek_from from);
+		virtual stream::pos tellg() const;
+		virtual stream::len size() const;
+
+	protected:
+		std::unique_ptr<stream::input> source; ///< Encoded data
+		std::shared_ptr<filter> decoder;       ///< Filter to run
+		stream::len lenDecoded;                ///< Value for size()
+		unsigned int numBuffers;               ///< Max buffers in ring
+		stream::len lenBuffer;                 ///< Size of each buffer
+		stream::pos offset;                    ///< Reader's position
+
+		std::thread worker;                    ///< Helper thread
+		std::mutex lock;                       ///< Protects everything below
+		std::condition_variable cvFilled;      ///< Signalled when a buffer is added
+		std::condition_variable cvDrained;     ///< Signalled when one is removed
+		std::deque<std::vector<uint8_t>> ring; ///< Decoded data waiting to be read
+		stream::len offFront;                  ///< Bytes already read from front
+		bool done;                             ///< Worker has decoded everything
+		std::atomic<bool> cancel;              ///< Tell the worker to stop
+		std::exception_ptr failure;            ///< Exception thrown by the worker
+
+		/// Launch the helper thread to decode from the start.
+		void start();
+
+		/// Tell the helper thread to stop, and wait for it.
+		void stop();
+
+		/// Helper thread body.
+		void decode();
+
+		/// Wait for decoded data and either copy or discard it.
+		/**
+		 * @param buffer
+		 *   Destination, or null to discard the data.
+		 *
+		 * @param len
+		 *   Amount of data to copy or discard.
+		 *
+		 * @return Number of bytes copied or discarded, which will only be less
+		 *   than len at the end of the data.
+		 */
+		stream::len consume(uint8_t *buffer, stream::len len);
+};
+
+/// Open a filtered file for reading, decoding it ahead on a helper thread.
+/**
+ * This is like applyFilter() for input streams, but uses input_decode_ahead
+ * if the filter provides a FilterType::decoder().  Otherwise it falls back to
+ * FilterType::apply() so it can be used for any filter.
+ *
+ * @param s
+ *   Unfiltered file data.  This is read on the helper thread, so it must not
+ *   share anything with streams used on other threads unless that is safe,
+ *   e.g. a file opened from Archive_FAT::snapshot().
+ *
+ * @param filter
+ *   Code of the filter to apply, e.g. Archive::File::filter.  May be empty,
+ *   in which case s is returned unchanged.
+ *
+ * @param lenDecoded
+ *   Size of the decoded data, e.g. Archive::File::realSize.
+ *
+ * @throws stream::error if the filter code is not known.
+ */
+std::unique_ptr<stream::input> CAMOTO_GAMEARCHIVE_API applyFilterDecodeAhead(
+	std::unique_ptr<stream::input> s, const std::string& filter,
+	stream::len lenDecoded);
+
+/// Open a file in an archive for reading, decoding it on a helper thread.
+/**
+ * The file is read through a snapshot of the archive (see
+ * Archive_FAT::snapshot()), so the helper thread has its own stream and the
+ * archive can still be used as normal while the file is being read.  Archives
+ * that can't take snapshots open the file with Archive::open() instead, which
+ * decodes the data on the caller's thread.
+ *
+ * @param archive
+ *   Archive containing the file.
+ *
+ * @param id
+ *   File to open, with its filter applied if it has one.
+ */
+std::unique_ptr<stream::input> CAMOTO_GAMEARCHIVE_API openDecodeAhead(
+	std::shared_ptr<Archive> archive, const Archive::FileHandle& id);
+
+} // namespace gamearchive
+} // namespace camoto
+
+#endif // _CAMOTO_GAMEARCHIVE_STREAM_DECODE_AHEAD_HPP_
@@ -0,0 +1,142 @@
+/**
+ * @file  camoto/gamearchive/stream_extent.hpp
+ * @brief File stream that can shift data by rearranging filesystem extents.
+ *
+ * Copyright (C) 2010-2016 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _CAMOTO_GAMEARCHIVE_STREAM_EXTENT_HPP_
+#define _CAMOTO_GAMEARCHIVE_STREAM_EXTENT_HPP_
+
+#include <string>
+#include <vector>
+#include <camoto/config.hpp>
+#include <camoto/stream.hpp>
+
+namespace camoto {
+namespace gamearchive {
+
+/// Read/write file stream able to insert and remove data without copying.
+/**
+ * This behaves like stream::file, but on filesystems that support it (ext4
+ * and XFS on Linux) insertRange() and removeRange() will shift everything
+ * after the given offset by adjusting the file's extents, instead of reading
+ * and rewriting the rest of the file.  This only works when both the offset
+ * and the length are multiples of the filesystem block size.
+ *
+ * Passing one of these as the content stream to ArchiveType::open() lets
+ * piece_table::flush() use the fast path whenever the data after a file that
+ * was inserted, removed or resized moves by a whole number of blocks.
+ * Everything else is copied as usual, and as before nothing is written until
+ * the archive is flushed.
+ */
+class CAMOTO_GAMEARCHIVE_API extent_file: virtual public stream::inout
+{
+	public:
+		/// Open a file.
+		/**
+		 * @param filename
+		 *   Path to the file.
+		 *
+		 * @param create
+		 *   true to create a new, empty file (truncating any existing one), false
+		 *   to open an existing file.
+		 *
+		 * @throws stream::open_error if the file could not be opened.
+		 */
+		extent_file(const std::string& filename, bool create);
+		virtual ~extent_file();
+
+		virtual stream::len try_read(uint8_t *buffer, stream::len len);
+		virtual void seekg(stream::delta off, stream::seek_from from);
+		virtual stream::pos tellg() const;
+		virtual stream::len size() const;
+
+		virtual stream::len try_write(const uint8_t *buffer, stream::len len);
+		virtual void seekp(stream::delta off, stream::seek_from from);
+		virtual stream::pos tellp() const;
+		virtual void truncate(stream::len size);
+		virtual void flush();
+
+		/// Get the filesystem block size.
+		/**
+		 * @return Granularity of insertRange() and removeRange(), or zero if
+		 *   extent operations are not available on this platform.
+		 */
+		stream::len blockSize() const;
+
+		/// Can insertRange() or removeRange() be used for the given region?
+		/**
+		 * @return true if both values are block-aligned and the platform
+		 *   supports extent operations.  A true value does not guarantee the
+		 *   operation will succeed, as the filesystem may still refuse it.
+		 */
+		bool isAligned(stream::pos off, stream::len len) const;
+
+		/// Stop using extent operations, even if the filesystem supports them.
+		/**
+		 * insertRange() and removeRange() will then always return false, so the
+		 * caller falls back to copying the data.  This is mainly so that path can
+		 * be tested on filesystems that would otherwise take the fast one.
+		 */
+		void disableExtents();
+
+		/// Insert a block of zeroes, moving following data further into the file.
+		/**
+		 * @param off
+		 *   Offset where the new space will start.  Must be block-aligned.
+		 *
+		 * @param len
+		 *   Number of bytes to insert.  Must be a multiple of the block size.
+		 *
+		 * @return true if the data was shifted, false if the filesystem does not
+		 *   support this (or the values are not aligned) and nothing was changed,
+		 *   in which case the caller must fall back to copying the data.
+		 *
+		 * @throws stream::write_error on an I/O error other than lack of support.
+		 */
+		bool insertRange(stream::pos off, stream::len len);
+
+		/// Remove a block of data, moving following data closer to the start.
+		/**
+		 * @copydetails insertRange()
+		 */
+		bool removeRange(stream::pos off, stream::len len);
+
+	protected:
+		int fd;                 ///< OS file descriptor
+		stream::pos offset;     ///< Current read/write position
+		stream::len lenBlock;   ///< Filesystem block size, 0 if unsupported
+		std::string filename;   ///< Filename, for error messages
+
+		std::vector<uint8_t> vcReadBuffer; ///< Data read ahead from the file
+		stream::pos offReadBuffer;         ///< File offset of vcReadBuffer[0]
+		stream::len lenReadBuffer;         ///< Valid bytes in vcReadBuffer
+
+		/// Read from the file at the given offset, bypassing the read buffer.
+		stream::len readAt(stream::pos off, uint8_t *buffer, stream::len len);
+
+		/// Discard the read buffer if it overlaps the given range.
+		void invalidate(stream::pos off, stream::len len);
+
+		/// Run an fallocate() operation.
+		bool shiftRange(int mode, stream::pos off, stream::len len);
+};
+
+} // namespace gamearchive
+} // namespace camoto
+
+#endif // _CAMOTO_GAMEARCHIVE_STREAM_EXTENT_HPP_
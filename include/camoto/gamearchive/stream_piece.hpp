@@ -0,0 +1,427 @@
+/**
+ * @file  camoto/gamearchive/stream_piece.hpp
+ * @brief Stream that records edits in a piece table until it is flushed.
+ *
+ * Copyright (C) 2010-2016 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _CAMOTO_GAMEARCHIVE_STREAM_PIECE_HPP_
+#define _CAMOTO_GAMEARCHIVE_STREAM_PIECE_HPP_
+
+#include <cstdio>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <vector>
+#include <camoto/config.hpp>
+#include <camoto/stream.hpp>
+
+namespace camoto {
+namespace gamearchive {
+
+/// Default value for piece_table::setMemoryLimit(), in bytes.
+#define PIECE_DEFAULT_MEMORY_LIMIT  (32 * 1048576)
+
+/// Stream allowing data to be inserted and removed cheaply anywhere within it.
+/**
+ * This is a drop-in replacement for stream::seg.  Instead of splitting the
+ * stream into segments, every change is recorded in a piece table: a list of
+ * spans, each of which refers either to a region of the parent stream, to
+ * newly written data held in memory, or to a run of inserted zero bytes.
+ *
+ * The list is kept in a balanced tree indexed by position, so insert(),
+ * remove() and writes are O(log n) in the number of pieces no matter where in
+ * the stream they happen.  Nothing is written to the parent until flush(),
+ * which writes the new content out in a single front-to-back pass, skipping
+ * any regions that have not moved.
+ *
+ * Newly written data is held in memory up to a limit (see setMemoryLimit()),
+ * after which it is moved out to an anonymous temporary file and read back from
+ * there as needed, so large edits do not need a matching amount of RAM.
+ *
+ * The tree nodes are shared copy-on-write, so a piece_snapshot can hold on to
+ * the content as it is at one moment without copying anything.  Later edits
+ * copy only the nodes they change, and flush() stashes any parent data a
+ * snapshot still refers to before overwriting it.
+ *
+ * Archive_FAT uses this for its content stream, so passing an instance of
+ * this class to ArchiveType::open() is not required, although it is possible
+ * if the caller wants to keep a pointer to it (e.g. to change the memory
+ * limit.)
+ */
+class CAMOTO_GAMEARCHIVE_API piece_table: virtual public stream::inout
+{
+	friend class piece_snapshot;
+
+	public:
+		/// Wrap a stream.
+		/**
+		 * @param parent
+		 *   Stream to edit.  Its content is not read until needed.
+		 */
+		piece_table(std::unique_ptr<stream::inout> parent);
+		virtual ~piece_table();
+
+		virtual stream::len try_read(uint8_t *buffer, stream::len len);
+		virtual void seekg(stream::delta off, stream::seek_from from);
+		virtual stream::pos tellg() const;
+		virtual stream::len size() const;
+
+		virtual stream::len try_write(const uint8_t *buffer, stream::len len);
+		virtual void seekp(stream::delta off, stream::seek_from from);
+		virtual stream::pos tellp() const;
+		virtual void truncate(stream::len size);
+
+		/// Write all changes to the parent stream.
+		/**
+		 * After this returns the piece table has been collapsed back into a
+		 * single span covering the parent stream.
+		 *
+		 * @throws stream::error on I/O error writing to the parent.
+		 */
+		virtual void flush();
+
+		/// Insert zero bytes at the current seek position.
+		/**
+		 * @param len
+		 *   Number of bytes to insert.  Data at the current position onwards is
+		 *   moved this many bytes further into the stream.
+		 */
+		virtual void insert(stream::len len);
+
+		/// Remove data at the current seek position.
+		/**
+		 * @param len
+		 *   Number of bytes to remove.  Data after the removed block is moved
+		 *   this many bytes closer to the start of the stream.
+		 */
+		virtual void remove(stream::len len);
+
+		/// Forget all pieces and reread the parent's size.
+		/**
+		 * This must be called after the parent stream was altered directly (for
+		 * example by extent_file::insertRange()), otherwise the piece table will
+		 * still describe the old layout.  Any unflushed changes are lost.
+		 *
+		 * @note The parent must not be altered directly while hasSnapshots()
+		 *   returns true, as the snapshots would be left pointing at parent data
+		 *   that has since moved.
+		 */
+		void reload();
+
+		/// Are any piece_snapshot instances still open on this table?
+		/**
+		 * While this is true the parent stream must only be changed by flush(),
+		 * which knows to preserve the data the snapshots need.
+		 */
+		bool hasSnapshots();
+
+		/// Get the stream being edited.
+		/**
+		 * This must only be changed directly under the same conditions as given
+		 * for reload(), and reload() must be called afterwards.
+		 */
+		stream::inout *parentStream();
+
+		/// Set the amount of pending data that may be kept in memory.
+		/**
+		 * @param limit
+		 *   Maximum number of bytes of unflushed data to keep in RAM.  Once
+		 *   this is exceeded the data is written to a temporary file instead.
+		 *   This also bounds the memory used by flush() when it has to move
+		 *   large amounts of existing data around.  Zero means no limit.  The
+		 *   default is PIECE_DEFAULT_MEMORY_LIMIT.
+		 */
+		void setMemoryLimit(stream::len limit);
+
+	protected:
+		/// Where the data for a piece comes from.
+		enum class Source {
+			Parent,    ///< Piece::offset is an offset into the parent stream
+			Buffer,    ///< Piece::offset is an offset into the Store
+			Zero,      ///< Piece is all zero bytes, offset is unused
+		};
+
+		/// Pending data written to the stream but not yet flushed.
+		/**
+		 * This only ever grows, so data already in it never changes and can be
+		 * read by snapshots on other threads while more is being added.  A new
+		 * one is started after each flush(), with any snapshots keeping the old
+		 * one alive as long as they need it.
+		 */
+		struct Store {
+			std::mutex lock;         ///< Protects everything below
+			std::vector<uint8_t> vcBuffer; ///< Data still in memory
+			FILE *spill;             ///< Temp file for data moved out of memory
+			stream::len lenSpilled;  ///< Amount of data in spill
+
+			Store();
+			~Store();
+
+			/// Add data to the store.
+			/**
+			 * @param limit
+			 *   Move everything out to the temporary file if vcBuffer ends up
+			 *   larger than this.  Zero means no limit.
+			 *
+			 * @return Offset of the data, for use in a Source::Buffer piece.
+			 */
+			stream::pos append(const uint8_t *data, stream::len len,
+				stream::len limit);
+
+			/// Read data back from the store.
+			void read(stream::pos off, uint8_t *buffer, stream::len len);
+
+			/// Move the in-memory data out to the temporary file.
+			/**
+			 * @pre lock is held.
+			 */
+			void spillLocked();
+		};
+
+		/// One contiguous span of the stream's content.
+		struct Piece {
+			Source source;         ///< Where the data is kept
+			stream::pos offset;    ///< Offset within the source
+			stream::len len;       ///< Length of the span
+		};
+
+		/// Tree node for one piece.
+		/**
+		 * The tree is a treap keyed implicitly by position: an in-order walk
+		 * gives the pieces in stream order, and each node knows the total length
+		 * of its subtree so a position can be found by walking down from the root.
+		 */
+		struct Node {
+			Piece piece;                  ///< Span held by this node
+			stream::len lenTree;          ///< Length of this node and its children
+			unsigned int priority;        ///< Random heap priority for balancing
+			std::shared_ptr<Node> left;   ///< Pieces earlier in the stream
+			std::shared_ptr<Node> right;  ///< Pieces later in the stream
+		};
+
+		/// The content as it was when a snapshot was taken.
+		struct Version {
+			std::shared_ptr<Node> root;   ///< Tree, never modified
+			std::shared_ptr<Store> store; ///< Store the Buffer pieces refer to
+
+			/// Have parentNeeded and rescued been set up yet?
+			bool tracked;
+
+			/// Parent regions the tree refers to that are still intact.
+			/**
+			 * Start -> end offsets, filled in by the first flush() after the
+			 * snapshot was taken.  Protected by lockParent.
+			 */
+			std::map<stream::pos, stream::pos> parentNeeded;
+
+			/// Parent data copied into the store before it was overwritten.
+			/**
+			 * Parent offset -> (store offset, length).  Protected by lockParent.
+			 */
+			std::map<stream::pos, std::pair<stream::pos, stream::len>> rescued;
+		};
+
+		std::unique_ptr<stream::inout> parent; ///< Stream being edited
+		std::mutex lockParent;                 ///< Held while using parent
+		std::shared_ptr<Node> root;            ///< Root of the piece tree
+		std::shared_ptr<Store> store;          ///< Pending data
+		stream::pos offset;                    ///< Current read/write position
+		std::minstd_rand rng;                  ///< Source of node priorities
+		stream::len lenMemoryLimit;            ///< Max memory in store, 0 = none
+
+		/// Snapshot of the current content, if one has been taken since the
+		/// last change.
+		std::weak_ptr<Version> latest;
+
+		/// All versions that still have snapshots open.
+		std::vector<std::weak_ptr<Version>> versions;
+
+		/// Get the total length of a subtree, which may be null.
+		static stream::len lenOf(const std::shared_ptr<Node>& node);
+
+		/// Recalculate a node's subtree length after its children changed.
+		static void update(Node *node);
+
+		/// Make sure a node is not shared with a snapshot before changing it.
+		/**
+		 * If anything else also refers to the node, it is replaced with a copy
+		 * (which shares the original's children) so the change doesn't show up
+		 * in the snapshot.
+		 */
+		static void own(std::shared_ptr<Node>& node);
+
+		/// Create a tree node holding a single piece.
+		std::shared_ptr<Node> newNode(Source source, stream::pos offset,
+			stream::len len);
+
+		/// Split a tree into everything before a position and everything after.
+		/**
+		 * If the position falls within a piece, that piece is split in two.
+		 */
+		void split(std::shared_ptr<Node> tree, stream::pos pos,
+			std::shared_ptr<Node> *before, std::shared_ptr<Node> *after);
+
+		/// Join two trees, with all of first's pieces ending up before second's.
+		std::shared_ptr<Node> merge(std::shared_ptr<Node> first,
+			std::shared_ptr<Node> second);
+
+		/// Can two pieces be stored as one?
+		/**
+		 * @return true if second carries on from where first ends in the same
+		 *   source, so the two could be replaced by a single longer piece.
+		 */
+		static bool adjoins(const Piece& first, const Piece& second);
+
+		/// Get the last piece in a tree, or null if the tree is empty.
+		static const Piece *lastPiece(const Node *tree);
+
+		/// Get the first piece in a tree, or null if the tree is empty.
+		static const Piece *firstPiece(const Node *tree);
+
+		/// Lengthen the last piece in a tree.
+		static void growLast(std::shared_ptr<Node>& tree, stream::len len);
+
+		/// Remove the first piece from a tree.
+		static void dropFirst(std::shared_ptr<Node>& tree);
+
+		/// Replace a span of the stream with a single piece.
+		/**
+		 * @param pos
+		 *   Start of the span to replace.
+		 *
+		 * @param lenOld
+		 *   Length of the span to remove.  May be zero to insert.
+		 *
+		 * @param piece
+		 *   New node to put in its place, or null to just remove data.
+		 *
+		 * The new piece is joined onto its neighbours where they adjoin, as are
+		 * the pieces either side of a removed span, so a run of sequential writes
+		 * or an insert followed by a matching remove does not leave the tree any
+		 * larger than it needs to be.
+		 */
+		void replace(stream::pos pos, stream::len lenOld,
+			std::shared_ptr<Node> piece);
+
+		/// Add data to the pending data store.
+		/**
+		 * @return Offset of the data, for use in a Source::Buffer piece.
+		 */
+		stream::pos appendBuffer(const uint8_t *data, stream::len len);
+
+		/// Get a Version for the current content, for a new snapshot.
+		std::shared_ptr<Version> pin();
+
+		/// Read data from the parent stream.
+		/**
+		 * @param version
+		 *   Snapshot doing the reading, so any of its data that has since been
+		 *   overwritten can be read from where it was stashed.  Null when reading
+		 *   the current content.
+		 */
+		void readParent(const Version *version, stream::pos off, uint8_t *buffer,
+			stream::len len);
+
+		/// Copy data out of the tree.
+		/**
+		 * @param version
+		 *   Snapshot doing the reading, or null for the current content.
+		 *
+		 * @param store
+		 *   Store that any Source::Buffer pieces in the tree refer to.
+		 *
+		 * @return Number of bytes copied, which will only be less than len if
+		 *   the end of the stream was reached.
+		 */
+		stream::len readTree(const Version *version, Store *store,
+			const Node *node, stream::pos pos, uint8_t *buffer, stream::len len);
+
+		/// Materialise the pieces onto the parent stream.
+		void writeOut();
+
+		/// Move parent data into place by shifting the parent's extents.
+		/**
+		 * If the parent is an extent_file, any block-aligned gap that opens or
+		 * closes in front of a span of parent data is inserted or removed by the
+		 * filesystem, so that data does not have to be copied.  This is only done
+		 * while writing out, so nothing reaches the parent before flush().
+		 *
+		 * @param pieces
+		 *   Pieces and the offset each one ends up at.  The offsets of the
+		 *   Source::Parent pieces are updated to where their data is afterwards.
+		 */
+		void shiftExtents(std::vector<std::pair<stream::pos, Piece>>& pieces);
+};
+
+/// Read-only view of a piece_table's content at one moment.
+/**
+ * Later changes to the piece_table, including flush(), do not affect what is
+ * read from this stream.  Nothing is copied when the snapshot is taken.
+ * Edits only copy the few tree nodes they change, and flush() only copies
+ * parent data that it is about to overwrite and that a snapshot still uses.
+ *
+ * Snapshots must be created on the thread that edits the piece_table (or with
+ * some other means of making sure no edit is in progress at the time), but
+ * once created each one can be read from a different thread while the
+ * piece_table is still being edited.  Reads only wait on the piece_table for
+ * as long as it takes to copy the data they need out of memory or from the
+ * parent stream.
+ *
+ * Writes are not allowed and will throw stream::write_error.
+ */
+class CAMOTO_GAMEARCHIVE_API piece_snapshot: virtual public stream::inout
+{
+	public:
+		/// Take a snapshot of a piece table's current content.
+		/**
+		 * @param table
+		 *   Piece table to take the snapshot of.  This is kept alive until the
+		 *   snapshot is destroyed.
+		 */
+		piece_snapshot(std::shared_ptr<piece_table> table);
+
+		/// Open another stream on the same snapshot.
+		/**
+		 * The new stream has its own seek position, starting at zero, so it can
+		 * be used by a different thread.
+		 */
+		piece_snapshot(const piece_snapshot& other);
+
+		virtual ~piece_snapshot();
+
+		virtual stream::len try_read(uint8_t *buffer, stream::len len);
+		virtual void seekg(stream::delta off, stream::seek_from from);
+		virtual stream::pos tellg() const;
+		virtual stream::len size() const;
+
+		virtual stream::len try_write(const uint8_t *buffer, stream::len len);
+		virtual void seekp(stream::delta off, stream::seek_from from);
+		virtual stream::pos tellp() const;
+		virtual void truncate(stream::len size);
+		virtual void flush();
+
+	protected:
+		std::shared_ptr<piece_table> table;            ///< Source of the data
+		std::shared_ptr<piece_table::Version> version; ///< Content to read
+		stream::pos offset;                            ///< Current position
+};
+
+} // namespace gamearchive
+} // namespace camoto
+
+#endif // _CAMOTO_GAMEARCHIVE_STREAM_PIECE_HPP_
@@ -21,6 +21,8 @@
 #ifndef _CAMOTO_GAMEARCHIVE_UTIL_HPP_
 #define _CAMOTO_GAMEARCHIVE_UTIL_HPP_
 
+#include <string>
+#include <vector>
 #include <camoto/config.hpp>
 #include <camoto/stream_sub.hpp>
 #include <camoto/gamearchive/archive.hpp>
@@ -49,6 +51,62 @@ namespace gamearchive {
 void CAMOTO_GAMEARCHIVE_API findFile(std::shared_ptr<Archive> *pArchive,
 	Archive::FileHandle *pFile, const std::string& filename);
 
+/// How insertFiles() handles files the caller has asked to be compressed.
+enum class CompressPolicy {
+	Always,    ///< Compress them, even if the data gets larger
+	Smallest,  ///< Store any that don't get smaller when compressed
+};
+
+/// Details about a file to add with insertFiles().
+struct CAMOTO_GAMEARCHIVE_API NewFile
+{
+	std::string name;                ///< Filename, see Archive::insert()
+	std::string type;                ///< MIME-like type, see File::type
+	Archive::File::Attribute attr;   ///< Attributes, see Archive::insert()
+	std::string content;             ///< Unfiltered file data
+};
+
+/// Insert a number of files at once, filtering them in parallel.
+/**
+ * The result is the same as calling Archive::insert() for each file in turn,
+ * then writing the content through the file's filter.  However instead of
+ * compressing each file as it is written, all the files with a filter are
+ * compressed at the same time on a pool of threads first.  Since the
+ * compressed sizes are then known, each file only needs to be resized once
+ * and no data is moved until the archive is flushed.
+ *
+ * @param archive
+ *   Archive to insert files into.
+ *
+ * @param idBeforeThis
+ *   The new files will be inserted before this one, in the order given.  If
+ *   it is not valid, the new files will be added to the end of the archive.
+ *
+ * @param files
+ *   Files to insert.
+ *
+ * @param numThreads
+ *   Maximum number of threads to use for filtering, or 0 to use one per
+ *   CPU core.
+ *
+ * @param policy
+ *   With CompressPolicy::Smallest, files with the Compressed attribute are
+ *   compressed as usual, but if the result is no smaller than the original
+ *   data, the file is inserted without the Compressed attribute instead.
+ *   Compression is abandoned as soon as it reaches the original size, so
+ *   incompressible data such as sounds or images that are already compressed
+ *   costs little extra time, and is faster to read back later.
+ *
+ * @return The handles of the new files, in the same order as files.
+ *
+ * @throws stream::error if a file could not be inserted or filtered.  Files
+ *   already inserted by this call are removed again before it throws.
+ */
+std::vector<Archive::FileHandle> CAMOTO_GAMEARCHIVE_API insertFiles(
+	Archive& archive, const Archive::FileHandle& idBeforeThis,
+	const std::vector<NewFile>& files, unsigned int numThreads = 0,
+	CompressPolicy policy = CompressPolicy::Always);
+
 /// Truncate callback for substreams that are a fixed size.
 void CAMOTO_GAMEARCHIVE_API preventResize(stream::output_sub* sub,
 	stream::len len);
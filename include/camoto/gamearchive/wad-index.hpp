@@ -0,0 +1,182 @@
+/**
+ * @file  camoto/gamearchive/wad-index.hpp
+ * @brief Index of the marker namespaces and maps in a Doom WAD.
+ *
+ * Copyright (C) 2010-2016 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _CAMOTO_GAMEARCHIVE_WAD_INDEX_HPP_
+#define _CAMOTO_GAMEARCHIVE_WAD_INDEX_HPP_
+
+#include <array>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <camoto/config.hpp>
+#include <camoto/gamearchive/archive.hpp>
+
+namespace camoto {
+namespace gamearchive {
+
+/// Index of the lump groups in a Doom WAD.
+/**
+ * Doom WADs group related lumps together, either between marker lumps such as
+ * S_START and S_END for sprites, or after a map header lump like E1M1 or
+ * MAP01 for the lumps making up that map.  This index finds all these groups
+ * in one pass over the lump list, so they can then be looked up directly
+ * instead of scanning through every lump each time.
+ *
+ * Lump names are at most eight characters, so they are compared as single
+ * 64-bit integers (see lumpName()) rather than as strings.  As in Doom, when
+ * the same name appears more than once the last one is used.
+ *
+ * Lumps outside any marker pair, including all the map lumps, are in the
+ * Global namespace.  The marker lumps themselves, including nested ones like
+ * F1_START, are not listed in any namespace.
+ */
+class CAMOTO_GAMEARCHIVE_API WADIndex
+{
+	public:
+		/// Groups of lumps between marker lumps.
+		enum class Namespace {
+			Global,   ///< Lumps not between any markers
+			Sprites,  ///< Between S_START and S_END (or SS_START and SS_END)
+			Flats,    ///< Between F_START and F_END (or FF_START and FF_END)
+			Patches,  ///< Between P_START and P_END (or PP_START and PP_END)
+		};
+
+		/// Number of values in Namespace.
+		static const unsigned int NamespaceCount = 4;
+
+		/// Lumps that can follow a map header.
+		enum class MapLump {
+			Things,
+			Linedefs,
+			Sidedefs,
+			Vertexes,
+			Segs,
+			SSectors,
+			Nodes,
+			Sectors,
+			Reject,
+			Blockmap,
+			Behavior,  ///< Hexen only
+		};
+
+		/// Number of values in MapLump.
+		static const unsigned int MapLumpCount = 11;
+
+		/// Lump name packed into an integer.
+		typedef uint64_t LumpName;
+
+		/// Convert a lump name into the integer used to compare it.
+		/**
+		 * @param name
+		 *   Lump name.  Case is ignored, and only the first eight characters are
+		 *   used.
+		 *
+		 * @return Integer holding the uppercased name, padded with nulls.
+		 */
+		static LumpName lumpName(const std::string& name);
+
+		/// Build an index of the given lumps.
+		/**
+		 * @param files
+		 *   Lumps in the order they appear in the WAD, e.g. Archive::files().
+		 *   Invalid and vacant entries are skipped.
+		 */
+		WADIndex(const Archive::FileVector& files);
+
+		/// Get all the lumps in a namespace.
+		/**
+		 * @param ns
+		 *   Namespace to list.
+		 *
+		 * @return Lumps in the order they appear in the WAD.
+		 */
+		const Archive::FileVector& lumps(Namespace ns) const;
+
+		/// Find a lump within a namespace.
+		/**
+		 * @param ns
+		 *   Namespace to search.
+		 *
+		 * @param name
+		 *   Lump name, case is ignored.
+		 *
+		 * @return The last lump with this name in the namespace, or nullptr if
+		 *   there are none.
+		 */
+		Archive::FileHandle find(Namespace ns, const std::string& name) const;
+
+		/// Get the header lump of every map, in the order they appear.
+		const Archive::FileVector& maps() const;
+
+		/// Find one of the lumps belonging to a map.
+		/**
+		 * @param map
+		 *   Name of the map header lump, e.g. "E1M1" or "MAP07".
+		 *
+		 * @param lump
+		 *   Which of the map's lumps to return.
+		 *
+		 * @return The lump, or nullptr if there is no such map or the map doesn't
+		 *   have this lump.
+		 */
+		Archive::FileHandle mapLump(const std::string& map, MapLump lump) const;
+
+	protected:
+		/// Lumps in one namespace.
+		struct Space {
+			Archive::FileVector lumps;  ///< In WAD order
+			std::unordered_map<LumpName, Archive::FileHandle> byName; ///< Last of each name
+		};
+
+		/// Lumps making up one map.
+		struct MapBlock {
+			std::array<Archive::FileHandle, MapLumpCount> lumps;
+		};
+
+		/// Lumps in each namespace, indexed by Namespace.
+		std::array<Space, NamespaceCount> spaces;
+
+		/// Map header lumps, in WAD order.
+		Archive::FileVector mapHeaders;
+
+		/// Lumps belonging to each map, by header lump name.
+		std::unordered_map<LumpName, MapBlock> mapBlocks;
+};
+
+/// Get the lump index for a Doom WAD.
+/**
+ * The index is built the first time it is requested, and kept until the
+ * archive is next changed.
+ *
+ * @param archive
+ *   Archive opened as a Doom WAD.
+ *
+ * @return The index, or nullptr if the archive is not a Doom WAD.  The index
+ *   remains usable after the archive is changed, but will then refer to the
+ *   lumps as they were when the index was returned, so this function should be
+ *   called again to get an updated one.
+ */
+CAMOTO_GAMEARCHIVE_API std::shared_ptr<const WADIndex> getWADIndex(
+	const Archive& archive);
+
+} // namespace gamearchive
+} // namespace camoto
+
+#endif // _CAMOTO_GAMEARCHIVE_WAD_INDEX_HPP_
@@ -20,20 +20,55 @@
 
 #include <algorithm>
 #include <cassert>
+#include <cstring>
 #include <functional>
+#include <map>
+#include <unordered_map>
+#include <vector>
 #include <camoto/util.hpp>
 #include <camoto/gamearchive/archive-fat.hpp>
 #include <camoto/gamearchive/stream_archfile.hpp>
+#include "archive-snapshot.hpp"
+
+/// Amount of data read at a time when comparing or copying shared file data.
+#define FAT_SHARE_BUFFER_LEN  65536
+
+/// Most spare FAT entries that will be looked for or reserved.
+#define FAT_MAX_SPARE_ENTRIES 4096
 
 namespace camoto {
 namespace gamearchive {
 
 Archive_FAT::FATEntry::FATEntry()
+	:	bShared(false),
+		bRealSizePending(false)
 {
 }
 Archive_FAT::FATEntry::~FATEntry()
 {
 }
+std::unique_ptr<Archive_FAT::FATEntry> Archive_FAT::FATEntry::clone() const
+{
+	auto copy = std::make_unique<FATEntry>();
+	this->copyTo(copy.get());
+	return copy;
+}
+void Archive_FAT::FATEntry::copyTo(FATEntry *dest) const
+{
+	dest->bValid = this->bValid;
+	dest->storedSize = this->storedSize;
+	dest->realSize = this->realSize;
+	dest->strName = this->strName;
+	dest->type = this->type;
+	dest->filter = this->filter;
+	dest->fAttr = this->fAttr;
+	dest->iIndex = this->iIndex;
+	dest->iOffset = this->iOffset;
+	dest->lenHeader = this->lenHeader;
+	dest->bShared = this->bShared;
+	dest->bRealSizePending = this->bRealSizePending;
+	return;
+}
 std::string Archive_FAT::FATEntry::getContent() const
 {
 	std::ostringstream ss;
@@ -47,14 +82,184 @@ std::string Archive_FAT::FATEntry::getContent() const
 
 Archive_FAT::Archive_FAT(std::unique_ptr<stream::inout> content,
 	stream::pos offFirstFile, int lenMaxFilename)
-	:	content(std::make_shared<stream::seg>(std::move(content))),
-		offFirstFile(offFirstFile),
-		lenMaxFilename(lenMaxFilename)
+	:	offFirstFile(offFirstFile),
+		lenMaxFilename(lenMaxFilename),
+		bCanShare(false),
+		bUnordered(false),
+		bLayoutChecked(false),
+		bRealSizesPending(false),
+		generation(0),
+		numSpareEntries(0),
+		lenSpareEntry(0),
+		attrSpareEntries(0),
+		lenAlign(0)
 {
+	// Use the caller's piece table if they gave us one, so they can keep a
+	// pointer to it.
+	auto pieces = dynamic_cast<piece_table *>(content.get());
+	if (pieces) {
+		content.release();
+		this->content.reset(pieces);
+	} else {
+		this->content = std::make_shared<piece_table>(std::move(content));
+	}
 }
 
 Archive_FAT::Archive_FAT()
+	:	bCanShare(false),
+		bUnordered(false),
+		bLayoutChecked(false),
+		bRealSizesPending(false),
+		generation(0),
+		numSpareEntries(0),
+		lenSpareEntry(0),
+		attrSpareEntries(0),
+		lenAlign(0)
+{
+}
+
+Archive_FAT::ProbedFAT::~ProbedFAT()
+{
+}
+
+void Archive_FAT::ProbedFAT::readHeader(stream::input& content,
+	stream::len len)
+{
+	len = std::min(len, content.size());
+	this->header.resize(len);
+	content.seekg(0, stream::start);
+	if (len) content.read(&this->header[0], len);
+	return;
+}
+
+void Archive_FAT::ProbedFAT::parse(stream::input& content)
+{
+	// No-op default, the entries were read in probe()
+	return;
+}
+
+bool Archive_FAT::useProbedFAT(
+	std::unique_ptr<ArchiveType::ProbeResult>& parsed)
 {
+	auto fat = dynamic_cast<ProbedFAT *>(parsed.get());
+	if (!fat) return false;
+
+	// Cheap checks that this is the same archive that was probed
+	if (fat->lenArchive != this->content->size()) return false;
+	if (!fat->header.empty()) {
+		std::string header(fat->header.size(), '\0');
+		this->content->seekg(0, stream::start);
+		this->content->read(&header[0], header.size());
+		if (header.compare(fat->header) != 0) return false;
+	}
+
+	fat->parse(*this->content);
+	this->vcFAT.reserve(fat->entries.size());
+	for (auto& f : fat->entries) {
+		this->vcFAT.push_back(std::move(f));
+	}
+	parsed.reset();
+	return true;
+}
+
+void Archive_FAT::initSpareEntries(stream::pos offFATEnd,
+	unsigned int lenEntry)
+{
+	this->lenSpareEntry = lenEntry;
+
+	// Nothing points into the space between the FAT and the first file's data,
+	// so however it was filled it is free to hold spare entries.  Entries that
+	// point before the end of the FAT (e.g. empty files at offset 0) don't
+	// count.
+	stream::pos offFirstData = this->content->size();
+	for (const auto& i : this->vcFAT) {
+		auto pFAT = FATEntry::cast(i);
+		if (pFAT->iOffset < offFATEnd) continue;
+		offFirstData = std::min(offFirstData, pFAT->iOffset);
+	}
+	this->numSpareEntries = 0;
+	if (offFirstData > offFATEnd) {
+		this->numSpareEntries = std::min<stream::len>(
+			(offFirstData - offFATEnd) / lenEntry, FAT_MAX_SPARE_ENTRIES);
+	}
+
+	this->attrSpareEntries = this->v_attributes.size();
+	this->v_attributes.emplace_back();
+	auto& a = this->v_attributes.back();
+	a.changed = false;
+	a.type = Attribute::Type::Integer;
+	a.name = "Spare FAT entries";
+	a.desc = "Number of unused FAT entries to keep after the last file's entry.  "
+		"Files can be added without moving the data of any other files while "
+		"there are spare entries left, at the cost of a slightly larger archive.";
+	a.integerValue = this->numSpareEntries;
+	a.integerMinValue = 0;
+	a.integerMaxValue = FAT_MAX_SPARE_ENTRIES;
+	return;
+}
+
+bool Archive_FAT::takeSpareEntry(stream::pos offFATEnd, FATEntry *pNewEntry)
+{
+	if (this->numSpareEntries == 0) return false;
+
+	// The first file in an empty archive would otherwise go at offFirstFile,
+	// where the spare entries are.
+	stream::pos offFirstData = offFATEnd
+		+ this->numSpareEntries * this->lenSpareEntry;
+	pNewEntry->iOffset = std::max(pNewEntry->iOffset, offFirstData);
+
+	this->content->seekp(offFATEnd, stream::start);
+	this->content->remove(this->lenSpareEntry);
+	this->numSpareEntries--;
+	this->v_attributes[this->attrSpareEntries].integerValue =
+		this->numSpareEntries;
+	return true;
+}
+
+bool Archive_FAT::keepSpareEntry(stream::pos offFATEnd)
+{
+	if (this->numSpareEntries == 0) return false;
+	if (this->numSpareEntries >= FAT_MAX_SPARE_ENTRIES) return false;
+
+	this->content->seekp(offFATEnd, stream::start);
+	this->content->insert(this->lenSpareEntry);
+	this->numSpareEntries++;
+	this->v_attributes[this->attrSpareEntries].integerValue =
+		this->numSpareEntries;
+	return true;
+}
+
+void Archive_FAT::setSpareEntries(stream::pos offFATEnd, unsigned int numSpare)
+{
+	assert(this->lenSpareEntry);
+	if (numSpare > FAT_MAX_SPARE_ENTRIES) {
+		throw stream::error(createString("there can be at most "
+			<< FAT_MAX_SPARE_ENTRIES << " spare FAT entries"));
+	}
+	this->snapshotFAT.reset();
+	this->checkLayout();
+
+	// Add or remove entries at the end of the spare ones, just before the file
+	// data.
+	stream::pos offSpareEnd = offFATEnd
+		+ this->numSpareEntries * this->lenSpareEntry;
+	stream::delta delta = ((stream::delta)numSpare - this->numSpareEntries)
+		* this->lenSpareEntry;
+	if (delta > 0) {
+		this->content->seekp(offSpareEnd, stream::start);
+		this->content->insert(delta);
+		this->shiftFiles(NULL, offSpareEnd, delta, 0);
+	} else if (delta < 0) {
+		this->content->seekp(offSpareEnd + delta, stream::start);
+		this->content->remove(-delta);
+		this->shiftFiles(NULL, offSpareEnd, delta, 0);
+	}
+
+	this->numSpareEntries = numSpare;
+	auto& a = this->v_attributes[this->attrSpareEntries];
+	a.integerValue = numSpare;
+	a.changed = false;
+	return;
 }
 
 Archive_FAT::~Archive_FAT()
@@ -73,6 +278,12 @@ Archive_FAT::~Archive_FAT()
 
 const Archive::FileVector& Archive_FAT::files() const
 {
+	// TESTED BY: fmt_cur_prehistorik_lazy_realsize
+	if (this->bRealSizesPending) {
+		// The caller may look at any realSize, so they must all be valid now
+		const_cast<Archive_FAT *>(this)->resolveRealSizes(this->vcFAT);
+		this->bRealSizesPending = false;
+	}
 	return this->vcFAT;
 }
 
@@ -82,6 +293,10 @@ const Archive::FileHandle Archive_FAT::find(const std::string& strFilename) cons
 	for (const auto& i : this->vcFAT) {
 		auto pFAT = dynamic_cast<const FATEntry *>(&*i);
 		if (camoto::icasecmp(pFAT->strName, strFilename)) {
+			if (pFAT->bRealSizePending) {
+				// TESTED BY: fmt_cur_prehistorik_lazy_realsize
+				const_cast<Archive_FAT *>(this)->resolveRealSizes({i});
+			}
 			return i;
 		}
 	}
@@ -117,6 +332,9 @@ std::unique_ptr<stream::inout> Archive_FAT::open(const FileHandle& id,
 			"that wasn't encapsulated in a shared_ptr!");
 	}
 
+	// Work out which files share data before any of them can be written to
+	this->checkLayout();
+
 	auto raw = std::make_unique<archfile>(
 		this->shared_from_this(),
 		id,
@@ -133,6 +351,16 @@ std::unique_ptr<stream::inout> Archive_FAT::open(const FileHandle& id,
 	return std::move(raw);
 }
 
+std::unique_ptr<archfile_reader> Archive_FAT::openReader(const FileHandle& id)
+{
+	auto fat = FATEntry::cast(id);
+	if (!fat || !fat->bValid) {
+		throw stream::error("Attempt to open a closed or deleted file.");
+	}
+	return std::make_unique<archfile_reader>(this->shared_from_this(), id,
+		this->content);
+}
+
 std::shared_ptr<Archive> Archive_FAT::openFolder(const FileHandle& id)
 {
 	// This function should only be called for folders (not files)
@@ -146,6 +374,9 @@ const Archive::FileHandle Archive_FAT::insert(const FileHandle& idBeforeThis,
 	const std::string& strFilename, stream::len storedSize, std::string type,
 	File::Attribute attr)
 {
+	this->snapshotFAT.reset();
+	this->generation++;
+	this->checkLayout();
 	// TESTED BY: fmt_grp_duke3d_insert2
 	// TESTED BY: fmt_grp_duke3d_remove_insert
 	// TESTED BY: fmt_grp_duke3d_insert_remove
@@ -187,6 +418,15 @@ const Archive::FileHandle Archive_FAT::insert(const FileHandle& idBeforeThis,
 			pNewFile->iOffset = pFATAfterThis->iOffset
 				+ pFATAfterThis->lenHeader + pFATAfterThis->storedSize;
 			pNewFile->iIndex = pFATAfterThis->iIndex + 1;
+			if (this->bUnordered) {
+				// The last file's data isn't necessarily at the end, so find the end
+				// of whichever file's data is.  Nothing then needs shifting.
+				for (const auto& i : this->vcFAT) {
+					auto pFAT = dynamic_cast<const FATEntry *>(i.get());
+					pNewFile->iOffset = std::max(pNewFile->iOffset,
+						pFAT->iOffset + pFAT->lenHeader + pFAT->storedSize);
+				}
+			}
 		} else {
 			// There are no files in the archive
 			pNewFile->iOffset = this->offFirstFile;
@@ -204,13 +444,22 @@ const Archive::FileHandle Archive_FAT::insert(const FileHandle& idBeforeThis,
 	// to be marked valid otherwise it won't be skipped/ignored.
 	pNewFile->bValid = true;
 
+	// When the files are being kept aligned, a file inserted in the middle
+	// brings its own padding so the ones after it don't lose their alignment,
+	// and a file added at the end is moved to the next aligned offset.
+	bool bPad = this->lenAlign && !this->bUnordered;
+	stream::len lenData = pNewFile->storedSize;
+	stream::len lenPadBefore = 0;
+
 	if (this->isValid(idBeforeThis)) {
+		if (bPad) lenData = this->alignUp(lenData);
+
 		// Update the offsets of any files located after this one (since they will
 		// all have been shifted forward to make room for the insert.)
 		this->shiftFiles(
 			&*pNewFile,
 			pNewFile->iOffset + pNewFile->lenHeader,
-			pNewFile->storedSize,
+			lenData,
 			1
 		);
 
@@ -224,14 +473,22 @@ const Archive::FileHandle Archive_FAT::insert(const FileHandle& idBeforeThis,
 	} else {
 		// TESTED BY: fmt_grp_duke3d_insert_end
 		this->vcFAT.push_back(pNewFile);
+
+		if (bPad && (pNewFile->lenHeader == 0)) {
+			lenPadBefore = this->alignUp(pNewFile->iOffset) - pNewFile->iOffset;
+			if (lenPadBefore) {
+				pNewFile->iOffset += lenPadBefore;
+				this->updateFileOffset(&*pNewFile, lenPadBefore);
+			}
+		}
 	}
 
 	// Insert space for the file's data into the archive.  If there is a header
 	// (e.g. embedded FAT) then preInsertFile() will have inserted space for
 	// this and written the data, so our insert should start just after the
 	// header.
-	this->content->seekp(pNewFile->iOffset + pNewFile->lenHeader, stream::start);
-	this->content->insert(pNewFile->storedSize);
+	this->insertContent(pNewFile->iOffset + pNewFile->lenHeader - lenPadBefore,
+		lenPadBefore + lenData);
 
 	this->postInsertFile(&*pNewFile);
 
@@ -240,6 +497,8 @@ const Archive::FileHandle Archive_FAT::insert(const FileHandle& idBeforeThis,
 
 void Archive_FAT::remove(const FileHandle& id)
 {
+	this->snapshotFAT.reset();
+	this->generation++;
 	// TESTED BY: fmt_grp_duke3d_remove
 	// TESTED BY: fmt_grp_duke3d_remove2
 	// TESTED BY: fmt_grp_duke3d_remove_insert
@@ -250,6 +509,7 @@ void Archive_FAT::remove(const FileHandle& id)
 
 	auto pFAT = FATEntry::cast(id);
 	assert(pFAT);
+	this->checkLayout();
 
 	// Remove the file's entry from the FAT
 	this->preRemoveFile(pFAT);
@@ -263,22 +523,39 @@ void Archive_FAT::remove(const FileHandle& id)
 	assert(itErase != this->vcFAT.end());
 	this->vcFAT.erase(itErase);
 
-	// Update the offsets of any files located after this one (since they will
-	// all have been shifted back to fill the gap made by the removal.)
-	this->shiftFiles(
-		pFAT,
-		pFAT->iOffset,
-		-((stream::delta)pFAT->storedSize + (stream::delta)pFAT->lenHeader),
-		-1
-	);
+	if (pFAT->bShared) {
+		// Other files are still using the data, so leave it where it is and only
+		// renumber the files after this one.
+		this->shiftFiles(pFAT, pFAT->iOffset, 0, -1);
+	} else {
+		// Any padding after the file goes with it, so the files after it stay
+		// aligned.
+		stream::len lenRemove = pFAT->storedSize + pFAT->lenHeader
+			+ this->paddingAfter(pFAT);
+
+		// Update the offsets of any files located after this one (since they
+		// will all have been shifted back to fill the gap made by the removal.)
+		// Once the data is out of order, only files starting after the end of
+		// this one's data can be behind it.
+		this->shiftFiles(
+			pFAT,
+			pFAT->iOffset + (this->bUnordered
+				? pFAT->lenHeader + pFAT->storedSize : 0),
+			-(stream::delta)lenRemove,
+			-1
+		);
 
-	// Remove the file's data from the archive
-	this->content->seekp(pFAT->iOffset, stream::start);
-	this->content->remove(pFAT->storedSize + pFAT->lenHeader);
+		// Remove the file's data from the archive
+		this->removeContent(pFAT->iOffset, lenRemove);
+	}
 
 	// Mark it as invalid in case some other code is still holding on to it.
 	pFAT->bValid = false;
 
+	if (pFAT->bShared) {
+		this->releaseShared(pFAT->iOffset, pFAT->storedSize);
+	}
+
 	this->postRemoveFile(pFAT);
 
 	return;
@@ -286,6 +563,8 @@ void Archive_FAT::remove(const FileHandle& id)
 
 void Archive_FAT::rename(const FileHandle& id, const std::string& strNewName)
 {
+	this->snapshotFAT.reset();
+	this->generation++;
 	// TESTED BY: fmt_grp_duke3d_rename
 	assert(this->isValid(id));
 	auto pFAT = FATEntry::cast(id);
@@ -306,6 +585,8 @@ void Archive_FAT::rename(const FileHandle& id, const std::string& strNewName)
 
 void Archive_FAT::move(const FileHandle& idBeforeThis, const FileHandle& id)
 {
+	this->snapshotFAT.reset();
+	this->generation++;
 	// Open the file we want to move
 	auto src = this->open(id, false);
 	assert(src);
@@ -330,6 +611,7 @@ void Archive_FAT::move(const FileHandle& idBeforeThis, const FileHandle& id)
 
 	// If there's a filter set then bring the unfiltered size across too.
 	if (!n->filter.empty()) {
+		this->resolveRealSizes({id});
 		this->resize(n, n->storedSize, id->realSize);
 	}
 
@@ -343,14 +625,43 @@ void Archive_FAT::move(const FileHandle& idBeforeThis, const FileHandle& id)
 void Archive_FAT::resize(const FileHandle& id, stream::len newStoredSize,
 	stream::len newRealSize)
 {
+	this->snapshotFAT.reset();
+	this->generation++;
 	assert(this->isValid(id));
 	auto pFAT = FATEntry::cast(id);
+	this->checkLayout();
+	if (pFAT->bShared) {
+		// Need the current size to tell whether it is changing
+		this->resolveRealSizes({id});
+	}
+	if (
+		pFAT->bShared
+		&& (
+			(newStoredSize != pFAT->storedSize)
+			|| (newRealSize != pFAT->realSize)
+		)
+	) {
+		// Don't change the size of the other files using the same data
+		this->unshare(id);
+	}
 	stream::delta iDelta = newStoredSize - id->storedSize;
 
+	// Amount of space the file takes up now and afterwards, which is more than
+	// the file size when padding follows it.
+	stream::len lenOldSpace = pFAT->storedSize;
+	stream::len lenNewSpace = newStoredSize;
+	if (this->lenAlign && !this->bUnordered) {
+		lenOldSpace += this->paddingAfter(pFAT);
+		lenNewSpace = this->alignUp(newStoredSize);
+	}
+	stream::delta iShift = lenNewSpace - lenOldSpace;
+
 	stream::len oldStoredSize = pFAT->storedSize;
 	stream::len oldRealSize = pFAT->realSize;
+	bool oldRealSizePending = pFAT->bRealSizePending;
 	pFAT->storedSize = newStoredSize;
 	pFAT->realSize = newRealSize;
+	pFAT->bRealSizePending = false;
 
 	try {
 		// Update the FAT with the file's new sizes
@@ -359,46 +670,288 @@ void Archive_FAT::resize(const FileHandle& id, stream::len newStoredSize,
 		// Undo and abort the resize
 		pFAT->storedSize = oldStoredSize;
 		pFAT->realSize = oldRealSize;
+		pFAT->bRealSizePending = oldRealSizePending;
 		throw;
 	}
 
 	// Add or remove the data in the underlying stream
 	stream::pos iStart;
-	if (iDelta > 0) { // inserting data
+	if (iShift > 0) { // inserting data
 		// TESTED BY: fmt_grp_duke3d_resize_larger
-		iStart = pFAT->iOffset + pFAT->lenHeader + oldStoredSize;
-		this->content->seekp(iStart, stream::start);
-		this->content->insert(iDelta);
-	} else if (iDelta < 0) { // removing data
+		iStart = pFAT->iOffset + pFAT->lenHeader + lenOldSpace;
+		this->insertContent(iStart, iShift);
+	} else if (iShift < 0) { // removing data
 		// TESTED BY: fmt_grp_duke3d_resize_smaller
-		iStart = pFAT->iOffset + pFAT->lenHeader + newStoredSize;
-		this->content->seekp(iStart, stream::start);
-		this->content->remove(-iDelta);
+		iStart = pFAT->iOffset + pFAT->lenHeader + lenNewSpace;
+		this->removeContent(iStart, -iShift);
+		// Empty files can start anywhere once the data is out of order, so only
+		// move those that were after the removed data.
+		if (this->bUnordered) iStart -= iShift;
 	} else if (pFAT->realSize == newRealSize) {
-		// Not resizing the internal size, and the external/real size
-		// hasn't changed either, so nothing to do.
+		// The file has not moved or grown past its padding, and the
+		// external/real size hasn't changed either, so nothing else to do.
 		return;
 	}
 
-	if (iDelta != 0) {
-		// The internal file size is changing, so adjust the offsets etc. of the
-		// rest of the files in the archive, including any open streams.
-		this->shiftFiles(pFAT, iStart, iDelta, 0);
-	} // else only realSize changed
+	if (iShift != 0) {
+		// The space taken by the file is changing, so adjust the offsets etc. of
+		// the rest of the files in the archive, including any open streams.
+		this->shiftFiles(pFAT, iStart, iShift, 0);
+	} // else only the sizes changed
 
 	return;
 }
 
 void Archive_FAT::flush()
 {
+	// Descendent classes may have moved things around before calling this
+	this->generation++;
+
 	// Write out to the underlying stream
 	this->content->flush();
 	return;
 }
 
+void Archive_FAT::resolveRealSizes(const FileVector& ids)
+{
+	std::vector<FATEntry *> pending;
+	for (const auto& i : ids) {
+		auto pFAT = FATEntry::cast(i);
+		if (pFAT && pFAT->bValid && pFAT->bRealSizePending) {
+			pending.push_back(pFAT);
+		}
+	}
+	if (pending.empty()) return;
+
+	// Read them in the order they appear in the archive, so the stream only
+	// ever seeks forwards.
+	std::sort(pending.begin(), pending.end(),
+		[](const FATEntry *a, const FATEntry *b) {
+			return a->iOffset < b->iOffset;
+		});
+	this->loadRealSizes(pending);
+	for (auto pFAT : pending) pFAT->bRealSizePending = false;
+	return;
+}
+
+std::shared_ptr<Archive> Archive_FAT::snapshot()
+{
+	if (!this->snapshotFAT) {
+		// The snapshot can't read the sizes later, as the data may have moved by
+		// then.
+		this->resolveRealSizes(this->vcFAT);
+
+		// Copy the entries rather than sharing them, as we will keep changing
+		// ours after the snapshot has been taken.  clone() keeps any fields a
+		// format has added to FATEntry.
+		auto copy = std::make_shared<FileVector>();
+		copy->reserve(this->vcFAT.size());
+		for (const auto& i : this->vcFAT) {
+			copy->push_back(FATEntry::cast(i)->clone());
+		}
+		this->snapshotFAT = copy;
+	}
+	return std::make_shared<Archive_Snapshot>(this->snapshotFAT,
+		std::make_shared<piece_snapshot>(this->content));
+}
+
+bool Archive_FAT::canDeduplicate() const
+{
+	return this->bCanShare;
+}
+
+stream::len Archive_FAT::deduplicate()
+{
+	if (!this->bCanShare) {
+		throw stream::error("This archive format cannot store the same data for "
+			"more than one file.");
+	}
+	this->checkLayout();
+
+	// Files of different sizes can't match, so only files that share a size
+	// with another need to be read.  Files already sharing data are only
+	// listed once.
+	std::map<stream::len, std::vector<FATEntry *>> bySize;
+	for (auto& i : this->vcFAT) {
+		auto pFAT = FATEntry::cast(i);
+		if (!this->shareable(pFAT)) continue;
+		auto& sizeGroup = bySize[pFAT->storedSize];
+		bool listed = false;
+		for (auto pOther : sizeGroup) {
+			if (pOther->iOffset == pFAT->iOffset) {
+				listed = true;
+				break;
+			}
+		}
+		if (!listed) sizeGroup.push_back(pFAT);
+	}
+
+	stream::len lenSaved = 0;
+	for (auto& sizeGroup : bySize) {
+		if (sizeGroup.second.size() < 2) continue;
+
+		// Keep the first copy of each file, in FAT order
+		std::unordered_map<uint64_t, std::vector<FATEntry *>> byHash;
+		for (auto pFAT : sizeGroup.second) {
+			auto& matches = byHash[this->hashData(pFAT)];
+			bool shared = false;
+			for (auto pKeep : matches) {
+				if (
+					this->sameData(pFAT, pKeep)
+					&& !this->overlapsOthers(pFAT)
+				) {
+					lenSaved += pFAT->storedSize;
+					this->shareData(pFAT, pKeep);
+					shared = true;
+					break;
+				}
+			}
+			if (!shared) matches.push_back(pFAT);
+		}
+	}
+	return lenSaved;
+}
+
+bool Archive_FAT::deduplicate(const FileHandle& id)
+{
+	if (!this->bCanShare) {
+		throw stream::error("This archive format cannot store the same data for "
+			"more than one file.");
+	}
+	assert(this->isValid(id));
+	this->checkLayout();
+
+	auto pFAT = FATEntry::cast(id);
+	if (!this->shareable(pFAT)) return false;
+	if (this->overlapsOthers(pFAT)) return false;
+
+	for (auto& i : this->vcFAT) {
+		auto pKeep = FATEntry::cast(i);
+		// Skip this file, and any already using the same data
+		if (pKeep->iOffset == pFAT->iOffset) continue;
+		if (!this->shareable(pKeep)) continue;
+		if (!this->sameData(pFAT, pKeep)) continue;
+
+		this->shareData(pFAT, pKeep);
+		return true;
+	}
+	return false;
+}
+
+void Archive_FAT::unshare(const FileHandle& id)
+{
+	assert(this->isValid(id));
+	auto pFAT = FATEntry::cast(id);
+	this->checkLayout();
+	if (!pFAT->bShared) return;
+	this->snapshotFAT.reset();
+	this->generation++;
+
+	// Put the copy straight after the shared data.  No file can start inside
+	// the shared data, so this won't split another file in two.
+	stream::pos offShared = pFAT->iOffset;
+	stream::len lenShared = pFAT->storedSize;
+	stream::pos offCopy = offShared + lenShared;
+	this->insertContent(offCopy, lenShared);
+	this->shiftFiles(NULL, offCopy, lenShared, 0);
+	this->copyContent(offShared, offCopy, lenShared);
+
+	pFAT->iOffset = offCopy;
+	pFAT->bShared = false;
+	this->updateFileOffset(pFAT, lenShared);
+
+	this->releaseShared(offShared, lenShared);
+	return;
+}
+
+void Archive_FAT::setAlignment(stream::len lenAlign)
+{
+	if (!this->bCanShare) {
+		throw stream::error("This archive format cannot leave gaps between "
+			"files.");
+	}
+	this->checkLayout();
+	this->lenAlign = (lenAlign > 1) ? lenAlign : 0;
+	if (!this->lenAlign) return;
+	this->snapshotFAT.reset();
+
+	// Go through the files in the order their data appears, so padding added
+	// in front of one file can't undo the alignment of an earlier one.
+	std::vector<FATEntry *> byOffset;
+	for (auto& i : this->vcFAT) {
+		auto pFAT = FATEntry::cast(i);
+		if (pFAT->storedSize == 0) continue; // empty files don't matter
+		byOffset.push_back(pFAT);
+	}
+	std::stable_sort(byOffset.begin(), byOffset.end(),
+		[](const FATEntry *a, const FATEntry *b) {
+			return a->iOffset < b->iOffset;
+		});
+
+	for (auto pFAT : byOffset) {
+		// Files sharing data are moved together by shiftFiles(), so once the
+		// first of them is aligned the rest already are.
+		stream::pos offData = pFAT->iOffset + pFAT->lenHeader;
+		stream::len lenPad = this->alignUp(offData) - offData;
+		if (lenPad == 0) continue;
+		stream::pos offFile = pFAT->iOffset;
+		this->insertContent(offFile, lenPad);
+		this->shiftFiles(NULL, offFile, lenPad, 0);
+	}
+	return;
+}
+
+void Archive_FAT::insertContent(stream::pos offInsert,
+	stream::len lenInsert)
+{
+	if (lenInsert == 0) return;
+	this->content->seekp(offInsert, stream::start);
+	this->content->insert(lenInsert);
+	return;
+}
+
+void Archive_FAT::removeContent(stream::pos offRemove,
+	stream::len lenRemove)
+{
+	if (lenRemove == 0) return;
+	this->content->seekp(offRemove, stream::start);
+	this->content->remove(lenRemove);
+	return;
+}
+
+bool Archive_FAT::isPadding(stream::pos off, stream::len len) const
+{
+	return true;
+}
+
 void Archive_FAT::shiftFiles(const FATEntry *fatSkip, stream::pos offStart,
 	stream::delta deltaOffset, int deltaIndex)
 {
+	this->generation++;
+	if (this->bUnordered) {
+		for (auto& i : this->vcFAT) {
+			auto pFAT = FATEntry::cast(i);
+			// Files sharing data all have the same offset, so they always move
+			// together here.
+			bool move = (deltaOffset != 0)
+				&& this->entryInRange(pFAT, offStart, fatSkip);
+			bool renumber = (deltaIndex != 0) && (
+				fatSkip
+					? ((pFAT != fatSkip) && (pFAT->iIndex >= fatSkip->iIndex))
+					: this->entryInRange(pFAT, offStart, fatSkip)
+			);
+			if (!move && !renumber) continue;
+
+			if (move) pFAT->iOffset += deltaOffset;
+			if (renumber) pFAT->iIndex += deltaIndex;
+
+			// Even if only the index has changed, the entry must be written out
+			// again as the on-disk FAT entries have moved.
+			this->updateFileOffset(pFAT, move ? deltaOffset : 0);
+		}
+		return;
+	}
+
 	for (auto& i : this->vcFAT) {
 		auto pFAT = FATEntry::cast(i);
 		if (this->entryInRange(pFAT, offStart, fatSkip)) {
@@ -464,6 +1017,13 @@ std::unique_ptr<Archive_FAT::FATEntry> Archive_FAT::createNewFATEntry()
 	return std::make_unique<FATEntry>();
 }
 
+void Archive_FAT::loadRealSizes(const std::vector<FATEntry *>& entries)
+{
+	// Formats that set bRealSizePending must override this
+	throw stream::error("BUG: Archive format did not say how to read the real "
+		"file sizes.");
+}
+
 bool Archive_FAT::entryInRange(const FATEntry *fat, stream::pos offStart,
 	const FATEntry *fatSkip)
 {
@@ -497,5 +1057,207 @@ bool Archive_FAT::entryInRange(const FATEntry *fat, stream::pos offStart,
 	return true;
 }
 
+void Archive_FAT::checkLayout()
+{
+	if (this->bLayoutChecked) return;
+	this->bLayoutChecked = true;
+	if (!this->bCanShare) return;
+
+	// See whether the data is in the same order as the FAT
+	stream::pos offEnd = 0;
+	for (auto& i : this->vcFAT) {
+		auto pFAT = FATEntry::cast(i);
+		if (pFAT->iOffset < offEnd) {
+			this->bUnordered = true;
+			break;
+		}
+		offEnd = pFAT->iOffset + pFAT->lenHeader + pFAT->storedSize;
+	}
+	if (!this->bUnordered) return;
+
+	// Flag any files that point at the same data as another
+	std::map<std::pair<stream::pos, stream::len>, FATEntry *> extents;
+	for (auto& i : this->vcFAT) {
+		auto pFAT = FATEntry::cast(i);
+		if (!this->shareable(pFAT)) continue;
+		auto ins = extents.insert(std::make_pair(
+			std::make_pair(pFAT->iOffset, pFAT->storedSize), pFAT));
+		if (!ins.second) {
+			ins.first->second->bShared = true;
+			pFAT->bShared = true;
+		}
+	}
+	return;
+}
+
+bool Archive_FAT::shareable(const FATEntry *fat) const
+{
+	// Sharing empty files wouldn't save anything, and would stop them from
+	// being treated as zero-length files by entryInRange().
+	return (fat->storedSize > 0) && (fat->lenHeader == 0);
+}
+
+bool Archive_FAT::sameData(const FATEntry *a, const FATEntry *b) const
+{
+	if (a->storedSize != b->storedSize) return false;
+	// A real size that hasn't been read yet is stored in the data, so it is
+	// compared along with the data below.
+	if (
+		!a->bRealSizePending && !b->bRealSizePending
+		&& (a->realSize != b->realSize)
+	) {
+		return false;
+	}
+	if (a->filter.compare(b->filter) != 0) return false;
+	if (a->iOffset == b->iOffset) return true;
+
+	std::vector<uint8_t> bufA(FAT_SHARE_BUFFER_LEN), bufB(FAT_SHARE_BUFFER_LEN);
+	stream::len lenRemaining = a->storedSize;
+	stream::pos offA = a->iOffset + a->lenHeader;
+	stream::pos offB = b->iOffset + b->lenHeader;
+	while (lenRemaining) {
+		stream::len amt = std::min<stream::len>(lenRemaining, FAT_SHARE_BUFFER_LEN);
+		this->content->seekg(offA, stream::start);
+		this->content->read(bufA.data(), amt);
+		this->content->seekg(offB, stream::start);
+		this->content->read(bufB.data(), amt);
+		if (memcmp(bufA.data(), bufB.data(), amt) != 0) return false;
+		offA += amt;
+		offB += amt;
+		lenRemaining -= amt;
+	}
+	return true;
+}
+
+uint64_t Archive_FAT::hashData(const FATEntry *fat) const
+{
+	// 64-bit FNV-1a.  Matches are always confirmed with sameData(), so this
+	// only has to be good enough to keep false matches rare.
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	std::vector<uint8_t> buf(FAT_SHARE_BUFFER_LEN);
+	stream::len lenRemaining = fat->storedSize;
+	this->content->seekg(fat->iOffset + fat->lenHeader, stream::start);
+	while (lenRemaining) {
+		stream::len amt = std::min<stream::len>(lenRemaining, FAT_SHARE_BUFFER_LEN);
+		this->content->read(buf.data(), amt);
+		for (stream::len i = 0; i < amt; i++) {
+			hash = (hash ^ buf[i]) * 0x100000001b3ULL;
+		}
+		lenRemaining -= amt;
+	}
+	return hash;
+}
+
+bool Archive_FAT::overlapsOthers(const FATEntry *fat) const
+{
+	stream::pos offStart = fat->iOffset;
+	stream::pos offEnd = fat->iOffset + fat->lenHeader + fat->storedSize;
+	for (auto& i : this->vcFAT) {
+		auto pOther = dynamic_cast<const FATEntry *>(&*i);
+		if (pOther == fat) continue;
+		if (pOther->storedSize + pOther->lenHeader == 0) continue;
+		if (
+			(pOther->iOffset == fat->iOffset)
+			&& (pOther->storedSize == fat->storedSize)
+			&& (pOther->lenHeader == fat->lenHeader)
+		) {
+			// Already sharing the same data
+			continue;
+		}
+		stream::pos offOtherEnd = pOther->iOffset + pOther->lenHeader
+			+ pOther->storedSize;
+		if ((pOther->iOffset < offEnd) && (offOtherEnd > offStart)) return true;
+	}
+	return false;
+}
+
+void Archive_FAT::shareData(FATEntry *pDup, FATEntry *pKeep)
+{
+	this->snapshotFAT.reset();
+	this->generation++;
+	this->bUnordered = true;
+
+	stream::pos offDup = pDup->iOffset;
+	stream::len lenDup = pDup->storedSize;
+	std::vector<FATEntry *> moving;
+	for (auto& i : this->vcFAT) {
+		auto pFAT = FATEntry::cast(i);
+		if ((pFAT->iOffset == offDup) && (pFAT->storedSize == lenDup)) {
+			moving.push_back(pFAT);
+		}
+	}
+
+	// Remove the duplicate data, moving everything after it (possibly including
+	// pKeep) back to fill the gap.
+	this->removeContent(offDup, lenDup);
+	this->shiftFiles(NULL, offDup + lenDup, -(stream::delta)lenDup, 0);
+
+	for (auto pFAT : moving) {
+		stream::delta delta = pKeep->iOffset - pFAT->iOffset;
+		pFAT->iOffset = pKeep->iOffset;
+		pFAT->bShared = true;
+		this->updateFileOffset(pFAT, delta);
+	}
+	pKeep->bShared = true;
+	return;
+}
+
+void Archive_FAT::releaseShared(stream::pos off, stream::len len)
+{
+	FATEntry *pLast = nullptr;
+	for (auto& i : this->vcFAT) {
+		auto pFAT = FATEntry::cast(i);
+		if (!pFAT->bShared) continue;
+		if ((pFAT->iOffset != off) || (pFAT->storedSize != len)) continue;
+		if (pLast) return; // still shared by at least two files
+		pLast = pFAT;
+	}
+	if (pLast) pLast->bShared = false;
+	return;
+}
+
+stream::len Archive_FAT::alignUp(stream::len len) const
+{
+	if (!this->lenAlign) return len;
+	return (len + this->lenAlign - 1) / this->lenAlign * this->lenAlign;
+}
+
+stream::len Archive_FAT::paddingAfter(const FATEntry *fat) const
+{
+	if (!this->lenAlign || this->bUnordered) return 0;
+
+	stream::pos offEnd = fat->iOffset + fat->lenHeader + fat->storedSize;
+	stream::pos offNext = this->content->size();
+	for (auto& i : this->vcFAT) {
+		auto pOther = dynamic_cast<const FATEntry *>(&*i);
+		if ((pOther == fat) || (pOther->storedSize + pOther->lenHeader == 0)) {
+			continue;
+		}
+		if (pOther->iOffset >= offEnd) offNext = std::min(offNext, pOther->iOffset);
+	}
+	if (offNext <= offEnd) return 0;
+	stream::len lenGap = offNext - offEnd;
+	if (lenGap >= this->lenAlign) return 0; // not padding we added
+	if (!this->isPadding(offEnd, lenGap)) return 0;
+	return lenGap;
+}
+
+void Archive_FAT::copyContent(stream::pos offFrom, stream::pos offTo,
+	stream::len len)
+{
+	std::vector<uint8_t> buf(FAT_SHARE_BUFFER_LEN);
+	while (len) {
+		stream::len amt = std::min<stream::len>(len, FAT_SHARE_BUFFER_LEN);
+		this->content->seekg(offFrom, stream::start);
+		this->content->read(buf.data(), amt);
+		this->content->seekp(offTo, stream::start);
+		this->content->write(buf.data(), amt);
+		offFrom += amt;
+		offTo += amt;
+		len -= amt;
+	}
+	return;
+}
+
 } // namespace gamearchive
 } // namespace camoto
@@ -0,0 +1,137 @@
+/**
+ * @file  archive-snapshot.cpp
+ * @brief Read-only view of an Archive_FAT at one point in time.
+ *
+ * Copyright (C) 2010-2016 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <camoto/stream_sub.hpp>
+#include <camoto/util.hpp>
+#include <camoto/gamearchive/archive-fat.hpp>
+#include <camoto/gamearchive/manager.hpp>
+#include <camoto/gamearchive/util.hpp>
+#include "archive-snapshot.hpp"
+
+namespace camoto {
+namespace gamearchive {
+
+Archive_Snapshot::Archive_Snapshot(std::shared_ptr<const FileVector> vcFAT,
+	std::shared_ptr<piece_snapshot> content)
+	:	vcFAT(vcFAT),
+		content(content)
+{
+}
+
+Archive_Snapshot::~Archive_Snapshot()
+{
+}
+
+const Archive::FileHandle Archive_Snapshot::find(
+	const std::string& strFilename) const
+{
+	for (const auto& i : *this->vcFAT) {
+		if (camoto::icasecmp(i->strName, strFilename)) {
+			return i;
+		}
+	}
+	return nullptr;
+}
+
+const Archive::FileVector& Archive_Snapshot::files() const
+{
+	return *this->vcFAT;
+}
+
+bool Archive_Snapshot::isValid(const FileHandle& id) const
+{
+	if (!id) return false;
+	auto id2 = dynamic_cast<const Archive_FAT::FATEntry *>(&*id);
+	return ((id2) && (id2->bValid));
+}
+
+std::unique_ptr<stream::inout> Archive_Snapshot::open(const FileHandle& id,
+	bool useFilter)
+{
+	auto pFAT = dynamic_cast<const Archive_FAT::FATEntry *>(&*id);
+	if (!pFAT) {
+		throw stream::error("BUG: Tried to open a file from a different archive "
+			"in a snapshot.");
+	}
+
+	// Give each file its own stream over the snapshot, so it has its own seek
+	// position and can be read independently of the others.
+	std::unique_ptr<stream::inout> raw = std::make_unique<stream::sub>(
+		std::make_shared<piece_snapshot>(*this->content),
+		pFAT->iOffset + pFAT->lenHeader,
+		pFAT->storedSize,
+		preventResize
+	);
+
+	if (useFilter && !id->filter.empty()) {
+		auto pFilterType = FilterManager::byCode(id->filter);
+		if (!pFilterType) {
+			throw stream::error(createString(
+				"could not find filter \"" << id->filter << "\""
+			));
+		}
+		return pFilterType->apply(std::move(raw), nullptr);
+	}
+	return raw;
+}
+
+std::shared_ptr<Archive> Archive_Snapshot::openFolder(const FileHandle& id)
+{
+	throw stream::error("Subfolders cannot be opened from a snapshot.");
+}
+
+const Archive::FileHandle Archive_Snapshot::insert(
+	const FileHandle& idBeforeThis, const std::string& strFilename,
+	stream::len storedSize, std::string type, File::Attribute attr)
+{
+	throw stream::error("Cannot insert files into a snapshot, it is read-only.");
+}
+
+void Archive_Snapshot::remove(const FileHandle& id)
+{
+	throw stream::error("Cannot remove files from a snapshot, it is read-only.");
+}
+
+void Archive_Snapshot::rename(const FileHandle& id,
+	const std::string& strNewName)
+{
+	throw stream::error("Cannot rename files in a snapshot, it is read-only.");
+}
+
+void Archive_Snapshot::move(const FileHandle& idBeforeThis,
+	const FileHandle& id)
+{
+	throw stream::error("Cannot move files in a snapshot, it is read-only.");
+}
+
+void Archive_Snapshot::resize(const FileHandle& id, stream::len newStoredSize,
+	stream::len newRealSize)
+{
+	throw stream::error("Cannot resize files in a snapshot, it is read-only.");
+}
+
+void Archive_Snapshot::flush()
+{
+	// Nothing can change, so there is nothing to write
+	return;
+}
+
+} // namespace gamearchive
+} // namespace camoto
@@ -0,0 +1,78 @@
+/**
+ * @file  archive-snapshot.hpp
+ * @brief Read-only view of an Archive_FAT at one point in time.
+ *
+ * Copyright (C) 2010-2016 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _CAMOTO_ARCHIVE_SNAPSHOT_HPP_
+#define _CAMOTO_ARCHIVE_SNAPSHOT_HPP_
+
+#include <camoto/gamearchive/archive.hpp>
+#include <camoto/gamearchive/stream_piece.hpp>
+
+namespace camoto {
+namespace gamearchive {
+
+/// Archive returned by Archive_FAT::snapshot().
+/**
+ * Holds a copy of the FAT and a piece_snapshot of the content, so it keeps
+ * showing the archive as it was when the snapshot was taken.  Any attempt to
+ * change it throws stream::error.
+ */
+class Archive_Snapshot: virtual public Archive
+{
+	public:
+		/// Wrap a copy of an archive's FAT and content.
+		/**
+		 * @param vcFAT
+		 *   Copy of the FAT.  The entries must be Archive_FAT::FATEntry instances
+		 *   and must not be changed once passed in, as they may be shared with
+		 *   other snapshots.
+		 *
+		 * @param content
+		 *   Snapshot of the archive content.  Each opened file gets its own copy
+		 *   of this stream, so different files can be read on different threads.
+		 */
+		Archive_Snapshot(std::shared_ptr<const FileVector> vcFAT,
+			std::shared_ptr<piece_snapshot> content);
+		virtual ~Archive_Snapshot();
+
+		virtual const FileHandle find(const std::string& strFilename) const;
+		virtual const FileVector& files() const;
+		virtual bool isValid(const FileHandle& id) const;
+		virtual std::unique_ptr<stream::inout> open(const FileHandle& id,
+			bool useFilter);
+		virtual std::shared_ptr<Archive> openFolder(const FileHandle& id);
+		virtual const FileHandle insert(const FileHandle& idBeforeThis,
+			const std::string& strFilename, stream::len storedSize, std::string type,
+			File::Attribute attr);
+		virtual void remove(const FileHandle& id);
+		virtual void rename(const FileHandle& id, const std::string& strNewName);
+		virtual void move(const FileHandle& idBeforeThis, const FileHandle& id);
+		virtual void resize(const FileHandle& id, stream::len newStoredSize,
+			stream::len newRealSize);
+		virtual void flush();
+
+	protected:
+		std::shared_ptr<const FileVector> vcFAT;  ///< Files at snapshot time
+		std::shared_ptr<piece_snapshot> content;  ///< Data at snapshot time
+};
+
+} // namespace gamearchive
+} // namespace camoto
+
+#endif // _CAMOTO_ARCHIVE_SNAPSHOT_HPP_
@@ -0,0 +1,143 @@
+/**
+ * @file  archive-stack.cpp
+ * @brief Several archives layered on top of each other, like IWAD + PWADs.
+ *
+ * Copyright (C) 2010-2016 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <unordered_set>
+#include <camoto/util.hpp>
+#include <camoto/gamearchive/archive-stack.hpp>
+
+namespace camoto {
+namespace gamearchive {
+
+ArchiveStack::ArchiveStack()
+	:	nextRank(0)
+{
+}
+
+ArchiveStack::~ArchiveStack()
+{
+}
+
+void ArchiveStack::add(std::shared_ptr<Archive> archive)
+{
+	for (const auto& l : this->stack) {
+		if (l.archive == archive) {
+			throw stream::error("This archive has already been added to the stack.");
+		}
+	}
+	this->stack.emplace_back();
+	Layer& layer = this->stack.back();
+	layer.archive = archive;
+	layer.rank = this->nextRank++;
+	this->indexLayer(layer);
+	return;
+}
+
+void ArchiveStack::remove(const std::shared_ptr<Archive>& archive)
+{
+	Layer& layer = this->findLayer(archive);
+	this->unindexLayer(layer);
+	this->stack.remove_if([&layer](const Layer& l) {
+		return &l == &layer;
+	});
+	return;
+}
+
+void ArchiveStack::refresh(const std::shared_ptr<Archive>& archive)
+{
+	Layer& layer = this->findLayer(archive);
+	this->unindexLayer(layer);
+	this->indexLayer(layer);
+	return;
+}
+
+ArchiveStack::Match ArchiveStack::find(const std::string& strFilename) const
+{
+	std::string key = strFilename;
+	camoto::uppercase(key);
+	auto it = this->index.find(key);
+	if (it == this->index.end()) return {nullptr, nullptr};
+	const Provider& top = it->second.back();
+	return {top.layer->archive, top.id};
+}
+
+std::vector<std::shared_ptr<Archive>> ArchiveStack::layers() const
+{
+	std::vector<std::shared_ptr<Archive>> list;
+	list.reserve(this->stack.size());
+	for (const auto& l : this->stack) list.push_back(l.archive);
+	return list;
+}
+
+ArchiveStack::Layer& ArchiveStack::findLayer(
+	const std::shared_ptr<Archive>& archive)
+{
+	for (auto& l : this->stack) {
+		if (l.archive == archive) return l;
+	}
+	throw stream::error("This archive has not been added to the stack.");
+}
+
+void ArchiveStack::indexLayer(Layer& layer)
+{
+	std::unordered_set<std::string> seen;
+	for (const auto& i : layer.archive->files()) {
+		if (!i->bValid) continue;
+		if (i->fAttr & Archive::File::Attribute::Vacant) continue;
+
+		std::string key = i->strName;
+		camoto::uppercase(key);
+		// Only the first file with each name is visible, as per Archive::find()
+		if (!seen.insert(key).second) continue;
+
+		auto& providers = this->index[key];
+		// Keep the list ordered by rank.  New layers usually go on top, so this
+		// normally just appends.
+		auto pos = std::upper_bound(providers.begin(), providers.end(),
+			layer.rank, [](unsigned int rank, const Provider& p) {
+				return rank < p.layer->rank;
+			});
+		providers.insert(pos, {&layer, i});
+		layer.names.emplace_back(std::move(key), i);
+	}
+	return;
+}
+
+void ArchiveStack::unindexLayer(Layer& layer)
+{
+	for (const auto& n : layer.names) {
+		auto it = this->index.find(n.first);
+		if (it == this->index.end()) continue;
+		auto& providers = it->second;
+		providers.erase(
+			std::remove_if(providers.begin(), providers.end(),
+				[&layer](const Provider& p) {
+					return p.layer == &layer;
+				}),
+			providers.end()
+		);
+		if (providers.empty()) this->index.erase(it);
+	}
+	layer.names.clear();
+	return;
+}
+
+} // namespace gamearchive
+} // namespace camoto
@@ -0,0 +1,283 @@
+/**
+ * @file  archive-sync.cpp
+ * @brief Bring one archive up to date with another, changing as little as
+ *        possible.
+ *
+ * Copyright (C) 2010-2016 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <deque>
+#include <unordered_map>
+#include <vector>
+#include <camoto/util.hpp>
+#include <camoto/gamearchive/archive-sync.hpp>
+
+/// Size of the buffer used when hashing file data.
+#define SYNC_HASH_BUFFER_LEN 65536
+
+namespace camoto {
+namespace gamearchive {
+
+ArchiveSync::ArchiveSync()
+{
+}
+
+ArchiveSync::~ArchiveSync()
+{
+}
+
+ArchiveSync::Result ArchiveSync::sync(Archive& dest, Archive& src)
+{
+	Result result = {0, 0, 0, 0, 0, 0};
+
+	// Take copies of the lists, as they will change as files are inserted and
+	// removed.
+	std::vector<Archive::FileHandle> srcFiles = src.files();
+	std::vector<Archive::FileHandle> destFiles = dest.files();
+
+	// The real sizes are compared and copied, so read any that are stored in
+	// the file data now, in one pass through each archive.
+	src.resolveRealSizes(srcFiles);
+	dest.resolveRealSizes(destFiles);
+
+	// Match up the files by name.  If a name appears more than once, the first
+	// one in the source goes with the first one in the destination, and so on.
+	std::unordered_map<std::string, std::deque<std::size_t>> byName;
+	for (std::size_t d = 0; d < destFiles.size(); d++) {
+		std::string key = destFiles[d]->strName;
+		camoto::uppercase(key);
+		byName[key].push_back(d);
+	}
+	const std::size_t none = (std::size_t)-1;
+	std::vector<std::size_t> destFor(srcFiles.size(), none);
+	for (std::size_t s = 0; s < srcFiles.size(); s++) {
+		std::string key = srcFiles[s]->strName;
+		camoto::uppercase(key);
+		auto it = byName.find(key);
+		if ((it == byName.end()) || it->second.empty()) continue;
+		destFor[s] = it->second.front();
+		it->second.pop_front();
+	}
+
+	// Of the matched files, find the longest run that is already in the same
+	// order in both archives.  These can stay where they are, and any other
+	// matched files are removed and inserted again in the right place.  This
+	// is the usual longest increasing subsequence search, run over the
+	// destination positions of the matched files in source order.
+	std::vector<std::size_t> tails;     // source index ending each run length
+	std::vector<std::size_t> prev(srcFiles.size(), none);
+	for (std::size_t s = 0; s < srcFiles.size(); s++) {
+		if (destFor[s] == none) continue;
+		auto pos = std::lower_bound(tails.begin(), tails.end(), destFor[s],
+			[&destFor](std::size_t t, std::size_t d) {
+				return destFor[t] < d;
+			});
+		if (pos != tails.begin()) prev[s] = *(pos - 1);
+		if (pos == tails.end()) tails.push_back(s);
+		else *pos = s;
+	}
+	std::vector<bool> keepSrc(srcFiles.size(), false);
+	std::vector<bool> keepDest(destFiles.size(), false);
+	if (!tails.empty()) {
+		for (std::size_t s = tails.back(); s != none; s = prev[s]) {
+			keepSrc[s] = true;
+			keepDest[destFor[s]] = true;
+		}
+	}
+
+	// Matched files that are out of order but otherwise identical only need
+	// moving, which is cheaper than copying them from the source again.
+	std::vector<bool> moveSrc(srcFiles.size(), false);
+	std::vector<bool> moveDest(destFiles.size(), false);
+	for (std::size_t s = 0; s < srcFiles.size(); s++) {
+		if (keepSrc[s] || (destFor[s] == none)) continue;
+		if (this->same(dest, destFiles[destFor[s]], src, srcFiles[s])) {
+			moveSrc[s] = true;
+			moveDest[destFor[s]] = true;
+		}
+	}
+
+	// Remove everything that isn't staying, from the end backwards.
+	for (std::size_t d = destFiles.size(); d > 0; d--) {
+		if (keepDest[d - 1] || moveDest[d - 1]) continue;
+		dest.remove(destFiles[d - 1]);
+		result.removed++;
+	}
+
+	// Now walk through the source in order, leaving the kept files in place and
+	// inserting everything else before the next kept file.
+	std::vector<Archive::FileHandle> kept;
+	for (std::size_t d = 0; d < destFiles.size(); d++) {
+		if (keepDest[d]) kept.push_back(destFiles[d]);
+	}
+	std::size_t next = 0;
+	for (std::size_t s = 0; s < srcFiles.size(); s++) {
+		auto& idSrc = srcFiles[s];
+		if (moveSrc[s]) {
+			auto& idDest = destFiles[destFor[s]];
+			dest.move((next < kept.size()) ? kept[next] : nullptr, idDest);
+			result.lenCopied += idSrc->storedSize;
+			result.moved++;
+			continue;
+		}
+		if (!keepSrc[s]) {
+			result.lenCopied += this->insertCopy(dest,
+				(next < kept.size()) ? kept[next] : nullptr, src, idSrc);
+			result.inserted++;
+			continue;
+		}
+
+		auto idDest = kept[next++];
+		if (this->same(dest, idDest, src, idSrc)) {
+			result.unchanged++;
+			continue;
+		}
+
+		if (
+			(idDest->type.compare(idSrc->type) != 0)
+			|| (idDest->fAttr != idSrc->fAttr)
+		) {
+			// These can't be changed on an existing file, so replace it
+			auto idAfter = (next < kept.size()) ? kept[next] : nullptr;
+			dest.remove(idDest);
+			result.removed++;
+			result.lenCopied += this->insertCopy(dest, idAfter, src, idSrc);
+			result.inserted++;
+			continue;
+		}
+
+		if (idDest->strName.compare(idSrc->strName) != 0) {
+			// Only the case is different, otherwise they wouldn't have matched
+			dest.rename(idDest, idSrc->strName);
+		}
+		result.lenCopied += this->copy(dest, idDest, src, idSrc);
+		result.updated++;
+	}
+
+	// Drop the hashes of files that no longer exist, so their handles can be
+	// freed.
+	for (auto it = this->hashes.begin(); it != this->hashes.end(); ) {
+		if (!it->first->bValid) it = this->hashes.erase(it);
+		else ++it;
+	}
+	return result;
+}
+
+void ArchiveSync::forget(const Archive::FileHandle& id)
+{
+	this->hashes.erase(id);
+	return;
+}
+
+void ArchiveSync::clear()
+{
+	this->hashes.clear();
+	return;
+}
+
+uint64_t ArchiveSync::hash(Archive& archive, const Archive::FileHandle& id)
+{
+	auto it = this->hashes.find(id);
+	if (it != this->hashes.end()) return it->second;
+
+	// 64-bit FNV-1a over the stored data
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	auto file = archive.open(id, false);
+	std::vector<uint8_t> buf(SYNC_HASH_BUFFER_LEN);
+	file->seekg(0, stream::start);
+	stream::len lenRemaining = id->storedSize;
+	while (lenRemaining) {
+		stream::len amt = std::min<stream::len>(lenRemaining, SYNC_HASH_BUFFER_LEN);
+		file->read(buf.data(), amt);
+		for (stream::len i = 0; i < amt; i++) {
+			hash = (hash ^ buf[i]) * 0x100000001b3ULL;
+		}
+		lenRemaining -= amt;
+	}
+	this->hashes[id] = hash;
+	return hash;
+}
+
+bool ArchiveSync::same(Archive& dest, const Archive::FileHandle& idDest,
+	Archive& src, const Archive::FileHandle& idSrc)
+{
+	// Check the cheap things first, so the data is only read when it might be
+	// the same.
+	if (idDest->storedSize != idSrc->storedSize) return false;
+	if (idDest->realSize != idSrc->realSize) return false;
+	if (idDest->strName.compare(idSrc->strName) != 0) return false;
+	if (idDest->type.compare(idSrc->type) != 0) return false;
+	if (idDest->filter.compare(idSrc->filter) != 0) return false;
+	if (idDest->fAttr != idSrc->fAttr) return false;
+	return this->hash(dest, idDest) == this->hash(src, idSrc);
+}
+
+stream::len ArchiveSync::copy(Archive& dest, const Archive::FileHandle& idDest,
+	Archive& src, const Archive::FileHandle& idSrc)
+{
+	// The data is about to change, so any hash we have for it is wrong
+	this->hashes.erase(idDest);
+
+	if (idDest->filter.compare(idSrc->filter) == 0) {
+		// Same filter, so the stored data can be copied across untouched
+		if (
+			(idDest->storedSize != idSrc->storedSize)
+			|| (idDest->realSize != idSrc->realSize)
+		) {
+			dest.resize(idDest, idSrc->storedSize, idSrc->realSize);
+		}
+		auto in = src.open(idSrc, false);
+		auto out = dest.open(idDest, false);
+		in->seekg(0, stream::start);
+		out->seekp(0, stream::start);
+		stream::copy(*out, *in);
+		out->flush();
+
+		// The destination now holds the same data as the source
+		auto it = this->hashes.find(idSrc);
+		if (it != this->hashes.end()) this->hashes[idDest] = it->second;
+		return idSrc->storedSize;
+	}
+
+	// Different filters (e.g. the archives are different formats) so the data
+	// has to be decoded and encoded again.
+	auto in = src.open(idSrc, true);
+	auto out = dest.open(idDest, true);
+	out->truncate(idSrc->realSize);
+	in->seekg(0, stream::start);
+	out->seekp(0, stream::start);
+	stream::copy(*out, *in);
+	out->flush();
+	return idDest->storedSize;
+}
+
+stream::len ArchiveSync::insertCopy(Archive& dest,
+	const Archive::FileHandle& idBeforeThis, Archive& src,
+	const Archive::FileHandle& idSrc)
+{
+	auto idDest = dest.insert(idBeforeThis, idSrc->strName, idSrc->storedSize,
+		idSrc->type, idSrc->fAttr);
+	try {
+		return this->copy(dest, idDest, src, idSrc);
+	} catch (...) {
+		dest.remove(idDest);
+		throw;
+	}
+}
+
+} // namespace gamearchive
+} // namespace camoto
@@ -49,5 +49,10 @@ Archive::File::Attribute Archive::getSupportedAttributes() const
 	return File::Attribute::Default;
 }
 
+void Archive::resolveRealSizes(const FileVector& ids)
+{
+	return;
+}
+
 } // namespace gamearchive
 } // namespace camoto
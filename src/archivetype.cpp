@@ -20,6 +20,7 @@
 
 #include <iostream>
 #include <camoto/gamearchive/archivetype.hpp>
+#include <camoto/gamearchive/stream_piece.hpp>
 
 using namespace camoto;
 using namespace camoto::gamearchive;
@@ -40,3 +41,50 @@ CAMOTO_GAMEARCHIVE_API std::ostream& camoto::gamearchive::operator<< (
 #pragma GCC diagnostic pop
 	return s;
 }
+
+ArchiveType::ProbeResult::~ProbeResult()
+{
+}
+
+ArchiveType::Certainty ArchiveType::probe(stream::input& content,
+	std::unique_ptr<ProbeResult> *parsed) const
+{
+	if (parsed) parsed->reset();
+	return this->isInstance(content);
+}
+
+std::shared_ptr<Archive> ArchiveType::openProbed(
+	std::unique_ptr<stream::inout> content, SuppData& suppData,
+	std::unique_ptr<ProbeResult> parsed) const
+{
+	return this->open(std::move(content), suppData);
+}
+
+std::shared_ptr<Archive> ArchiveType::createBuffered(
+	std::unique_ptr<stream::inout> content, SuppData& suppData,
+	stream::len lenMemoryLimit) const
+{
+	auto pieces = std::make_unique<piece_table>(std::move(content));
+	pieces->setMemoryLimit(lenMemoryLimit);
+	return this->create(std::move(pieces), suppData);
+}
+
+std::shared_ptr<Archive> ArchiveType::openBuffered(
+	std::unique_ptr<stream::inout> content, SuppData& suppData,
+	stream::len lenMemoryLimit, std::unique_ptr<ProbeResult> parsed) const
+{
+	auto pieces = std::make_unique<piece_table>(std::move(content));
+	pieces->setMemoryLimit(lenMemoryLimit);
+	return this->openProbed(std::move(pieces), suppData, std::move(parsed));
+}
+
+std::shared_ptr<Archive> ArchiveType::probeAndOpen(
+	std::unique_ptr<stream::inout>& content, SuppData& suppData,
+	Certainty *cert) const
+{
+	std::unique_ptr<ProbeResult> parsed;
+	Certainty c = this->probe(*content, &parsed);
+	if (cert) *cert = c;
+	if (c == Certainty::DefinitelyNo) return nullptr;
+	return this->openProbed(std::move(content), suppData, std::move(parsed));
+}
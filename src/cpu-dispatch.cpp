@@ -0,0 +1,189 @@
+/**
+ * @file  cpu-dispatch.cpp
+ * @brief Select CPU-specific versions of hot filter loops at runtime.
+ *
+ * Copyright (C) 2010-2016 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <cstdlib>
+#include <camoto/util.hpp>
+#include "cpu-dispatch.hpp"
+
+// Each x86 kernel is compiled for its own instruction set via the target
+// attribute, so the rest of the library can still be built for a baseline CPU
+// and only the selected kernels use the newer instructions.
+#ifdef HAVE_X86_TARGET_ATTRIBUTE
+#include <immintrin.h>
+#define USE_X86_KERNELS
+#endif
+
+namespace camoto {
+namespace gamearchive {
+
+#ifdef USE_X86_KERNELS
+/// Values to add to the key to get the key for each byte in a vector.
+alignas(64) static const uint8_t ramp[64] = {
+	 0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14, 15,
+	16, 17, 18, 19, 20, 21, 22, 23, 24, 25, 26, 27, 28, 29, 30, 31,
+	32, 33, 34, 35, 36, 37, 38, 39, 40, 41, 42, 43, 44, 45, 46, 47,
+	48, 49, 50, 51, 52, 53, 54, 55, 56, 57, 58, 59, 60, 61, 62, 63,
+};
+#endif
+
+static void xorRamp_generic(uint8_t *out, const uint8_t *in, stream::len len,
+	uint8_t key)
+{
+	for (stream::len i = 0; i < len; i++) {
+		out[i] = in[i] ^ (uint8_t)(key + i);
+	}
+	return;
+}
+
+#ifdef USE_X86_KERNELS
+__attribute__((target("sse2")))
+static void xorRamp_sse2(uint8_t *out, const uint8_t *in, stream::len len,
+	uint8_t key)
+{
+	stream::len i = 0;
+	__m128i k = _mm_add_epi8(_mm_set1_epi8((char)key),
+		_mm_load_si128((const __m128i *)ramp));
+	const __m128i step = _mm_set1_epi8(16);
+	for (; i + 16 <= len; i += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(in + i));
+		_mm_storeu_si128((__m128i *)(out + i), _mm_xor_si128(v, k));
+		k = _mm_add_epi8(k, step);
+	}
+	xorRamp_generic(out + i, in + i, len - i, (uint8_t)(key + i));
+	return;
+}
+
+__attribute__((target("avx2")))
+static void xorRamp_avx2(uint8_t *out, const uint8_t *in, stream::len len,
+	uint8_t key)
+{
+	stream::len i = 0;
+	__m256i k = _mm256_add_epi8(_mm256_set1_epi8((char)key),
+		_mm256_load_si256((const __m256i *)ramp));
+	const __m256i step = _mm256_set1_epi8(32);
+	for (; i + 32 <= len; i += 32) {
+		__m256i v = _mm256_loadu_si256((const __m256i *)(in + i));
+		_mm256_storeu_si256((__m256i *)(out + i), _mm256_xor_si256(v, k));
+		k = _mm256_add_epi8(k, step);
+	}
+	xorRamp_generic(out + i, in + i, len - i, (uint8_t)(key + i));
+	return;
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static void xorRamp_avx512(uint8_t *out, const uint8_t *in, stream::len len,
+	uint8_t key)
+{
+	stream::len i = 0;
+	__m512i k = _mm512_add_epi8(_mm512_set1_epi8((char)key),
+		_mm512_load_si512((const void *)ramp));
+	const __m512i step = _mm512_set1_epi8(64);
+	for (; i + 64 <= len; i += 64) {
+		__m512i v = _mm512_loadu_si512((const void *)(in + i));
+		_mm512_storeu_si512((void *)(out + i), _mm512_xor_si512(v, k));
+		k = _mm512_add_epi8(k, step);
+	}
+	xorRamp_generic(out + i, in + i, len - i, (uint8_t)(key + i));
+	return;
+}
+#endif // USE_X86_KERNELS
+
+/// Find the best instruction set supported by this CPU and OS.
+static ISA detectISA()
+{
+#ifdef USE_X86_KERNELS
+	__builtin_cpu_init();
+	if (
+		__builtin_cpu_supports("avx512f")
+		&& __builtin_cpu_supports("avx512bw")
+	) {
+		return ISA::AVX512;
+	}
+	if (__builtin_cpu_supports("avx2")) return ISA::AVX2;
+	if (__builtin_cpu_supports("sse2")) return ISA::SSE2;
+#endif
+	return ISA::Generic;
+}
+
+ISA cpuISA()
+{
+	static const ISA isa = []() {
+		ISA best = detectISA();
+		const char *force = getenv("GAMEARCHIVE_FORCE_ISA");
+		if (force) {
+			for (int i = (int)ISA::Generic; i <= (int)ISA::AVX512; i++) {
+				ISA candidate = (ISA)i;
+				if (camoto::icasecmp(force, isaName(candidate))) {
+					// Only allow going down, or we'd crash on an illegal instruction
+					if (candidate < best) best = candidate;
+					break;
+				}
+			}
+		}
+		return best;
+	}();
+	return isa;
+}
+
+const char *isaName(ISA isa)
+{
+	switch (isa) {
+		case ISA::Generic: return "generic";
+		case ISA::SSE2: return "sse2";
+		case ISA::AVX2: return "avx2";
+		case ISA::AVX512: return "avx512";
+	}
+	return "unknown";
+}
+
+const Kernels *kernelsFor(ISA isa)
+{
+	static const ISA best = detectISA();
+	if (isa > best) return nullptr;
+
+	static const Kernels generic = { xorRamp_generic };
+#ifdef USE_X86_KERNELS
+	static const Kernels sse2 = { xorRamp_sse2 };
+	static const Kernels avx2 = { xorRamp_avx2 };
+	static const Kernels avx512 = { xorRamp_avx512 };
+	switch (isa) {
+		case ISA::AVX512: return &avx512;
+		case ISA::AVX2: return &avx2;
+		case ISA::SSE2: return &sse2;
+		case ISA::Generic: return &generic;
+	}
+	return nullptr;
+#else
+	return (isa == ISA::Generic) ? &generic : nullptr;
+#endif
+}
+
+const Kernels& kernels()
+{
+	static const Kernels& k = *kernelsFor(cpuISA());
+	return k;
+}
+
+} // namespace gamearchive
+} // namespace camoto
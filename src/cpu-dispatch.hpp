@@ -0,0 +1,85 @@
+/**
+ * @file  cpu-dispatch.hpp
+ * @brief Select CPU-specific versions of hot filter loops at runtime.
+ *
+ * Copyright (C) 2010-2016 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _CAMOTO_CPU_DISPATCH_HPP_
+#define _CAMOTO_CPU_DISPATCH_HPP_
+
+#include <stdint.h>
+#include <camoto/stream.hpp>
+
+namespace camoto {
+namespace gamearchive {
+
+/// Instruction set extensions a kernel may be compiled for.
+/**
+ * These are in order, with each one implying support for those before it.
+ */
+enum class ISA {
+	Generic = 0,   ///< Plain C++, runs anywhere
+	SSE2,          ///< x86 SSE2 (128-bit)
+	AVX2,          ///< x86 AVX2 (256-bit)
+	AVX512,        ///< x86 AVX-512 F+BW (512-bit)
+};
+
+/// Get the instruction set the kernels will use.
+/**
+ * This is the best one the CPU supports, worked out on the first call.  It
+ * can be lowered by setting the GAMEARCHIVE_FORCE_ISA environment variable to
+ * "generic", "sse2", "avx2" or "avx512", which is useful for testing the
+ * different code paths on one machine.  Asking for an instruction set the CPU
+ * lacks gives the best one it does have instead.
+ */
+ISA cpuISA();
+
+/// Get the name of an instruction set, as used by GAMEARCHIVE_FORCE_ISA.
+const char *isaName(ISA isa);
+
+/// Function pointers to the best version of each kernel for this CPU.
+struct Kernels
+{
+	/// XOR data with a key that increments by one for each byte.
+	/**
+	 * out[i] = in[i] ^ (uint8_t)(key + i).  out and in may be the same.
+	 */
+	void (*xorRamp)(uint8_t *out, const uint8_t *in, stream::len len,
+		uint8_t key);
+};
+
+/// Get the kernels for the current CPU.
+/**
+ * The table is filled in on the first call and the same one returned after
+ * that, so callers can keep the reference.
+ */
+const Kernels& kernels();
+
+/// Get the kernels for a particular instruction set.
+/**
+ * This is for the tests, so each version of a kernel can be checked against
+ * the generic one on the same machine.
+ *
+ * @return The kernel table, or nullptr if this build or CPU can't run code
+ *   for that instruction set.  GAMEARCHIVE_FORCE_ISA is ignored.
+ */
+const Kernels *kernelsFor(ISA isa);
+
+} // namespace gamearchive
+} // namespace camoto
+
+#endif // _CAMOTO_CPU_DISPATCH_HPP_
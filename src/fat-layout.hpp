@@ -0,0 +1,418 @@
+/**
+ * @file  fat-layout.hpp
+ * @brief Compile-time descriptions of fixed-size FAT entries.
+ *
+ * Copyright (C) 2010-2016 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _CAMOTO_FAT_LAYOUT_HPP_
+#define _CAMOTO_FAT_LAYOUT_HPP_
+
+#include <stdint.h>
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <camoto/stream.hpp>
+#include <camoto/util.hpp>
+#include <camoto/gamearchive/archive-fat.hpp>
+#include <camoto/gamearchive/stream_piece.hpp>
+
+namespace camoto {
+namespace gamearchive {
+
+/// Building blocks for FATLayout.
+namespace fatfield {
+
+/// Field that is not stored in this format's FAT entries.
+struct None
+{
+	static constexpr bool present = false;
+	static constexpr unsigned int offset = 0;
+	static constexpr unsigned int width = 0;
+
+	static uint64_t read(const uint8_t *entry)
+	{
+		return 0;
+	}
+
+	static void read(const uint8_t *entry, std::string& value)
+	{
+		return;
+	}
+
+	static void write(uint8_t *entry, uint64_t value)
+	{
+		return;
+	}
+
+	static void write(uint8_t *entry, const std::string& value)
+	{
+		return;
+	}
+};
+
+/// Unsigned integer field.
+/**
+ * @tparam Offset
+ *   Offset of the field from the start of the FAT entry.
+ *
+ * @tparam Width
+ *   Size of the field in bytes, 1 to 8.
+ *
+ * @tparam BigEndian
+ *   true if the most significant byte comes first.
+ */
+template <unsigned int Offset, unsigned int Width, bool BigEndian = false>
+struct UInt
+{
+	static_assert((Width >= 1) && (Width <= 8), "integer field must be 1-8 bytes");
+
+	static constexpr bool present = true;
+	static constexpr unsigned int offset = Offset;
+	static constexpr unsigned int width = Width;
+
+	static uint64_t read(const uint8_t *entry)
+	{
+		const uint8_t *p = entry + Offset;
+		uint64_t value = 0;
+		for (unsigned int i = 0; i < Width; i++) {
+			unsigned int shift = 8 * (BigEndian ? (Width - 1 - i) : i);
+			value |= (uint64_t)p[i] << shift;
+		}
+		return value;
+	}
+
+	static void write(uint8_t *entry, uint64_t value)
+	{
+		uint8_t *p = entry + Offset;
+		for (unsigned int i = 0; i < Width; i++) {
+			unsigned int shift = 8 * (BigEndian ? (Width - 1 - i) : i);
+			p[i] = (uint8_t)(value >> shift);
+		}
+		return;
+	}
+};
+
+/// Little-endian unsigned integer field.
+template <unsigned int Offset, unsigned int Width>
+using UIntLE = UInt<Offset, Width, false>;
+
+/// Big-endian unsigned integer field.
+template <unsigned int Offset, unsigned int Width>
+using UIntBE = UInt<Offset, Width, true>;
+
+/// Integer field storing a value relative to some fixed point.
+/**
+ * This is for formats that store offsets from somewhere other than the start
+ * of the archive, such as the end of the header.
+ *
+ * @tparam Field
+ *   Underlying field, e.g. UIntLE.
+ *
+ * @tparam Base
+ *   Value that is subtracted before writing and added back after reading.
+ */
+template <class Field, unsigned int Base>
+struct Relative: public Field
+{
+	static uint64_t read(const uint8_t *entry)
+	{
+		return Field::read(entry) + Base;
+	}
+
+	static void write(uint8_t *entry, uint64_t value)
+	{
+		Field::write(entry, value - Base);
+		return;
+	}
+};
+
+/// String field padded with nulls, as read and written by nullPadded().
+/**
+ * The string may fill the whole field, in which case there is no terminating
+ * null.
+ *
+ * @tparam Offset
+ *   Offset of the field from the start of the FAT entry.
+ *
+ * @tparam Width
+ *   Size of the field in bytes.
+ */
+template <unsigned int Offset, unsigned int Width>
+struct NullPadded
+{
+	static constexpr bool present = true;
+	static constexpr unsigned int offset = Offset;
+	static constexpr unsigned int width = Width;
+
+	static void read(const uint8_t *entry, std::string& value)
+	{
+		const char *p = (const char *)entry + Offset;
+		const void *end = std::memchr(p, 0, Width);
+		value.assign(p, end ? (const char *)end - p : Width);
+		return;
+	}
+
+	static void write(uint8_t *entry, const std::string& value)
+	{
+		uint8_t *p = entry + Offset;
+		std::size_t len = std::min<std::size_t>(value.length(), Width);
+		std::memcpy(p, value.data(), len);
+		std::memset(p + len, 0, Width - len);
+		return;
+	}
+};
+
+} // namespace fatfield
+
+/// Layout of a FAT made of fixed-size entries one after the other.
+/**
+ * Many formats store their FAT as a header followed by one entry of the same
+ * size for each file, with the name, offset and size at fixed places within
+ * each entry.  Describing this once as a type lets the format read the whole
+ * FAT with a single read and decode it from memory, write a whole entry with
+ * a single write, and update one field without working out the offset by
+ * hand.
+ *
+ * For example a FAT starting at offset 16 with 16-byte entries, each holding
+ * a 12-byte filename and a 32-bit little-endian size:
+ *
+ * @code
+ * typedef FATLayout<16, 16,
+ *   fatfield::NullPadded<0, 12>,  // name
+ *   fatfield::None,               // offset
+ *   fatfield::UIntLE<12, 4>       // size
+ * > GRPLayout;
+ * @endcode
+ *
+ * Any bytes in the entry not covered by a field are written as zero.  Offsets
+ * stored relative to a fixed point can be wrapped in fatfield::Relative.
+ * Fields a format stores some other way (e.g. offsets that depend on earlier
+ * entries) should be given as fatfield::None and handled by the format itself.
+ *
+ * @tparam FATOffset
+ *   Offset of the first FAT entry from the start of the archive.
+ *
+ * @tparam EntryLen
+ *   Size of each FAT entry in bytes.
+ *
+ * @tparam Name
+ *   Field holding the filename, fatfield::NullPadded or fatfield::None.
+ *
+ * @tparam Offset
+ *   Field holding the offset of the file data, fatfield::UInt,
+ *   fatfield::Relative or fatfield::None.
+ *
+ * @tparam Size
+ *   Field holding the stored size of the file data, fatfield::UInt or
+ *   fatfield::None.
+ */
+template <stream::pos FATOffset, unsigned int EntryLen, class Name, class Offset,
+	class Size>
+struct FATLayout
+{
+	static_assert(Name::offset + Name::width <= EntryLen,
+		"filename field extends past end of FAT entry");
+	static_assert(Offset::offset + Offset::width <= EntryLen,
+		"offset field extends past end of FAT entry");
+	static_assert(Size::offset + Size::width <= EntryLen,
+		"size field extends past end of FAT entry");
+
+	typedef Name NameField;      ///< Field holding the filename
+	typedef Offset OffsetField;  ///< Field holding the file offset
+	typedef Size SizeField;      ///< Field holding the stored size
+
+	/// Offset of the first FAT entry.
+	static constexpr stream::pos fatOffset = FATOffset;
+
+	/// Size of each FAT entry.
+	static constexpr unsigned int entryLen = EntryLen;
+
+	/// Offset of the given FAT entry from the start of the archive.
+	/**
+	 * @param index
+	 *   Index of the entry.
+	 *
+	 * @param offFAT
+	 *   Offset of the first FAT entry, for formats where the header says where
+	 *   the FAT is rather than it being at a fixed place.
+	 */
+	static constexpr stream::pos entryOffset(unsigned int index,
+		stream::pos offFAT = FATOffset)
+	{
+		return offFAT + (stream::pos)index * EntryLen;
+	}
+
+	/// Offset of the end of the FAT when it holds the given number of entries.
+	static constexpr stream::pos fatEnd(unsigned int numEntries,
+		stream::pos offFAT = FATOffset)
+	{
+		return entryOffset(numEntries, offFAT);
+	}
+
+	/// Read a number of FAT entries from the current position in one go.
+	/**
+	 * @param content
+	 *   Stream positioned at the start of the first entry to read.
+	 *
+	 * @param numEntries
+	 *   Number of entries to read.
+	 *
+	 * @return The raw entries, numEntries * entryLen bytes, to be passed to
+	 *   decode().
+	 *
+	 * @throws stream::error if the stream ends first.
+	 */
+	static std::vector<uint8_t> readEntries(stream::input& content,
+		unsigned int numEntries)
+	{
+		// Check before allocating anything, so a corrupted file count can't ask
+		// for gigabytes of memory.
+		stream::len lenFAT = (stream::len)numEntries * EntryLen;
+		stream::len lenContent = content.size();
+		stream::pos offFAT = std::min<stream::pos>(content.tellg(), lenContent);
+		if (lenFAT > lenContent - offFAT) {
+			throw stream::error(createString("FAT of " << numEntries
+				<< " entries runs past the end of the archive"));
+		}
+		std::vector<uint8_t> raw(lenFAT);
+		if (!raw.empty()) content.read(raw.data(), raw.size());
+		return raw;
+	}
+
+	/// Populate the fields of a FATEntry described by this layout.
+	/**
+	 * Only the name, offset and size (both stored and real) are set, and only
+	 * if the layout includes them.  Everything else is left for the caller.
+	 *
+	 * @param raw
+	 *   Start of the FAT entry in memory.
+	 *
+	 * @param f
+	 *   Entry to populate.
+	 */
+	static void decode(const uint8_t *raw, Archive_FAT::FATEntry *f)
+	{
+		if (Name::present) Name::read(raw, f->strName);
+		if (Offset::present) f->iOffset = Offset::read(raw);
+		if (Size::present) f->realSize = f->storedSize = Size::read(raw);
+		return;
+	}
+
+	/// Write out a whole FAT entry in memory.
+	/**
+	 * @param f
+	 *   Entry to encode.
+	 *
+	 * @param raw
+	 *   Buffer of at least entryLen bytes.  Any bytes not covered by a field
+	 *   are set to zero, so the caller can fill in any other fields afterwards.
+	 */
+	static void encode(const Archive_FAT::FATEntry *f, uint8_t *raw)
+	{
+		std::memset(raw, 0, EntryLen);
+		Name::write(raw, f->strName);
+		Offset::write(raw, f->iOffset);
+		Size::write(raw, f->storedSize);
+		return;
+	}
+
+	/// Make room for a new entry at f->iIndex and write it out.
+	/**
+	 * @param content
+	 *   Archive content.
+	 *
+	 * @param f
+	 *   Entry to insert.  iIndex must be set to the position of the new entry.
+	 *
+	 * @param offFAT
+	 *   Offset of the first FAT entry, see entryOffset().
+	 */
+	static void insertEntry(piece_table& content,
+		const Archive_FAT::FATEntry *f, stream::pos offFAT = FATOffset)
+	{
+		uint8_t raw[EntryLen];
+		encode(f, raw);
+		content.seekp(entryOffset(f->iIndex, offFAT), stream::start);
+		content.insert(EntryLen);
+		content.write(raw, EntryLen);
+		return;
+	}
+
+	/// Overwrite an existing entry at f->iIndex with a single write.
+	static void writeEntry(stream::output& content,
+		const Archive_FAT::FATEntry *f, stream::pos offFAT = FATOffset)
+	{
+		uint8_t raw[EntryLen];
+		encode(f, raw);
+		content.seekp(entryOffset(f->iIndex, offFAT), stream::start);
+		content.write(raw, EntryLen);
+		return;
+	}
+
+	/// Remove the entry at f->iIndex.
+	static void removeEntry(piece_table& content,
+		const Archive_FAT::FATEntry *f, stream::pos offFAT = FATOffset)
+	{
+		content.seekp(entryOffset(f->iIndex, offFAT), stream::start);
+		content.remove(EntryLen);
+		return;
+	}
+
+	/// Overwrite only the filename field of an existing entry.
+	static void writeName(stream::output& content,
+		const Archive_FAT::FATEntry *f, const std::string& name,
+		stream::pos offFAT = FATOffset)
+	{
+		writeField<Name>(content, f->iIndex, name, offFAT);
+		return;
+	}
+
+	/// Overwrite only the offset field of an existing entry with f->iOffset.
+	static void writeOffset(stream::output& content,
+		const Archive_FAT::FATEntry *f, stream::pos offFAT = FATOffset)
+	{
+		writeField<Offset>(content, f->iIndex, (uint64_t)f->iOffset, offFAT);
+		return;
+	}
+
+	/// Overwrite only the size field of an existing entry with f->storedSize.
+	static void writeSize(stream::output& content,
+		const Archive_FAT::FATEntry *f, stream::pos offFAT = FATOffset)
+	{
+		writeField<Size>(content, f->iIndex, (uint64_t)f->storedSize, offFAT);
+		return;
+	}
+
+	/// Write one field of the entry at the given index.
+	template <class Field, class Value>
+	static void writeField(stream::output& content, unsigned int index,
+		const Value& value, stream::pos offFAT = FATOffset)
+	{
+		static_assert(Field::present, "this format does not store that field");
+		uint8_t raw[EntryLen];
+		Field::write(raw, value);
+		content.seekp(entryOffset(index, offFAT) + Field::offset, stream::start);
+		content.write(raw + Field::offset, Field::width);
+		return;
+	}
+};
+
+} // namespace gamearchive
+} // namespace camoto
+
+#endif // _CAMOTO_FAT_LAYOUT_HPP_
@@ -27,6 +27,7 @@
 #include <camoto/filter-lzw.hpp>
 
 #include "filter-bash-rle.hpp"
+#include "filter-chain.hpp"
 #include "filter-bash.hpp"
 
 namespace camoto {
@@ -96,22 +97,10 @@ std::unique_ptr<stream::inout> FilterType_Bash::apply(
 std::unique_ptr<stream::input> FilterType_Bash::apply(
 	std::unique_ptr<stream::input> target) const
 {
-	auto st1 = std::make_unique<stream::input_filtered>(
-		std::move(target),
-		std::make_shared<filter_lzw_decompress>(
-			9,   // initial codeword length (in bits)
-			12,  // maximum codeword length (in bits)
-			257, // first valid codeword
-			256, // EOF codeword is first codeword
-			256, // reset codeword is unused
-			LZW_LITTLE_ENDIAN    | // bits are split into bytes in little-endian order
-			LZW_RESET_PARAM_VALID  // Has codeword reserved for dictionary reset/EOF
-		)
-	);
-
+	// Decompress and un-RLE in one pass, without buffering the intermediate data
 	return std::make_unique<stream::input_filtered>(
-		std::move(st1),
-		std::make_shared<filter_bash_unrle>()
+		std::move(target),
+		this->decoder()
 	);
 }
 
@@ -141,5 +130,24 @@ std::unique_ptr<stream::output> FilterType_Bash::apply(
 	);
 }
 
+std::shared_ptr<filter> FilterType_Bash::decoder() const
+{
+	auto chain = std::make_shared<filter_chain>();
+	chain->add(
+		std::make_shared<filter_lzw_decompress>(
+			9,   // initial codeword length (in bits)
+			12,  // maximum codeword length (in bits)
+			257, // first valid codeword
+			256, // EOF codeword is first codeword
+			256, // reset codeword is unused
+			LZW_LITTLE_ENDIAN    | // bits are split into bytes in little-endian order
+			LZW_RESET_PARAM_VALID  // Has codeword reserved for dictionary reset/EOF
+		),
+		false
+	);
+	chain->add(std::make_shared<filter_bash_unrle>(), false);
+	return chain;
+}
+
 } // namespace gamearchive
 } // namespace camoto
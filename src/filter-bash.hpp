@@ -44,6 +44,7 @@ class FilterType_Bash: virtual public FilterType
 		virtual std::unique_ptr<stream::output> apply(
 			std::unique_ptr<stream::output> target, stream::fn_notify_prefiltered_size resize)
 			const;
+		virtual std::shared_ptr<filter> decoder() const;
 };
 
 } // namespace gamearchive
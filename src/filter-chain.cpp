@@ -0,0 +1,172 @@
+/**
+ * @file  filter-chain.cpp
+ * @brief Filter that runs data through several other filters in one pass.
+ *
+ * Copyright (C) 2010-2016 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <cstring>
+#include "filter-chain.hpp"
+
+namespace camoto {
+namespace gamearchive {
+
+filter_chain::filter_chain()
+{
+}
+
+void filter_chain::add(std::shared_ptr<filter> stage, bool sameLength)
+{
+	if (sameLength && !this->groups.empty()) {
+		Group& g = this->groups.back();
+		g.fused.push_back(stage);
+		if (g.scratch.empty()) g.scratch.resize(FILTER_CHAIN_BUFFER_LEN);
+	} else {
+		Group g;
+		g.lead = stage;
+		g.leadSameLength = sameLength;
+		g.buffer.resize(FILTER_CHAIN_BUFFER_LEN);
+		g.start = g.end = 0;
+		g.eof = false;
+		this->groups.push_back(std::move(g));
+	}
+	return;
+}
+
+void filter_chain::reset(stream::len lenInput)
+{
+	// Each stage gets the same length as the one before it, until a stage that
+	// could change the length has been passed.
+	stream::len lenStage = lenInput;
+	for (auto& g : this->groups) {
+		g.lead->reset(lenStage);
+		if (!g.leadSameLength) lenStage = FILTER_CHAIN_LEN_UNKNOWN;
+		for (auto& f : g.fused) f->reset(lenStage);
+		g.start = g.end = 0;
+		g.eof = false;
+	}
+	return;
+}
+
+void filter_chain::transform(uint8_t *out, stream::len *lenOut,
+	const uint8_t *in, stream::len *lenIn)
+{
+	if (this->groups.empty()) {
+		stream::len amt = std::min(*lenIn, *lenOut);
+		memcpy(out, in, amt);
+		*lenIn = *lenOut = amt;
+		return;
+	}
+
+	// An empty input buffer means there is no more data to come, so the stages
+	// must now flush any data they are holding on to.
+	bool inputEOF = (*lenIn == 0);
+	stream::len r = 0, w = 0;
+	auto last = this->groups.size() - 1;
+
+	// Keep cycling through the stages until the output is full or nothing can
+	// move any further.
+	bool progress = true;
+	while (progress && (w < *lenOut)) {
+		progress = false;
+		for (std::size_t i = 0; i <= last; i++) {
+			Group& g = this->groups[i];
+			if (g.eof) continue;
+
+			const uint8_t *src;
+			stream::len lenSrc;
+			bool srcEOF;
+			if (i == 0) {
+				src = in + r;
+				lenSrc = *lenIn - r;
+				srcEOF = inputEOF;
+			} else {
+				Group& prev = this->groups[i - 1];
+				src = prev.buffer.data() + prev.start;
+				lenSrc = prev.end - prev.start;
+				srcEOF = prev.eof;
+			}
+			// Don't call a filter with no input unless it really is the end,
+			// otherwise it will think it is and flush early.
+			if ((lenSrc == 0) && !srcEOF) continue;
+
+			uint8_t *dst;
+			stream::len lenDst;
+			if (i == last) {
+				dst = out + w;
+				lenDst = *lenOut - w;
+			} else {
+				if (g.start > 0) {
+					memmove(g.buffer.data(), g.buffer.data() + g.start,
+						g.end - g.start);
+					g.end -= g.start;
+					g.start = 0;
+				}
+				dst = g.buffer.data() + g.end;
+				lenDst = g.buffer.size() - g.end;
+			}
+			if (!g.fused.empty()) {
+				lenDst = std::min<stream::len>(lenDst, g.scratch.size());
+			}
+			if (lenDst == 0) continue;
+
+			// The stages in this group take turns writing to dst and the scratch
+			// buffer, starting with whichever one leaves the last stage's output
+			// in dst.
+			uint8_t *bufs[2] = {dst, g.scratch.data()};
+			unsigned int cur = g.fused.size() % 2;
+
+			stream::len lenRead = lenSrc, lenWritten = lenDst;
+			g.lead->transform(bufs[cur], &lenWritten, src, &lenRead);
+
+			for (auto& f : g.fused) {
+				stream::len lenFused = lenWritten, lenFusedOut = lenWritten;
+				f->transform(bufs[cur ^ 1], &lenFusedOut, bufs[cur], &lenFused);
+				if ((lenFused != lenWritten) || (lenFusedOut != lenWritten)) {
+					throw filter_error("Filter added to chain as same-length did not "
+						"process all its data.");
+				}
+				cur ^= 1;
+			}
+
+			if (i == 0) {
+				r += lenRead;
+			} else {
+				this->groups[i - 1].start += lenRead;
+			}
+			if (i == last) {
+				w += lenWritten;
+			} else {
+				g.end += lenWritten;
+			}
+
+			if (lenRead || lenWritten) {
+				progress = true;
+			} else if ((lenSrc == 0) && srcEOF) {
+				// Nothing left in, nothing more out, so this stage is done.
+				g.eof = true;
+			}
+		}
+	}
+
+	*lenIn = r;
+	*lenOut = w;
+	return;
+}
+
+} // namespace gamearchive
+} // namespace camoto
@@ -0,0 +1,99 @@
+/**
+ * @file  filter-chain.hpp
+ * @brief Filter that runs data through several other filters in one pass.
+ *
+ * Copyright (C) 2010-2016 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _CAMOTO_FILTER_CHAIN_HPP_
+#define _CAMOTO_FILTER_CHAIN_HPP_
+
+#include <memory>
+#include <vector>
+#include <camoto/filter.hpp>
+
+namespace camoto {
+namespace gamearchive {
+
+/// Size of the buffer between each pair of stages in a filter_chain.
+#define FILTER_CHAIN_BUFFER_LEN  16384
+
+/// Input length passed to filter::reset() when a stage's length is unknown.
+/**
+ * A filter_chain only knows how much data each stage will get up until the
+ * first stage that can change the length of the data.  Stages after that are
+ * given this value instead.
+ */
+#define FILTER_CHAIN_LEN_UNKNOWN  ((stream::len)-1)
+
+/// Filter running data through a series of other filters.
+/**
+ * Wrapping one filtered stream inside another means each layer processes and
+ * buffers the whole file before the next one starts.  This filter instead
+ * passes the data through each stage a block at a time, so only a small
+ * fixed-size buffer sits between each stage and the whole chain can be used
+ * with a single filtered stream.
+ *
+ * Stages that always produce exactly one byte of output per byte of input
+ * (such as XOR or bitswap) can be added with sameLength set.  These are fused
+ * onto the stage before them: they are run straight over that stage's output
+ * as soon as it is produced, instead of it sitting in a buffer waiting for the
+ * next time around.  Each stage still reads from one buffer and writes to
+ * another, so filters never see their input and output overlap.
+ */
+class filter_chain: virtual public filter
+{
+	public:
+		filter_chain();
+
+		/// Add a stage to the end of the chain.
+		/**
+		 * @param stage
+		 *   Filter to run.  Data passes through the stages in the order they were
+		 *   added.
+		 *
+		 * @param sameLength
+		 *   true if the filter always produces the same number of bytes as it is
+		 *   given.  Such stages are fused onto the previous stage, and stages
+		 *   after them are told the same input length in reset().
+		 */
+		void add(std::shared_ptr<filter> stage, bool sameLength);
+
+		virtual void reset(stream::len lenInput);
+		virtual void transform(uint8_t *out, stream::len *lenOut,
+			const uint8_t *in, stream::len *lenIn);
+
+	protected:
+		/// A stage, along with any same-length stages fused onto it.
+		struct Group {
+			std::shared_ptr<filter> lead;                 ///< Main filter
+			bool leadSameLength;                          ///< lead keeps the length
+			std::vector<std::shared_ptr<filter>> fused;   ///< Run over lead's output
+			std::vector<uint8_t> buffer; ///< Output waiting for the next group
+			std::vector<uint8_t> scratch; ///< Between lead and fused stages
+			stream::len start;           ///< Offset of first unread byte in buffer
+			stream::len end;             ///< Offset after last byte in buffer
+			bool eof;                    ///< Lead filter has no more output
+		};
+
+		/// Stages in the order data passes through them.
+		std::vector<Group> groups;
+};
+
+} // namespace gamearchive
+} // namespace camoto
+
+#endif // _CAMOTO_FILTER_CHAIN_HPP_
@@ -102,17 +102,7 @@ std::unique_ptr<stream::input> FilterType_EPFS::apply(
 {
 	return std::make_unique<stream::input_filtered>(
 		std::move(target),
-		std::make_shared<filter_lzw_decompress>(
-			9,   // initial codeword length (in bits)
-			14,  // maximum codeword length (in bits)
-			256, // first valid codeword
-			0,   // EOF codeword is max codeword
-			-1,  // reset codeword is max-1
-			LZW_BIG_ENDIAN        | // bits are split into bytes in big-endian order
-			LZW_NO_BITSIZE_RESET  | // bitsize doesn't go back to 9 after dict reset
-			LZW_EOF_PARAM_VALID   | // Has codeword reserved for EOF
-			LZW_RESET_PARAM_VALID   // Has codeword reserved for dict reset
-		)
+		this->decoder()
 	);
 }
 
@@ -137,5 +127,20 @@ std::unique_ptr<stream::output> FilterType_EPFS::apply(
 	);
 }
 
+std::shared_ptr<filter> FilterType_EPFS::decoder() const
+{
+	return std::make_shared<filter_lzw_decompress>(
+		9,   // initial codeword length (in bits)
+		14,  // maximum codeword length (in bits)
+		256, // first valid codeword
+		0,   // EOF codeword is max codeword
+		-1,  // reset codeword is max-1
+		LZW_BIG_ENDIAN        | // bits are split into bytes in big-endian order
+		LZW_NO_BITSIZE_RESET  | // bitsize doesn't go back to 9 after dict reset
+		LZW_EOF_PARAM_VALID   | // Has codeword reserved for EOF
+		LZW_RESET_PARAM_VALID   // Has codeword reserved for dict reset
+	);
+}
+
 } // namespace gamearchive
 } // namespace camoto
@@ -21,6 +21,7 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <cstring>
 #include <camoto/iostream_helpers.hpp>
 #include <camoto/stream_filtered.hpp>
 #include <camoto/util.hpp> // std::make_unique
@@ -29,6 +30,7 @@
 #include <camoto/filter-pad.hpp>
 #include <camoto/stream_sub.hpp>
 
+#include "filter-chain.hpp"
 #include "filter-prehistorik.hpp"
 
 namespace camoto {
@@ -37,6 +39,72 @@ namespace gamearchive {
 /// Length of the field storing the decompressed file size
 #define PH_DECOMP_LEN 4
 
+void filter_prehistorik_unlzss::reset(stream::len lenInput)
+{
+	this->bits = 0;
+	this->numBits = 0;
+	this->lzssDist = 0;
+	this->lzssLength = 0;
+	memset(this->history, 0, sizeof(this->history));
+	return;
+}
+
+void filter_prehistorik_unlzss::transform(uint8_t *out, stream::len *lenOut,
+	const uint8_t *in, stream::len *lenIn)
+{
+	const unsigned int lenLiteral = 1 + 8;
+	const unsigned int lenReference = 1 + DIST_BITS + LEN_BITS;
+
+	stream::len r = 0, w = 0;
+	for (;;) {
+		// Copy out the current back reference, which may have been cut short by
+		// the end of the output buffer last time.  If it reaches back further
+		// than this call's output, the earlier bytes come from the history.
+		while (this->lzssLength && (w < *lenOut)) {
+			out[w] = (this->lzssDist <= w)
+				? out[w - this->lzssDist]
+				: this->history[WINDOW + w - this->lzssDist];
+			w++;
+			this->lzssLength--;
+		}
+		if (w >= *lenOut) break;
+
+		// Top up the bit buffer a byte at a time, so it always holds whole codes
+		// and bits are never taken across a refill.
+		while ((this->numBits <= 64 - 8) && (r < *lenIn)) {
+			this->bits = (this->bits << 8) | in[r++];
+			this->numBits += 8;
+		}
+		if (this->numBits < lenLiteral) break; // need more input
+
+		if (((this->bits >> (this->numBits - 1)) & 1) == 0) {
+			// Literal byte
+			this->numBits -= lenLiteral;
+			out[w++] = (uint8_t)(this->bits >> this->numBits);
+		} else {
+			// Back reference
+			if (this->numBits < lenReference) break; // need more input
+			this->numBits -= lenReference;
+			this->lzssDist =
+				((this->bits >> (this->numBits + LEN_BITS)) & (WINDOW - 1)) + 1;
+			this->lzssLength =
+				((this->bits >> this->numBits) & ((1 << LEN_BITS) - 1)) + MIN_LEN;
+		}
+	}
+
+	// Keep the end of the output for back references in the next call
+	if (w >= WINDOW) {
+		memcpy(this->history, out + w - WINDOW, WINDOW);
+	} else if (w > 0) {
+		memmove(this->history, this->history + w, WINDOW - w);
+		memcpy(this->history + WINDOW - w, out, w);
+	}
+
+	*lenOut = w;
+	*lenIn = r;
+	return;
+}
+
 FilterType_Prehistorik::FilterType_Prehistorik()
 {
 }
@@ -77,7 +145,7 @@ std::unique_ptr<stream::inout> FilterType_Prehistorik::apply(
 
 	return std::make_unique<stream::filtered>(
 		std::move(st1),
-		std::make_shared<filter_lzss_decompress>(bitstream::bigEndian, 2, 8),
+		std::make_shared<filter_prehistorik_unlzss>(),
 		std::make_shared<filter_lzss_compress>(bitstream::bigEndian, 2, 8),
 		[resize, filtPad](stream::output_filtered* s, stream::len newSize) {
 			// Write the prefiltered size to the start of the original stream
@@ -92,14 +160,14 @@ std::unique_ptr<stream::inout> FilterType_Prehistorik::apply(
 std::unique_ptr<stream::input> FilterType_Prehistorik::apply(
 	std::unique_ptr<stream::input> target) const
 {
-	auto st1 = std::make_unique<stream::input_filtered>(
-		std::move(target),
-		std::make_shared<filter_crop>(PH_DECOMP_LEN)
-	);
+	// Skip the length field and decompress in one pass
+	auto chain = std::make_shared<filter_chain>();
+	chain->add(std::make_shared<filter_crop>(PH_DECOMP_LEN), false);
+	chain->add(std::make_shared<filter_prehistorik_unlzss>(), false);
 
 	return std::make_unique<stream::input_filtered>(
-		std::move(st1),
-		std::make_shared<filter_lzss_decompress>(bitstream::bigEndian, 2, 8)
+		std::move(target),
+		chain
 	);
 }
 
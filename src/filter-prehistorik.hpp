@@ -21,6 +21,7 @@
 #ifndef _CAMOTO_FILTER_PREHISTORIK_HPP_
 #define _CAMOTO_FILTER_PREHISTORIK_HPP_
 
+#include <camoto/filter.hpp>
 #include <camoto/gamearchive/filtertype.hpp>
 
 #ifndef DLL_EXPORT
@@ -30,6 +31,37 @@
 namespace camoto {
 namespace gamearchive {
 
+/// Prehistorik LZSS decompressor.
+/**
+ * This gives the same output as filter_lzss_decompress with a big-endian
+ * bitstream, a 2-bit length and an 8-bit distance.  With the field sizes
+ * known at compile time, whole codes are taken out of a 64-bit bit buffer at
+ * once, and back references are copied straight out of the output buffer
+ * rather than through a separate dictionary a bit at a time.
+ */
+class filter_prehistorik_unlzss: virtual public filter
+{
+	public:
+		constexpr static unsigned int LEN_BITS = 2;  ///< Size of length field
+		constexpr static unsigned int DIST_BITS = 8; ///< Size of distance field
+		constexpr static unsigned int MIN_LEN = 2;   ///< Length when field is 0
+
+		/// Furthest a back reference can reach into the earlier data.
+		constexpr static unsigned int WINDOW = 1 << DIST_BITS;
+
+		virtual void reset(stream::len lenInput);
+		virtual void transform(uint8_t *out, stream::len *lenOut,
+			const uint8_t *in, stream::len *lenIn);
+
+	protected:
+		uint64_t bits;            ///< Bits read but not yet used, in the low bits
+		unsigned int numBits;     ///< Number of valid bits in bits
+		unsigned int lzssDist;    ///< How far back the current reference is
+		unsigned int lzssLength;  ///< Bytes still to copy for the reference
+		/// Last bytes written by previous calls to transform(), oldest first.
+		uint8_t history[WINDOW];
+};
+
 /// Prehistorik decompression filter.
 class DLL_EXPORT FilterType_Prehistorik: virtual public FilterType
 {
@@ -18,6 +18,8 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <algorithm>
+#include <cstring>
 #include <camoto/stream_filtered.hpp>
 #include <camoto/util.hpp> // std::make_unique
 #include "filter-xor-blood.hpp"
@@ -30,6 +32,7 @@ namespace gamearchive {
 filter_rff_crypt::filter_rff_crypt(int lenCrypt, int seed)
 	:	filter_xor_crypt(lenCrypt, seed)
 {
+	this->bRampKey = false;
 }
 
 uint8_t filter_rff_crypt::getKey()
@@ -37,6 +40,184 @@ uint8_t filter_rff_crypt::getKey()
 	return (uint8_t)(this->seed + (this->offset >> 1));
 }
 
+/// XOR the part of a buffer that falls within the encrypted area.
+/**
+ * @param buffer
+ *   Data to process in place.
+ *
+ * @param off
+ *   Offset of the first byte in buffer, from the start of the file.
+ *
+ * @param len
+ *   Number of bytes in buffer.
+ *
+ * @param lenCrypt
+ *   Number of bytes encrypted at the start of the file, 0 for all.
+ *
+ * @param seed
+ *   Initial XOR value.
+ */
+static void rffCrypt(uint8_t *buffer, stream::pos off, stream::len len,
+	stream::len lenCrypt, int seed)
+{
+	while (len && ((lenCrypt == 0) || (off < lenCrypt))) {
+		*buffer++ ^= (uint8_t)(seed + (off >> 1));
+		off++;
+		len--;
+	}
+	return;
+}
+
+/// Work out the destination of a seek.
+static stream::pos seekTarget(stream::pos cur, stream::len size,
+	stream::delta off, stream::seek_from from)
+{
+	stream::delta base;
+	switch (from) {
+		case stream::start: base = 0; break;
+		case stream::cur: base = cur; break;
+		case stream::end: base = size; break;
+		default: base = 0; break;
+	}
+	if (base + off < 0) {
+		throw stream::seek_error("Attempted to seek to before the start of the "
+			"file.");
+	}
+	if ((stream::len)(base + off) > size) {
+		throw stream::seek_error("Attempted to seek past the end of the file.");
+	}
+	return base + off;
+}
+
+input_rff_spliced::input_rff_spliced(std::unique_ptr<stream::input> parent,
+	stream::len lenCrypt, int seed)
+	:	in_parent(std::move(parent)),
+		lenCrypt(lenCrypt),
+		seed(seed),
+		offset(0)
+{
+}
+
+stream::len input_rff_spliced::try_read(uint8_t *buffer, stream::len len)
+{
+	this->in_parent->seekg(this->offset, stream::start);
+	stream::len r = this->in_parent->try_read(buffer, len);
+	rffCrypt(buffer, this->offset, r, this->lenCrypt, this->seed);
+	this->offset += r;
+	return r;
+}
+
+void input_rff_spliced::seekg(stream::delta off, stream::seek_from from)
+{
+	this->offset = seekTarget(this->offset, this->size(), off, from);
+	return;
+}
+
+stream::pos input_rff_spliced::tellg() const
+{
+	return this->offset;
+}
+
+stream::len input_rff_spliced::size() const
+{
+	return this->in_parent->size();
+}
+
+
+rff_spliced::rff_spliced(std::unique_ptr<stream::inout> parent,
+	stream::len lenCrypt, int seed)
+	:	parent(std::move(parent)),
+		lenCrypt(lenCrypt),
+		seed(seed),
+		offset(0)
+{
+}
+
+stream::len rff_spliced::try_read(uint8_t *buffer, stream::len len)
+{
+	this->parent->seekg(this->offset, stream::start);
+	stream::len r = this->parent->try_read(buffer, len);
+	rffCrypt(buffer, this->offset, r, this->lenCrypt, this->seed);
+	this->offset += r;
+	return r;
+}
+
+void rff_spliced::seekg(stream::delta off, stream::seek_from from)
+{
+	this->offset = seekTarget(this->offset, this->size(), off, from);
+	return;
+}
+
+stream::pos rff_spliced::tellg() const
+{
+	return this->offset;
+}
+
+stream::len rff_spliced::size() const
+{
+	return this->parent->size();
+}
+
+stream::len rff_spliced::try_write(const uint8_t *buffer, stream::len len)
+{
+	// A filtered stream would grow as needed, so do the same.
+	if (this->offset + len > this->parent->size()) {
+		this->parent->truncate(this->offset + len);
+	}
+	this->parent->seekp(this->offset, stream::start);
+
+	// Encrypt a copy of the head, rather than altering the caller's buffer
+	stream::len total = 0;
+	uint8_t head[RFF_FILE_CRYPT_LEN];
+	while (
+		(total < len)
+		&& ((this->lenCrypt == 0) || (this->offset < this->lenCrypt))
+	) {
+		stream::len lenHead = std::min<stream::len>(len - total, sizeof(head));
+		if (this->lenCrypt) {
+			lenHead = std::min(lenHead, this->lenCrypt - this->offset);
+		}
+		memcpy(head, buffer + total, lenHead);
+		rffCrypt(head, this->offset, lenHead, this->lenCrypt, this->seed);
+		stream::len w = this->parent->try_write(head, lenHead);
+		this->offset += w;
+		total += w;
+		if (w < lenHead) return total;
+	}
+
+	// The rest is plaintext so can go straight through
+	if (total < len) {
+		stream::len w = this->parent->try_write(buffer + total, len - total);
+		this->offset += w;
+		total += w;
+	}
+	return total;
+}
+
+void rff_spliced::seekp(stream::delta off, stream::seek_from from)
+{
+	this->seekg(off, from);
+	return;
+}
+
+stream::pos rff_spliced::tellp() const
+{
+	return this->offset;
+}
+
+void rff_spliced::truncate(stream::len size)
+{
+	this->parent->truncate(size);
+	if (this->offset > size) this->offset = size;
+	return;
+}
+
+void rff_spliced::flush()
+{
+	this->parent->flush();
+	return;
+}
+
 
 FilterType_RFF::FilterType_RFF()
 {
@@ -67,22 +248,18 @@ std::unique_ptr<stream::inout> FilterType_RFF::apply(
 	std::unique_ptr<stream::inout> target, stream::fn_notify_prefiltered_size resize)
 	const
 {
-	return std::make_unique<stream::filtered>(
-		std::move(target),
-		// We need two separate filters, otherwise reading from one will
-		// affect the XOR key next used when writing to the other.
-		std::make_shared<filter_rff_crypt>(RFF_FILE_CRYPT_LEN, 0),
-		std::make_shared<filter_rff_crypt>(RFF_FILE_CRYPT_LEN, 0),
-		resize
+	// The data length never changes and writes go straight to the target,
+	// which resizes itself as needed, so there is nothing to report to resize.
+	return std::make_unique<rff_spliced>(
+		std::move(target), RFF_FILE_CRYPT_LEN, 0
 	);
 }
 
 std::unique_ptr<stream::input> FilterType_RFF::apply(
 	std::unique_ptr<stream::input> target) const
 {
-	return std::make_unique<stream::input_filtered>(
-		std::move(target),
-		std::make_shared<filter_rff_crypt>(RFF_FILE_CRYPT_LEN, 0)
+	return std::make_unique<input_rff_spliced>(
+		std::move(target), RFF_FILE_CRYPT_LEN, 0
 	);
 }
 
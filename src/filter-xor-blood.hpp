@@ -22,6 +22,7 @@
 #define _CAMOTO_FILTER_XOR_BLOOD_HPP_
 
 #include <camoto/stream.hpp>
+#include <camoto/stream_filtered.hpp>
 #include <stdint.h>
 #include <camoto/gamearchive/filtertype.hpp>
 
@@ -40,6 +41,78 @@ class filter_rff_crypt: public filter_xor_crypt
 		virtual uint8_t getKey();
 };
 
+/// Read-only stream decrypting a file where only the start is encrypted.
+/**
+ * This is equivalent to an input_filtered using filter_rff_crypt, but since
+ * the XOR does not change the data length and only applies to the first few
+ * bytes, the rest of the file can be read straight from the parent without
+ * having to pass the whole thing through a filter first.  This means seeking
+ * and reading from large files is as quick as if they were not encrypted.
+ */
+class input_rff_spliced: virtual public stream::input
+{
+	public:
+		/// Decrypt the start of a stream.
+		/**
+		 * @param parent
+		 *   Encrypted data.
+		 *
+		 * @param lenCrypt
+		 *   Number of bytes encrypted at the start of the file.  Data after this
+		 *   point is passed through unchanged.
+		 *
+		 * @param seed
+		 *   Initial XOR value.
+		 */
+		input_rff_spliced(std::unique_ptr<stream::input> parent,
+			stream::len lenCrypt, int seed);
+
+		virtual stream::len try_read(uint8_t *buffer, stream::len len);
+		virtual void seekg(stream::delta off, stream::seek_from from);
+		virtual stream::pos tellg() const;
+		virtual stream::len size() const;
+
+	protected:
+		std::unique_ptr<stream::input> in_parent; ///< Encrypted data
+		stream::len lenCrypt;  ///< Number of bytes encrypted
+		int seed;              ///< Initial XOR value
+		stream::pos offset;    ///< Current read position
+};
+
+/// Read/write stream decrypting a file where only the start is encrypted.
+/**
+ * As for input_rff_spliced, only the first lenCrypt bytes are passed through
+ * the cipher.  Writes go straight to the parent stream, which is enlarged with
+ * truncate() as needed.
+ */
+class rff_spliced: virtual public stream::inout
+{
+	public:
+		/// Decrypt and encrypt the start of a stream.
+		/**
+		 * @copydetails input_rff_spliced::input_rff_spliced()
+		 */
+		rff_spliced(std::unique_ptr<stream::inout> parent, stream::len lenCrypt,
+			int seed);
+
+		virtual stream::len try_read(uint8_t *buffer, stream::len len);
+		virtual void seekg(stream::delta off, stream::seek_from from);
+		virtual stream::pos tellg() const;
+		virtual stream::len size() const;
+
+		virtual stream::len try_write(const uint8_t *buffer, stream::len len);
+		virtual void seekp(stream::delta off, stream::seek_from from);
+		virtual stream::pos tellp() const;
+		virtual void truncate(stream::len size);
+		virtual void flush();
+
+	protected:
+		std::unique_ptr<stream::inout> parent; ///< Encrypted data
+		stream::len lenCrypt;  ///< Number of bytes encrypted
+		int seed;              ///< Initial XOR value
+		stream::pos offset;    ///< Current read/write position
+};
+
 class FilterType_RFF: virtual public FilterType
 {
 	public:
@@ -22,6 +22,7 @@
 #include <camoto/util.hpp> // std::make_unique
 #include "filter-xor-sagent.hpp"
 #include "filter-bitswap.hpp"
+#include "filter-chain.hpp"
 
 namespace camoto {
 namespace gamearchive {
@@ -35,6 +36,7 @@ filter_sam_crypt::filter_sam_crypt(int resetInterval)
 	:	filter_xor_crypt(0, 0),
 		resetInterval(resetInterval)
 {
+	this->bRampKey = false;
 }
 
 uint8_t filter_sam_crypt::getKey()
@@ -73,40 +75,45 @@ std::vector<std::string> FilterType_SAM_Base::games() const
 	};
 }
 
+/// Chain to undo the bitswap then decrypt, as one pass over the data.
+static std::shared_ptr<filter_chain> samDecoder(int resetInterval)
+{
+	auto chain = std::make_shared<filter_chain>();
+	// Both stages are byte-for-byte, so the XOR can run over the bitswap output
+	chain->add(std::make_shared<filter_bitswap>(), true);
+	chain->add(std::make_shared<filter_sam_crypt>(resetInterval), true);
+	return chain;
+}
+
+/// Chain to encrypt then bitswap, as one pass over the data.
+static std::shared_ptr<filter_chain> samEncoder(int resetInterval)
+{
+	auto chain = std::make_shared<filter_chain>();
+	chain->add(std::make_shared<filter_sam_crypt>(resetInterval), true);
+	chain->add(std::make_shared<filter_bitswap>(), true);
+	return chain;
+}
+
 std::unique_ptr<stream::inout> FilterType_SAM_Base::apply(
 	std::unique_ptr<stream::inout> target, stream::fn_notify_prefiltered_size resize)
 	const
 {
-	auto fswap = std::make_shared<filter_bitswap>();
-
 	return std::make_unique<stream::filtered>(
-		std::make_unique<stream::filtered>(
-			std::move(target),
-			// Since the bitswap doesn't care how many bytes have been read or
-			// written, we can use the same filter for both reading and writing.
-			fswap,
-			fswap,
-			resize
-		),
-		// We need two separate filters, otherwise reading from one will
+		std::move(target),
+		// We need two separate chains, otherwise reading from one will
 		// affect the XOR key next used when writing to the other.
-		std::make_shared<filter_sam_crypt>(this->resetInterval),
-		std::make_shared<filter_sam_crypt>(this->resetInterval),
-		stream::fn_notify_prefiltered_size()
+		samDecoder(this->resetInterval),
+		samEncoder(this->resetInterval),
+		resize
 	);
 }
 
 std::unique_ptr<stream::input> FilterType_SAM_Base::apply(
 	std::unique_ptr<stream::input> target) const
 {
-	auto fswap = std::make_shared<filter_bitswap>();
-
 	return std::make_unique<stream::input_filtered>(
-		std::make_unique<stream::input_filtered>(
-			std::move(target),
-			fswap
-		),
-		std::make_shared<filter_sam_crypt>(this->resetInterval)
+		std::move(target),
+		samDecoder(this->resetInterval)
 	);
 }
 
@@ -114,16 +121,10 @@ std::unique_ptr<stream::output> FilterType_SAM_Base::apply(
 	std::unique_ptr<stream::output> target, stream::fn_notify_prefiltered_size resize)
 	const
 {
-	auto fswap = std::make_shared<filter_bitswap>();
-
 	return std::make_unique<stream::output_filtered>(
-		std::make_unique<stream::output_filtered>(
-			std::move(target),
-			fswap,
-			resize
-		),
-		std::make_shared<filter_sam_crypt>(this->resetInterval),
-		stream::fn_notify_prefiltered_size()
+		std::move(target),
+		samEncoder(this->resetInterval),
+		resize
 	);
 }
 
@@ -18,9 +18,11 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <algorithm>
 #include <camoto/stream_filtered.hpp>
 #include <camoto/util.hpp> // std::make_unique
 
+#include "cpu-dispatch.hpp"
 #include "filter-xor.hpp"
 
 namespace camoto {
@@ -28,7 +30,8 @@ namespace gamearchive {
 
 filter_xor_crypt::filter_xor_crypt(int lenCrypt, int seed)
 	:	lenCrypt(lenCrypt),
-		seed(seed)
+		seed(seed),
+		bRampKey(true)
 {
 }
 
@@ -47,6 +50,21 @@ void filter_xor_crypt::transform(uint8_t *out, stream::len *lenOut,
 {
 	stream::len w = 0;
 
+	// If getKey() has not been replaced, the key is a simple ramp that can be
+	// applied by an optimised kernel.
+	if (this->bRampKey) {
+		w = std::min(*lenOut, *lenIn);
+		if (this->lenCrypt != 0) {
+			stream::len remCrypt = (this->offset < this->lenCrypt)
+				? (stream::len)(this->lenCrypt - this->offset) : 0;
+			w = std::min(w, remCrypt);
+		}
+		kernels().xorRamp(out, in, w, this->getKey());
+		this->offset += w;
+		out += w;
+		in += w;
+	}
+
 	// Copy the crypted portion
 	while (
 		(w < *lenOut)
@@ -45,6 +45,14 @@ class filter_xor_crypt: virtual public filter
 		/// Current offset (number of bytes processed)
 		int offset;
 
+		/// Is the key always seed + offset?
+		/**
+		 * When true the data is crypted with a vectorised kernel instead of
+		 * calling getKey() for every byte.  Descendent classes that override
+		 * getKey() must set this to false in their constructor.
+		 */
+		bool bRampKey;
+
 	public:
 		/// Create a new encryption filter with the given options.
 		/**
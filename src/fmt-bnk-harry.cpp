@@ -132,7 +132,7 @@ SuppFilenames ArchiveType_BNK_Harry::getRequiredSupps(stream::input& content,
 Archive_BNK_Harry::Archive_BNK_Harry(std::unique_ptr<stream::inout> content,
 	std::unique_ptr<stream::inout> psFAT)
 	:	Archive_FAT(std::move(content), BNK_FIRST_FILE_OFFSET, BNK_MAX_FILENAME_LEN),
-		psFAT(std::make_unique<stream::seg>(std::move(psFAT))),
+		psFAT(std::make_unique<piece_table>(std::move(psFAT))),
 		isAC(false) // TODO: detect and set this
 {
 	stream::pos lenFAT = this->psFAT->size();
@@ -51,7 +51,7 @@ class ArchiveType_BNK_Harry: virtual public ArchiveType
 class Archive_BNK_Harry: virtual public Archive_FAT
 {
 	protected:
-		std::unique_ptr<stream::seg> psFAT;
+		std::unique_ptr<piece_table> psFAT;
 		bool isAC;  // true == Alien Carnage, false == Halloween Harry
 
 	public:
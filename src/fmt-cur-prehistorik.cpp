@@ -196,12 +196,14 @@ Archive_CUR_Prehistorik::Archive_CUR_Prehistorik(std::unique_ptr<stream::inout>
 	}
 
 	// The only way of figuring out whether a file is compressed or not
-	// seems to be by checking the filename extension!
+	// seems to be by checking the filename extension!  The decompressed size is
+	// at the start of the compressed data, so leave it until files() or find()
+	// hands the entry out rather than reading every compressed file now.
 	for (auto i : this->vcFAT) {
 		auto f = FATEntry::cast(i);
 		if (isCompressed(f->strName)) {
-			this->content->seekg(f->iOffset, stream::start);
-			*this->content >> u32be(f->realSize);
+			f->bRealSizePending = true;
+			this->bRealSizesPending = true;
 			f->fAttr = File::Attribute::Compressed;
 			f->filter = "lzss-prehistorik";
 		}
@@ -212,6 +214,19 @@ Archive_CUR_Prehistorik::~Archive_CUR_Prehistorik()
 {
 }
 
+void Archive_CUR_Prehistorik::loadRealSizes(
+	const std::vector<FATEntry *>& entries)
+{
+	// TESTED BY: fmt_cur_prehistorik_probe_open
+	for (auto f : entries) {
+		this->content->seekg(f->iOffset + f->lenHeader, stream::start);
+		uint32_t realSize;
+		*this->content >> u32be(realSize);
+		f->realSize = realSize;
+	}
+	return;
+}
+
 void Archive_CUR_Prehistorik::updateFileName(const FATEntry *pid,
 	const std::string& strNewName)
 {
@@ -62,6 +62,7 @@ class Archive_CUR_Prehistorik: virtual public Archive_FAT
 		virtual void postInsertFile(FATEntry *pid);
 		virtual void preRemoveFile(const FATEntry *pid);
 		virtual void postRemoveFile(const FATEntry *pid);
+		virtual void loadRealSizes(const std::vector<FATEntry *>& entries);
 
 	protected:
 		/// Update the header with the size of the FAT.
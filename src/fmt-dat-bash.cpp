@@ -41,6 +41,96 @@
 namespace camoto {
 namespace gamearchive {
 
+/// Set the filename extension and type of a file from its type code.
+static void setFileType(Archive_FAT::FATEntry *f, uint16_t type)
+{
+	switch (type) {
+		case 0:
+			f->strName += ".mif";
+			f->type = "map/bash-info";
+			break;
+		case 1:
+			f->strName += ".mbg";
+			f->type = "map/bash-bg";
+			break;
+		case 2:
+			f->strName += ".mfg";
+			f->type = "map/bash-fg";
+			break;
+		case 3:
+			f->strName += ".tbg";
+			f->type = "image/bash-tiles-bg";
+			break;
+		case 4:
+			f->strName += ".tfg";
+			f->type = "image/bash-tiles-fg";
+			break;
+		case 5:
+			f->strName += ".tbn";
+			f->type = "image/bash-tiles-fg";
+			break;
+		case 6:
+			f->strName += ".sgl";
+			f->type = "data/bash-sprite-graphics-list";
+			break;
+		case 7:
+			f->strName += ".msp";
+			f->type = "map/bash-sprites";
+			break;
+		case 8:
+			// Already has ".snd" extension
+			f->type = "sound/bash";
+			break;
+		case 12:
+			f->strName += ".pbg";
+			f->type = "data/bash-tile-properties";
+			break;
+		case 13:
+			f->strName += ".pfg";
+			f->type = "data/bash-tile-properties";
+			break;
+		case 14:
+			f->strName += ".pal";
+			f->type = "image/pal-ega";
+			break;
+		case 16:
+			f->strName += ".pbn";
+			f->type = "data/bash-tile-properties";
+			break;
+		case 64:
+			f->strName += ".spr";
+			f->type = "image/bash-sprite";
+			break;
+		case 32:
+			f->type = FILETYPE_GENERIC;
+			break;
+		default:
+			f->strName += createString("." << type);
+			f->type = createString("unknown/bash-" << type);
+			break;
+	}
+	return;
+}
+
+/// Set the fields read from an embedded FAT entry.
+static void setFATFields(Archive_FAT::FATEntry *f, unsigned int index,
+	stream::pos offset, uint16_t type)
+{
+	f->iIndex = index;
+	f->iOffset = offset;
+	f->lenHeader = DAT_EFAT_ENTRY_LEN;
+	f->fAttr = Archive::File::Attribute::Default;
+	f->bValid = true;
+	if (f->realSize) {
+		f->fAttr |= Archive::File::Attribute::Compressed;
+		f->filter = "lzw-bash"; // decompression algorithm
+	} else {
+		f->realSize = f->storedSize;
+	}
+	setFileType(f, type);
+	return;
+}
+
 ArchiveType_DAT_Bash::ArchiveType_DAT_Bash()
 {
 }
@@ -76,12 +166,27 @@ std::vector<std::string> ArchiveType_DAT_Bash::games() const
 ArchiveType::Certainty ArchiveType_DAT_Bash::isInstance(
 	stream::input& content) const
 {
+	return this->probe(content, nullptr);
+}
+
+ArchiveType::Certainty ArchiveType_DAT_Bash::probe(stream::input& content,
+	std::unique_ptr<ProbeResult> *parsed) const
+{
+	if (parsed) parsed->reset();
 	stream::pos lenArchive = content.size();
 	// TESTED BY: fmt_dat_bash_isinstance_c02
 	//if (lenArchive < DAT_FAT_OFFSET) return Certainty::DefinitelyNo; // too short
 
 	content.seekg(0, stream::start);
 
+	// Keep the entries as we check them, so they needn't be read again when
+	// the archive is opened.
+	std::unique_ptr<Archive_FAT::ProbedFAT> fat;
+	if (parsed) {
+		fat = std::make_unique<Archive_FAT::ProbedFAT>();
+		fat->lenArchive = lenArchive;
+	}
+
 	// Check each FAT entry
 	char fn[DAT_FILENAME_FIELD_LEN];
 	stream::pos pos = 0;
@@ -105,6 +210,15 @@ ArchiveType::Certainty ArchiveType_DAT_Bash::isInstance(
 			if (fn[j] < 32) return Certainty::DefinitelyNo; // TESTED BY: fmt_dat_bash_isinstance_c01
 		}
 
+		if (fat) {
+			auto f = std::make_unique<Archive_FAT::FATEntry>();
+			f->strName.assign(fn, strnlen(fn, DAT_FILENAME_FIELD_LEN));
+			f->storedSize = lenEntry;
+			content >> u16le(f->realSize);
+			setFATFields(f.get(), fat->entries.size(), pos, type);
+			fat->entries.push_back(std::move(f));
+		}
+
 		pos += lenEntry + DAT_EFAT_ENTRY_LEN;
 
 		// If a file entry points past the end of the archive then it's an invalid
@@ -114,6 +228,10 @@ ArchiveType::Certainty ArchiveType_DAT_Bash::isInstance(
 
 		content.seekg(pos, stream::start);
 	}
+	if (parsed) {
+		fat->readHeader(content, DAT_EFAT_ENTRY_LEN);
+		*parsed = std::move(fat);
+	}
 
 	// If we've made it this far, this is almost certainly a DAT file.
 
@@ -133,6 +251,14 @@ std::shared_ptr<Archive> ArchiveType_DAT_Bash::open(
 	return std::make_shared<Archive_DAT_Bash>(std::move(content));
 }
 
+std::shared_ptr<Archive> ArchiveType_DAT_Bash::openProbed(
+	std::unique_ptr<stream::inout> content, SuppData& suppData,
+	std::unique_ptr<ProbeResult> parsed) const
+{
+	return std::make_shared<Archive_DAT_Bash>(std::move(content),
+		std::move(parsed));
+}
+
 SuppFilenames ArchiveType_DAT_Bash::getRequiredSupps(stream::input& content,
 	const std::string& filename) const
 {
@@ -140,9 +266,12 @@ SuppFilenames ArchiveType_DAT_Bash::getRequiredSupps(stream::input& content,
 }
 
 
-Archive_DAT_Bash::Archive_DAT_Bash(std::unique_ptr<stream::inout> content)
+Archive_DAT_Bash::Archive_DAT_Bash(std::unique_ptr<stream::inout> content,
+	std::unique_ptr<ArchiveType::ProbeResult> parsed)
 	:	Archive_FAT(std::move(content), DAT_FIRST_FILE_OFFSET, DAT_MAX_FILENAME_LEN)
 {
+	if (this->useProbedFAT(parsed)) return;
+
 	stream::pos lenArchive = this->content->size();
 
 	this->content->seekg(0, stream::start);
@@ -153,12 +282,6 @@ Archive_DAT_Bash::Archive_DAT_Bash(std::unique_ptr<stream::inout> content)
 	while (pos < lenArchive) {
 		auto f = this->createNewFATEntry();
 
-		f->iIndex = numFiles;
-		f->iOffset = pos;
-		f->lenHeader = DAT_EFAT_ENTRY_LEN;
-		f->fAttr = File::Attribute::Default;
-		f->bValid = true;
-
 		// Read the data in from the FAT entry in the file
 		*this->content
 			>> u16le(type)
@@ -166,78 +289,7 @@ Archive_DAT_Bash::Archive_DAT_Bash(std::unique_ptr<stream::inout> content)
 			>> nullPadded(f->strName, DAT_FILENAME_FIELD_LEN)
 			>> u16le(f->realSize);
 
-		if (f->realSize) {
-			f->fAttr |= File::Attribute::Compressed;
-			f->filter = "lzw-bash"; // decompression algorithm
-		} else {
-			f->realSize = f->storedSize;
-		}
-
-		switch (type) {
-			case 0:
-				f->strName += ".mif";
-				f->type = "map/bash-info";
-				break;
-			case 1:
-				f->strName += ".mbg";
-				f->type = "map/bash-bg";
-				break;
-			case 2:
-				f->strName += ".mfg";
-				f->type = "map/bash-fg";
-				break;
-			case 3:
-				f->strName += ".tbg";
-				f->type = "image/bash-tiles-bg";
-				break;
-			case 4:
-				f->strName += ".tfg";
-				f->type = "image/bash-tiles-fg";
-				break;
-			case 5:
-				f->strName += ".tbn";
-				f->type = "image/bash-tiles-fg";
-				break;
-			case 6:
-				f->strName += ".sgl";
-				f->type = "data/bash-sprite-graphics-list";
-				break;
-			case 7:
-				f->strName += ".msp";
-				f->type = "map/bash-sprites";
-				break;
-			case 8:
-				// Already has ".snd" extension
-				f->type = "sound/bash";
-				break;
-			case 12:
-				f->strName += ".pbg";
-				f->type = "data/bash-tile-properties";
-				break;
-			case 13:
-				f->strName += ".pfg";
-				f->type = "data/bash-tile-properties";
-				break;
-			case 14:
-				f->strName += ".pal";
-				f->type = "image/pal-ega";
-				break;
-			case 16:
-				f->strName += ".pbn";
-				f->type = "data/bash-tile-properties";
-				break;
-			case 64:
-				f->strName += ".spr";
-				f->type = "image/bash-sprite";
-				break;
-			case 32:
-				f->type = FILETYPE_GENERIC;
-				break;
-			default:
-				f->strName += createString("." << type);
-				f->type = createString("unknown/bash-" << type);
-				break;
-		}
+		setFATFields(f.get(), numFiles, pos, type);
 		this->content->seekg(f->storedSize, stream::cur);
 		pos += DAT_EFAT_ENTRY_LEN + f->storedSize;
 
@@ -21,10 +21,12 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <algorithm>
 #include <cassert>
-#include <functional>
 #include <camoto/iostream_helpers.hpp>
+#include <camoto/stream_string.hpp>
 #include <camoto/util.hpp>
+#include "cpu-dispatch.hpp"
 #include "fmt-dat-got.hpp"
 
 #define GOT_MAX_FILES         256
@@ -40,6 +42,9 @@
 #define GOT_FILEOFFSET_OFFSET(e) (GOT_FATENTRY_OFFSET(e) + GOT_FILENAME_FIELD_LEN)
 #define GOT_FILESIZE_OFFSET(e)   (GOT_FILEOFFSET_OFFSET(e) + 4)
 
+/// Key for the first byte of the FAT, incrementing by one for each byte after.
+#define GOT_XOR_SEED 128
+
 // Comment the next line out and also in the test file to run the tests
 // with no encryption to assist in debugging.
 #define USE_XOR
@@ -47,6 +52,46 @@
 namespace camoto {
 namespace gamearchive {
 
+/// Read the whole FAT and decrypt it.
+static void readFAT(stream::input& content, uint8_t *fat)
+{
+	content.seekg(0, stream::start);
+	content.read(fat, GOT_FAT_LENGTH);
+#ifdef USE_XOR
+	kernels().xorRamp(fat, fat, GOT_FAT_LENGTH, GOT_XOR_SEED);
+#endif
+	return;
+}
+
+/// Get a little-endian integer out of the decrypted FAT.
+static inline uint32_t fatU32(const uint8_t *p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+/// Get a little-endian integer out of the decrypted FAT.
+static inline uint16_t fatU16(const uint8_t *p)
+{
+	return p[0] | (p[1] << 8);
+}
+
+/// Set the fields that aren't stored directly in a FAT entry.
+static void setFATFields(Archive_FAT::FATEntry *f, unsigned int index,
+	uint16_t flags)
+{
+	f->iIndex = index;
+	f->lenHeader = 0;
+	f->type = FILETYPE_GENERIC;
+	if (flags & 1) {
+		f->fAttr = Archive::File::Attribute::Compressed;
+		f->filter = "lzss-got";
+	} else {
+		f->fAttr = Archive::File::Attribute::Default;
+	}
+	f->bValid = true;
+	return;
+}
+
 ArchiveType_DAT_GoT::ArchiveType_DAT_GoT()
 {
 }
@@ -82,62 +127,72 @@ std::vector<std::string> ArchiveType_DAT_GoT::games() const
 ArchiveType::Certainty ArchiveType_DAT_GoT::isInstance(
 	stream::input& content) const
 {
+	return this->probe(content, nullptr);
+}
+
+ArchiveType::Certainty ArchiveType_DAT_GoT::probe(stream::input& content,
+	std::unique_ptr<ProbeResult> *parsed) const
+{
+	if (parsed) parsed->reset();
 	stream::pos lenArchive = content.size();
 
 	// Make sure the archive is large enough to hold a FAT
 	// TESTED BY: fmt_dat_got_isinstance_c02
 	if (lenArchive < GOT_FAT_LENGTH) return Certainty::DefinitelyNo;
 
-	// Create a substream to decrypt the FAT
-	auto fatSubStream = std::make_unique<stream::input_sub>(
-		// Create a fake shared_ptr so we can run the content through a decryption
-		// filter.
-		std::shared_ptr<stream::input>(std::shared_ptr<stream::input>(), &content),
-		0,
-		GOT_MAX_FILES * GOT_FAT_ENTRY_LEN
-	);
+	// Read the whole FAT in one go and decrypt it in memory, rather than
+	// running it through a filter a few bytes at a time.
+	uint8_t fatData[GOT_FAT_LENGTH];
+	try {
+		readFAT(content, fatData);
+	} catch (const stream::incomplete_read&) {
+		return Certainty::DefinitelyNo;
+	}
 
-#ifdef USE_XOR
-	auto fatStream = std::make_shared<stream::input_filtered>(
-		std::move(fatSubStream),
-		std::make_shared<filter_xor_crypt>(0, 128)
-	);
-#else
-	auto fatStream = std::move(fatSubStream);
-#endif
+	// Keep the decrypted entries as we check them, so the FAT needn't be read
+	// and decrypted again when the archive is opened.
+	std::unique_ptr<Archive_FAT::ProbedFAT> fat;
+	if (parsed) {
+		fat = std::make_unique<Archive_FAT::ProbedFAT>();
+		fat->lenArchive = lenArchive;
+	}
 
-	fatStream->seekg(0, stream::start);
+	// Check each FAT entry
+	const uint8_t *entry = fatData;
+	for (int i = 0; i < GOT_MAX_FILES; i++, entry += GOT_FAT_ENTRY_LEN) {
+		const char *fn = (const char *)entry;
+		// Make sure there aren't any invalid characters in the filename
+		for (int j = 0; j < GOT_MAX_FILENAME_LEN; j++) {
+			if (!fn[j]) break; // stop on terminating null
 
-	try {
-		// Check each FAT entry
-		char fn[GOT_FILENAME_FIELD_LEN];
-		for (int i = 0; i < GOT_MAX_FILES; i++) {
-			fatStream->read(fn, GOT_FILENAME_FIELD_LEN);
-			// Make sure there aren't any invalid characters in the filename
-			for (int j = 0; j < GOT_MAX_FILENAME_LEN; j++) {
-				if (!fn[j]) break; // stop on terminating null
-
-				// Fail on control characters in the filename
-				if (fn[j] < 32) return Certainty::DefinitelyNo; // TESTED BY: fmt_dat_got_isinstance_c01
-			}
-
-			uint32_t offEntry, lenEntry, lenDecomp;
-			uint16_t flags;
-			*fatStream
-				>> u32le(offEntry)
-				>> u32le(lenEntry)
-				>> u32le(lenDecomp)
-				>> u16le(flags)
-			;
-
-			// If a file entry points past the end of the archive then it's an invalid
-			// format.
-			// TESTED BY: fmt_dat_got_isinstance_c03
-			// TESTED BY: fmt_dat_got_isinstance_c04
-			if (offEntry + lenEntry > lenArchive) return Certainty::DefinitelyNo;
+			// Fail on control characters in the filename
+			if (fn[j] < 32) return Certainty::DefinitelyNo; // TESTED BY: fmt_dat_got_isinstance_c01
 		}
-	} catch (const stream::incomplete_read&) {
-		return Certainty::DefinitelyNo;
+
+		const uint8_t *fields = entry + GOT_FILENAME_FIELD_LEN;
+		uint32_t offEntry = fatU32(fields);
+		uint32_t lenEntry = fatU32(fields + 4);
+
+		// If a file entry points past the end of the archive then it's an invalid
+		// format.
+		// TESTED BY: fmt_dat_got_isinstance_c03
+		// TESTED BY: fmt_dat_got_isinstance_c04
+		if (offEntry + lenEntry > lenArchive) return Certainty::DefinitelyNo;
+
+		// Blank FAT entries have an offset of zero
+		if (fat && (offEntry > 0)) {
+			auto f = std::make_unique<Archive_FAT::FATEntry>();
+			f->strName.assign(fn, strnlen(fn, GOT_FILENAME_FIELD_LEN));
+			f->iOffset = offEntry;
+			f->storedSize = lenEntry;
+			f->realSize = fatU32(fields + 8);
+			setFATFields(f.get(), i, fatU16(fields + 12));
+			fat->entries.push_back(std::move(f));
+		}
+	}
+	if (parsed) {
+		fat->readHeader(content, GOT_FAT_ENTRY_LEN);
+		*parsed = std::move(fat);
 	}
 
 	// If we've made it this far, this is almost certainly a GoT file.
@@ -166,6 +221,14 @@ std::shared_ptr<Archive> ArchiveType_DAT_GoT::open(
 	return std::make_shared<Archive_DAT_GoT>(std::move(content));
 }
 
+std::shared_ptr<Archive> ArchiveType_DAT_GoT::openProbed(
+	std::unique_ptr<stream::inout> content, SuppData& suppData,
+	std::unique_ptr<ProbeResult> parsed) const
+{
+	return std::make_shared<Archive_DAT_GoT>(std::move(content),
+		std::move(parsed));
+}
+
 SuppFilenames ArchiveType_DAT_GoT::getRequiredSupps(stream::input& content,
 	const std::string& filename) const
 {
@@ -173,58 +236,35 @@ SuppFilenames ArchiveType_DAT_GoT::getRequiredSupps(stream::input& content,
 }
 
 
-Archive_DAT_GoT::Archive_DAT_GoT(std::unique_ptr<stream::inout> content)
+Archive_DAT_GoT::Archive_DAT_GoT(std::unique_ptr<stream::inout> content,
+	std::unique_ptr<ArchiveType::ProbeResult> parsed)
 	:	Archive_FAT(std::move(content), GOT_FIRST_FILE_OFFSET, GOT_MAX_FILENAME_LEN)
 {
-	// Create a substream to decrypt the FAT
-	auto fatSubStream = std::make_unique<stream::sub>(
-		this->content,
-		0,
-		GOT_MAX_FILES * GOT_FAT_ENTRY_LEN,
-		std::bind<void>(&Archive_DAT_GoT::truncateFAT, this, std::placeholders::_2)
-	);
+	this->bCanShare = true;
 
-#ifdef USE_XOR
-	auto fatFilter = std::make_unique<stream::filtered>(
-		std::move(fatSubStream),
-		std::make_shared<filter_xor_crypt>(0, 128),
-		std::make_shared<filter_xor_crypt>(0, 128),
-		stream::fn_notify_prefiltered_size()
-	);
-#else
-	auto fatFilter = std::move(fatSubStream);
-#endif
+	// The FAT is not kept in memory.  Since each byte's key depends only on its
+	// position, changes are encrypted and written straight over the entries
+	// they affect.
+	if (this->useProbedFAT(parsed)) return;
 
-	this->fatStream = std::make_unique<stream::seg>(std::move(fatFilter));
-	this->fatStream->seekg(0, stream::start);
+	std::vector<uint8_t> fatData(GOT_FAT_LENGTH);
+	readFAT(*this->content, fatData.data());
 
 	this->vcFAT.reserve(256);
-	for (int i = 0; i < GOT_MAX_FILES; i++) {
-		auto f = this->createNewFATEntry();
-
-		uint16_t flags;
-		*this->fatStream
-			>> nullPadded(f->strName, GOT_FILENAME_FIELD_LEN)
-			>> u32le(f->iOffset)
-			>> u32le(f->storedSize)
-			>> u32le(f->realSize)
-			>> u16le(flags)
-		;
-
-		f->iIndex = i;
-		f->lenHeader = 0;
-		f->type = FILETYPE_GENERIC;
-		if (flags & 1) {
-			f->fAttr = File::Attribute::Compressed;
-			f->filter = "lzss-got";
-		} else {
-			f->fAttr = File::Attribute::Default;
-		}
-		f->bValid = true;
+	const uint8_t *entry = fatData.data();
+	for (int i = 0; i < GOT_MAX_FILES; i++, entry += GOT_FAT_ENTRY_LEN) {
+		const uint8_t *fields = entry + GOT_FILENAME_FIELD_LEN;
 		// Blank FAT entries have an offset of zero
-		if (f->iOffset > 0) {
-			this->vcFAT.push_back(std::move(f));
-		}
+		if (fatU32(fields) == 0) continue;
+
+		auto f = this->createNewFATEntry();
+		f->strName.assign((const char *)entry,
+			strnlen((const char *)entry, GOT_FILENAME_FIELD_LEN));
+		f->iOffset = fatU32(fields);
+		f->storedSize = fatU32(fields + 4);
+		f->realSize = fatU32(fields + 8);
+		setFATFields(f.get(), i, fatU16(fields + 12));
+		this->vcFAT.push_back(std::move(f));
 	}
 }
 
@@ -232,15 +272,6 @@ Archive_DAT_GoT::~Archive_DAT_GoT()
 {
 }
 
-void Archive_DAT_GoT::flush()
-{
-	this->fatStream->flush();
-
-	// Commit this->content
-	this->Archive_FAT::flush();
-	return;
-}
-
 Archive::File::Attribute Archive_DAT_GoT::getSupportedAttributes() const
 {
 	return File::Attribute::Compressed;
@@ -250,8 +281,9 @@ void Archive_DAT_GoT::updateFileName(const FATEntry *pid, const std::string& str
 {
 	// TESTED BY: fmt_got_dat_rename
 	assert(strNewName.length() <= GOT_MAX_FILENAME_LEN);
-	this->fatStream->seekp(GOT_FILENAME_OFFSET(pid), stream::start);
-	*this->fatStream << nullPadded(strNewName, GOT_FILENAME_FIELD_LEN);
+	stream::string field;
+	field << nullPadded(strNewName, GOT_FILENAME_FIELD_LEN);
+	this->writeFAT(GOT_FILENAME_OFFSET(pid), field.data);
 	return;
 }
 
@@ -259,8 +291,9 @@ void Archive_DAT_GoT::updateFileOffset(const FATEntry *pid, stream::delta offDel
 {
 	// TESTED BY: fmt_got_dat_insert*
 	// TESTED BY: fmt_got_dat_resize*
-	this->fatStream->seekp(GOT_FILEOFFSET_OFFSET(pid), stream::start);
-	*this->fatStream << u32le(pid->iOffset);
+	// The index may have changed as well, in which case the entry has moved to
+	// another slot and has to be written out in full.
+	this->writeEntry(pid);
 	return;
 }
 
@@ -268,11 +301,12 @@ void Archive_DAT_GoT::updateFileSize(const FATEntry *pid, stream::delta sizeDelt
 {
 	// TESTED BY: fmt_got_dat_insert*
 	// TESTED BY: fmt_got_dat_resize*
-	this->fatStream->seekp(GOT_FILESIZE_OFFSET(pid), stream::start);
-	*this->fatStream
+	stream::string field;
+	field
 		<< u32le(pid->storedSize)
 		<< u32le(pid->realSize)
 	;
+	this->writeFAT(GOT_FILESIZE_OFFSET(pid), field.data);
 	return;
 }
 
@@ -294,78 +328,100 @@ void Archive_DAT_GoT::preInsertFile(const FATEntry *idBeforeThis, FATEntry *pNew
 		pNewEntry->filter = "lzss-got";
 	}
 
-	// Allocate the space in the FAT now, so that the correct offsets can be
-	// updated on return.
-	this->fatStream->seekp(GOT_FATENTRY_OFFSET(pNewEntry), stream::start);
-	this->fatStream->insert(GOT_FAT_ENTRY_LEN);
-	camoto::uppercase(pNewEntry->strName);
-
-	// Because the FAT is a fixed size we have to remove a blank entry to
-	// compensate for the entry we just added.
-	if (this->vcFAT.size() > 0) {
-		unsigned int indexLast = GOT_MAX_FILES - 1;
-		for (FileVector::reverse_iterator i = this->vcFAT.rbegin(); i != this->vcFAT.rend(); i++) {
-			const FATEntry *pFAT = dynamic_cast<const FATEntry *>(i->get());
-			if (pFAT->iIndex != indexLast) {
-				// The previous slot is free, so delete it
-				this->fatStream->seekp(indexLast * GOT_FAT_ENTRY_LEN, stream::start);
-				this->fatStream->remove(GOT_FAT_ENTRY_LEN);
-				break;
-			} else {
-				indexLast = pFAT->iIndex - 1;
-			}
-		}
-
-		// Make sure an entry was removed.  This should never fail as failure would
-		// indicate there were more than GOT_MAX_FILES files, which means an
-		// exception should've been thrown at the start of this function.
-		//assert(indexLast >= 0);
-		assert(indexLast < GOT_MAX_FILES); // unsigned version of previous line
-	} else {
-		// No files so just remove the following entry
-		this->fatStream->seekp(1 * GOT_FAT_ENTRY_LEN, stream::start);
-		this->fatStream->remove(GOT_FAT_ENTRY_LEN);
+	// The FAT is a fixed size, so the files from here on each move along one
+	// slot and the last one must have somewhere to go.  Blank slots between
+	// files move along with them, so they can't be used to make room.
+	// TESTED BY: fmt_dat_got_slot_gaps
+	if (
+		(this->vcFAT.size() > 0)
+		&& (FATEntry::cast(this->vcFAT.back())->iIndex >= GOT_MAX_FILES - 1)
+	) {
+		throw stream::error("the last FAT entry is in use, so no more files can "
+			"be added before it");
 	}
 
+	camoto::uppercase(pNewEntry->strName);
+
+	// The entry is written out in postInsertFile() once its sizes are set, and
+	// the files after it are rewritten in their new slots as they are shifted.
 	return;
 }
 
 void Archive_DAT_GoT::postInsertFile(FATEntry *pNewEntry)
 {
-	// Write out the entry into the space we allocated in preInsertFile(),
-	// now that the sizes are set.
-	this->fatStream->seekp(GOT_FATENTRY_OFFSET(pNewEntry), stream::start);
-	uint16_t flags = (pNewEntry->fAttr & File::Attribute::Compressed) ? 1 : 0; // 0 == not compressed
-	*this->fatStream
-		<< nullPadded(pNewEntry->strName, GOT_FILENAME_FIELD_LEN)
-		<< u32le(pNewEntry->iOffset)
-		<< u32le(pNewEntry->storedSize)
-		<< u32le(pNewEntry->realSize)
-		<< u16le(flags)
-	;
+	this->writeEntry(pNewEntry);
+
+	// Each file after this one has been written one slot further on.  Where
+	// there was a gap before a file, nothing has moved into the slot it left,
+	// so that slot still holds the old copy of the entry and must be blanked.
+	// TESTED BY: fmt_dat_got_slot_gaps
+	auto it = std::find_if(this->vcFAT.begin(), this->vcFAT.end(),
+		[pNewEntry](const FileHandle& f) { return f.get() == pNewEntry; });
+	assert(it != this->vcFAT.end());
+	unsigned int indexPrev = pNewEntry->iIndex;
+	for (it++; it != this->vcFAT.end(); it++) {
+		auto pFAT = FATEntry::cast(*it);
+		if (pFAT->iIndex - 1 != indexPrev) this->clearEntry(pFAT->iIndex - 1);
+		indexPrev = pFAT->iIndex;
+	}
 	return;
 }
 
 void Archive_DAT_GoT::preRemoveFile(const FATEntry *pid)
 {
 	// TESTED BY: fmt_got_dat_remove*
+	// TESTED BY: fmt_dat_got_slot_gaps
+
+	// This file and each one after it will move back one slot, and are written
+	// out in their new slots as they are shifted.  Blank the slots nothing will
+	// move into, which are those not directly followed by another file.
+	auto it = std::find_if(this->vcFAT.begin(), this->vcFAT.end(),
+		[pid](const FileHandle& f) { return f.get() == pid; });
+	assert(it != this->vcFAT.end());
+	for (; it != this->vcFAT.end(); it++) {
+		auto pFAT = FATEntry::cast(*it);
+		auto itNext = std::next(it);
+		if (
+			(itNext == this->vcFAT.end())
+			|| (FATEntry::cast(*itNext)->iIndex != pFAT->iIndex + 1)
+		) {
+			this->clearEntry(pFAT->iIndex);
+		}
+	}
+	return;
+}
 
-	// Remove the FAT entry
-	this->fatStream->seekp(GOT_FATENTRY_OFFSET(pid), stream::start);
-	this->fatStream->remove(GOT_FAT_ENTRY_LEN);
-
-	// Add an empty FAT entry onto the end to keep the FAT the same size
-	const FATEntry *pFAT = dynamic_cast<const FATEntry *>(this->vcFAT.back().get());
-	this->fatStream->seekp((pFAT->iIndex + 1) * GOT_FAT_ENTRY_LEN, stream::start);
-	this->fatStream->insert(GOT_FAT_ENTRY_LEN);
+void Archive_DAT_GoT::writeFAT(stream::pos off, std::string& data)
+{
+	assert(off + data.length() <= GOT_FAT_LENGTH);
+#ifdef USE_XOR
+	uint8_t *buf = (uint8_t *)&data[0];
+	kernels().xorRamp(buf, buf, data.length(), (uint8_t)(GOT_XOR_SEED + off));
+#endif
+	this->content->seekp(off, stream::start);
+	this->content->write(data);
+	return;
+}
 
+void Archive_DAT_GoT::writeEntry(const FATEntry *pid)
+{
+	uint16_t flags = (pid->fAttr & File::Attribute::Compressed) ? 1 : 0; // 0 == not compressed
+	stream::string entry;
+	entry
+		<< nullPadded(pid->strName, GOT_FILENAME_FIELD_LEN)
+		<< u32le(pid->iOffset)
+		<< u32le(pid->storedSize)
+		<< u32le(pid->realSize)
+		<< u16le(flags)
+	;
+	this->writeFAT(GOT_FATENTRY_OFFSET(pid), entry.data);
 	return;
 }
 
-void Archive_DAT_GoT::truncateFAT(stream::pos newSize)
+void Archive_DAT_GoT::clearEntry(unsigned int index)
 {
-	// Sanity check to make sure the FAT is not actually changing size.
-	assert(newSize == GOT_FAT_LENGTH);
+	std::string entry(GOT_FAT_ENTRY_LEN, '\0');
+	this->writeFAT(index * GOT_FAT_ENTRY_LEN, entry);
 	return;
 }
 
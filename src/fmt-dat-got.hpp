@@ -21,10 +21,8 @@
 #ifndef _CAMOTO_FMT_DAT_GOT_HPP_
 #define _CAMOTO_FMT_DAT_GOT_HPP_
 
-#include <camoto/stream_filtered.hpp>
 #include <camoto/gamearchive/archivetype.hpp>
 #include <camoto/gamearchive/archive-fat.hpp>
-#include "filter-xor.hpp"
 
 namespace camoto {
 namespace gamearchive {
@@ -41,10 +39,15 @@ class ArchiveType_DAT_GoT: virtual public ArchiveType
 		virtual std::vector<std::string> fileExtensions() const;
 		virtual std::vector<std::string> games() const;
 		virtual ArchiveType::Certainty isInstance(stream::input& content) const;
+		virtual ArchiveType::Certainty probe(stream::input& content,
+			std::unique_ptr<ProbeResult> *parsed) const;
 		virtual std::shared_ptr<Archive> create(
 			std::unique_ptr<stream::inout> content, SuppData& suppData) const;
 		virtual std::shared_ptr<Archive> open(
 			std::unique_ptr<stream::inout> content, SuppData& suppData) const;
+		virtual std::shared_ptr<Archive> openProbed(
+			std::unique_ptr<stream::inout> content, SuppData& suppData,
+			std::unique_ptr<ProbeResult> parsed) const;
 		virtual SuppFilenames getRequiredSupps(stream::input& content,
 			const std::string& filename) const;
 };
@@ -53,10 +56,10 @@ class ArchiveType_DAT_GoT: virtual public ArchiveType
 class Archive_DAT_GoT: virtual public Archive_FAT
 {
 	public:
-		Archive_DAT_GoT(std::unique_ptr<stream::inout> content);
+		Archive_DAT_GoT(std::unique_ptr<stream::inout> content,
+			std::unique_ptr<ArchiveType::ProbeResult> parsed = nullptr);
 		virtual ~Archive_DAT_GoT();
 
-		virtual void flush();
 		virtual Archive::File::Attribute getSupportedAttributes() const;
 
 		virtual void updateFileName(const FATEntry *pid,
@@ -69,15 +72,24 @@ class Archive_DAT_GoT: virtual public Archive_FAT
 		virtual void preRemoveFile(const FATEntry *pid);
 
 	protected:
-		/// Segstream wrapper around decrypted fatSubStream
-		std::unique_ptr<stream::seg> fatStream;
-
-		/// Dummy function - does nothing
+		/// Encrypt part of the FAT and write it over the existing data.
 		/**
-		 * Since this format's FAT is a constant size it will never be changed,
-		 * but fatStream requires a truncate callback when commit() is called.
+		 * The key for each byte depends only on its offset in the file, so any
+		 * part of the FAT can be written on its own without touching the rest.
+		 *
+		 * @param off
+		 *   Offset of the data from the start of the archive.
+		 *
+		 * @param data
+		 *   Cleartext to write.  It is encrypted in place.
 		 */
-		void truncateFAT(stream::pos newSize);
+		void writeFAT(stream::pos off, std::string& data);
+
+		/// Write out a file's whole FAT entry, in the slot given by its index.
+		void writeEntry(const FATEntry *pid);
+
+		/// Write an empty FAT entry into the given slot.
+		void clearEntry(unsigned int index);
 };
 
 } // namespace gamearchive
@@ -140,7 +140,7 @@ SuppFilenames ArchiveType_DAT_Hocus::getRequiredSupps(stream::input& content,
 Archive_DAT_Hocus::Archive_DAT_Hocus(std::unique_ptr<stream::inout> content,
 	std::unique_ptr<stream::inout> psFAT)
 	:	Archive_FAT(std::move(content), DAT_FIRST_FILE_OFFSET, 0),
-		psFAT(std::make_unique<stream::seg>(std::move(psFAT))),
+		psFAT(std::make_unique<piece_table>(std::move(psFAT))),
 		numFiles(0)
 {
 	stream::pos lenArchive = this->content->size();
@@ -51,7 +51,7 @@ class ArchiveType_DAT_Hocus: virtual public ArchiveType
 class Archive_DAT_Hocus: virtual public Archive_FAT
 {
 	protected:
-		std::unique_ptr<stream::seg> psFAT; ///< FAT stream (hocus.exe)
+		std::unique_ptr<piece_table> psFAT; ///< FAT stream (hocus.exe)
 		uint32_t maxFiles;    ///< Maximum number of files in FAT
 		uint32_t numFiles;    ///< Current number of files in FAT
 
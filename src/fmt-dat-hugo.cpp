@@ -165,7 +165,7 @@ Archive_DAT_Hugo::Archive_DAT_Hugo(std::unique_ptr<stream::inout> content,
 	:	Archive_FAT(std::move(content), DAT_FIRST_FILE_OFFSET, 0)
 {
 	if (psFAT) {
-		this->psFAT = std::make_unique<stream::seg>(std::move(psFAT));
+		this->psFAT = std::make_shared<piece_table>(std::move(psFAT));
 	} else {
 		this->psFAT = this->content;
 	}
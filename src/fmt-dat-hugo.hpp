@@ -51,9 +51,17 @@ class ArchiveType_DAT_Hugo: virtual public ArchiveType
 class Archive_DAT_Hugo: virtual public Archive_FAT
 {
 	protected:
-		std::shared_ptr<stream::seg> psFAT;
+		std::shared_ptr<piece_table> psFAT;
 		struct FATEntry_Hugo: virtual public FATEntry {
 			int file;
+
+			virtual std::unique_ptr<FATEntry> clone() const
+			{
+				auto copy = std::make_unique<FATEntry_Hugo>();
+				this->copyTo(copy.get());
+				copy->file = this->file;
+				return std::move(copy);
+			}
 		};
 
 	public:
@@ -24,6 +24,7 @@
 #include <cassert>
 #include <camoto/iostream_helpers.hpp>
 #include <camoto/util.hpp>
+#include "fat-layout.hpp"
 #include "fmt-dat-riptide.hpp"
 
 #define DATRIP_FILECOUNT_OFFSET    0
@@ -34,15 +35,17 @@
 #define DATRIP_FAT_ENTRY_LEN       (4+4+4+13)  // u32le size + timestamp + offset + filename
 #define DATRIP_FIRST_FILE_OFFSET   DATRIP_HEADER_LEN
 
-#define DATRIP_FATENTRY_OFFSET(e) (DATRIP_HEADER_LEN + e->iIndex * DATRIP_FAT_ENTRY_LEN)
-
-#define DATRIP_FILESIZE_OFFSET(e)    DATRIP_FATENTRY_OFFSET(e)
-#define DATRIP_FILEOFFSET_OFFSET(e) (DATRIP_FATENTRY_OFFSET(e) + 8)
-#define DATRIP_FILENAME_OFFSET(e)   (DATRIP_FATENTRY_OFFSET(e) + 12)
-
 namespace camoto {
 namespace gamearchive {
 
+/// Layout of each FAT entry: u32le size, u32le timestamp, u32le offset, then
+/// filename.  The timestamp is not used and is written as zero.
+typedef FATLayout<DATRIP_FAT_OFFSET, DATRIP_FAT_ENTRY_LEN,
+	fatfield::NullPadded<12, DATRIP_FILENAME_FIELD_LEN>,
+	fatfield::UIntLE<8, 4>,
+	fatfield::UIntLE<0, 4>
+> DatRipLayout;
+
 ArchiveType_DAT_Riptide::ArchiveType_DAT_Riptide()
 {
 }
@@ -159,23 +162,17 @@ Archive_DAT_Riptide::Archive_DAT_Riptide(std::unique_ptr<stream::inout> content)
 	uint16_t numFiles;
 	this->content->seekg(DATRIP_FILECOUNT_OFFSET, stream::start);
 	*this->content >> u16le(numFiles);
+	auto raw = DatRipLayout::readEntries(*this->content, numFiles);
 
 	for (unsigned int i = 0; i < numFiles; i++) {
 		auto f = this->createNewFATEntry();
 
-		uint16_t lastModified;
 		f->iIndex = i;
 		f->lenHeader = 0;
 		f->type = FILETYPE_GENERIC;
 		f->fAttr = File::Attribute::Default;
 		f->bValid = true;
-		*this->content
-			>> u32le(f->storedSize)
-			>> u32le(lastModified)
-			>> u32le(f->iOffset)
-			>> nullPadded(f->strName, DATRIP_FILENAME_FIELD_LEN)
-		;
-		f->realSize = f->storedSize;
+		DatRipLayout::decode(&raw[i * DATRIP_FAT_ENTRY_LEN], f.get());
 
 		this->vcFAT.push_back(std::move(f));
 	}
@@ -189,8 +186,7 @@ void Archive_DAT_Riptide::updateFileName(const FATEntry *pid, const std::string&
 {
 	// TESTED BY: fmt_dat_riptide_rename
 	assert(strNewName.length() <= DATRIP_MAX_FILENAME_LEN);
-	this->content->seekp(DATRIP_FILENAME_OFFSET(pid), stream::start);
-	*this->content << nullPadded(strNewName, DATRIP_FILENAME_FIELD_LEN);
+	DatRipLayout::writeName(*this->content, pid, strNewName);
 	return;
 }
 
@@ -198,8 +194,7 @@ void Archive_DAT_Riptide::updateFileOffset(const FATEntry *pid, stream::delta of
 {
 	// TESTED BY: fmt_dat_riptide_insert*
 	// TESTED BY: fmt_dat_riptide_resize*
-	this->content->seekp(DATRIP_FILEOFFSET_OFFSET(pid), stream::start);
-	*this->content << u32le(pid->iOffset);
+	DatRipLayout::writeOffset(*this->content, pid);
 	return;
 }
 
@@ -207,8 +202,7 @@ void Archive_DAT_Riptide::updateFileSize(const FATEntry *pid, stream::delta size
 {
 	// TESTED BY: fmt_dat_riptide_insert*
 	// TESTED BY: fmt_dat_riptide_resize*
-	this->content->seekp(DATRIP_FILESIZE_OFFSET(pid), stream::start);
-	*this->content << u32le(pid->storedSize);
+	DatRipLayout::writeSize(*this->content, pid);
 	return;
 }
 
@@ -221,14 +215,15 @@ void Archive_DAT_Riptide::preInsertFile(const FATEntry *idBeforeThis, FATEntry *
 		throw stream::error("Maximum number of files in this archive has been reached.");
 	}
 
-	this->content->seekp(DATRIP_FATENTRY_OFFSET(pNewEntry), stream::start);
+	this->content->seekp(DatRipLayout::entryOffset(pNewEntry->iIndex),
+		stream::start);
 	this->content->insert(DATRIP_FAT_ENTRY_LEN);
 	camoto::uppercase(pNewEntry->strName);
 
 	// Update the offsets now there's a new FAT entry taking up space.
 	this->shiftFiles(
 		NULL,
-		DATRIP_FAT_OFFSET + this->vcFAT.size() * DATRIP_FAT_ENTRY_LEN,
+		DatRipLayout::fatEnd(this->vcFAT.size()),
 		DATRIP_FAT_ENTRY_LEN,
 		0
 	);
@@ -241,16 +236,8 @@ void Archive_DAT_Riptide::preInsertFile(const FATEntry *idBeforeThis, FATEntry *
 	// Now write all the fields in.  We can't do this earlier like normal, because
 	// the calls to shiftFiles() overwrite anything we have written, because this
 	// file entry isn't in the FAT vector yet.
-	this->content->seekp(DATRIP_FATENTRY_OFFSET(pNewEntry), stream::start);
-	*this->content
-		<< u32le(pNewEntry->storedSize)
-
-		/// @todo Write last-updated time
-		<< u32le(0)
-
-		<< u32le(pNewEntry->iOffset)
-		<< nullPadded(pNewEntry->strName, DATRIP_FILENAME_FIELD_LEN)
-	;
+	/// @todo Write last-updated time
+	DatRipLayout::writeEntry(*this->content, pNewEntry);
 
 	// Set the format-specific variables
 	this->updateFileCount(this->vcFAT.size() + 1);
@@ -267,13 +254,12 @@ void Archive_DAT_Riptide::preRemoveFile(const FATEntry *pid)
 	// it'll overwrite something else.)
 	this->shiftFiles(
 		NULL,
-		DATRIP_FAT_OFFSET + this->vcFAT.size() * DATRIP_FAT_ENTRY_LEN,
+		DatRipLayout::fatEnd(this->vcFAT.size()),
 		-DATRIP_FAT_ENTRY_LEN,
 		0
 	);
 
-	this->content->seekp(DATRIP_FATENTRY_OFFSET(pid), stream::start);
-	this->content->remove(DATRIP_FAT_ENTRY_LEN);
+	DatRipLayout::removeEntry(*this->content, pid);
 
 	this->updateFileCount(this->vcFAT.size() - 1);
 	return;
@@ -24,6 +24,7 @@
 #include <cassert>
 #include <camoto/iostream_helpers.hpp>
 #include <camoto/util.hpp>
+#include "fat-layout.hpp"
 #include "fmt-dat-wacky.hpp"
 
 #define DAT_FILECOUNT_OFFSET     0
@@ -33,15 +34,20 @@
 #define DAT_FAT_OFFSET           2
 #define DAT_FIRST_FILE_OFFSET    DAT_FAT_OFFSET
 
-#define DAT_FATENTRY_OFFSET(e)   (DAT_FAT_OFFSET + e->iIndex * DAT_FAT_ENTRY_LEN)
-
-#define DAT_FILENAME_OFFSET(e)    DAT_FATENTRY_OFFSET(e)
-#define DAT_FILESIZE_OFFSET(e)   (DAT_FATENTRY_OFFSET(e) + DAT_FILENAME_FIELD_LEN)
-#define DAT_FILEOFFSET_OFFSET(e) (DAT_FATENTRY_OFFSET(e) + DAT_FILENAME_FIELD_LEN + 4)
-
 namespace camoto {
 namespace gamearchive {
 
+/// Layout of each FAT entry: filename, u32le size, then u32le offset.  The
+/// offset doesn't include the two byte file count.
+typedef FATLayout<DAT_FAT_OFFSET, DAT_FAT_ENTRY_LEN,
+	fatfield::NullPadded<0, DAT_FILENAME_FIELD_LEN>,
+	fatfield::Relative<
+		fatfield::UIntLE<DAT_FILENAME_FIELD_LEN + 4, 4>,
+		DAT_FAT_OFFSET
+	>,
+	fatfield::UIntLE<DAT_FILENAME_FIELD_LEN, 4>
+> WackyLayout;
+
 ArchiveType_DAT_Wacky::ArchiveType_DAT_Wacky()
 {
 }
@@ -162,6 +168,7 @@ Archive_DAT_Wacky::Archive_DAT_Wacky(std::unique_ptr<stream::inout> content)
 	uint16_t numFiles;
 	*this->content >> u16le(numFiles);
 	this->vcFAT.reserve(numFiles);
+	auto raw = WackyLayout::readEntries(*this->content, numFiles);
 
 	for (int i = 0; i < numFiles; i++) {
 		auto f = this->createNewFATEntry();
@@ -171,17 +178,7 @@ Archive_DAT_Wacky::Archive_DAT_Wacky(std::unique_ptr<stream::inout> content)
 		f->type = FILETYPE_GENERIC;
 		f->fAttr = File::Attribute::Default;
 		f->bValid = true;
-
-		// Read the data in from the FAT entry in the file
-		*this->content
-			>> nullPadded(f->strName, DAT_FILENAME_FIELD_LEN)
-			>> u32le(f->storedSize)
-			>> u32le(f->iOffset);
-
-		// Offset doesn't include the two byte file count
-		f->iOffset += DAT_FAT_OFFSET;
-
-		f->realSize = f->storedSize;
+		WackyLayout::decode(&raw[i * DAT_FAT_ENTRY_LEN], f.get());
 		this->vcFAT.push_back(std::move(f));
 	}
 
@@ -195,8 +192,7 @@ void Archive_DAT_Wacky::updateFileName(const FATEntry *pid, const std::string& s
 {
 	// TESTED BY: fmt_dat_wacky_rename
 	assert(strNewName.length() <= DAT_MAX_FILENAME_LEN);
-	this->content->seekp(DAT_FILENAME_OFFSET(pid), stream::start);
-	*this->content << nullPadded(strNewName, DAT_FILENAME_FIELD_LEN);
+	WackyLayout::writeName(*this->content, pid, strNewName);
 	return;
 }
 
@@ -206,12 +202,7 @@ void Archive_DAT_Wacky::updateFileOffset(const FATEntry *pid,
 {
 	// TESTED BY: fmt_dat_wacky_insert*
 	// TESTED BY: fmt_dat_wacky_resize*
-
-	// Offsets don't start from the beginning of the archive
-	uint32_t deltaOffset = pid->iOffset - DAT_FAT_OFFSET;
-
-	this->content->seekp(DAT_FILEOFFSET_OFFSET(pid), stream::start);
-	*this->content << u32le(deltaOffset);
+	WackyLayout::writeOffset(*this->content, pid);
 	return;
 }
 
@@ -221,8 +212,7 @@ void Archive_DAT_Wacky::updateFileSize(const FATEntry *pid,
 {
 	// TESTED BY: fmt_dat_wacky_insert*
 	// TESTED BY: fmt_dat_wacky_resize*
-	this->content->seekp(DAT_FILESIZE_OFFSET(pid), stream::start);
-	*this->content << u32le(pid->storedSize);
+	WackyLayout::writeSize(*this->content, pid);
 	return;
 }
 
@@ -239,23 +229,13 @@ void Archive_DAT_Wacky::preInsertFile(
 	// Because the new entry isn't in the vector yet we need to shift it manually
 	pNewEntry->iOffset += DAT_FAT_ENTRY_LEN;
 
-	this->content->seekp(DAT_FATENTRY_OFFSET(pNewEntry), stream::start);
-	this->content->insert(DAT_FAT_ENTRY_LEN);
 	camoto::uppercase(pNewEntry->strName);
-
-	// Offsets don't start from the beginning of the archive
-	uint32_t deltaOffset = pNewEntry->iOffset - DAT_FAT_OFFSET;
-
-	// Write out the entry
-	*this->content
-		<< nullPadded(pNewEntry->strName, DAT_FILENAME_FIELD_LEN)
-		<< u32le(pNewEntry->storedSize)
-		<< u32le(deltaOffset);
+	WackyLayout::insertEntry(*this->content, pNewEntry);
 
 	// Update the offsets now there's a new FAT entry taking up space.
 	this->shiftFiles(
 		NULL,
-		DAT_FAT_OFFSET + this->vcFAT.size() * DAT_FAT_ENTRY_LEN,
+		WackyLayout::fatEnd(this->vcFAT.size()),
 		DAT_FAT_ENTRY_LEN,
 		0
 	);
@@ -274,13 +254,12 @@ void Archive_DAT_Wacky::preRemoveFile(const FATEntry *pid)
 	// it'll overwrite something else.)
 	this->shiftFiles(
 		NULL,
-		DAT_FAT_OFFSET + this->vcFAT.size() * DAT_FAT_ENTRY_LEN,
+		WackyLayout::fatEnd(this->vcFAT.size()),
 		-DAT_FAT_ENTRY_LEN,
 		0
 	);
 
-	this->content->seekp(DAT_FATENTRY_OFFSET(pid), stream::start);
-	this->content->remove(DAT_FAT_ENTRY_LEN);
+	WackyLayout::removeEntry(*this->content, pid);
 
 	this->updateFileCount(this->vcFAT.size() - 1);
 	return;
@@ -125,7 +125,7 @@ SuppFilenames ArchiveType_GD_Doofus::getRequiredSupps(stream::input& content,
 Archive_GD_Doofus::Archive_GD_Doofus(std::unique_ptr<stream::inout> content,
 	std::unique_ptr<stream::inout> psFAT)
 	:	Archive_FAT(std::move(content), GD_FIRST_FILE_OFFSET, 0),
-		psFAT(std::make_unique<stream::seg>(std::move(psFAT))),
+		psFAT(std::make_unique<piece_table>(std::move(psFAT))),
 		numFiles(0)
 {
 	assert(this->psFAT);
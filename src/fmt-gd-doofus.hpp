@@ -51,7 +51,7 @@ class ArchiveType_GD_Doofus: virtual public ArchiveType
 class Archive_GD_Doofus: virtual public Archive_FAT
 {
 	protected:
-		std::unique_ptr<stream::seg> psFAT; ///< FAT stream (doofus.exe)
+		std::unique_ptr<piece_table> psFAT; ///< FAT stream (doofus.exe)
 		uint32_t maxFiles;    ///< Maximum number of files in FAT
 		uint32_t numFiles;    ///< Current number of files in FAT
 
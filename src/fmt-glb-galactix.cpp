@@ -24,6 +24,7 @@
 #include <cassert>
 #include <camoto/util.hpp>
 #include <camoto/iostream_helpers.hpp>
+#include "fat-layout.hpp"
 #include "fmt-glb-galactix.hpp"
 
 #define GLB_FILECOUNT_OFFSET    0
@@ -36,15 +37,16 @@
 
 #define GLB_SAFETY_MAX_FILECOUNT  8192 // Maximum value we will load
 
-#define GLB_FATENTRY_OFFSET(e) (GLB_HEADER_LEN + e->iIndex * GLB_FAT_ENTRY_LEN)
-
-#define GLB_FILENAME_OFFSET(e)   (GLB_FATENTRY_OFFSET(e) + 4)
-#define GLB_FILESIZE_OFFSET(e)   (GLB_FATENTRY_OFFSET(e) + 26)
-#define GLB_FILEOFFSET_OFFSET(e) (GLB_FATENTRY_OFFSET(e) + 0)
-
 namespace camoto {
 namespace gamearchive {
 
+/// Layout of each FAT entry: u32le offset, filename, then u16le size.
+typedef FATLayout<GLB_FAT_OFFSET, GLB_FAT_ENTRY_LEN,
+	fatfield::NullPadded<4, GLB_FILENAME_FIELD_LEN>,
+	fatfield::UIntLE<0, 4>,
+	fatfield::UIntLE<26, 2>
+> GLBLayout;
+
 ArchiveType_GLB_Galactix::ArchiveType_GLB_Galactix()
 {
 }
@@ -130,6 +132,7 @@ Archive_GLB_Galactix::Archive_GLB_Galactix(std::unique_ptr<stream::inout> conten
 	}
 
 	this->content->seekg(GLB_FAT_OFFSET, stream::start);
+	auto raw = GLBLayout::readEntries(*this->content, numFiles);
 	for (unsigned int i = 0; i < numFiles; i++) {
 		auto f = this->createNewFATEntry();
 
@@ -138,14 +141,7 @@ Archive_GLB_Galactix::Archive_GLB_Galactix(std::unique_ptr<stream::inout> conten
 		f->type = FILETYPE_GENERIC;
 		f->fAttr = File::Attribute::Default;
 		f->bValid = true;
-
-		// Read the data in from the FAT entry in the file
-		*this->content
-			>> u32le(f->iOffset)
-			>> nullPadded(f->strName, GLB_FILENAME_FIELD_LEN)
-			>> u16le(f->storedSize)
-		;
-		f->realSize = f->storedSize;
+		GLBLayout::decode(&raw[i * GLB_FAT_ENTRY_LEN], f.get());
 		this->vcFAT.push_back(std::move(f));
 	}
 }
@@ -158,8 +154,7 @@ void Archive_GLB_Galactix::updateFileName(const FATEntry *pid, const std::string
 {
 	// TESTED BY: fmt_glb_galactix_rename
 	assert(strNewName.length() <= GLB_MAX_FILENAME_LEN);
-	this->content->seekp(GLB_FILENAME_OFFSET(pid), stream::start);
-	*this->content << nullPadded(strNewName, GLB_FILENAME_FIELD_LEN);
+	GLBLayout::writeName(*this->content, pid, strNewName);
 	return;
 }
 
@@ -167,8 +162,7 @@ void Archive_GLB_Galactix::updateFileOffset(const FATEntry *pid, stream::delta o
 {
 	// TESTED BY: fmt_glb_galactix_insert*
 	// TESTED BY: fmt_glb_galactix_resize*
-	this->content->seekp(GLB_FILEOFFSET_OFFSET(pid), stream::start);
-	*this->content << u32le(pid->iOffset);
+	GLBLayout::writeOffset(*this->content, pid);
 	return;
 }
 
@@ -176,8 +170,7 @@ void Archive_GLB_Galactix::updateFileSize(const FATEntry *pid, stream::delta siz
 {
 	// TESTED BY: fmt_glb_galactix_insert*
 	// TESTED BY: fmt_glb_galactix_resize*
-	this->content->seekp(GLB_FILESIZE_OFFSET(pid), stream::start);
-	*this->content << u16le(pid->storedSize);
+	GLBLayout::writeSize(*this->content, pid);
 	return;
 }
 
@@ -192,21 +185,13 @@ void Archive_GLB_Galactix::preInsertFile(const FATEntry *idBeforeThis, FATEntry
 	// Because the new entry isn't in the vector yet we need to shift it manually
 	pNewEntry->iOffset += GLB_FAT_ENTRY_LEN;
 
-	this->content->seekp(GLB_FATENTRY_OFFSET(pNewEntry), stream::start);
-	this->content->insert(GLB_FAT_ENTRY_LEN);
-
 	camoto::uppercase(pNewEntry->strName);
-
-	*this->content
-		<< u32le(pNewEntry->iOffset)
-		<< nullPadded(pNewEntry->strName, GLB_FILENAME_FIELD_LEN)
-		<< u16le(pNewEntry->storedSize)
-	;
+	GLBLayout::insertEntry(*this->content, pNewEntry);
 
 	// Update the offsets now there's a new FAT entry taking up space.
 	this->shiftFiles(
 		NULL,
-		GLB_FAT_OFFSET + this->vcFAT.size() * GLB_FAT_ENTRY_LEN,
+		GLBLayout::fatEnd(this->vcFAT.size()),
 		GLB_FAT_ENTRY_LEN,
 		0
 	);
@@ -225,13 +210,12 @@ void Archive_GLB_Galactix::preRemoveFile(const FATEntry *pid)
 	// it'll overwrite something else.)
 	this->shiftFiles(
 		NULL,
-		GLB_FAT_OFFSET + this->vcFAT.size() * GLB_FAT_ENTRY_LEN,
+		GLBLayout::fatEnd(this->vcFAT.size()),
 		-GLB_FAT_ENTRY_LEN,
 		0
 	);
 
-	this->content->seekp(GLB_FATENTRY_OFFSET(pid), stream::start);
-	this->content->remove(GLB_FAT_ENTRY_LEN);
+	GLBLayout::removeEntry(*this->content, pid);
 
 	this->updateFileCount(this->vcFAT.size() - 1);
 	return;
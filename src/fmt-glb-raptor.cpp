@@ -166,7 +166,7 @@ Archive_GLB_Raptor::Archive_GLB_Raptor(std::unique_ptr<stream::inout> content)
 #endif
 	auto mem = std::make_unique<stream::string>();
 	stream::copy(*mem, *preFAT);
-	this->fat = std::make_unique<stream::seg>(std::move(mem));
+	this->fat = std::make_unique<piece_table>(std::move(mem));
 
 	if (numFiles >= GLB_SAFETY_MAX_FILECOUNT) {
 		throw stream::error("too many files or corrupted archive");
@@ -198,6 +198,11 @@ Archive_GLB_Raptor::Archive_GLB_Raptor(std::unique_ptr<stream::inout> content)
 		f->realSize = f->storedSize;
 		this->vcFAT.push_back(std::move(f));
 	}
+
+	// Any spare entries are left as zeros rather than being encrypted, as the
+	// game never reads them.
+	this->initSpareEntries(GLB_FAT_OFFSET + numFiles * GLB_FAT_ENTRY_LEN,
+		GLB_FAT_ENTRY_LEN);
 }
 
 Archive_GLB_Raptor::~Archive_GLB_Raptor()
@@ -244,6 +249,17 @@ void Archive_GLB_Raptor::flush()
 	return;
 }
 
+void Archive_GLB_Raptor::attribute(unsigned int index, int newValue)
+{
+	// TESTED BY: test_archive::test_spare_entries
+	this->Archive_FAT::attribute(index, newValue);
+	if (this->lenSpareEntry && (index == this->attrSpareEntries)) {
+		this->setSpareEntries(
+			GLB_FAT_OFFSET + this->vcFAT.size() * GLB_FAT_ENTRY_LEN, newValue);
+	}
+	return;
+}
+
 void Archive_GLB_Raptor::updateFileName(const FATEntry *pid, const std::string& strNewName)
 {
 	// TESTED BY: fmt_glb_raptor_rename
@@ -279,8 +295,14 @@ void Archive_GLB_Raptor::preInsertFile(const FATEntry *idBeforeThis, FATEntry *p
 	// Set the format-specific variables
 	pNewEntry->lenHeader = 0;
 
-	// Because the new entry isn't in the vector yet we need to shift it manually
-	pNewEntry->iOffset += GLB_FAT_ENTRY_LEN;
+	stream::pos offFATEnd = GLB_FAT_OFFSET
+		+ this->vcFAT.size() * GLB_FAT_ENTRY_LEN;
+	bool spare = this->takeSpareEntry(offFATEnd, pNewEntry);
+	if (!spare) {
+		// Because the new entry isn't in the vector yet we need to shift it
+		// manually
+		pNewEntry->iOffset += GLB_FAT_ENTRY_LEN;
+	}
 
 	this->fat->seekp(GLB_FATENTRY_OFFSET(pNewEntry), stream::start);
 	this->fat->insert(GLB_FAT_ENTRY_LEN);
@@ -299,13 +321,10 @@ void Archive_GLB_Raptor::preInsertFile(const FATEntry *idBeforeThis, FATEntry *p
 		<< nullPadded(pNewEntry->strName, GLB_FILENAME_FIELD_LEN)
 	;
 
-	// Update the offsets now there's a new FAT entry taking up space.
-	this->shiftFiles(
-		NULL,
-		GLB_FAT_OFFSET + this->vcFAT.size() * GLB_FAT_ENTRY_LEN,
-		GLB_FAT_ENTRY_LEN,
-		0
-	);
+	if (!spare) {
+		// Update the offsets now there's a new FAT entry taking up space.
+		this->shiftFiles(NULL, offFATEnd, GLB_FAT_ENTRY_LEN, 0);
+	}
 
 	this->updateFileCount(this->vcFAT.size() + 1);
 	return;
@@ -315,16 +334,15 @@ void Archive_GLB_Raptor::preRemoveFile(const FATEntry *pid)
 {
 	// TESTED BY: fmt_glb_raptor_remove*
 
-	// Update the offsets now there's one less FAT entry taking up space.  This
-	// must be called before the FAT is altered, because it will write a new
-	// offset into the FAT entry we're about to erase (and if we erase it first
-	// it'll overwrite something else.)
-	this->shiftFiles(
-		NULL,
-		GLB_FAT_OFFSET + this->vcFAT.size() * GLB_FAT_ENTRY_LEN,
-		-GLB_FAT_ENTRY_LEN,
-		0
-	);
+	stream::pos offFATEnd = GLB_FAT_OFFSET
+		+ this->vcFAT.size() * GLB_FAT_ENTRY_LEN;
+	if (!this->keepSpareEntry(offFATEnd)) {
+		// Update the offsets now there's one less FAT entry taking up space.  This
+		// must be called before the FAT is altered, because it will write a new
+		// offset into the FAT entry we're about to erase (and if we erase it
+		// first it'll overwrite something else.)
+		this->shiftFiles(NULL, offFATEnd, -GLB_FAT_ENTRY_LEN, 0);
+	}
 
 	this->fat->seekp(GLB_FATENTRY_OFFSET(pid), stream::start);
 	this->fat->remove(GLB_FAT_ENTRY_LEN);
@@ -55,6 +55,7 @@ class Archive_GLB_Raptor: virtual public Archive_FAT
 		virtual ~Archive_GLB_Raptor();
 
 		virtual void flush();
+		virtual void attribute(unsigned int index, int newValue);
 		virtual void updateFileName(const FATEntry *pid,
 			const std::string& strNewName);
 		virtual void updateFileOffset(const FATEntry *pid, stream::delta offDelta);
@@ -64,7 +65,7 @@ class Archive_GLB_Raptor: virtual public Archive_FAT
 		virtual void preRemoveFile(const FATEntry *pid);
 
 	protected:
-		std::unique_ptr<stream::seg> fat;        ///< Cleartext version of FAT
+		std::unique_ptr<piece_table> fat;      ///< Cleartext version of FAT
 
 		/// Update the header with the number of files in the archive
 		void updateFileCount(uint32_t iNewCount);
@@ -24,6 +24,7 @@
 #include <cassert>
 #include <camoto/iostream_helpers.hpp>
 #include <camoto/util.hpp>
+#include "fat-layout.hpp"
 #include "fmt-grp-duke3d.hpp"
 
 #define GRP_FILECOUNT_OFFSET    12
@@ -36,14 +37,65 @@
 
 #define GRP_SAFETY_MAX_FILECOUNT  8192 // Maximum value we will load
 
-#define GRP_FATENTRY_OFFSET(e) (GRP_HEADER_LEN + e->iIndex * GRP_FAT_ENTRY_LEN)
-
-#define GRP_FILENAME_OFFSET(e) GRP_FATENTRY_OFFSET(e)
-#define GRP_FILESIZE_OFFSET(e) (GRP_FATENTRY_OFFSET(e) + GRP_FILENAME_FIELD_LEN)
-
 namespace camoto {
 namespace gamearchive {
 
+/// Layout of each FAT entry: filename then u32le size.
+typedef FATLayout<GRP_FAT_OFFSET, GRP_FAT_ENTRY_LEN,
+	fatfield::NullPadded<0, GRP_FILENAME_FIELD_LEN>,
+	fatfield::None,
+	fatfield::UIntLE<GRP_FILENAME_FIELD_LEN, 4>
+> GRPLayout;
+
+/// Decode one FAT entry, shared by probe() and the Archive constructor.
+/**
+ * @param raw
+ *   FAT entry as returned by GRPLayout::readEntries().
+ *
+ * @param f
+ *   Entry to populate.
+ *
+ * @param index
+ *   Index of the entry.
+ *
+ * @param offNext
+ *   Offset of this file's data, advanced to the offset of the next file.
+ */
+static void decodeFATEntry(const uint8_t *raw, Archive_FAT::FATEntry *f,
+	unsigned int index, stream::pos& offNext)
+{
+	f->iIndex = index;
+	f->iOffset = offNext;
+	f->lenHeader = 0;
+	f->type = FILETYPE_GENERIC;
+	f->fAttr = Archive::File::Attribute::Default;
+	f->bValid = true;
+
+	GRPLayout::decode(raw, f);
+	offNext += f->storedSize;
+	return;
+}
+
+/// Header checked by probe(), with the FAT left until the archive is opened.
+struct ProbedFAT_GRP: public Archive_FAT::ProbedFAT
+{
+	uint32_t numFiles; ///< File count from the header
+
+	virtual void parse(stream::input& content)
+	{
+		content.seekg(GRP_FAT_OFFSET, stream::start);
+		stream::pos offNext = GRPLayout::fatEnd(this->numFiles);
+		auto raw = GRPLayout::readEntries(content, this->numFiles);
+		this->entries.reserve(this->numFiles);
+		for (unsigned int i = 0; i < this->numFiles; i++) {
+			auto f = std::make_unique<Archive_FAT::FATEntry>();
+			decodeFATEntry(&raw[i * GRP_FAT_ENTRY_LEN], f.get(), i, offNext);
+			this->entries.push_back(std::move(f));
+		}
+		return;
+	}
+};
+
 ArchiveType_GRP_Duke3D::ArchiveType_GRP_Duke3D()
 {
 }
@@ -81,6 +133,13 @@ std::vector<std::string> ArchiveType_GRP_Duke3D::games() const
 ArchiveType::Certainty ArchiveType_GRP_Duke3D::isInstance(
 	stream::input& content) const
 {
+	return this->probe(content, nullptr);
+}
+
+ArchiveType::Certainty ArchiveType_GRP_Duke3D::probe(stream::input& content,
+	std::unique_ptr<ProbeResult> *parsed) const
+{
+	if (parsed) parsed->reset();
 	stream::pos lenArchive = content.size();
 
 	// File too short
@@ -95,6 +154,25 @@ ArchiveType::Certainty ArchiveType_GRP_Duke3D::isInstance(
 	// TESTED BY: fmt_grp_duke3d_isinstance_c01
 	if (strncmp(sig, "KenSilverman", 12) != 0) return Certainty::DefinitelyNo;
 
+	if (parsed) {
+		// The signature is enough to be sure, so only the header is checked
+		// here.  The FAT is read by ProbedFAT_GRP::parse() if the archive is
+		// opened.
+		uint32_t numFiles;
+		content >> u32le(numFiles);
+		if (
+			(numFiles < GRP_SAFETY_MAX_FILECOUNT)
+			&& (GRP_HEADER_LEN + (stream::len)numFiles * GRP_FAT_ENTRY_LEN
+				<= lenArchive)
+		) {
+			auto fat = std::make_unique<ProbedFAT_GRP>();
+			fat->lenArchive = lenArchive;
+			fat->numFiles = numFiles;
+			fat->readHeader(content, GRP_HEADER_LEN);
+			*parsed = std::move(fat);
+		}
+	}
+
 	// TESTED BY: fmt_grp_duke3d_isinstance_c00
 	return Certainty::DefinitelyYes;
 }
@@ -113,6 +191,14 @@ std::shared_ptr<Archive> ArchiveType_GRP_Duke3D::open(
 	return std::make_shared<Archive_GRP_Duke3D>(std::move(content));
 }
 
+std::shared_ptr<Archive> ArchiveType_GRP_Duke3D::openProbed(
+	std::unique_ptr<stream::inout> content, SuppData& suppData,
+	std::unique_ptr<ProbeResult> parsed) const
+{
+	return std::make_shared<Archive_GRP_Duke3D>(std::move(content),
+		std::move(parsed));
+}
+
 SuppFilenames ArchiveType_GRP_Duke3D::getRequiredSupps(stream::input& data,
 	const std::string& filename) const
 {
@@ -120,9 +206,12 @@ SuppFilenames ArchiveType_GRP_Duke3D::getRequiredSupps(stream::input& data,
 }
 
 
-Archive_GRP_Duke3D::Archive_GRP_Duke3D(std::unique_ptr<stream::inout> content)
+Archive_GRP_Duke3D::Archive_GRP_Duke3D(std::unique_ptr<stream::inout> content,
+	std::unique_ptr<ArchiveType::ProbeResult> parsed)
 	:	Archive_FAT(std::move(content), GRP_FIRST_FILE_OFFSET, GRP_MAX_FILENAME_LEN)
 {
+	if (this->useProbedFAT(parsed)) return;
+
 	this->content->seekg(GRP_FILECOUNT_OFFSET, stream::start); // skip "KenSilverman" sig
 
 	// We still have to perform sanity checks in case the user forced an archive
@@ -136,24 +225,11 @@ Archive_GRP_Duke3D::Archive_GRP_Duke3D(std::unique_ptr<stream::inout> content)
 		throw stream::error("too many files or corrupted archive");
 	}
 
-	stream::pos offNext = GRP_HEADER_LEN + (numFiles * GRP_FAT_ENTRY_LEN);
+	stream::pos offNext = GRPLayout::fatEnd(numFiles);
+	auto raw = GRPLayout::readEntries(*this->content, numFiles);
 	for (unsigned int i = 0; i < numFiles; i++) {
 		auto f = std::make_unique<FATEntry>();
-
-		f->iIndex = i;
-		f->iOffset = offNext;
-		f->lenHeader = 0;
-		f->type = FILETYPE_GENERIC;
-		f->fAttr = File::Attribute::Default;
-		f->bValid = true;
-
-		// Read the data in from the FAT entry in the file
-		*this->content
-			>> nullPadded(f->strName, GRP_FILENAME_FIELD_LEN)
-			>> u32le(f->storedSize);
-
-		f->realSize = f->storedSize;
-		offNext += f->storedSize;
+		decodeFATEntry(&raw[i * GRP_FAT_ENTRY_LEN], f.get(), i, offNext);
 		this->vcFAT.push_back(std::move(f));
 	}
 }
@@ -167,8 +243,7 @@ void Archive_GRP_Duke3D::updateFileName(const FATEntry *pid,
 {
 	// TESTED BY: fmt_grp_duke3d_rename
 	assert(strNewName.length() <= GRP_MAX_FILENAME_LEN);
-	this->content->seekp(GRP_FILENAME_OFFSET(pid), stream::start);
-	*this->content << nullPadded(strNewName, GRP_FILENAME_FIELD_LEN);
+	GRPLayout::writeName(*this->content, pid, strNewName);
 	return;
 }
 
@@ -177,8 +252,7 @@ void Archive_GRP_Duke3D::updateFileSize(const FATEntry *pid,
 {
 	// TESTED BY: fmt_grp_duke3d_insert*
 	// TESTED BY: fmt_grp_duke3d_resize*
-	this->content->seekp(GRP_FILESIZE_OFFSET(pid), stream::start);
-	*this->content << u32le(pid->storedSize);
+	GRPLayout::writeSize(*this->content, pid);
 	return;
 }
 
@@ -194,18 +268,13 @@ void Archive_GRP_Duke3D::preInsertFile(const FATEntry *idBeforeThis,
 	// Because the new entry isn't in the vector yet we need to shift it manually
 	pNewEntry->iOffset += GRP_FAT_ENTRY_LEN;
 
-	this->content->seekp(GRP_FATENTRY_OFFSET(pNewEntry), stream::start);
-	this->content->insert(GRP_FAT_ENTRY_LEN);
 	camoto::uppercase(pNewEntry->strName);
-
-	*this->content
-		<< nullPadded(pNewEntry->strName, GRP_FILENAME_FIELD_LEN)
-		<< u32le(pNewEntry->storedSize);
+	GRPLayout::insertEntry(*this->content, pNewEntry);
 
 	// Update the offsets now there's a new FAT entry taking up space.
 	this->shiftFiles(
 		NULL,
-		GRP_FAT_OFFSET + this->vcFAT.size() * GRP_FAT_ENTRY_LEN,
+		GRPLayout::fatEnd(this->vcFAT.size()),
 		GRP_FAT_ENTRY_LEN,
 		0
 	);
@@ -224,13 +293,12 @@ void Archive_GRP_Duke3D::preRemoveFile(const FATEntry *pid)
 	// it'll overwrite something else.)
 	this->shiftFiles(
 		NULL,
-		GRP_FAT_OFFSET + this->vcFAT.size() * GRP_FAT_ENTRY_LEN,
+		GRPLayout::fatEnd(this->vcFAT.size()),
 		-GRP_FAT_ENTRY_LEN,
 		0
 	);
 
-	this->content->seekp(GRP_FATENTRY_OFFSET(pid), stream::start);
-	this->content->remove(GRP_FAT_ENTRY_LEN);
+	GRPLayout::removeEntry(*this->content, pid);
 
 	this->updateFileCount(this->vcFAT.size() - 1);
 	return;
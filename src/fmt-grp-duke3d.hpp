@@ -39,10 +39,15 @@ class ArchiveType_GRP_Duke3D: virtual public ArchiveType
 		virtual std::vector<std::string> fileExtensions() const;
 		virtual std::vector<std::string> games() const;
 		virtual ArchiveType::Certainty isInstance(stream::input& content) const;
+		virtual ArchiveType::Certainty probe(stream::input& content,
+			std::unique_ptr<ProbeResult> *parsed) const;
 		virtual std::shared_ptr<Archive> create(
 			std::unique_ptr<stream::inout> content, SuppData& suppData) const;
 		virtual std::shared_ptr<Archive> open(
 			std::unique_ptr<stream::inout> content, SuppData& suppData) const;
+		virtual std::shared_ptr<Archive> openProbed(
+			std::unique_ptr<stream::inout> content, SuppData& suppData,
+			std::unique_ptr<ProbeResult> parsed) const;
 		virtual SuppFilenames getRequiredSupps(stream::input& content,
 			const std::string& filename) const;
 };
@@ -51,7 +56,8 @@ class ArchiveType_GRP_Duke3D: virtual public ArchiveType
 class Archive_GRP_Duke3D: virtual public Archive_FAT
 {
 	public:
-		Archive_GRP_Duke3D(std::unique_ptr<stream::inout> content);
+		Archive_GRP_Duke3D(std::unique_ptr<stream::inout> content,
+			std::unique_ptr<ArchiveType::ProbeResult> parsed = nullptr);
 		virtual ~Archive_GRP_Duke3D();
 
 		virtual void updateFileName(const FATEntry *pid,
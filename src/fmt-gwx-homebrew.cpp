@@ -24,6 +24,7 @@
 #include <cassert>
 #include <camoto/iostream_helpers.hpp>
 #include <camoto/util.hpp>
+#include "fat-layout.hpp"
 #include "fmt-gwx-homebrew.hpp"
 
 #define GWx_FAT_OFFSET            0x40
@@ -31,14 +32,17 @@
 #define GWx_MAX_FILENAME_LEN      12
 #define GWx_FIRST_FILE_OFFSET     GWx_FAT_OFFSET
 
-#define GWx_FATENTRY_OFFSET(e)   (GWx_FAT_OFFSET + (e)->iIndex * GWx_FAT_ENTRY_LEN)
-#define GWx_FILENAME_OFFSET(e)    GWx_FATENTRY_OFFSET(e)
-#define GWx_FILEOFFSET_OFFSET(e) (GWx_FATENTRY_OFFSET(e) + GWx_MAX_FILENAME_LEN + 4)
-#define GWx_FILESIZE_OFFSET(e)   (GWx_FILEOFFSET_OFFSET(e) + 4)
-
 namespace camoto {
 namespace gamearchive {
 
+/// Layout of each FAT entry: filename, padding, u32le offset, u32le size and
+/// more padding.
+typedef FATLayout<GWx_FAT_OFFSET, GWx_FAT_ENTRY_LEN,
+	fatfield::NullPadded<0, GWx_MAX_FILENAME_LEN>,
+	fatfield::UIntLE<GWx_MAX_FILENAME_LEN + 4, 4>,
+	fatfield::UIntLE<GWx_MAX_FILENAME_LEN + 8, 4>
+> GWxLayout;
+
 ArchiveType_GWx_HomeBrew::ArchiveType_GWx_HomeBrew()
 {
 }
@@ -123,30 +127,24 @@ SuppFilenames ArchiveType_GWx_HomeBrew::getRequiredSupps(stream::input& content,
 Archive_GWx_HomeBrew::Archive_GWx_HomeBrew(std::unique_ptr<stream::inout> content)
 	:	Archive_FAT(std::move(content), GWx_FIRST_FILE_OFFSET, GWx_MAX_FILENAME_LEN)
 {
+	this->bCanShare = true;
+
 	this->content->seekg(0x22, stream::start);
 	uint32_t numFiles;
 	*this->content >> u32le(numFiles);
-	this->vcFAT.reserve(numFiles);
 
 	this->content->seekg(GWx_FAT_OFFSET, stream::start);
+	auto raw = GWxLayout::readEntries(*this->content, numFiles);
+	this->vcFAT.reserve(numFiles);
 
 	for (unsigned int i = 0; i < numFiles; i++) {
 		auto f = this->createNewFATEntry();
 		f->iIndex = i;
-		*this->content
-			>> nullPadded(f->strName, GWx_MAX_FILENAME_LEN)
-		;
-		this->content->seekg(4, stream::cur);
-		*this->content
-			>> u32le(f->iOffset)
-			>> u32le(f->storedSize)
-		;
-		this->content->seekg(8, stream::cur);
+		GWxLayout::decode(&raw[i * GWx_FAT_ENTRY_LEN], f.get());
 		f->lenHeader = 0;
 		f->type = FILETYPE_GENERIC;
 		f->fAttr = File::Attribute::Default;
 		f->bValid = true;
-		f->realSize = f->storedSize;
 		this->vcFAT.push_back(std::move(f));
 	}
 }
@@ -159,8 +157,7 @@ void Archive_GWx_HomeBrew::updateFileName(const FATEntry *pid, const std::string
 {
 	// TESTED BY: fmt_gwx_homebrew_rename
 	assert(strNewName.length() <= GWx_MAX_FILENAME_LEN);
-	this->content->seekp(GWx_FILENAME_OFFSET(pid), stream::start);
-	*this->content << nullPadded(strNewName, GWx_MAX_FILENAME_LEN);
+	GWxLayout::writeName(*this->content, pid, strNewName);
 	return;
 }
 
@@ -168,8 +165,7 @@ void Archive_GWx_HomeBrew::updateFileOffset(const FATEntry *pid, stream::delta o
 {
 	// TESTED BY: fmt_gwx_homebrew_insert*
 	// TESTED BY: fmt_gwx_homebrew_resize*
-	this->content->seekp(GWx_FILEOFFSET_OFFSET(pid), stream::start);
-	*this->content << u32le(pid->iOffset);
+	GWxLayout::writeOffset(*this->content, pid);
 	return;
 }
 
@@ -177,8 +173,7 @@ void Archive_GWx_HomeBrew::updateFileSize(const FATEntry *pid, stream::delta siz
 {
 	// TESTED BY: fmt_gwx_homebrew_insert*
 	// TESTED BY: fmt_gwx_homebrew_resize*
-	this->content->seekp(GWx_FILESIZE_OFFSET(pid), stream::start);
-	*this->content << u32le(pid->storedSize);
+	GWxLayout::writeSize(*this->content, pid);
 	return;
 }
 
@@ -193,24 +188,13 @@ void Archive_GWx_HomeBrew::preInsertFile(const FATEntry *idBeforeThis, FATEntry
 	// Because the new entry isn't in the vector yet we need to shift it manually
 	pNewEntry->iOffset += GWx_FAT_ENTRY_LEN;
 
-	this->content->seekp(GWx_FATENTRY_OFFSET(pNewEntry), stream::start);
-	this->content->insert(GWx_FAT_ENTRY_LEN);
 	camoto::uppercase(pNewEntry->strName);
-
-	// Write out the entry
-	*this->content
-		<< nullPadded(pNewEntry->strName, GWx_MAX_FILENAME_LEN)
-		<< u32le(0) // padding
-		<< u32le(pNewEntry->iOffset)
-		<< u32le(pNewEntry->storedSize)
-		<< u32le(0) // padding
-		<< u32le(0) // padding
-	;
+	GWxLayout::insertEntry(*this->content, pNewEntry);
 
 	// Update the offsets now there's a new FAT entry taking up space.
 	this->shiftFiles(
 		NULL,
-		GWx_FAT_OFFSET + this->vcFAT.size() * GWx_FAT_ENTRY_LEN,
+		GWxLayout::fatEnd(this->vcFAT.size()),
 		GWx_FAT_ENTRY_LEN,
 		0
 	);
@@ -230,14 +214,13 @@ void Archive_GWx_HomeBrew::preRemoveFile(const FATEntry *pid)
 	// it'll overwrite something else.)
 	this->shiftFiles(
 		NULL,
-		GWx_FAT_OFFSET + this->vcFAT.size() * GWx_FAT_ENTRY_LEN,
+		GWxLayout::fatEnd(this->vcFAT.size()),
 		-GWx_FAT_ENTRY_LEN,
 		0
 	);
 
 	// Remove the FAT entry
-	this->content->seekp(GWx_FATENTRY_OFFSET(pid), stream::start);
-	this->content->remove(GWx_FAT_ENTRY_LEN);
+	GWxLayout::removeEntry(*this->content, pid);
 
 	this->updateFileCount(this->vcFAT.size() - 1);
 
@@ -24,6 +24,7 @@
 #include <cassert>
 #include <camoto/iostream_helpers.hpp>
 #include <camoto/util.hpp> // std::make_unique
+#include "fat-layout.hpp"
 #include "fmt-lib-mythos.hpp"
 
 #define LIB_HEADER_LEN          4  // "LIB\x1A"
@@ -36,13 +37,17 @@
 
 #define LIB_SAFETY_MAX_FILECOUNT  8192 // Maximum value we will load
 
-#define LIB_FATENTRY_OFFSET(e)   (LIB_FAT_OFFSET + e->iIndex * LIB_FAT_ENTRY_LEN)
-#define LIB_FILENAME_OFFSET(e)   LIB_FATENTRY_OFFSET(e)
-#define LIB_FILEOFFSET_OFFSET(e) (LIB_FATENTRY_OFFSET(e) + LIB_FILENAME_FIELD_LEN)
-
 namespace camoto {
 namespace gamearchive {
 
+/// Layout of each FAT entry: filename then u32le offset.  There is no size,
+/// as each file runs up to the start of the next.
+typedef FATLayout<LIB_FAT_OFFSET, LIB_FAT_ENTRY_LEN,
+	fatfield::NullPadded<0, LIB_FILENAME_FIELD_LEN>,
+	fatfield::UIntLE<LIB_FILENAME_FIELD_LEN, 4>,
+	fatfield::None
+> LIBLayout;
+
 ArchiveType_LIB_Mythos::ArchiveType_LIB_Mythos()
 {
 }
@@ -129,11 +134,15 @@ Archive_LIB_Mythos::Archive_LIB_Mythos(std::unique_ptr<stream::inout> content)
 	this->content->seekg(4, stream::start);
 	*this->content >> u16le(numFiles);
 
+	if (numFiles >= LIB_SAFETY_MAX_FILECOUNT) {
+		throw stream::error("too many files or corrupted archive");
+	}
+
+	// Read the spacer entry after the last file too, for the final file's size
+	auto raw = LIBLayout::readEntries(*this->content, numFiles + 1);
+
 	FATEntry *fatLast = NULL;
 	for (unsigned int i = 0; i <= numFiles; i++) {
-		if (i >= LIB_SAFETY_MAX_FILECOUNT) {
-			throw stream::error("too many files or corrupted archive");
-		}
 		auto f = this->createNewFATEntry();
 
 		f->iIndex = i;
@@ -141,10 +150,7 @@ Archive_LIB_Mythos::Archive_LIB_Mythos(std::unique_ptr<stream::inout> content)
 		f->type = FILETYPE_GENERIC;
 		f->fAttr = File::Attribute::Default;
 		f->bValid = true;
-		*this->content
-			>> nullPadded(f->strName, LIB_FILENAME_FIELD_LEN)
-			>> u32le(f->iOffset)
-		;
+		LIBLayout::decode(&raw[i * LIB_FAT_ENTRY_LEN], f.get());
 		if (fatLast) {
 			fatLast->storedSize = f->iOffset - fatLast->iOffset;
 			fatLast->realSize = fatLast->storedSize;
@@ -164,15 +170,13 @@ void Archive_LIB_Mythos::updateFileName(const FATEntry *pid, const std::string&
 {
 	// TESTED BY: fmt_lib_mythos_rename
 	assert(strNewName.length() <= LIB_MAX_FILENAME_LEN);
-	this->content->seekp(LIB_FILENAME_OFFSET(pid), stream::start);
-	*this->content << nullPadded(strNewName, LIB_FILENAME_FIELD_LEN);
+	LIBLayout::writeName(*this->content, pid, strNewName);
 	return;
 }
 
 void Archive_LIB_Mythos::updateFileOffset(const FATEntry *pid, stream::delta offDelta)
 {
-	this->content->seekp(LIB_FILEOFFSET_OFFSET(pid), stream::start);
-	*this->content << u32le(pid->iOffset);
+	LIBLayout::writeOffset(*this->content, pid);
 	return;
 }
 
@@ -197,19 +201,13 @@ void Archive_LIB_Mythos::preInsertFile(const FATEntry *idBeforeThis, FATEntry *p
 	// Update the last FAT entry (the one that points to EOF.)
 	this->updateLastEntry(pNewEntry->storedSize + LIB_FAT_ENTRY_LEN);
 
-	this->content->seekp(LIB_FATENTRY_OFFSET(pNewEntry), stream::start);
-	this->content->insert(LIB_FAT_ENTRY_LEN);
 	camoto::uppercase(pNewEntry->strName);
-
-	*this->content
-		<< nullPadded(pNewEntry->strName, LIB_FILENAME_FIELD_LEN)
-		<< u32le(pNewEntry->iOffset)
-	;
+	LIBLayout::insertEntry(*this->content, pNewEntry);
 
 	// Update the offsets now there's a new FAT entry taking up space.
 	this->shiftFiles(
 		NULL,
-		LIB_FAT_OFFSET + (this->vcFAT.size() + 1) * LIB_FAT_ENTRY_LEN,
+		LIBLayout::fatEnd(this->vcFAT.size() + 1),
 		LIB_FAT_ENTRY_LEN,
 		0
 	);
@@ -231,13 +229,12 @@ void Archive_LIB_Mythos::preRemoveFile(const FATEntry *pid)
 	// it'll overwrite something else.)
 	this->shiftFiles(
 		NULL,
-		LIB_FAT_OFFSET + (this->vcFAT.size() + 1) * LIB_FAT_ENTRY_LEN,
+		LIBLayout::fatEnd(this->vcFAT.size() + 1),
 		-LIB_FAT_ENTRY_LEN,
 		0
 	);
 
-	this->content->seekp(LIB_FATENTRY_OFFSET(pid), stream::start);
-	this->content->remove(LIB_FAT_ENTRY_LEN);
+	LIBLayout::removeEntry(*this->content, pid);
 
 	this->updateFileCount(this->vcFAT.size() - 1);
 	return;
@@ -247,10 +244,8 @@ void Archive_LIB_Mythos::updateLastEntry(stream::delta lenDelta)
 {
 	assert(this->lenArchive >= 0x17); // smallest valid size (sig+fat terminator)
 	this->lenArchive += lenDelta;
-	this->content->seekp(LIB_FAT_OFFSET + this->vcFAT.size() * LIB_FAT_ENTRY_LEN
-		+ LIB_FILENAME_FIELD_LEN, stream::start);
-	*this->content
-		<< u32le(this->lenArchive);
+	LIBLayout::writeField<LIBLayout::OffsetField>(*this->content,
+		this->vcFAT.size(), (uint64_t)this->lenArchive);
 	return;
 }
 
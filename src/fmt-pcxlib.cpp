@@ -24,6 +24,7 @@
 #include <cassert>
 #include <camoto/iostream_helpers.hpp>
 #include <camoto/util.hpp>
+#include "fat-layout.hpp"
 #include "fmt-pcxlib.hpp"
 
 #define PCX_MAX_FILES         65535
@@ -38,14 +39,56 @@
 #define PCX_MAX_FILENAME_LEN  12
 #define PCX_FIRST_FILE_OFFSET PCX_FAT_OFFSET
 
-#define PCX_FATENTRY_OFFSET(e)   (PCX_FAT_OFFSET + (e)->iIndex * PCX_FAT_ENTRY_LEN)
-#define PCX_FILENAME_OFFSET(e)   (PCX_FATENTRY_OFFSET(e) + 1)
-#define PCX_FILEOFFSET_OFFSET(e) (PCX_FATENTRY_OFFSET(e) + 14)
-#define PCX_FILESIZE_OFFSET(e)   (PCX_FATENTRY_OFFSET(e) + 18)
-
 namespace camoto {
 namespace gamearchive {
 
+/// Layout of each FAT entry: sync byte, filename, extension, u32le offset,
+/// u32le size, u16le date and u16le time.
+/**
+ * The filename is split into two space-padded fields, so it is handled by
+ * decodeName() and encodeName() instead.
+ */
+typedef FATLayout<PCX_FAT_OFFSET, PCX_FAT_ENTRY_LEN,
+	fatfield::None,
+	fatfield::UIntLE<14, 4>,
+	fatfield::UIntLE<18, 4>
+> PCXLayout;
+
+/// Filename part of the name in a FAT entry.
+typedef fatfield::NullPadded<1, 8> PCXNameField;
+
+/// Extension part of the name in a FAT entry, including the dot.
+typedef fatfield::NullPadded<9, 5> PCXExtField;
+
+/// Get the filename from a raw FAT entry.
+static std::string decodeName(const uint8_t *raw)
+{
+	std::string name, ext;
+	PCXNameField::read(raw, name);
+	PCXExtField::read(raw, ext);
+	return name.substr(0, name.find_first_of(' '))
+		+ ext.substr(0, ext.find_first_of(' '));
+}
+
+/// Put a filename into a raw FAT entry, padding it with spaces.
+/**
+ * @throws stream::error if the filename won't fit.
+ */
+static void encodeName(uint8_t *raw, const std::string& strName)
+{
+	int pos = strName.find_last_of('.');
+	std::string name = strName.substr(0, pos);
+	while (name.length() < 8) name += ' ';
+	std::string ext = strName.substr(pos);
+	if (ext.length() > 4) {
+		throw stream::error("Filename extension too long - three letters max.");
+	}
+	while (ext.length() < 4) ext += ' ';
+	PCXNameField::write(raw, name);
+	PCXExtField::write(raw, ext);
+	return;
+}
+
 ArchiveType_PCXLib::ArchiveType_PCXLib()
 {
 }
@@ -223,32 +266,23 @@ Archive_PCXLib::Archive_PCXLib(std::unique_ptr<stream::inout> content)
 
 	// Skip over remaining header
 	this->content->seekg(32, stream::cur);
+	auto raw = PCXLayout::readEntries(*this->content, numFiles);
 
 	for (int i = 0; i < numFiles; i++) {
 		auto f = this->createNewFATEntry();
-
-		uint8_t sync;
-		std::string name, ext;
-		uint16_t date, time;
-		*this->content
-			>> u8(sync)
-			>> nullPadded(name, 8)
-			>> nullPadded(ext, 5)
-			>> u32le(f->iOffset)
-			>> u32le(f->storedSize)
-			>> u16le(date)
-			>> u16le(time)
-		;
-		f->strName = name.substr(0, name.find_first_of(' ')) + ext.substr(0, ext.find_first_of(' '));
+		const uint8_t *entry = &raw[i * PCX_FAT_ENTRY_LEN];
+		PCXLayout::decode(entry, f.get());
+		f->strName = decodeName(entry);
 
 		f->iIndex = i;
 		f->lenHeader = 0;
 		f->type = FILETYPE_GENERIC;
 		f->fAttr = File::Attribute::Default;
 		f->bValid = true;
-		f->realSize = f->storedSize;
 		this->vcFAT.push_back(std::move(f));
 	}
+
+	this->initSpareEntries(PCXLayout::fatEnd(numFiles), PCX_FAT_ENTRY_LEN);
 }
 
 Archive_PCXLib::~Archive_PCXLib()
@@ -289,23 +323,26 @@ void Archive_PCXLib::flush()
 	return;
 }
 
+void Archive_PCXLib::attribute(unsigned int index, int newValue)
+{
+	// TESTED BY: test_archive::test_spare_entries
+	this->Archive_FAT::attribute(index, newValue);
+	if (this->lenSpareEntry && (index == this->attrSpareEntries)) {
+		this->setSpareEntries(PCXLayout::fatEnd(this->vcFAT.size()), newValue);
+	}
+	return;
+}
+
 void Archive_PCXLib::updateFileName(const FATEntry *pid, const std::string& strNewName)
 {
 	// TESTED BY: fmt_pcxlib_rename
 	assert(strNewName.length() <= PCX_MAX_FILENAME_LEN);
-	this->content->seekp(PCX_FILENAME_OFFSET(pid), stream::start);
-	int pos = strNewName.find_last_of('.');
-	std::string name = strNewName.substr(0, pos);
-	while (name.length() < 8) name += ' ';
-	std::string ext = strNewName.substr(pos);
-	if (ext.length() > 4) {
-		throw stream::error("Filename extension too long - three letters max.");
-	}
-	while (ext.length() < 4) ext += ' ';
-	*this->content
-		<< nullPadded(name, 8)
-		<< nullPadded(ext, 5)
-	;
+	uint8_t raw[PCX_FAT_ENTRY_LEN];
+	encodeName(raw, strNewName);
+	this->content->seekp(PCXLayout::entryOffset(pid->iIndex)
+		+ PCXNameField::offset, stream::start);
+	this->content->write(raw + PCXNameField::offset,
+		PCXNameField::width + PCXExtField::width);
 	return;
 }
 
@@ -313,8 +350,7 @@ void Archive_PCXLib::updateFileOffset(const FATEntry *pid, stream::delta offDelt
 {
 	// TESTED BY: fmt_pcxlib_insert*
 	// TESTED BY: fmt_pcxlib_resize*
-	this->content->seekp(PCX_FILEOFFSET_OFFSET(pid), stream::start);
-	*this->content << u32le(pid->iOffset);
+	PCXLayout::writeOffset(*this->content, pid);
 	return;
 }
 
@@ -322,8 +358,7 @@ void Archive_PCXLib::updateFileSize(const FATEntry *pid, stream::delta sizeDelta
 {
 	// TESTED BY: fmt_pcxlib_insert*
 	// TESTED BY: fmt_pcxlib_resize*
-	this->content->seekp(PCX_FILESIZE_OFFSET(pid), stream::start);
-	*this->content << u32le(pid->storedSize);
+	PCXLayout::writeSize(*this->content, pid);
 	return;
 }
 
@@ -336,45 +371,34 @@ void Archive_PCXLib::preInsertFile(const FATEntry *idBeforeThis,
 	// Set the format-specific variables
 	pNewEntry->lenHeader = 0;
 
-	// Because the new entry isn't in the vector yet we need to shift it manually
-	pNewEntry->iOffset += PCX_FAT_ENTRY_LEN;
-
 	if (this->vcFAT.size() >= PCX_MAX_FILES) {
 		throw stream::error("too many files, maximum is " TOSTRING(PCX_MAX_FILES));
 	}
-	this->content->seekp(PCX_FATENTRY_OFFSET(pNewEntry), stream::start);
-	this->content->insert(PCX_FAT_ENTRY_LEN);
-	camoto::uppercase(pNewEntry->strName);
 
-	int pos = pNewEntry->strName.find_last_of('.');
-	std::string name = pNewEntry->strName.substr(0, pos);
-	while (name.length() < 8) name += ' ';
-	std::string ext = pNewEntry->strName.substr(pos);
-	if (ext.length() > 4) {
-		throw stream::error("Filename extension too long - three letters max.");
+	stream::pos offFATEnd = PCXLayout::fatEnd(this->vcFAT.size());
+	bool spare = this->takeSpareEntry(offFATEnd, pNewEntry);
+	if (!spare) {
+		// Because the new entry isn't in the vector yet we need to shift it
+		// manually
+		pNewEntry->iOffset += PCX_FAT_ENTRY_LEN;
 	}
-	while (ext.length() < 4) ext += ' ';
 
-	uint16_t date = 0, time = 0; // TODO
-
-	// Write out the entry
-	*this->content
-		<< u8(0) // sync byte
-		<< nullPadded(name, 8)
-		<< nullPadded(ext, 5)
-		<< u32le(pNewEntry->iOffset)
-		<< u32le(pNewEntry->storedSize)
-		<< u16le(date)
-		<< u16le(time)
-	;
-
-	// Update the offsets now there's a new FAT entry taking up space.
-	this->shiftFiles(
-		NULL,
-		PCX_FAT_OFFSET + this->vcFAT.size() * PCX_FAT_ENTRY_LEN,
-		PCX_FAT_ENTRY_LEN,
-		0
-	);
+	camoto::uppercase(pNewEntry->strName);
+
+	// Write out the entry, with a zero sync byte, date and time
+	/// @todo Write date and time
+	uint8_t raw[PCX_FAT_ENTRY_LEN];
+	PCXLayout::encode(pNewEntry, raw);
+	encodeName(raw, pNewEntry->strName);
+	this->content->seekp(PCXLayout::entryOffset(pNewEntry->iIndex),
+		stream::start);
+	this->content->insert(PCX_FAT_ENTRY_LEN);
+	this->content->write(raw, PCX_FAT_ENTRY_LEN);
+
+	if (!spare) {
+		// Update the offsets now there's a new FAT entry taking up space.
+		this->shiftFiles(NULL, offFATEnd, PCX_FAT_ENTRY_LEN, 0);
+	}
 
 	this->updateFileCount(this->vcFAT.size() + 1);
 
@@ -385,20 +409,17 @@ void Archive_PCXLib::preRemoveFile(const FATEntry *pid)
 {
 	// TESTED BY: fmt_pcxlib_remove*
 
-	// Update the offsets now there's one less FAT entry taking up space.  This
-	// must be called before the FAT is altered, because it will write a new
-	// offset into the FAT entry we're about to erase (and if we erase it first
-	// it'll overwrite something else.)
-	this->shiftFiles(
-		NULL,
-		PCX_FAT_OFFSET + this->vcFAT.size() * PCX_FAT_ENTRY_LEN,
-		-PCX_FAT_ENTRY_LEN,
-		0
-	);
+	stream::pos offFATEnd = PCXLayout::fatEnd(this->vcFAT.size());
+	if (!this->keepSpareEntry(offFATEnd)) {
+		// Update the offsets now there's one less FAT entry taking up space.  This
+		// must be called before the FAT is altered, because it will write a new
+		// offset into the FAT entry we're about to erase (and if we erase it
+		// first it'll overwrite something else.)
+		this->shiftFiles(NULL, offFATEnd, -PCX_FAT_ENTRY_LEN, 0);
+	}
 
 	// Remove the FAT entry
-	this->content->seekp(PCX_FATENTRY_OFFSET(pid), stream::start);
-	this->content->remove(PCX_FAT_ENTRY_LEN);
+	PCXLayout::removeEntry(*this->content, pid);
 
 	this->updateFileCount(this->vcFAT.size() - 1);
 
@@ -55,6 +55,7 @@ class Archive_PCXLib: virtual public Archive_FAT
 		virtual ~Archive_PCXLib();
 
 		virtual void flush();
+		virtual void attribute(unsigned int index, int newValue);
 
 		virtual void updateFileName(const FATEntry *pid,
 			const std::string& strNewName);
@@ -24,6 +24,7 @@
 #include <cassert>
 #include <camoto/iostream_helpers.hpp>
 #include <camoto/util.hpp>
+#include "fat-layout.hpp"
 #include "fmt-pod-tv.hpp"
 
 #define POD_DESCRIPTION_OFFSET    4
@@ -33,14 +34,16 @@
 #define POD_MAX_FILENAME_LEN      32
 #define POD_FIRST_FILE_OFFSET     POD_FAT_OFFSET
 
-#define POD_FATENTRY_OFFSET(e)   (POD_FAT_OFFSET + (e)->iIndex * POD_FAT_ENTRY_LEN)
-#define POD_FILENAME_OFFSET(e)    POD_FATENTRY_OFFSET(e)
-#define POD_FILESIZE_OFFSET(e)   (POD_FATENTRY_OFFSET(e) + POD_MAX_FILENAME_LEN)
-#define POD_FILEOFFSET_OFFSET(e) (POD_FILESIZE_OFFSET(e) + 4)
-
 namespace camoto {
 namespace gamearchive {
 
+/// Layout of each FAT entry: filename, u32le size, then u32le offset.
+typedef FATLayout<POD_FAT_OFFSET, POD_FAT_ENTRY_LEN,
+	fatfield::NullPadded<0, POD_MAX_FILENAME_LEN>,
+	fatfield::UIntLE<POD_MAX_FILENAME_LEN + 4, 4>,
+	fatfield::UIntLE<POD_MAX_FILENAME_LEN, 4>
+> PODLayout;
+
 ArchiveType_POD_TV::ArchiveType_POD_TV()
 {
 }
@@ -76,6 +79,13 @@ std::vector<std::string> ArchiveType_POD_TV::games() const
 ArchiveType::Certainty ArchiveType_POD_TV::isInstance(
 	stream::input& content) const
 {
+	return this->probe(content, nullptr);
+}
+
+ArchiveType::Certainty ArchiveType_POD_TV::probe(stream::input& content,
+	std::unique_ptr<ProbeResult> *parsed) const
+{
+	if (parsed) parsed->reset();
 	stream::pos lenArchive = content.size();
 
 	// Must have filecount + description
@@ -97,15 +107,25 @@ ArchiveType::Certainty ArchiveType_POD_TV::isInstance(
 	}
 
 	// Make sure the FAT fits inside the archive
-	if (POD_FAT_OFFSET + numFiles * POD_FAT_ENTRY_LEN > lenArchive) {
-		return Certainty::DefinitelyNo;
+	if (POD_FAT_OFFSET + (stream::len)numFiles * POD_FAT_ENTRY_LEN > lenArchive) {
+		return Certainty::DefinitelyNo; // TESTED BY: fmt_pod_tv_isinstance_c05
+	}
+
+	// Keep the entries as we check them, so they needn't be read again when
+	// the archive is opened.
+	std::unique_ptr<Archive_FAT::ProbedFAT> fat;
+	if (parsed) {
+		fat = std::make_unique<Archive_FAT::ProbedFAT>();
+		fat->lenArchive = lenArchive;
+		fat->entries.reserve(numFiles);
 	}
 
 	// Check each FAT entry
-	char fn[POD_MAX_FILENAME_LEN];
 	content.seekg(POD_FAT_OFFSET, stream::start);
+	auto raw = PODLayout::readEntries(content, numFiles);
 	for (unsigned int i = 0; i < numFiles; i++) {
-		content.read(fn, POD_MAX_FILENAME_LEN);
+		const uint8_t *entry = &raw[i * POD_FAT_ENTRY_LEN];
+		const char *fn = (const char *)entry;
 		// Make sure there aren't any invalid characters in the filename
 		for (int j = 0; j < POD_MAX_FILENAME_LEN; j++) {
 			if (!fn[j]) break; // stop on terminating null
@@ -114,13 +134,27 @@ ArchiveType::Certainty ArchiveType_POD_TV::isInstance(
 			if (fn[j] < 32) return Certainty::DefinitelyNo; // TESTED BY: fmt_pod_tv_isinstance_c01
 		}
 
-		uint32_t offEntry, lenEntry;
-		content >> u32le(offEntry) >> u32le(lenEntry);
-
 		// If a file entry points past the end of the archive then it's an invalid
 		// format.
 		// TESTED BY: fmt_pod_tv_isinstance_c0[23]
+		uint64_t lenEntry = PODLayout::SizeField::read(entry);
+		uint64_t offEntry = PODLayout::OffsetField::read(entry);
 		if (offEntry + lenEntry > lenArchive) return Certainty::DefinitelyNo;
+
+		if (fat) {
+			auto f = std::make_unique<Archive_FAT::FATEntry>();
+			f->iIndex = i;
+			PODLayout::decode(entry, f.get());
+			f->lenHeader = 0;
+			f->type = FILETYPE_GENERIC;
+			f->fAttr = Archive::File::Attribute::Default;
+			f->bValid = true;
+			fat->entries.push_back(std::move(f));
+		}
+	}
+	if (parsed) {
+		fat->readHeader(content, POD_FAT_OFFSET);
+		*parsed = std::move(fat);
 	}
 
 	// If we've made it this far, this is almost certainly a POD file.
@@ -144,6 +178,14 @@ std::shared_ptr<Archive> ArchiveType_POD_TV::open(
 	return std::make_shared<Archive_POD_TV>(std::move(content));
 }
 
+std::shared_ptr<Archive> ArchiveType_POD_TV::openProbed(
+	std::unique_ptr<stream::inout> content, SuppData& suppData,
+	std::unique_ptr<ProbeResult> parsed) const
+{
+	return std::make_shared<Archive_POD_TV>(std::move(content),
+		std::move(parsed));
+}
+
 SuppFilenames ArchiveType_POD_TV::getRequiredSupps(stream::input& content,
 	const std::string& filename) const
 {
@@ -151,29 +193,29 @@ SuppFilenames ArchiveType_POD_TV::getRequiredSupps(stream::input& content,
 }
 
 
-Archive_POD_TV::Archive_POD_TV(std::unique_ptr<stream::inout> content)
+Archive_POD_TV::Archive_POD_TV(std::unique_ptr<stream::inout> content,
+	std::unique_ptr<ArchiveType::ProbeResult> parsed)
 	:	Archive_FAT(std::move(content), POD_FIRST_FILE_OFFSET, POD_MAX_FILENAME_LEN)
 {
-	this->content->seekg(0, stream::start);
-	uint32_t numFiles;
-	*this->content >> u32le(numFiles);
-	this->vcFAT.reserve(numFiles);
+	this->bCanShare = true;
 
-	this->content->seekg(POD_FAT_OFFSET, stream::start);
+	uint32_t numFiles = 0;
+	if (!this->useProbedFAT(parsed)) {
+		this->content->seekg(0, stream::start);
+		*this->content >> u32le(numFiles);
+		this->content->seekg(POD_FAT_OFFSET, stream::start);
+	}
 
+	auto raw = PODLayout::readEntries(*this->content, numFiles);
+	this->vcFAT.reserve(numFiles);
 	for (unsigned int i = 0; i < numFiles; i++) {
 		auto f = this->createNewFATEntry();
 		f->iIndex = i;
-		*this->content
-			>> nullPadded(f->strName, POD_MAX_FILENAME_LEN)
-			>> u32le(f->storedSize)
-			>> u32le(f->iOffset)
-		;
+		PODLayout::decode(&raw[i * POD_FAT_ENTRY_LEN], f.get());
 		f->lenHeader = 0;
 		f->type = FILETYPE_GENERIC;
 		f->fAttr = File::Attribute::Default;
 		f->bValid = true;
-		f->realSize = f->storedSize;
 		this->vcFAT.push_back(std::move(f));
 	}
 
@@ -187,6 +229,9 @@ Archive_POD_TV::Archive_POD_TV(std::unique_ptr<stream::inout> content)
 	attrDesc.textMaxLength = POD_DESCRIPTION_LEN;
 	this->content->seekg(POD_DESCRIPTION_OFFSET, stream::start);
 	*this->content >> nullTerminated(attrDesc.textValue, POD_DESCRIPTION_LEN);
+
+	this->initSpareEntries(PODLayout::fatEnd(this->vcFAT.size()),
+		POD_FAT_ENTRY_LEN);
 }
 
 Archive_POD_TV::~Archive_POD_TV()
@@ -209,12 +254,21 @@ void Archive_POD_TV::flush()
 	return;
 }
 
+void Archive_POD_TV::attribute(unsigned int index, int newValue)
+{
+	// TESTED BY: test_archive::test_spare_entries
+	this->Archive_FAT::attribute(index, newValue);
+	if (this->lenSpareEntry && (index == this->attrSpareEntries)) {
+		this->setSpareEntries(PODLayout::fatEnd(this->vcFAT.size()), newValue);
+	}
+	return;
+}
+
 void Archive_POD_TV::updateFileName(const FATEntry *pid, const std::string& strNewName)
 {
 	// TESTED BY: fmt_pod_tv_rename
 	assert(strNewName.length() <= POD_MAX_FILENAME_LEN);
-	this->content->seekp(POD_FILENAME_OFFSET(pid), stream::start);
-	*this->content << nullPadded(strNewName, POD_MAX_FILENAME_LEN);
+	PODLayout::writeName(*this->content, pid, strNewName);
 	return;
 }
 
@@ -222,8 +276,7 @@ void Archive_POD_TV::updateFileOffset(const FATEntry *pid, stream::delta offDelt
 {
 	// TESTED BY: fmt_pod_tv_insert*
 	// TESTED BY: fmt_pod_tv_resize*
-	this->content->seekp(POD_FILEOFFSET_OFFSET(pid), stream::start);
-	*this->content << u32le(pid->iOffset);
+	PODLayout::writeOffset(*this->content, pid);
 	return;
 }
 
@@ -231,8 +284,7 @@ void Archive_POD_TV::updateFileSize(const FATEntry *pid, stream::delta sizeDelta
 {
 	// TESTED BY: fmt_pod_tv_insert*
 	// TESTED BY: fmt_pod_tv_resize*
-	this->content->seekp(POD_FILESIZE_OFFSET(pid), stream::start);
-	*this->content << u32le(pid->storedSize);
+	PODLayout::writeSize(*this->content, pid);
 	return;
 }
 
@@ -244,26 +296,21 @@ void Archive_POD_TV::preInsertFile(const FATEntry *idBeforeThis, FATEntry *pNewE
 	// Set the format-specific variables
 	pNewEntry->lenHeader = 0;
 
-	// Because the new entry isn't in the vector yet we need to shift it manually
-	pNewEntry->iOffset += POD_FAT_ENTRY_LEN;
+	stream::pos offFATEnd = PODLayout::fatEnd(this->vcFAT.size());
+	bool spare = this->takeSpareEntry(offFATEnd, pNewEntry);
+	if (!spare) {
+		// Because the new entry isn't in the vector yet we need to shift it
+		// manually
+		pNewEntry->iOffset += POD_FAT_ENTRY_LEN;
+	}
 
-	this->content->seekp(POD_FATENTRY_OFFSET(pNewEntry), stream::start);
-	this->content->insert(POD_FAT_ENTRY_LEN);
 	camoto::uppercase(pNewEntry->strName);
+	PODLayout::insertEntry(*this->content, pNewEntry);
 
-	// Write out the entry
-	*this->content
-		<< nullPadded(pNewEntry->strName, POD_MAX_FILENAME_LEN)
-		<< u32le(pNewEntry->storedSize)
-		<< u32le(pNewEntry->iOffset);
-
-	// Update the offsets now there's a new FAT entry taking up space.
-	this->shiftFiles(
-		NULL,
-		POD_FAT_OFFSET + this->vcFAT.size() * POD_FAT_ENTRY_LEN,
-		POD_FAT_ENTRY_LEN,
-		0
-	);
+	if (!spare) {
+		// Update the offsets now there's a new FAT entry taking up space.
+		this->shiftFiles(NULL, offFATEnd, POD_FAT_ENTRY_LEN, 0);
+	}
 
 	this->updateFileCount(this->vcFAT.size() + 1);
 
@@ -274,20 +321,17 @@ void Archive_POD_TV::preRemoveFile(const FATEntry *pid)
 {
 	// TESTED BY: fmt_pod_tv_remove*
 
-	// Update the offsets now there's one less FAT entry taking up space.  This
-	// must be called before the FAT is altered, because it will write a new
-	// offset into the FAT entry we're about to erase (and if we erase it first
-	// it'll overwrite something else.)
-	this->shiftFiles(
-		NULL,
-		POD_FAT_OFFSET + this->vcFAT.size() * POD_FAT_ENTRY_LEN,
-		-POD_FAT_ENTRY_LEN,
-		0
-	);
+	stream::pos offFATEnd = PODLayout::fatEnd(this->vcFAT.size());
+	if (!this->keepSpareEntry(offFATEnd)) {
+		// Update the offsets now there's one less FAT entry taking up space.  This
+		// must be called before the FAT is altered, because it will write a new
+		// offset into the FAT entry we're about to erase (and if we erase it
+		// first it'll overwrite something else.)
+		this->shiftFiles(NULL, offFATEnd, -POD_FAT_ENTRY_LEN, 0);
+	}
 
 	// Remove the FAT entry
-	this->content->seekp(POD_FATENTRY_OFFSET(pid), stream::start);
-	this->content->remove(POD_FAT_ENTRY_LEN);
+	PODLayout::removeEntry(*this->content, pid);
 
 	this->updateFileCount(this->vcFAT.size() - 1);
 
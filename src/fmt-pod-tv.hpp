@@ -39,10 +39,15 @@ class ArchiveType_POD_TV: virtual public ArchiveType
 		virtual std::vector<std::string> fileExtensions() const;
 		virtual std::vector<std::string> games() const;
 		virtual ArchiveType::Certainty isInstance(stream::input& content) const;
+		virtual ArchiveType::Certainty probe(stream::input& content,
+			std::unique_ptr<ProbeResult> *parsed) const;
 		virtual std::shared_ptr<Archive> create(
 			std::unique_ptr<stream::inout> content, SuppData& suppData) const;
 		virtual std::shared_ptr<Archive> open(
 			std::unique_ptr<stream::inout> content, SuppData& suppData) const;
+		virtual std::shared_ptr<Archive> openProbed(
+			std::unique_ptr<stream::inout> content, SuppData& suppData,
+			std::unique_ptr<ProbeResult> parsed) const;
 		virtual SuppFilenames getRequiredSupps(stream::input& content,
 			const std::string& filename) const;
 };
@@ -51,10 +56,12 @@ class ArchiveType_POD_TV: virtual public ArchiveType
 class Archive_POD_TV: virtual public Archive_FAT
 {
 	public:
-		Archive_POD_TV(std::unique_ptr<stream::inout> content);
+		Archive_POD_TV(std::unique_ptr<stream::inout> content,
+			std::unique_ptr<ArchiveType::ProbeResult> parsed = nullptr);
 		virtual ~Archive_POD_TV();
 
 		virtual void flush();
+		virtual void attribute(unsigned int index, int newValue);
 
 		virtual void updateFileName(const FATEntry *pid,
 			const std::string& strNewName);
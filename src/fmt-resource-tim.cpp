@@ -136,7 +136,7 @@ SuppFilenames ArchiveType_Resource_TIM::getRequiredSupps(stream::input& content,
 Archive_Resource_TIM::Archive_Resource_TIM(
 	std::unique_ptr<stream::inout> content, std::unique_ptr<stream::inout> psFAT)
 	:	Archive_FAT(std::move(content), TIM_FIRST_FILE_OFFSET, TIM_MAX_FILENAME_LEN),
-		psFAT(std::make_unique<stream::seg>(std::move(psFAT)))
+		psFAT(std::make_unique<piece_table>(std::move(psFAT)))
 {
 	stream::len lenArchive = this->content->size();
 	this->content->seekg(0, stream::start);
@@ -51,7 +51,7 @@ class ArchiveType_Resource_TIM: virtual public ArchiveType
 class Archive_Resource_TIM: virtual public Archive_FAT
 {
 	protected:
-		std::unique_ptr<stream::seg> psFAT;
+		std::unique_ptr<piece_table> psFAT;
 
 	public:
 		Archive_Resource_TIM(std::unique_ptr<stream::inout> content,
@@ -174,7 +174,7 @@ Archive_RFF_Blood::Archive_RFF_Blood(std::unique_ptr<stream::inout> content)
 	}
 
 	// Copy the decrypted FAT into memory
-	this->fatStream = std::make_unique<stream::seg>(
+	this->fatStream = std::make_unique<piece_table>(
 		std::make_unique<stream::string>()
 	);
 	this->fatStream->seekp(0, stream::start);
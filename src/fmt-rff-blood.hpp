@@ -74,7 +74,7 @@ class Archive_RFF_Blood: virtual public Archive_FAT
 
 	protected:
 		/// In-memory stream storing the cleartext FAT
-		std::unique_ptr<stream::seg> fatStream;
+		std::unique_ptr<piece_table> fatStream;
 		uint32_t version;            ///< File format version
 		bool modifiedFAT;            ///< Has the FAT been changed?
 
@@ -24,11 +24,13 @@
 #include <cassert>
 #include <camoto/iostream_helpers.hpp>
 #include <camoto/util.hpp>
+#include "fat-layout.hpp"
 #include "fmt-wad-doom.hpp"
 
 #define WAD_FILECOUNT_OFFSET    4
+#define WAD_FATOFFSET_OFFSET    8
 #define WAD_HEADER_LEN          12
-#define WAD_FAT_OFFSET          WAD_HEADER_LEN // assuming no extra data after header
+#define WAD_FAT_OFFSET          WAD_HEADER_LEN // new archives only
 #define WAD_FILENAME_FIELD_LEN  8
 #define WAD_MAX_FILENAME_LEN    WAD_FILENAME_FIELD_LEN
 #define WAD_FAT_ENTRY_LEN       16
@@ -36,15 +38,16 @@
 
 #define WAD_SAFETY_MAX_FILECOUNT  8192 // Maximum value we will load
 
-#define WAD_FATENTRY_OFFSET(e) (WAD_HEADER_LEN + e->iIndex * WAD_FAT_ENTRY_LEN)
-
-#define WAD_FILEOFFSET_OFFSET(e) WAD_FATENTRY_OFFSET(e)
-#define WAD_FILESIZE_OFFSET(e) (WAD_FATENTRY_OFFSET(e) + 4)
-#define WAD_FILENAME_OFFSET(e) (WAD_FATENTRY_OFFSET(e) + 8)
-
 namespace camoto {
 namespace gamearchive {
 
+/// Layout of each FAT entry: u32le offset, u32le size, then filename.
+typedef FATLayout<WAD_FAT_OFFSET, WAD_FAT_ENTRY_LEN,
+	fatfield::NullPadded<8, WAD_FILENAME_FIELD_LEN>,
+	fatfield::UIntLE<0, 4>,
+	fatfield::UIntLE<4, 4>
+> WADLayout;
+
 ArchiveType_WAD_Doom::ArchiveType_WAD_Doom()
 {
 }
@@ -130,6 +133,8 @@ SuppFilenames ArchiveType_WAD_Doom::getRequiredSupps(stream::input& content,
 Archive_WAD_Doom::Archive_WAD_Doom(std::unique_ptr<stream::inout> content)
 	:	Archive_FAT(std::move(content), WAD_FIRST_FILE_OFFSET, WAD_MAX_FILENAME_LEN)
 {
+	this->bCanShare = true;
+
 	this->content->seekg(4, stream::start); // skip sig
 
 	// We still have to perform sanity checks in case the user forced an archive
@@ -146,7 +151,13 @@ Archive_WAD_Doom::Archive_WAD_Doom(std::unique_ptr<stream::inout> content)
 		throw stream::error("too many files or corrupted archive");
 	}
 
+	// The FAT can be anywhere, but is usually either straight after the header
+	// or after the last lump.
+	this->offFAT = offFAT;
+	this->bFATAtHead = (offFAT == WAD_FAT_OFFSET);
+
 	this->content->seekg(offFAT, stream::start);
+	auto raw = WADLayout::readEntries(*this->content, numFiles);
 	for (unsigned int i = 0; i < numFiles; i++) {
 		auto f = this->createNewFATEntry();
 
@@ -155,15 +166,7 @@ Archive_WAD_Doom::Archive_WAD_Doom(std::unique_ptr<stream::inout> content)
 		f->type = FILETYPE_GENERIC;
 		f->fAttr = File::Attribute::Default;
 		f->bValid = true;
-
-		// Read the data in from the FAT entry in the file
-		*this->content
-			>> u32le(f->iOffset)
-			>> u32le(f->storedSize)
-			>> nullPadded(f->strName, WAD_FILENAME_FIELD_LEN)
-		;
-
-		f->realSize = f->storedSize;
+		WADLayout::decode(&raw[i * WAD_FAT_ENTRY_LEN], f.get());
 		this->vcFAT.push_back(std::move(f));
 	}
 
@@ -186,6 +189,12 @@ Archive_WAD_Doom::Archive_WAD_Doom(std::unique_ptr<stream::inout> content)
 	this->content->read(&wadType, 1);
 	if (wadType == 'I') attrType.enumValue = 0;
 	else attrType.enumValue = 1;
+
+	// Spare entries are only needed when the lump data is after the FAT
+	if (this->bFATAtHead) {
+		this->initSpareEntries(WADLayout::fatEnd(numFiles, this->offFAT),
+			WAD_FAT_ENTRY_LEN);
+	}
 }
 
 Archive_WAD_Doom::~Archive_WAD_Doom()
@@ -210,12 +219,23 @@ void Archive_WAD_Doom::flush()
 	return;
 }
 
+void Archive_WAD_Doom::attribute(unsigned int index, int newValue)
+{
+	// TESTED BY: test_archive::test_spare_entries
+	this->Archive_FAT::attribute(index, newValue);
+	if (this->lenSpareEntry && (index == this->attrSpareEntries)) {
+		this->setSpareEntries(WADLayout::fatEnd(this->vcFAT.size(), this->offFAT),
+			newValue);
+	}
+	return;
+}
+
 void Archive_WAD_Doom::updateFileName(const FATEntry *pid, const std::string& strNewName)
 {
 	// TESTED BY: fmt_wad_doom_rename
 	assert(strNewName.length() <= WAD_MAX_FILENAME_LEN);
-	this->content->seekp(WAD_FILENAME_OFFSET(pid), stream::start);
-	*this->content << nullPadded(strNewName, WAD_FILENAME_FIELD_LEN);
+	this->index.reset();
+	WADLayout::writeName(*this->content, pid, strNewName, this->offFAT);
 	return;
 }
 
@@ -223,8 +243,7 @@ void Archive_WAD_Doom::updateFileOffset(const FATEntry *pid, stream::delta offDe
 {
 	// TESTED BY: fmt_wad_doom_insert*
 	// TESTED BY: fmt_wad_doom_resize*
-	this->content->seekp(WAD_FILEOFFSET_OFFSET(pid), stream::start);
-	*this->content << u32le(pid->iOffset);
+	WADLayout::writeOffset(*this->content, pid, this->offFAT);
 	return;
 }
 
@@ -232,8 +251,7 @@ void Archive_WAD_Doom::updateFileSize(const FATEntry *pid, stream::delta sizeDel
 {
 	// TESTED BY: fmt_wad_doom_insert*
 	// TESTED BY: fmt_wad_doom_resize*
-	this->content->seekp(WAD_FILESIZE_OFFSET(pid), stream::start);
-	*this->content << u32le(pid->storedSize);
+	WADLayout::writeSize(*this->content, pid, this->offFAT);
 	return;
 }
 
@@ -241,30 +259,36 @@ void Archive_WAD_Doom::preInsertFile(const FATEntry *idBeforeThis, FATEntry *pNe
 {
 	// TESTED BY: fmt_wad_doom_insert*
 	assert(pNewEntry->strName.length() <= WAD_MAX_FILENAME_LEN);
+	this->index.reset();
 
 	// Set the format-specific variables
 	pNewEntry->lenHeader = 0;
 
-	// Because the new entry isn't in the vector yet we need to shift it manually
-	pNewEntry->iOffset += WAD_FAT_ENTRY_LEN;
+	// Anything after the FAT has to move to make room for the new entry.  When
+	// the FAT is after the lumps this is usually nothing at all, and the new
+	// lump's data goes where the FAT was, pushing the FAT back in
+	// insertContent().
+	stream::pos offFATEnd = WADLayout::fatEnd(this->vcFAT.size(), this->offFAT);
+	bool spare = this->takeSpareEntry(offFATEnd, pNewEntry);
+	if (
+		!spare && (
+			this->bFATAtHead
+				? (pNewEntry->iOffset >= offFATEnd)
+				: (pNewEntry->iOffset > this->offFAT)
+		)
+	) {
+		// Because the new entry isn't in the vector yet we need to shift it
+		// manually
+		pNewEntry->iOffset += WAD_FAT_ENTRY_LEN;
+	}
 
-	this->content->seekp(WAD_FATENTRY_OFFSET(pNewEntry), stream::start);
-	this->content->insert(WAD_FAT_ENTRY_LEN);
 	camoto::uppercase(pNewEntry->strName);
+	WADLayout::insertEntry(*this->content, pNewEntry, this->offFAT);
 
-	*this->content
-		<< u32le(pNewEntry->iOffset)
-		<< u32le(pNewEntry->storedSize)
-		<< nullPadded(pNewEntry->strName, WAD_FILENAME_FIELD_LEN)
-	;
-
-	// Update the offsets now there's a new FAT entry taking up space.
-	this->shiftFiles(
-		NULL,
-		WAD_FAT_OFFSET + this->vcFAT.size() * WAD_FAT_ENTRY_LEN,
-		WAD_FAT_ENTRY_LEN,
-		0
-	);
+	if (!spare) {
+		// Update the offsets now there's a new FAT entry taking up space.
+		this->shiftFiles(NULL, offFATEnd, WAD_FAT_ENTRY_LEN, 0);
+	}
 
 	this->updateFileCount(this->vcFAT.size() + 1);
 	return;
@@ -273,25 +297,70 @@ void Archive_WAD_Doom::preInsertFile(const FATEntry *idBeforeThis, FATEntry *pNe
 void Archive_WAD_Doom::preRemoveFile(const FATEntry *pid)
 {
 	// TESTED BY: fmt_wad_doom_remove*
+	this->index.reset();
 
 	// Update the offsets now there's one less FAT entry taking up space.  This
 	// must be called before the FAT is altered, because it will write a new
 	// offset into the FAT entry we're about to erase (and if we erase it first
 	// it'll overwrite something else.)
-	this->shiftFiles(
-		NULL,
-		WAD_FAT_OFFSET + this->vcFAT.size() * WAD_FAT_ENTRY_LEN,
-		-WAD_FAT_ENTRY_LEN,
-		0
-	);
+	stream::pos offFATEnd = WADLayout::fatEnd(this->vcFAT.size(), this->offFAT);
+	if (!this->keepSpareEntry(offFATEnd)) {
+		this->shiftFiles(NULL, offFATEnd, -WAD_FAT_ENTRY_LEN, 0);
+	}
 
-	this->content->seekp(WAD_FATENTRY_OFFSET(pid), stream::start);
-	this->content->remove(WAD_FAT_ENTRY_LEN);
+	WADLayout::removeEntry(*this->content, pid, this->offFAT);
 
 	this->updateFileCount(this->vcFAT.size() - 1);
 	return;
 }
 
+void Archive_WAD_Doom::insertContent(stream::pos offInsert,
+	stream::len lenInsert)
+{
+	// TESTED BY: fmt_wad_doom_dirend_*
+	this->Archive_FAT::insertContent(offInsert, lenInsert);
+
+	// Data inserted where the FAT starts goes in front of it, which is how new
+	// lumps are appended without moving any existing lump data.
+	if (!this->bFATAtHead && (lenInsert > 0) && (offInsert <= this->offFAT)) {
+		this->updateFATOffset(this->offFAT + lenInsert);
+	}
+	return;
+}
+
+void Archive_WAD_Doom::removeContent(stream::pos offRemove,
+	stream::len lenRemove)
+{
+	// TESTED BY: fmt_wad_doom_dirend_*
+	this->Archive_FAT::removeContent(offRemove, lenRemove);
+
+	if (!this->bFATAtHead && (lenRemove > 0) && (offRemove < this->offFAT)) {
+		// The FAT is never inside the removed data, as it is only ever lump data
+		// being removed.
+		assert(offRemove + lenRemove <= this->offFAT);
+		this->updateFATOffset(this->offFAT - lenRemove);
+	}
+	return;
+}
+
+bool Archive_WAD_Doom::isPadding(stream::pos off, stream::len len) const
+{
+	// The FAT can sit between two lumps, in which case it is not padding.
+	if (this->bFATAtHead) return true;
+	stream::pos offFATEnd = WADLayout::fatEnd(this->vcFAT.size(), this->offFAT);
+	return (off + len <= this->offFAT) || (off >= offFATEnd);
+}
+
+std::shared_ptr<const WADIndex> Archive_WAD_Doom::lumpIndex() const
+{
+	// Any change to the lumps drops the index, so it is rebuilt here at most
+	// once after each batch of changes.
+	if (!this->index) {
+		this->index = std::make_shared<WADIndex>(this->vcFAT);
+	}
+	return this->index;
+}
+
 void Archive_WAD_Doom::updateFileCount(uint32_t iNewCount)
 {
 	// TESTED BY: fmt_wad_doom_insert*
@@ -301,5 +370,21 @@ void Archive_WAD_Doom::updateFileCount(uint32_t iNewCount)
 	return;
 }
 
+void Archive_WAD_Doom::updateFATOffset(stream::pos offNewFAT)
+{
+	// TESTED BY: fmt_wad_doom_dirend_*
+	this->offFAT = offNewFAT;
+	this->content->seekp(WAD_FATOFFSET_OFFSET, stream::start);
+	*this->content << u32le(offNewFAT);
+	return;
+}
+
+std::shared_ptr<const WADIndex> getWADIndex(const Archive& archive)
+{
+	auto wad = dynamic_cast<const Archive_WAD_Doom *>(&archive);
+	if (!wad) return nullptr;
+	return wad->lumpIndex();
+}
+
 } // namespace gamearchive
 } // namespace camoto
@@ -23,6 +23,7 @@
 
 #include <camoto/gamearchive/archivetype.hpp>
 #include <camoto/gamearchive/archive-fat.hpp>
+#include <camoto/gamearchive/wad-index.hpp>
 
 namespace camoto {
 namespace gamearchive {
@@ -55,6 +56,7 @@ class Archive_WAD_Doom: virtual public Archive_FAT
 		virtual ~Archive_WAD_Doom();
 
 		virtual void flush();
+		virtual void attribute(unsigned int index, int newValue);
 
 		virtual void updateFileName(const FATEntry *pid,
 			const std::string& strNewName);
@@ -63,11 +65,35 @@ class Archive_WAD_Doom: virtual public Archive_FAT
 		virtual void preInsertFile(const FATEntry *idBeforeThis,
 			FATEntry *pNewEntry);
 		virtual void preRemoveFile(const FATEntry *pid);
+		virtual void insertContent(stream::pos offInsert, stream::len lenInsert);
+		virtual void removeContent(stream::pos offRemove, stream::len lenRemove);
+		virtual bool isPadding(stream::pos off, stream::len len) const;
+
+		/// Get the lump index, building it if the lumps have changed.
+		std::shared_ptr<const WADIndex> lumpIndex() const;
 
 	protected:
+		/// Lump index, or null if it needs to be rebuilt.
+		mutable std::shared_ptr<const WADIndex> index;
+
+		/// Offset of the first FAT entry, as stored in the header.
+		stream::pos offFAT;
+
+		/// Is the FAT straight after the header, with all the lump data after it?
+		/**
+		 * If false (as in most IWADs and PWADs) the FAT is elsewhere, usually
+		 * after the last lump.  New lumps then go in front of the FAT, and the FAT
+		 * moves whenever lump data is inserted or removed before it.  This is kept
+		 * even when all the lumps are removed, so an archive keeps its layout.
+		 */
+		bool bFATAtHead;
+
 		// Update the header with the number of files in the archive
 		void updateFileCount(uint32_t iNewCount);
 
+		// Update the header with the new location of the FAT
+		void updateFATOffset(stream::pos offNewFAT);
+
 };
 
 } // namespace gamearchive
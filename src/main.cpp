@@ -155,6 +155,11 @@ namespace gamearchive {
 constexpr CAMOTO_GAMEARCHIVE_API const char* const ArchiveType::obj_t_name;
 constexpr CAMOTO_GAMEARCHIVE_API const char* const FilterType::obj_t_name;
 
+std::shared_ptr<filter> FilterType::decoder() const
+{
+	return nullptr;
+}
+
 } // namespace gamearchive
 
 } // namespace camoto
@@ -0,0 +1,48 @@
+/**
+ * @file  stream-bounded.cpp
+ * @brief Memory stream that stops keeping data past a set size.
+ *
+ * Copyright (C) 2010-2016 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "stream-bounded.hpp"
+
+namespace camoto {
+namespace gamearchive {
+
+output_bounded::output_bounded(stream::len limit)
+	:	limit(limit),
+		exceeded(false)
+{
+}
+
+stream::len output_bounded::try_write(const uint8_t *buffer, stream::len len)
+{
+	if (!this->exceeded && (this->tellp() + len > this->limit)) {
+		this->exceeded = true;
+	}
+	// Claim the data was written, so the caller doesn't treat it as an error.
+	if (this->exceeded) return len;
+	return this->output_string::try_write(buffer, len);
+}
+
+bool output_bounded::tooLarge() const
+{
+	return this->exceeded;
+}
+
+} // namespace gamearchive
+} // namespace camoto
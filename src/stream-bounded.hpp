@@ -0,0 +1,54 @@
+/**
+ * @file  stream-bounded.hpp
+ * @brief Memory stream that stops keeping data past a set size.
+ *
+ * Copyright (C) 2010-2016 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _CAMOTO_STREAM_BOUNDED_HPP_
+#define _CAMOTO_STREAM_BOUNDED_HPP_
+
+#include <camoto/stream_string.hpp>
+
+namespace camoto {
+namespace gamearchive {
+
+/// Memory stream that gives up once it would hold more than a set amount.
+/**
+ * Once a write would go over the limit, it and all later writes are dropped
+ * and tooLarge() returns true.  Nothing is thrown, because this is normally
+ * the target of a stream::output_filtered, which flushes in its destructor.
+ */
+class output_bounded: virtual public stream::output_string
+{
+	public:
+		/// Keep at most limit bytes.
+		output_bounded(stream::len limit);
+
+		virtual stream::len try_write(const uint8_t *buffer, stream::len len);
+
+		/// Has anything been dropped for going over the limit?
+		bool tooLarge() const;
+
+	protected:
+		stream::len limit;   ///< Most data to keep
+		bool exceeded;       ///< Set once a write has been dropped
+};
+
+} // namespace gamearchive
+} // namespace camoto
+
+#endif // _CAMOTO_STREAM_BOUNDED_HPP_
@@ -125,6 +125,16 @@ output_archfile::output_archfile(std::shared_ptr<Archive> archive,
 {
 }
 
+stream::len output_archfile::try_write(const uint8_t *buffer, stream::len len)
+{
+	if (this->fat && this->fat->bShared) {
+		// Other files use the same data, so make sure they don't see this change
+		auto pFATArchive = std::dynamic_pointer_cast<Archive_FAT>(this->archive);
+		if (pFATArchive) pFATArchive->unshare(this->id);
+	}
+	return this->output_sub::try_write(buffer, len);
+}
+
 void output_archfile::truncate(stream::len size)
 {
 	if (this->sub_size() == size) return; // nothing to do
@@ -133,6 +143,7 @@ void output_archfile::truncate(stream::len size)
 	stream::len newRealSize;
 	if (this->id->fAttr & Archive::File::Attribute::Compressed) {
 		// We're compressed, so the real and stored sizes are both valid
+		this->archive->resolveRealSizes({this->id});
 		newRealSize = this->id->realSize;
 	} else {
 		// We're not compressed, so the real size won't be updated by a filter,
@@ -193,5 +204,70 @@ archfile::archfile(std::shared_ptr<Archive> archive, Archive::FileHandle id,
 {
 }
 
+
+archfile_reader::archfile_reader(std::shared_ptr<const Archive_FAT> archive,
+	Archive::FileHandle id, std::shared_ptr<stream::input> content)
+	:	archive(archive),
+		id(id),
+		fat(Archive_FAT::FATEntry::cast(id)),
+		content(content),
+		offPointer(0)
+{
+	assert(this->fat);
+	this->refresh();
+}
+
+stream::len archfile_reader::try_read(uint8_t *buffer, stream::len len)
+{
+	this->revalidate();
+	if (this->offPointer >= this->lenFile) return 0;
+	stream::len lenRemaining = this->lenFile - this->offPointer;
+	if (len > lenRemaining) len = lenRemaining;
+
+	this->content->seekg(this->offStart + this->offPointer, stream::start);
+	stream::len lenRead = this->content->try_read(buffer, len);
+	this->offPointer += lenRead;
+	return lenRead;
+}
+
+void archfile_reader::seekg(stream::delta off, stream::seek_from from)
+{
+	this->revalidate();
+	stream::delta offNew;
+	switch (from) {
+		case stream::start: offNew = off; break;
+		case stream::cur: offNew = this->offPointer + off; break;
+		case stream::end: offNew = this->lenFile + off; break;
+		default: offNew = -1; break;
+	}
+	if ((offNew < 0) || ((stream::len)offNew > this->lenFile)) {
+		throw stream::seek_error("Attempt to seek outside of file.");
+	}
+	this->offPointer = offNew;
+	return;
+}
+
+stream::pos archfile_reader::tellg() const
+{
+	return this->offPointer;
+}
+
+stream::len archfile_reader::size() const
+{
+	this->revalidate();
+	return this->lenFile;
+}
+
+void archfile_reader::refresh() const
+{
+	if (!this->fat->bValid) {
+		throw stream::error("Attempt to access closed or deleted file.");
+	}
+	this->offStart = this->fat->iOffset + this->fat->lenHeader;
+	this->lenFile = this->fat->storedSize;
+	this->generation = this->archive->layoutGeneration();
+	return;
+}
+
 } // namespace gamearchive
 } // namespace camoto
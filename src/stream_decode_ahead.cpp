@@ -0,0 +1,285 @@
+/**
+ * @file  stream_decode_ahead.cpp
+ * @brief Read-only stream that decodes filtered data on a helper thread.
+ *
+ * Copyright (C) 2010-2016 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <cstring>
+#include <camoto/util.hpp>
+#include <camoto/gamearchive/archive-fat.hpp>
+#include <camoto/gamearchive/manager.hpp>
+#include <camoto/gamearchive/stream_decode_ahead.hpp>
+
+namespace camoto {
+namespace gamearchive {
+
+input_decode_ahead::input_decode_ahead(std::unique_ptr<stream::input> source,
+	std::shared_ptr<filter> decoder, stream::len lenDecoded,
+	unsigned int numBuffers, stream::len lenBuffer)
+	:	source(std::move(source)),
+		decoder(decoder),
+		lenDecoded(lenDecoded),
+		numBuffers(std::max(numBuffers, 1u)),
+		lenBuffer(lenBuffer ? lenBuffer : DECODE_AHEAD_BUFFER_LEN),
+		offset(0),
+		offFront(0),
+		done(false),
+		cancel(false)
+{
+	this->start();
+}
+
+input_decode_ahead::~input_decode_ahead()
+{
+	this->stop();
+}
+
+stream::len input_decode_ahead::try_read(uint8_t *buffer, stream::len len)
+{
+	stream::len r = this->consume(buffer, len);
+	this->offset += r;
+	return r;
+}
+
+void input_decode_ahead::seekg(stream::delta off, stream::seek_from from)
+{
+	stream::delta base;
+	switch (from) {
+		case stream::start: base = 0; break;
+		case stream::cur: base = this->offset; break;
+		case stream::end: base = this->lenDecoded; break;
+		default: base = 0; break;
+	}
+	if (base + off < 0) {
+		throw stream::seek_error("Attempted to seek to before the start of the "
+			"stream.");
+	}
+	stream::pos target = base + off;
+
+	if (target < this->offset) {
+		// The decoded data before this point has already been thrown away, so
+		// the only way back is to decode it all again.
+		this->stop();
+		this->offset = 0;
+		this->start();
+	}
+
+	if (target > this->offset) {
+		stream::len skipped = this->consume(nullptr, target - this->offset);
+		this->offset += skipped;
+		if (this->offset < target) {
+			throw stream::seek_error("Attempted to seek past the end of the "
+				"stream.");
+		}
+	}
+	return;
+}
+
+stream::pos input_decode_ahead::tellg() const
+{
+	return this->offset;
+}
+
+stream::len input_decode_ahead::size() const
+{
+	return this->lenDecoded;
+}
+
+void input_decode_ahead::start()
+{
+	this->source->seekg(0, stream::start);
+	this->decoder->reset(this->source->size());
+	this->ring.clear();
+	this->offFront = 0;
+	this->done = false;
+	this->cancel = false;
+	this->failure = nullptr;
+	this->worker = std::thread(&input_decode_ahead::decode, this);
+	return;
+}
+
+void input_decode_ahead::stop()
+{
+	{
+		std::lock_guard<std::mutex> lk(this->lock);
+		this->cancel = true;
+	}
+	this->cvDrained.notify_all();
+	if (this->worker.joinable()) this->worker.join();
+	return;
+}
+
+void input_decode_ahead::decode()
+{
+	try {
+		std::vector<uint8_t> in(this->lenBuffer);
+		stream::len inStart = 0, inEnd = 0;
+		bool srcEOF = false;
+		bool finished = false;
+
+		while (!finished) {
+			// Wait for the reader to make room in the ring
+			{
+				std::unique_lock<std::mutex> lk(this->lock);
+				this->cvDrained.wait(lk, [this]() {
+					return this->cancel || (this->ring.size() < this->numBuffers);
+				});
+				if (this->cancel) return;
+			}
+
+			// Decode one buffer's worth without holding the lock, so the reader can
+			// carry on with the buffers already in the ring.
+			std::vector<uint8_t> out(this->lenBuffer);
+			stream::len w = 0;
+			while ((w < this->lenBuffer) && !this->cancel) {
+				if ((inStart == inEnd) && !srcEOF) {
+					inStart = 0;
+					inEnd = this->source->try_read(in.data(), in.size());
+					if (inEnd == 0) srcEOF = true;
+				}
+
+				// An empty input buffer tells the filter the data has ended, so it can
+				// flush whatever it is holding on to.
+				stream::len lenIn = inEnd - inStart;
+				stream::len lenOut = this->lenBuffer - w;
+				this->decoder->transform(out.data() + w, &lenOut,
+					in.data() + inStart, &lenIn);
+				inStart += lenIn;
+				w += lenOut;
+
+				if ((lenIn == 0) && (lenOut == 0)) {
+					if (srcEOF) {
+						// Out of data, and the filter has nothing more to give
+						finished = true;
+						break;
+					}
+					if ((inStart == 0) && (inEnd == in.size())) {
+						// Stopping here would look like the end of the file, but the
+						// data is really just being cut short.
+						throw filter_error("Filter made no progress with a full input "
+							"buffer, unable to decode the rest of the file.");
+					}
+					// The filter wants more input than is left in the buffer
+					memmove(in.data(), in.data() + inStart, inEnd - inStart);
+					inEnd -= inStart;
+					inStart = 0;
+					stream::len r = this->source->try_read(in.data() + inEnd,
+						in.size() - inEnd);
+					if (r == 0) srcEOF = true;
+					inEnd += r;
+				}
+			}
+
+			{
+				std::lock_guard<std::mutex> lk(this->lock);
+				if (this->cancel) return;
+				if (w) {
+					out.resize(w);
+					this->ring.push_back(std::move(out));
+				}
+				if (finished) this->done = true;
+			}
+			this->cvFilled.notify_one();
+		}
+	} catch (...) {
+		// Pass the error on to the reader, to be thrown once it has read all the
+		// data decoded before the problem.
+		{
+			std::lock_guard<std::mutex> lk(this->lock);
+			this->failure = std::current_exception();
+			this->done = true;
+		}
+		this->cvFilled.notify_one();
+	}
+	return;
+}
+
+stream::len input_decode_ahead::consume(uint8_t *buffer, stream::len len)
+{
+	stream::len lenDone = 0;
+	std::unique_lock<std::mutex> lk(this->lock);
+	while (lenDone < len) {
+		this->cvFilled.wait(lk, [this]() {
+			return !this->ring.empty() || this->done;
+		});
+		if (this->ring.empty()) {
+			// Only report an error once all the good data has been read
+			if (this->failure && (lenDone == 0)) {
+				std::rethrow_exception(this->failure);
+			}
+			break;
+		}
+
+		auto& front = this->ring.front();
+		stream::len amt = std::min(front.size() - this->offFront, len - lenDone);
+		if (buffer) memcpy(buffer + lenDone, front.data() + this->offFront, amt);
+		this->offFront += amt;
+		lenDone += amt;
+
+		if (this->offFront == front.size()) {
+			this->ring.pop_front();
+			this->offFront = 0;
+			this->cvDrained.notify_one();
+		}
+	}
+	return lenDone;
+}
+
+std::unique_ptr<stream::input> applyFilterDecodeAhead(
+	std::unique_ptr<stream::input> s, const std::string& filter,
+	stream::len lenDecoded)
+{
+	if (filter.empty()) return s;
+
+	auto pFilterType = FilterManager::byCode(filter);
+	if (!pFilterType) {
+		throw stream::error(createString(
+			"could not find filter \"" << filter << "\""
+		));
+	}
+
+	auto decoder = pFilterType->decoder();
+	if (!decoder) return pFilterType->apply(std::move(s));
+
+	return std::make_unique<input_decode_ahead>(std::move(s), decoder,
+		lenDecoded);
+}
+
+std::unique_ptr<stream::input> openDecodeAhead(
+	std::shared_ptr<Archive> archive, const Archive::FileHandle& id)
+{
+	if (id->filter.empty()) return archive->open(id, false);
+
+	// The helper thread needs a stream of its own that can be read while the
+	// archive is used on this thread, which only a snapshot can give.
+	auto fat = std::dynamic_pointer_cast<Archive_FAT>(archive);
+	if (!fat) return archive->open(id, true);
+
+	const auto& files = archive->files();
+	auto it = std::find(files.begin(), files.end(), id);
+	if (it == files.end()) {
+		throw stream::error("Cannot open a file that is not in the archive.");
+	}
+	auto snap = fat->snapshot();
+	const auto& idSnap = snap->files()[it - files.begin()];
+	return applyFilterDecodeAhead(snap->open(idSnap, false), idSnap->filter,
+		idSnap->realSize);
+}
+
+} // namespace gamearchive
+} // namespace camoto
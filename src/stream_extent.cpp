@@ -0,0 +1,294 @@
+/**
+ * @file  stream_extent.cpp
+ * @brief File stream that can shift data by rearranging filesystem extents.
+ *
+ * Copyright (C) 2010-2016 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <io.h>
+#define lseek _lseeki64
+#define ftruncate _chsize_s
+#else
+#include <unistd.h>
+#endif
+#ifdef HAVE_LINUX_FALLOC_H
+#include <linux/falloc.h>
+#endif
+#include <camoto/util.hpp>
+#include <camoto/gamearchive/stream_extent.hpp>
+
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+
+#if defined(HAVE_FALLOCATE) && defined(FALLOC_FL_INSERT_RANGE) \
+	&& defined(FALLOC_FL_COLLAPSE_RANGE)
+#define USE_EXTENT_SHIFT
+#endif
+
+/// Amount of data to read from the file at a time for small reads.
+#define EXTENT_READ_BUFFER  65536
+
+namespace camoto {
+namespace gamearchive {
+
+extent_file::extent_file(const std::string& filename, bool create)
+	:	offset(0),
+		lenBlock(0),
+		filename(filename),
+		offReadBuffer(0),
+		lenReadBuffer(0)
+{
+	int flags = O_RDWR | O_BINARY;
+	if (create) flags |= O_CREAT | O_TRUNC;
+	this->fd = ::open(filename.c_str(), flags, 0644);
+	if (this->fd < 0) {
+		throw stream::open_error(createString("Unable to open " << filename
+			<< ": " << strerror(errno)));
+	}
+
+#ifdef USE_EXTENT_SHIFT
+	struct stat st;
+	if (::fstat(this->fd, &st) == 0) {
+		this->lenBlock = st.st_blksize;
+	}
+#endif
+}
+
+extent_file::~extent_file()
+{
+	::close(this->fd);
+}
+
+stream::len extent_file::try_read(uint8_t *buffer, stream::len len)
+{
+	// Small reads, like the ones used to parse a FAT one field at a time, are
+	// served from a block read ahead of time, so they don't each cost a system
+	// call.  Large reads go straight to the file.
+	stream::len total = 0;
+	while (total < len) {
+		if (
+			(this->offset >= this->offReadBuffer)
+			&& (this->offset < this->offReadBuffer + this->lenReadBuffer)
+		) {
+			stream::len amt = std::min(len - total,
+				this->offReadBuffer + this->lenReadBuffer - this->offset);
+			memcpy(buffer + total,
+				&this->vcReadBuffer[this->offset - this->offReadBuffer], amt);
+			total += amt;
+			this->offset += amt;
+			continue;
+		}
+		if (len - total >= EXTENT_READ_BUFFER) {
+			stream::len r = this->readAt(this->offset, buffer + total, len - total);
+			total += r;
+			this->offset += r;
+			break;
+		}
+		this->vcReadBuffer.resize(EXTENT_READ_BUFFER);
+		this->offReadBuffer = this->offset;
+		this->lenReadBuffer = this->readAt(this->offset,
+			this->vcReadBuffer.data(), EXTENT_READ_BUFFER);
+		if (this->lenReadBuffer == 0) break; // EOF or error
+	}
+	return total;
+}
+
+void extent_file::seekg(stream::delta off, stream::seek_from from)
+{
+	stream::delta base;
+	switch (from) {
+		case stream::start: base = 0; break;
+		case stream::cur: base = this->offset; break;
+		case stream::end: base = this->size(); break;
+		default: base = 0; break;
+	}
+	if (base + off < 0) {
+		throw stream::seek_error("Attempted to seek to before the start of "
+			+ this->filename);
+	}
+	this->offset = base + off;
+	return;
+}
+
+stream::pos extent_file::tellg() const
+{
+	return this->offset;
+}
+
+stream::len extent_file::size() const
+{
+	struct stat st;
+	if (::fstat(this->fd, &st) < 0) {
+		throw stream::read_error(createString("Unable to get size of "
+			<< this->filename << ": " << strerror(errno)));
+	}
+	return st.st_size;
+}
+
+stream::len extent_file::try_write(const uint8_t *buffer, stream::len len)
+{
+	this->invalidate(this->offset, len);
+	stream::len total = 0;
+	if (::lseek(this->fd, this->offset, SEEK_SET) < 0) return 0;
+	while (total < len) {
+		auto w = ::write(this->fd, buffer + total, len - total);
+		if (w <= 0) break; // disk full or error
+		total += w;
+	}
+	this->offset += total;
+	return total;
+}
+
+void extent_file::seekp(stream::delta off, stream::seek_from from)
+{
+	this->seekg(off, from);
+	return;
+}
+
+stream::pos extent_file::tellp() const
+{
+	return this->offset;
+}
+
+void extent_file::truncate(stream::len size)
+{
+	this->invalidate(size, (stream::len)-1 - size);
+	if (::ftruncate(this->fd, size) != 0) {
+		throw stream::write_error(createString("Unable to truncate "
+			<< this->filename << ": " << strerror(errno)));
+	}
+	return;
+}
+
+void extent_file::flush()
+{
+	// Writes go straight to the OS so there is nothing buffered here.
+	return;
+}
+
+stream::len extent_file::blockSize() const
+{
+	return this->lenBlock;
+}
+
+bool extent_file::isAligned(stream::pos off, stream::len len) const
+{
+	if (this->lenBlock == 0) return false;
+	if (len == 0) return false;
+	return ((off % this->lenBlock) == 0) && ((len % this->lenBlock) == 0);
+}
+
+void extent_file::disableExtents()
+{
+	this->lenBlock = 0;
+	return;
+}
+
+bool extent_file::insertRange(stream::pos off, stream::len len)
+{
+#ifdef USE_EXTENT_SHIFT
+	// Likewise inserting at EOF is refused, but is the same as extending it.
+	stream::len lenFile = this->size();
+	if (off == lenFile) {
+		if (!this->isAligned(off, len)) return false;
+		this->truncate(lenFile + len);
+		return true;
+	}
+	return this->shiftRange(FALLOC_FL_INSERT_RANGE, off, len);
+#else
+	return false;
+#endif
+}
+
+bool extent_file::removeRange(stream::pos off, stream::len len)
+{
+#ifdef USE_EXTENT_SHIFT
+	// The kernel refuses to collapse a range that reaches EOF, but that is just
+	// a truncate anyway.
+	stream::len lenFile = this->size();
+	if (off + len == lenFile) {
+		if (!this->isAligned(off, len)) return false;
+		this->truncate(off);
+		return true;
+	}
+	return this->shiftRange(FALLOC_FL_COLLAPSE_RANGE, off, len);
+#else
+	return false;
+#endif
+}
+
+stream::len extent_file::readAt(stream::pos off, uint8_t *buffer,
+	stream::len len)
+{
+	stream::len total = 0;
+	if (::lseek(this->fd, off, SEEK_SET) < 0) return 0;
+	while (total < len) {
+		auto r = ::read(this->fd, buffer + total, len - total);
+		if (r <= 0) break; // EOF or error
+		total += r;
+	}
+	return total;
+}
+
+void extent_file::invalidate(stream::pos off, stream::len len)
+{
+	if (
+		(off < this->offReadBuffer + this->lenReadBuffer)
+		&& (off + len > this->offReadBuffer)
+	) {
+		this->lenReadBuffer = 0;
+	}
+	return;
+}
+
+bool extent_file::shiftRange(int mode, stream::pos off, stream::len len)
+{
+#ifdef USE_EXTENT_SHIFT
+	if (!this->isAligned(off, len)) return false;
+	// Everything after the offset moves, so any of it that was read ahead is
+	// now out of date.
+	this->invalidate(off, (stream::len)-1 - off);
+	if (::fallocate(this->fd, mode, off, len) == 0) return true;
+	switch (errno) {
+		case EOPNOTSUPP:
+		case EINVAL:
+		case ENOSYS:
+			// Filesystem can't do it (or the range is past EOF), so let the caller
+			// fall back to shifting the data by copying it.
+			return false;
+		default:
+			throw stream::write_error(createString("Unable to shift data in "
+				<< this->filename << ": " << strerror(errno)));
+	}
+#else
+	return false;
+#endif
+}
+
+} // namespace gamearchive
+} // namespace camoto
@@ -0,0 +1,885 @@
+/**
+ * @file  stream_piece.cpp
+ * @brief Stream that records edits in a piece table until it is flushed.
+ *
+ * Copyright (C) 2010-2016 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <fcntl.h>
+#ifdef _WIN32
+#define fseeko _fseeki64
+#else
+#include <unistd.h>
+#endif
+#include <camoto/util.hpp>
+#include <camoto/gamearchive/stream_extent.hpp>
+#include <camoto/gamearchive/stream_piece.hpp>
+
+/// Amount of data to copy at a time when writing out pieces.
+#define PIECE_COPY_BLOCK  65536
+
+namespace camoto {
+namespace gamearchive {
+
+namespace {
+
+/// Regions of the parent stream, as start -> end offsets.
+typedef std::map<stream::pos, stream::pos> RegionMap;
+
+/// Copies of parent data taken before it was overwritten.
+/**
+ * Maps the parent offset of the data to the offset and length of the copy in
+ * the pending data store.
+ */
+typedef std::map<stream::pos, std::pair<stream::pos, stream::len>> RescueMap;
+
+/// Remove [start, end) from a set of regions, splitting any it cuts through.
+/**
+ * @param fnEach
+ *   Called with the start and end of each part that was removed.
+ */
+template <class F>
+void cutRegion(RegionMap *regions, stream::pos start, stream::pos end,
+	F fnEach)
+{
+	auto it = regions->upper_bound(start);
+	if (it != regions->begin()) {
+		auto prev = std::prev(it);
+		if (prev->second > start) it = prev;
+	}
+	while ((it != regions->end()) && (it->first < end)) {
+		stream::pos regionStart = it->first;
+		stream::pos regionEnd = it->second;
+		stream::pos cutStart = std::max(regionStart, start);
+		stream::pos cutEnd = std::min(regionEnd, end);
+		fnEach(cutStart, cutEnd);
+		it = regions->erase(it);
+		if (regionStart < cutStart) (*regions)[regionStart] = cutStart;
+		if (cutEnd < regionEnd) {
+			it = regions->emplace(cutEnd, regionEnd).first;
+		}
+	}
+	return;
+}
+
+} // anonymous namespace
+
+piece_table::Store::Store()
+	:	spill(nullptr),
+		lenSpilled(0)
+{
+}
+
+piece_table::Store::~Store()
+{
+	if (this->spill) fclose(this->spill);
+}
+
+stream::pos piece_table::Store::append(const uint8_t *data, stream::len len,
+	stream::len limit)
+{
+	std::lock_guard<std::mutex> lk(this->lock);
+	stream::pos off = this->lenSpilled + this->vcBuffer.size();
+	this->vcBuffer.insert(this->vcBuffer.end(), data, data + len);
+	if (limit && (this->vcBuffer.size() > limit)) this->spillLocked();
+	return off;
+}
+
+void piece_table::Store::read(stream::pos off, uint8_t *buffer,
+	stream::len len)
+{
+	std::lock_guard<std::mutex> lk(this->lock);
+	if (off < this->lenSpilled) {
+		stream::len amt = std::min(len, this->lenSpilled - off);
+		if (
+			(fseeko(this->spill, off, SEEK_SET) != 0)
+			|| (fread(buffer, 1, amt, this->spill) != amt)
+		) {
+			throw stream::read_error(createString("Unable to read back pending "
+				"data from temporary file: " << strerror(errno)));
+		}
+		off += amt;
+		buffer += amt;
+		len -= amt;
+	}
+	if (len) memcpy(buffer, &this->vcBuffer[off - this->lenSpilled], len);
+	return;
+}
+
+void piece_table::Store::spillLocked()
+{
+	if (this->vcBuffer.empty()) return;
+	if (!this->spill) {
+#ifdef O_TMPFILE
+		// Prefer an unnamed file, so nothing is left behind if we crash.
+		const char *dir = getenv("TMPDIR");
+		if (!dir) dir = "/tmp";
+		int fd = ::open(dir, O_TMPFILE | O_RDWR | O_EXCL, 0600);
+		if (fd >= 0) {
+			this->spill = fdopen(fd, "w+b");
+			if (!this->spill) ::close(fd);
+		}
+#endif
+		if (!this->spill) this->spill = tmpfile();
+		if (!this->spill) {
+			throw stream::write_error(createString("Unable to create temporary "
+				"file for pending data: " << strerror(errno)));
+		}
+	}
+	if (
+		(fseeko(this->spill, this->lenSpilled, SEEK_SET) != 0)
+		|| (fwrite(this->vcBuffer.data(), 1, this->vcBuffer.size(), this->spill)
+			!= this->vcBuffer.size())
+	) {
+		throw stream::write_error(createString("Unable to write pending data to "
+			"temporary file: " << strerror(errno)));
+	}
+	this->lenSpilled += this->vcBuffer.size();
+	this->vcBuffer.clear();
+	return;
+}
+
+piece_table::piece_table(std::unique_ptr<stream::inout> parent)
+	:	parent(std::move(parent)),
+		offset(0),
+		lenMemoryLimit(PIECE_DEFAULT_MEMORY_LIMIT)
+{
+	this->reload();
+}
+
+piece_table::~piece_table()
+{
+}
+
+stream::len piece_table::try_read(uint8_t *buffer, stream::len len)
+{
+	stream::len r = this->readTree(nullptr, this->store.get(), this->root.get(),
+		this->offset, buffer, len);
+	this->offset += r;
+	return r;
+}
+
+void piece_table::seekg(stream::delta off, stream::seek_from from)
+{
+	stream::delta base;
+	switch (from) {
+		case stream::start: base = 0; break;
+		case stream::cur: base = this->offset; break;
+		case stream::end: base = this->size(); break;
+		default: base = 0; break;
+	}
+	if (base + off < 0) {
+		throw stream::seek_error("Attempted to seek to before the start of the "
+			"stream.");
+	}
+	if ((stream::len)(base + off) > this->size()) {
+		throw stream::seek_error("Attempted to seek past the end of the stream.");
+	}
+	this->offset = base + off;
+	return;
+}
+
+stream::pos piece_table::tellg() const
+{
+	return this->offset;
+}
+
+stream::len piece_table::size() const
+{
+	return lenOf(this->root);
+}
+
+stream::len piece_table::try_write(const uint8_t *buffer, stream::len len)
+{
+	if (len == 0) return 0;
+	stream::pos offBuffer = this->appendBuffer(buffer, len);
+
+	// Anything from here to the end of the new data gets overwritten, which may
+	// be less than len if the write extends the stream.
+	stream::len lenOld = std::min(len, this->size() - this->offset);
+	this->replace(this->offset, lenOld,
+		this->newNode(Source::Buffer, offBuffer, len));
+	this->offset += len;
+	return len;
+}
+
+void piece_table::seekp(stream::delta off, stream::seek_from from)
+{
+	this->seekg(off, from);
+	return;
+}
+
+stream::pos piece_table::tellp() const
+{
+	return this->offset;
+}
+
+void piece_table::truncate(stream::len size)
+{
+	stream::len lenCurrent = this->size();
+	if (size < lenCurrent) {
+		this->replace(size, lenCurrent - size, nullptr);
+		if (this->offset > size) this->offset = size;
+	} else if (size > lenCurrent) {
+		this->replace(lenCurrent, 0,
+			this->newNode(Source::Zero, 0, size - lenCurrent));
+	}
+	return;
+}
+
+void piece_table::flush()
+{
+	this->writeOut();
+	{
+		std::lock_guard<std::mutex> lk(this->lockParent);
+		this->parent->flush();
+	}
+	this->reload();
+	return;
+}
+
+void piece_table::insert(stream::len len)
+{
+	if (len == 0) return;
+	this->replace(this->offset, 0, this->newNode(Source::Zero, 0, len));
+	return;
+}
+
+void piece_table::remove(stream::len len)
+{
+	if (len == 0) return;
+	if (this->offset + len > this->size()) {
+		throw stream::write_error("Attempted to remove data past the end of the "
+			"stream.");
+	}
+	this->replace(this->offset, len, nullptr);
+	return;
+}
+
+void piece_table::reload()
+{
+	stream::len lenParent;
+	{
+		std::lock_guard<std::mutex> lk(this->lockParent);
+		lenParent = this->parent->size();
+	}
+	if (lenParent) {
+		this->root = this->newNode(Source::Parent, 0, lenParent);
+	} else {
+		this->root.reset();
+	}
+	// Start a new store rather than emptying the old one, as snapshots may still
+	// be reading from it.
+	this->store = std::make_shared<Store>();
+	this->latest.reset();
+	if (this->offset > lenParent) this->offset = lenParent;
+	return;
+}
+
+bool piece_table::hasSnapshots()
+{
+	this->versions.erase(
+		std::remove_if(this->versions.begin(), this->versions.end(),
+			[](const std::weak_ptr<Version>& v) { return v.expired(); }),
+		this->versions.end()
+	);
+	return !this->versions.empty();
+}
+
+stream::inout *piece_table::parentStream()
+{
+	return this->parent.get();
+}
+
+void piece_table::setMemoryLimit(stream::len limit)
+{
+	this->lenMemoryLimit = limit;
+	std::lock_guard<std::mutex> lk(this->store->lock);
+	if (limit && (this->store->vcBuffer.size() > limit)) {
+		this->store->spillLocked();
+	}
+	return;
+}
+
+stream::len piece_table::lenOf(const std::shared_ptr<Node>& node)
+{
+	return node ? node->lenTree : 0;
+}
+
+void piece_table::update(Node *node)
+{
+	node->lenTree = lenOf(node->left) + node->piece.len + lenOf(node->right);
+	return;
+}
+
+void piece_table::own(std::shared_ptr<Node>& node)
+{
+	if (!node) return;
+	if (node.use_count() > 1) {
+		node = std::make_shared<Node>(*node);
+	} else {
+		// A snapshot on another thread may have only just let go of this node,
+		// so make sure its reads are finished before the node is changed.
+		std::atomic_thread_fence(std::memory_order_acquire);
+	}
+	return;
+}
+
+std::shared_ptr<piece_table::Node> piece_table::newNode(Source source,
+	stream::pos offset, stream::len len)
+{
+	auto node = std::make_shared<Node>();
+	node->piece.source = source;
+	node->piece.offset = offset;
+	node->piece.len = len;
+	node->lenTree = len;
+	node->priority = this->rng();
+	return node;
+}
+
+void piece_table::split(std::shared_ptr<Node> tree, stream::pos pos,
+	std::shared_ptr<Node> *before, std::shared_ptr<Node> *after)
+{
+	if (!tree) {
+		before->reset();
+		after->reset();
+		return;
+	}
+	own(tree);
+	stream::len lenLeft = lenOf(tree->left);
+	if (pos <= lenLeft) {
+		this->split(std::move(tree->left), pos, before, &tree->left);
+		update(tree.get());
+		*after = std::move(tree);
+	} else if (pos >= lenLeft + tree->piece.len) {
+		this->split(std::move(tree->right), pos - lenLeft - tree->piece.len,
+			&tree->right, after);
+		update(tree.get());
+		*before = std::move(tree);
+	} else {
+		// Position is in the middle of this node's piece, so cut it in two.  The
+		// second half gets a new priority, so merge it in rather than just
+		// attaching the right subtree to it.
+		stream::len lenHead = pos - lenLeft;
+		Piece& p = tree->piece;
+		auto tail = this->newNode(p.source,
+			(p.source == Source::Zero) ? 0 : p.offset + lenHead, p.len - lenHead);
+		p.len = lenHead;
+		*after = this->merge(std::move(tail), std::move(tree->right));
+		update(tree.get());
+		*before = std::move(tree);
+	}
+	return;
+}
+
+std::shared_ptr<piece_table::Node> piece_table::merge(
+	std::shared_ptr<Node> first, std::shared_ptr<Node> second)
+{
+	if (!first) return second;
+	if (!second) return first;
+	if (first->priority > second->priority) {
+		own(first);
+		first->right = this->merge(std::move(first->right), std::move(second));
+		update(first.get());
+		return first;
+	}
+	own(second);
+	second->left = this->merge(std::move(first), std::move(second->left));
+	update(second.get());
+	return second;
+}
+
+bool piece_table::adjoins(const Piece& first, const Piece& second)
+{
+	if (first.source != second.source) return false;
+	if (first.source == Source::Zero) return true;
+	return first.offset + first.len == second.offset;
+}
+
+const piece_table::Piece *piece_table::lastPiece(const Node *tree)
+{
+	if (!tree) return nullptr;
+	while (tree->right) tree = tree->right.get();
+	return &tree->piece;
+}
+
+const piece_table::Piece *piece_table::firstPiece(const Node *tree)
+{
+	if (!tree) return nullptr;
+	while (tree->left) tree = tree->left.get();
+	return &tree->piece;
+}
+
+void piece_table::growLast(std::shared_ptr<Node>& tree, stream::len len)
+{
+	own(tree);
+	if (tree->right) {
+		growLast(tree->right, len);
+	} else {
+		tree->piece.len += len;
+	}
+	update(tree.get());
+	return;
+}
+
+void piece_table::dropFirst(std::shared_ptr<Node>& tree)
+{
+	own(tree);
+	if (tree->left) {
+		dropFirst(tree->left);
+		update(tree.get());
+	} else {
+		tree = std::move(tree->right);
+	}
+	return;
+}
+
+void piece_table::replace(stream::pos pos, stream::len lenOld,
+	std::shared_ptr<Node> piece)
+{
+	// The content is changing, so the next snapshot will need a new version
+	this->latest.reset();
+
+	std::shared_ptr<Node> head, rest, old, tail;
+	this->split(std::move(this->root), pos, &head, &rest);
+	this->split(std::move(rest), lenOld, &old, &tail);
+
+	// Join the new piece onto its neighbours where possible, so a run of
+	// sequential writes ends up as one piece rather than one per write.
+	const Piece *before = lastPiece(head.get());
+	if (piece && before && adjoins(*before, piece->piece)) {
+		growLast(head, piece->piece.len);
+		piece.reset();
+	}
+	const Piece *after = firstPiece(tail.get());
+	if (after) {
+		if (piece) {
+			if (adjoins(piece->piece, *after)) {
+				piece->piece.len += after->len;
+				update(piece.get());
+				dropFirst(tail);
+			}
+		} else {
+			before = lastPiece(head.get());
+			if (before && adjoins(*before, *after)) {
+				stream::len lenAfter = after->len;
+				dropFirst(tail);
+				growLast(head, lenAfter);
+			}
+		}
+	}
+
+	this->root = this->merge(
+		this->merge(std::move(head), std::move(piece)),
+		std::move(tail)
+	);
+	return;
+}
+
+stream::len piece_table::readTree(const Version *version, Store *store,
+	const Node *node, stream::pos pos, uint8_t *buffer, stream::len len)
+{
+	if (!node || (len == 0)) return 0;
+
+	stream::len copied = 0;
+	stream::len lenLeft = lenOf(node->left);
+	if (pos < lenLeft) {
+		copied = this->readTree(version, store, node->left.get(), pos, buffer,
+			len);
+		if (copied == len) return copied;
+	}
+
+	const Piece& p = node->piece;
+	stream::pos cur = pos + copied;
+	if (cur < lenLeft + p.len) {
+		stream::pos offPiece = cur - lenLeft;
+		stream::len amt = std::min(p.len - offPiece, len - copied);
+		switch (p.source) {
+			case Source::Parent:
+				this->readParent(version, p.offset + offPiece, buffer + copied, amt);
+				break;
+			case Source::Buffer:
+				store->read(p.offset + offPiece, buffer + copied, amt);
+				break;
+			case Source::Zero:
+				memset(buffer + copied, 0, amt);
+				break;
+		}
+		copied += amt;
+		cur += amt;
+	}
+
+	if (copied < len) {
+		copied += this->readTree(version, store, node->right.get(),
+			cur - lenLeft - p.len, buffer + copied, len - copied);
+	}
+	return copied;
+}
+
+stream::pos piece_table::appendBuffer(const uint8_t *data, stream::len len)
+{
+	return this->store->append(data, len, this->lenMemoryLimit);
+}
+
+std::shared_ptr<piece_table::Version> piece_table::pin()
+{
+	auto v = this->latest.lock();
+	if (!v) {
+		v = std::make_shared<Version>();
+		v->root = this->root;
+		v->store = this->store;
+		v->tracked = false;
+		this->latest = v;
+		this->hasSnapshots(); // drop any that have closed
+		this->versions.push_back(v);
+	}
+	return v;
+}
+
+void piece_table::readParent(const Version *version, stream::pos off,
+	uint8_t *buffer, stream::len len)
+{
+	std::lock_guard<std::mutex> lk(this->lockParent);
+	stream::pos p = off, end = off + len;
+	while (p < end) {
+		stream::pos until = end;
+		if (version) {
+			// Use the stashed copy of anything flush() has since overwritten
+			auto r = version->rescued.upper_bound(p);
+			if (r != version->rescued.begin()) {
+				auto prev = std::prev(r);
+				stream::pos prevEnd = prev->first + prev->second.second;
+				if (p < prevEnd) {
+					stream::len amt = std::min(prevEnd, end) - p;
+					version->store->read(prev->second.first + (p - prev->first),
+						buffer + (p - off), amt);
+					p += amt;
+					continue;
+				}
+			}
+			if ((r != version->rescued.end()) && (r->first < until)) {
+				until = r->first;
+			}
+		}
+		this->parent->seekg(p, stream::start);
+		this->parent->read(buffer + (p - off), until - p);
+		p = until;
+	}
+	return;
+}
+
+void piece_table::writeOut()
+{
+	// Flatten the tree into a list of pieces along with where each one ends up.
+	std::vector<std::pair<stream::pos, Piece>> pieces;
+	std::vector<const Node *> stack;
+	const Node *node = this->root.get();
+	stream::pos offDest = 0;
+	while (node || !stack.empty()) {
+		while (node) {
+			stack.push_back(node);
+			node = node->left.get();
+		}
+		node = stack.back();
+		stack.pop_back();
+		pieces.emplace_back(offDest, node->piece);
+		offDest += node->piece.len;
+		node = node->right.get();
+	}
+	stream::len lenNew = offDest;
+
+	// Shifting the parent would move data out from under any snapshots, which
+	// refer to it by offset.
+	if (!this->hasSnapshots()) this->shiftExtents(pieces);
+
+	// The parent is both the source and destination, so any parent data that
+	// has moved must be read before whatever ends up on top of it is written.
+	// Keep track of which parent regions are still needed, and when about to
+	// overwrite one, stash a copy of it in memory first.  Pieces that have not
+	// moved never need to be read or written.
+	RegionMap needed;
+	for (auto& i : pieces) {
+		const Piece& p = i.second;
+		if ((p.source == Source::Parent) && (p.offset != i.first)) {
+			needed[p.offset] = p.offset + p.len;
+		}
+	}
+	RescueMap rescued;
+
+	// Open snapshots need the same treatment, except their copies are kept for
+	// as long as the snapshot is, since the snapshot will never be written out.
+	std::vector<std::shared_ptr<Version>> live;
+	this->hasSnapshots();
+	for (auto& w : this->versions) {
+		auto v = w.lock();
+		if (v) live.push_back(v);
+	}
+	{
+		std::lock_guard<std::mutex> lk(this->lockParent);
+		for (auto& v : live) {
+			if (v->tracked) continue;
+			std::vector<const Node *> vstack;
+			const Node *vnode = v->root.get();
+			while (vnode || !vstack.empty()) {
+				while (vnode) {
+					vstack.push_back(vnode);
+					vnode = vnode->left.get();
+				}
+				vnode = vstack.back();
+				vstack.pop_back();
+				const Piece& p = vnode->piece;
+				if (p.source == Source::Parent) {
+					v->parentNeeded[p.offset] = p.offset + p.len;
+				}
+				vnode = vnode->right.get();
+			}
+			v->tracked = true;
+		}
+	}
+
+	// The copies go in the pending data store, so they are subject to the same
+	// memory limit as everything else.
+	std::vector<uint8_t> block;
+	auto stash = [&](stream::pos s, stream::pos e, Store *store) {
+		block.resize(e - s);
+		this->parent->seekg(s, stream::start);
+		this->parent->read(block.data(), e - s);
+		return std::make_pair(
+			store->append(block.data(), e - s, this->lenMemoryLimit), e - s);
+	};
+	auto protect = [&](stream::pos start, stream::pos end) {
+		cutRegion(&needed, start, end, [&](stream::pos s, stream::pos e) {
+			rescued[s] = stash(s, e, this->store.get());
+		});
+		for (auto& v : live) {
+			cutRegion(&v->parentNeeded, start, end,
+				[&](stream::pos s, stream::pos e) {
+					v->rescued[s] = stash(s, e, v->store.get());
+				}
+			);
+		}
+	};
+
+	auto fetch = [&](stream::pos start, stream::len len, uint8_t *out) {
+		stream::pos p = start, end = start + len;
+		while (p < end) {
+			auto r = rescued.upper_bound(p);
+			if (r != rescued.begin()) {
+				auto prev = std::prev(r);
+				stream::pos prevEnd = prev->first + prev->second.second;
+				if (p < prevEnd) {
+					stream::len amt = std::min(prevEnd, end) - p;
+					this->store->read(prev->second.first + (p - prev->first),
+						out + (p - start), amt);
+					p += amt;
+					if (p >= prevEnd) rescued.erase(prev);
+					continue;
+				}
+			}
+			stream::pos until = end;
+			if ((r != rescued.end()) && (r->first < until)) until = r->first;
+			this->parent->seekg(p, stream::start);
+			this->parent->read(out + (p - start), until - p);
+			p = until;
+		}
+		// This data has been consumed, so it no longer needs protecting.
+		cutRegion(&needed, start, end, [](stream::pos, stream::pos) {});
+	};
+
+	// The parent is only locked a block at a time, so snapshots on other threads
+	// can keep reading while this runs.
+	std::vector<uint8_t> data;
+	for (auto& i : pieces) {
+		stream::pos dest = i.first;
+		const Piece& p = i.second;
+		if ((p.source == Source::Parent) && (p.offset == dest)) continue;
+
+		for (stream::len done = 0; done < p.len; ) {
+			stream::len amt = std::min<stream::len>(p.len - done, PIECE_COPY_BLOCK);
+			std::lock_guard<std::mutex> lk(this->lockParent);
+			switch (p.source) {
+				case Source::Parent:
+					data.resize(amt);
+					fetch(p.offset + done, amt, data.data());
+					break;
+				case Source::Buffer:
+					data.resize(amt);
+					this->store->read(p.offset + done, data.data(), amt);
+					break;
+				case Source::Zero:
+				default:
+					data.assign(amt, 0);
+					break;
+			}
+			protect(dest + done, dest + done + amt);
+			this->parent->seekp(dest + done, stream::start);
+			this->parent->write(data.data(), amt);
+			done += amt;
+		}
+	}
+
+	std::lock_guard<std::mutex> lk(this->lockParent);
+	stream::len lenParent = this->parent->size();
+	if (lenParent > lenNew) {
+		protect(lenNew, lenParent);
+		this->parent->truncate(lenNew);
+	}
+	return;
+}
+
+void piece_table::shiftExtents(
+	std::vector<std::pair<stream::pos, Piece>>& pieces)
+{
+	auto extents = dynamic_cast<extent_file *>(this->parent.get());
+	if (!extents) return;
+	stream::len lenBlock = extents->blockSize();
+	if (lenBlock == 0) return;
+
+	// The gaps are only free to shift if no parent data in them is used, which
+	// is the case as long as the parent spans are in order and don't overlap.
+	stream::pos offPrevEnd = 0;
+	for (auto& i : pieces) {
+		const Piece& p = i.second;
+		if (p.source != Source::Parent) continue;
+		if (p.offset < offPrevEnd) return;
+		offPrevEnd = p.offset + p.len;
+	}
+
+	std::lock_guard<std::mutex> lk(this->lockParent);
+	stream::delta shifted = 0; // how far the parent has moved so far
+	stream::pos offGap = 0;    // start of the unused parent data before a span
+	for (auto& i : pieces) {
+		Piece& p = i.second;
+		if (p.source != Source::Parent) continue;
+		stream::pos offNow = p.offset + shifted;
+		stream::delta delta = (stream::delta)i.first - (stream::delta)offNow;
+		stream::pos offShift = (offGap + lenBlock - 1) / lenBlock * lenBlock;
+		if (
+			(delta > 0)
+			&& ((stream::len)delta % lenBlock == 0)
+			&& (offShift <= offNow)
+			&& extents->insertRange(offShift, delta)
+		) {
+			shifted += delta;
+		} else if (
+			(delta < 0)
+			&& ((stream::len)-delta % lenBlock == 0)
+			&& (offShift + -delta <= offNow)
+			&& extents->removeRange(offShift, -delta)
+		) {
+			shifted += delta;
+		}
+		p.offset += shifted;
+		offGap = p.offset + p.len;
+	}
+	return;
+}
+
+piece_snapshot::piece_snapshot(std::shared_ptr<piece_table> table)
+	:	table(table),
+		version(table->pin()),
+		offset(0)
+{
+}
+
+piece_snapshot::piece_snapshot(const piece_snapshot& other)
+	:	table(other.table),
+		version(other.version),
+		offset(0)
+{
+}
+
+piece_snapshot::~piece_snapshot()
+{
+}
+
+stream::len piece_snapshot::try_read(uint8_t *buffer, stream::len len)
+{
+	stream::len r = this->table->readTree(this->version.get(),
+		this->version->store.get(), this->version->root.get(), this->offset,
+		buffer, len);
+	this->offset += r;
+	return r;
+}
+
+void piece_snapshot::seekg(stream::delta off, stream::seek_from from)
+{
+	stream::delta base;
+	switch (from) {
+		case stream::start: base = 0; break;
+		case stream::cur: base = this->offset; break;
+		case stream::end: base = this->size(); break;
+		default: base = 0; break;
+	}
+	if (base + off < 0) {
+		throw stream::seek_error("Attempted to seek to before the start of the "
+			"stream.");
+	}
+	if ((stream::len)(base + off) > this->size()) {
+		throw stream::seek_error("Attempted to seek past the end of the stream.");
+	}
+	this->offset = base + off;
+	return;
+}
+
+stream::pos piece_snapshot::tellg() const
+{
+	return this->offset;
+}
+
+stream::len piece_snapshot::size() const
+{
+	return piece_table::lenOf(this->version->root);
+}
+
+stream::len piece_snapshot::try_write(const uint8_t *buffer, stream::len len)
+{
+	throw stream::write_error("Cannot write to a snapshot, it is read-only.");
+}
+
+void piece_snapshot::seekp(stream::delta off, stream::seek_from from)
+{
+	this->seekg(off, from);
+	return;
+}
+
+stream::pos piece_snapshot::tellp() const
+{
+	return this->offset;
+}
+
+void piece_snapshot::truncate(stream::len size)
+{
+	throw stream::write_error("Cannot resize a snapshot, it is read-only.");
+}
+
+void piece_snapshot::flush()
+{
+	return;
+}
+
+} // namespace gamearchive
+} // namespace camoto
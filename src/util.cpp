@@ -18,10 +18,22 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <camoto/stream_string.hpp>
 #include <camoto/util.hpp>
 #include <camoto/gamearchive/util.hpp>
 #include <camoto/gamearchive/archive-fat.hpp>
 #include <camoto/gamearchive/fixedarchive.hpp>
+#include <camoto/gamearchive/manager.hpp>
+#include "stream-bounded.hpp"
+
+/// Amount of data passed to a filter at a time by insertFiles(), so it can
+/// stop early once the result is too large to use.
+#define INSERT_FILTER_CHUNK_LEN  65536
 
 namespace fs = camoto::filesystem; // until C++17, then std::filesystem
 
@@ -100,6 +112,138 @@ void findFile(std::shared_ptr<Archive> *pArchive,
 	return;
 }
 
+std::vector<Archive::FileHandle> insertFiles(Archive& archive,
+	const Archive::FileHandle& idBeforeThis, const std::vector<NewFile>& files,
+	unsigned int numThreads, CompressPolicy policy)
+{
+	std::vector<Archive::FileHandle> ids;
+	ids.reserve(files.size());
+
+	// Filtered data for each file, filled in by the worker threads
+	std::vector<std::string> encoded(files.size());
+	std::vector<std::shared_ptr<const FilterType>> filters(files.size());
+
+	// Set for files that turned out to be better off stored without a filter
+	std::vector<char> keepRaw(files.size(), 0);
+
+	try {
+		// Insert each file first, as this is what picks the filter (if any) and it
+		// must happen in order.  The size is only a guess for filtered files,
+		// they get resized once their filtered size is known.
+		for (const auto& f : files) {
+			auto id = archive.insert(idBeforeThis, f.name, f.content.size(), f.type,
+				f.attr);
+			ids.push_back(id);
+			if (!id->filter.empty()) {
+				auto pFilterType = FilterManager::byCode(id->filter);
+				if (!pFilterType) {
+					throw stream::error(createString(
+						"could not find filter \"" << id->filter << "\""
+					));
+				}
+				filters[ids.size() - 1] = pFilterType;
+			}
+		}
+
+		// Run the filters on a pool of threads.  Each thread takes the next file
+		// that hasn't been done yet, so one large file doesn't hold up the rest.
+		if (numThreads == 0) numThreads = std::thread::hardware_concurrency();
+		numThreads = std::max(1u, std::min<unsigned int>(numThreads, files.size()));
+		std::atomic<std::size_t> next(0);
+		std::mutex lockFailure;
+		std::exception_ptr failure;
+		auto worker = [&]() {
+			for (;;) {
+				std::size_t i = next++;
+				if (i >= files.size()) break;
+				if (!filters[i]) continue;
+				const std::string& content = files[i].content;
+				try {
+					std::unique_ptr<stream::output_string> target;
+					output_bounded *bounded = nullptr;
+					if (policy == CompressPolicy::Smallest) {
+						if (content.empty()) {
+							// Nothing can be smaller than this
+							keepRaw[i] = 1;
+							continue;
+						}
+						// Stop as soon as the filtered data is no smaller than the
+						// original, as it won't be used.
+						auto b = std::make_unique<output_bounded>(content.size() - 1);
+						bounded = b.get();
+						target = std::move(b);
+					} else {
+						target = std::make_unique<stream::output_string>();
+					}
+					auto out = target.get();
+					auto filtered = filters[i]->apply(std::move(target), nullptr);
+					for (std::size_t pos = 0; pos < content.size();
+						pos += INSERT_FILTER_CHUNK_LEN
+					) {
+						filtered->write((const uint8_t *)content.data() + pos,
+							std::min<std::size_t>(INSERT_FILTER_CHUNK_LEN,
+								content.size() - pos));
+						if (bounded && bounded->tooLarge()) break;
+					}
+					// Once over the limit anything the filter still holds is thrown
+					// away, so it doesn't need flushing.
+					if (!bounded || !bounded->tooLarge()) filtered->flush();
+					if (bounded && bounded->tooLarge()) {
+						keepRaw[i] = 1;
+						continue;
+					}
+					encoded[i] = std::move(out->data);
+				} catch (...) {
+					std::lock_guard<std::mutex> lk(lockFailure);
+					if (!failure) failure = std::current_exception();
+					next = files.size(); // don't bother with the rest
+				}
+			}
+			return;
+		};
+		std::vector<std::thread> pool;
+		for (unsigned int t = 1; t < numThreads; t++) pool.emplace_back(worker);
+		worker(); // this thread helps out too
+		for (auto& t : pool) t.join();
+		if (failure) std::rethrow_exception(failure);
+
+		// Now all the sizes are known, set them and write the data
+		for (std::size_t i = 0; i < files.size(); i++) {
+			if (keepRaw[i]) {
+				// Put the file back without the compressed attribute, so the format
+				// marks it as stored.
+				auto attr = files[i].attr;
+				attr &= ~Archive::File::Attribute::Compressed;
+				archive.remove(ids[i]);
+				ids[i] = archive.insert(
+					(i + 1 < files.size()) ? ids[i + 1] : idBeforeThis,
+					files[i].name, files[i].content.size(), files[i].type, attr);
+				filters[i] = nullptr;
+				if (!ids[i]->filter.empty()) {
+					// The format filters this file anyway, so write it as normal
+					auto file = archive.open(ids[i], true);
+					file->write(files[i].content);
+					file->flush();
+					continue;
+				}
+			}
+			const std::string& data = filters[i] ? encoded[i] : files[i].content;
+			if (filters[i]) {
+				archive.resize(ids[i], data.size(), files[i].content.size());
+			}
+			auto file = archive.open(ids[i], false);
+			file->write(data);
+		}
+	} catch (...) {
+		for (auto& id : ids) {
+			if (archive.isValid(id)) archive.remove(id);
+		}
+		throw;
+	}
+
+	return ids;
+}
+
 void preventResize(stream::output_sub* sub, stream::len len)
 {
 	throw stream::write_error("This file is a fixed size, it cannot be made "
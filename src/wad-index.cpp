@@ -0,0 +1,208 @@
+/**
+ * @file  wad-index.cpp
+ * @brief Index of the marker namespaces and maps in a Doom WAD.
+ *
+ * Copyright (C) 2010-2016 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cctype>
+#include <camoto/gamearchive/wad-index.hpp>
+
+namespace camoto {
+namespace gamearchive {
+
+/// Pack an uppercase name the same way as WADIndex::lumpName().
+static constexpr WADIndex::LumpName packName(const char *name)
+{
+	WADIndex::LumpName key = 0;
+	for (unsigned int i = 0; (i < 8) && name[i]; i++) {
+		key |= (WADIndex::LumpName)(uint8_t)name[i] << (i * 8);
+	}
+	return key;
+}
+
+/// What a marker lump does.
+enum class MarkerType {
+	Start,   ///< Start of a namespace
+	End,     ///< End of a namespace
+	Nested,  ///< Start or end of a sub-group within a namespace
+};
+
+/// Marker lump and the namespace it belongs to.
+struct Marker {
+	WADIndex::LumpName name;
+	WADIndex::Namespace ns;
+	MarkerType type;
+};
+
+static constexpr Marker markers[] = {
+	{packName("S_START"),  WADIndex::Namespace::Sprites, MarkerType::Start},
+	{packName("SS_START"), WADIndex::Namespace::Sprites, MarkerType::Start},
+	{packName("S_END"),    WADIndex::Namespace::Sprites, MarkerType::End},
+	{packName("SS_END"),   WADIndex::Namespace::Sprites, MarkerType::End},
+	{packName("F_START"),  WADIndex::Namespace::Flats,   MarkerType::Start},
+	{packName("FF_START"), WADIndex::Namespace::Flats,   MarkerType::Start},
+	{packName("F_END"),    WADIndex::Namespace::Flats,   MarkerType::End},
+	{packName("FF_END"),   WADIndex::Namespace::Flats,   MarkerType::End},
+	{packName("F1_START"), WADIndex::Namespace::Flats,   MarkerType::Nested},
+	{packName("F1_END"),   WADIndex::Namespace::Flats,   MarkerType::Nested},
+	{packName("F2_START"), WADIndex::Namespace::Flats,   MarkerType::Nested},
+	{packName("F2_END"),   WADIndex::Namespace::Flats,   MarkerType::Nested},
+	{packName("F3_START"), WADIndex::Namespace::Flats,   MarkerType::Nested},
+	{packName("F3_END"),   WADIndex::Namespace::Flats,   MarkerType::Nested},
+	{packName("P_START"),  WADIndex::Namespace::Patches, MarkerType::Start},
+	{packName("PP_START"), WADIndex::Namespace::Patches, MarkerType::Start},
+	{packName("P_END"),    WADIndex::Namespace::Patches, MarkerType::End},
+	{packName("PP_END"),   WADIndex::Namespace::Patches, MarkerType::End},
+	{packName("P1_START"), WADIndex::Namespace::Patches, MarkerType::Nested},
+	{packName("P1_END"),   WADIndex::Namespace::Patches, MarkerType::Nested},
+	{packName("P2_START"), WADIndex::Namespace::Patches, MarkerType::Nested},
+	{packName("P2_END"),   WADIndex::Namespace::Patches, MarkerType::Nested},
+	{packName("P3_START"), WADIndex::Namespace::Patches, MarkerType::Nested},
+	{packName("P3_END"),   WADIndex::Namespace::Patches, MarkerType::Nested},
+};
+
+/// Names of the map lumps, in the same order as WADIndex::MapLump.
+static constexpr WADIndex::LumpName mapLumpNames[] = {
+	packName("THINGS"),
+	packName("LINEDEFS"),
+	packName("SIDEDEFS"),
+	packName("VERTEXES"),
+	packName("SEGS"),
+	packName("SSECTORS"),
+	packName("NODES"),
+	packName("SECTORS"),
+	packName("REJECT"),
+	packName("BLOCKMAP"),
+	packName("BEHAVIOR"),
+};
+
+static_assert(sizeof(mapLumpNames) / sizeof(mapLumpNames[0])
+	== WADIndex::MapLumpCount, "mapLumpNames must match WADIndex::MapLump");
+
+/// Get the marker with the given name, or nullptr if it's not a marker.
+static const Marker *findMarker(WADIndex::LumpName name)
+{
+	for (const auto& m : markers) {
+		if (m.name == name) return &m;
+	}
+	return nullptr;
+}
+
+/// Get the index into MapLump for the given name, or -1 if it's not a map lump.
+static int findMapLump(WADIndex::LumpName name)
+{
+	for (unsigned int i = 0; i < WADIndex::MapLumpCount; i++) {
+		if (mapLumpNames[i] == name) return i;
+	}
+	return -1;
+}
+
+WADIndex::LumpName WADIndex::lumpName(const std::string& name)
+{
+	LumpName key = 0;
+	for (unsigned int i = 0; (i < 8) && (i < name.length()) && name[i]; i++) {
+		key |= (LumpName)(uint8_t)toupper(name[i]) << (i * 8);
+	}
+	return key;
+}
+
+WADIndex::WADIndex(const Archive::FileVector& allFiles)
+{
+	// Leave out anything Archive::isValid() would reject, so no lookup can
+	// return it.  Vacant slots are skipped too, as they aren't real lumps.
+	Archive::FileVector files;
+	files.reserve(allFiles.size());
+	for (const auto& f : allFiles) {
+		if (!f || !f->bValid) continue;
+		if (f->fAttr & Archive::File::Attribute::Vacant) continue;
+		files.push_back(f);
+	}
+
+	// Work out each name once, as the map detection looks ahead
+	std::vector<LumpName> names;
+	names.reserve(files.size());
+	for (const auto& f : files) names.push_back(lumpName(f->strName));
+
+	Namespace cur = Namespace::Global;
+	for (std::size_t i = 0; i < files.size(); i++) {
+		LumpName name = names[i];
+
+		auto marker = findMarker(name);
+		if (marker) {
+			switch (marker->type) {
+				case MarkerType::Start:
+					cur = marker->ns;
+					break;
+				case MarkerType::End:
+					if (cur == marker->ns) cur = Namespace::Global;
+					break;
+				case MarkerType::Nested:
+					break;
+			}
+			continue;
+		}
+
+		Space& space = this->spaces[(unsigned int)cur];
+		space.lumps.push_back(files[i]);
+		space.byName[name] = files[i];
+
+		// A map header is any lump followed by the map's THINGS lump
+		if (
+			(cur == Namespace::Global)
+			&& (i + 1 < files.size())
+			&& (names[i + 1] == mapLumpNames[(unsigned int)MapLump::Things])
+		) {
+			MapBlock block;
+			for (std::size_t j = i + 1; j < files.size(); j++) {
+				int type = findMapLump(names[j]);
+				if (type < 0) break;
+				block.lumps[type] = files[j];
+			}
+			this->mapHeaders.push_back(files[i]);
+			this->mapBlocks[name] = block;
+		}
+	}
+}
+
+const Archive::FileVector& WADIndex::lumps(Namespace ns) const
+{
+	return this->spaces[(unsigned int)ns].lumps;
+}
+
+Archive::FileHandle WADIndex::find(Namespace ns, const std::string& name) const
+{
+	const auto& byName = this->spaces[(unsigned int)ns].byName;
+	auto it = byName.find(lumpName(name));
+	if (it == byName.end()) return nullptr;
+	return it->second;
+}
+
+const Archive::FileVector& WADIndex::maps() const
+{
+	return this->mapHeaders;
+}
+
+Archive::FileHandle WADIndex::mapLump(const std::string& map,
+	MapLump lump) const
+{
+	auto it = this->mapBlocks.find(lumpName(map));
+	if (it == this->mapBlocks.end()) return nullptr;
+	return it->second.lumps[(unsigned int)lump];
+}
+
+} // namespace gamearchive
+} // namespace camoto
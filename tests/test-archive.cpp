@@ -18,16 +18,28 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <atomic>
 #include <iomanip>
 #include <functional>
+#include <thread>
+#include <typeinfo>
 #include <camoto/util.hpp>
 #include <camoto/gamearchive/archive-fat.hpp> // Archive_FAT::FATEntry
+#include <camoto/gamearchive/archive-stack.hpp>
+#include <camoto/gamearchive/archive-sync.hpp>
 #include <camoto/gamearchive/fixedarchive.hpp> // FixedArchive::FixedEntry
+#include <camoto/gamearchive/stream_archfile.hpp> // archfile_reader
 #include "test-archive.hpp"
 
 using namespace camoto;
 using namespace camoto::gamearchive;
 
+/// Stream operations allowed on top of linear growth in checkScaling().
+#define SCALING_SLACK_OPS   64
+
+/// Bytes allowed on top of linear growth in checkScaling().
+#define SCALING_SLACK_BYTES 65536
+
 BOOST_AUTO_TEST_CASE(archive_attribute_operators)
 {
 	BOOST_TEST_MESSAGE("Confirm Attribute operators calculate as expected");
@@ -86,10 +98,12 @@ void test_archive::addTests()
 	ADD_ARCH_TEST(false, &test_archive::test_isinstance_others);
 	if (!this->virtualFiles) {
 		ADD_ARCH_TEST(false, &test_archive::test_open);
+		ADD_ARCH_TEST(false, &test_archive::test_probe_open);
 	}
 	if (this->lenMaxFilename >= 0) {
 		// Only perform the rename test if the archive has filenames
 		ADD_ARCH_TEST(false, &test_archive::test_rename);
+		ADD_ARCH_TEST(false, &test_archive::test_stack);
 		ADD_ARCH_TEST(false, &test_archive::test_shortext);
 	}
 	if (this->lenMaxFilename > 0) {
@@ -101,6 +115,18 @@ void test_archive::addTests()
 		ADD_ARCH_TEST(false, &test_archive::test_insert_mid);
 		ADD_ARCH_TEST(false, &test_archive::test_insert_end);
 		ADD_ARCH_TEST(false, &test_archive::test_insert2);
+		if (!this->foldersOnly) {
+			ADD_ARCH_TEST(false, &test_archive::test_insert_batch);
+			ADD_ARCH_TEST(false, &test_archive::test_snapshot);
+			ADD_ARCH_TEST(false, &test_archive::test_snapshot_thread);
+			ADD_ARCH_TEST(false, &test_archive::test_dedup);
+			ADD_ARCH_TEST(false, &test_archive::test_reader);
+			ADD_ARCH_TEST(false, &test_archive::test_spare_entries);
+			if (this->lenMaxFilename >= 0) {
+				// Files are matched up by name
+				ADD_ARCH_TEST(false, &test_archive::test_sync);
+			}
+		}
 		ADD_ARCH_TEST(false, &test_archive::test_remove);
 		ADD_ARCH_TEST(false, &test_archive::test_remove2);
 		ADD_ARCH_TEST(false, &test_archive::test_remove_open);
@@ -119,6 +145,12 @@ void test_archive::addTests()
 		ADD_ARCH_TEST(false, &test_archive::test_remove_all_re_add);
 	}
 
+	if (!this->staticFiles && !this->virtualFiles && !this->foldersOnly) {
+		// Check operations don't get disproportionately slower in large archives
+		ADD_ARCH_TEST(true, &test_archive::test_scaling_1k);
+		ADD_SLOW_ARCH_TEST(true, &test_archive::test_scaling_10k);
+	}
+
 	// Only perform the attribute tests if supported by the archive format
 	if (!this->attributes.empty()) {
 		ADD_ARCH_TEST(false, &test_archive::test_attributes);
@@ -140,15 +172,18 @@ void test_archive::addTests()
 
 void test_archive::addBoundTest(bool empty, std::function<void()> fnTest,
 	boost::unit_test::const_string file, std::size_t line,
-	boost::unit_test::const_string name)
+	boost::unit_test::const_string name, bool slow)
 {
-	this->ts->add(
-		boost::unit_test::make_test_case(
-			std::bind(&test_archive::runTest, this, empty, fnTest),
-			createString(name << '[' << this->basename << ']'),
-			file, line
-		)
+	auto tc = boost::unit_test::make_test_case(
+		std::bind(&test_archive::runTest, this, empty, fnTest),
+		createString(name << '[' << this->basename << ']'),
+		file, line
 	);
+	if (slow) {
+		tc->add_label("slow");
+		tc->p_default_status.value = boost::unit_test::test_unit::RS_DISABLED;
+	}
+	this->ts->add(tc);
 	return;
 }
 
@@ -382,6 +417,14 @@ void test_archive::test_isInstance(ArchiveType::Certainty result,
 	ss << content;
 
 	BOOST_CHECK_EQUAL(pTestType->isInstance(ss), result);
+
+	// probe() must always agree with isInstance()
+	std::unique_ptr<ArchiveType::ProbeResult> parsed;
+	BOOST_CHECK_EQUAL(pTestType->probe(ss, &parsed), result);
+	if (result == ArchiveType::Certainty::DefinitelyNo) {
+		BOOST_CHECK_MESSAGE(!parsed, "probe() returned data for a file that "
+			"isn't in its format");
+	}
 	return;
 }
 
@@ -586,6 +629,40 @@ void test_archive::test_open()
 	// No changes, so no flush
 }
 
+void test_archive::test_probe_open()
+{
+	BOOST_TEST_MESSAGE(this->basename << ": Opening archive with probeAndOpen()");
+
+	auto pTestType = ArchiveManager::byCode(this->type);
+	BOOST_REQUIRE_MESSAGE(pTestType,
+		createString("Could not find archive type " << this->type));
+
+	// Make this->suppData valid again, reusing previous data
+	this->populateSuppData();
+
+	std::unique_ptr<stream::inout> base2 = stream_wrap(this->base);
+	ArchiveType::Certainty cert;
+	auto pArchive = pTestType->probeAndOpen(base2, this->suppData, &cert);
+	BOOST_REQUIRE_MESSAGE(pArchive, "probeAndOpen() didn't recognise archive");
+	BOOST_CHECK_EQUAL(cert, pTestType->isInstance(*this->base));
+
+	// Should list the same files as open()
+	auto& filesProbed = pArchive->files();
+	auto& files = this->pArchive->files();
+	BOOST_REQUIRE_EQUAL(filesProbed.size(), files.size());
+	pArchive->resolveRealSizes(filesProbed);
+	this->pArchive->resolveRealSizes(files);
+	for (unsigned int i = 0; i < files.size(); i++) {
+		BOOST_CHECK_EQUAL(filesProbed[i]->strName, files[i]->strName);
+		BOOST_CHECK_EQUAL(filesProbed[i]->storedSize, files[i]->storedSize);
+		BOOST_CHECK_EQUAL(filesProbed[i]->realSize, files[i]->realSize);
+		BOOST_CHECK_EQUAL(filesProbed[i]->type, files[i]->type);
+		BOOST_CHECK_EQUAL(filesProbed[i]->filter, files[i]->filter);
+	}
+
+	// No changes, so no flush
+}
+
 void test_archive::test_rename()
 {
 	BOOST_TEST_MESSAGE(this->basename << ": Renaming file inside archive");
@@ -601,6 +678,47 @@ void test_archive::test_rename()
 		"Error renaming file");
 }
 
+void test_archive::test_stack()
+{
+	BOOST_TEST_MESSAGE(this->basename << ": Looking up files in a stack of archives");
+
+	ArchiveStack stack;
+	stack.add(this->pArchive);
+	auto match = stack.find(this->filename[0]);
+	BOOST_REQUIRE_MESSAGE(match.archive == this->pArchive,
+		"Couldn't find file in a stack of one archive");
+	BOOST_CHECK(match.id == this->findFile(0));
+
+	// Open a second copy of the archive on top of the first
+	auto pTestType = ArchiveManager::byCode(this->type);
+	BOOST_REQUIRE_MESSAGE(pTestType,
+		createString("Could not find archive type " << this->type));
+
+	// Make this->suppData valid again, reusing previous data
+	this->populateSuppData();
+
+	auto copy = std::make_shared<stream::string>();
+	copy->data = this->base->data;
+	std::shared_ptr<Archive> pUpper = pTestType->open(stream_wrap(copy),
+		this->suppData);
+	stack.add(pUpper);
+	BOOST_CHECK_MESSAGE(stack.find(this->filename[1]).archive == pUpper,
+		"File in upper archive didn't override the one in the lower archive");
+
+	// Removing the top layer should uncover the original files again
+	stack.remove(pUpper);
+	BOOST_CHECK_MESSAGE(stack.find(this->filename[1]).archive == this->pArchive,
+		"File in lower archive didn't reappear after removing upper archive");
+
+	// Changes to a layer should show up once it has been refreshed
+	this->pArchive->rename(this->findFile(0), this->filename[2]);
+	stack.refresh(this->pArchive);
+	BOOST_CHECK_MESSAGE(!stack.find(this->filename[0]).archive,
+		"Old filename still found after rename");
+	BOOST_CHECK_MESSAGE(stack.find(this->filename[2]).archive == this->pArchive,
+		"New filename not found after rename");
+}
+
 void test_archive::test_rename_long()
 {
 	BOOST_TEST_MESSAGE(this->basename << ": Rename file with name too long");
@@ -822,6 +940,392 @@ void test_archive::test_insert2()
 	);
 }
 
+void test_archive::test_insert_batch()
+{
+	BOOST_TEST_MESSAGE(this->basename << ": Inserting multiple files at once");
+
+	Archive::FileHandle epBefore = this->findFile(1);
+
+	std::vector<NewFile> files(2);
+	for (int i = 0; i < 2; i++) {
+		files[i].name = this->filename[2 + i];
+		files[i].type = this->insertType;
+		files[i].attr = this->insertAttr;
+		files[i].content = this->content[2 + i];
+	}
+	auto ids = insertFiles(*this->pArchive, epBefore, files, 2);
+
+	BOOST_REQUIRE_EQUAL(ids.size(), 2);
+	for (auto& id : ids) {
+		BOOST_REQUIRE_MESSAGE(this->pArchive->isValid(id),
+			"Couldn't insert new files in sample archive");
+	}
+
+	// Should be the same as inserting them one at a time
+	this->checkData(&test_archive::content_1342,
+		"Error inserting two files at once"
+	);
+}
+
+void test_archive::test_snapshot()
+{
+	BOOST_TEST_MESSAGE(this->basename << ": Reading snapshot after modifying archive");
+
+	auto pFATArchive = std::dynamic_pointer_cast<Archive_FAT>(this->pArchive);
+	if (!pFATArchive) return; // snapshots are only available for FAT archives
+
+	auto snap = pFATArchive->snapshot();
+	BOOST_REQUIRE_EQUAL(snap->files().size(), 2);
+
+	// Remove the first file and write the change out
+	this->pArchive->remove(this->findFile(0));
+	this->checkData(&test_archive::content_2,
+		"Error removing file while a snapshot was open"
+	);
+
+	// The snapshot should still have both files, with their original data
+	BOOST_REQUIRE_EQUAL(snap->files().size(), 2);
+	for (int i = 0; i < 2; i++) {
+		auto ep = snap->files()[i];
+		BOOST_REQUIRE_MESSAGE(snap->isValid(ep), "Snapshot has an invalid file");
+		auto pfsIn = snap->open(ep, true);
+		stream::string out;
+		stream::copy(out, *pfsIn);
+		BOOST_CHECK_MESSAGE(
+			this->is_equal(this->content[i], out.data),
+			"Snapshot file content changed after archive was modified"
+		);
+	}
+
+	BOOST_CHECK_THROW(snap->remove(snap->files()[0]), stream::error);
+}
+
+void test_archive::test_snapshot_thread()
+{
+	BOOST_TEST_MESSAGE(this->basename << ": Reading snapshot on another thread "
+		"while modifying archive");
+
+	auto pFATArchive = std::dynamic_pointer_cast<Archive_FAT>(this->pArchive);
+	if (!pFATArchive) return; // snapshots are only available for FAT archives
+
+	auto snap = pFATArchive->snapshot();
+	const auto& orig = this->pArchive->files();
+	BOOST_REQUIRE_EQUAL(snap->files().size(), orig.size());
+	for (unsigned int i = 0; i < orig.size(); i++) {
+		// Formats with their own FATEntry fields must still have them
+		BOOST_CHECK_MESSAGE(typeid(*snap->files()[i]) == typeid(*orig[i]),
+			"Snapshot entry is a different type to the archive's entry");
+		BOOST_CHECK_EQUAL(snap->files()[i]->getContent(), orig[i]->getContent());
+	}
+
+	// Keep reading the files from the snapshot until told to stop
+	std::atomic<bool> stop(false);
+	unsigned int numReads = 0;
+	std::string problem;
+	std::thread reader([&]() {
+		try {
+			do {
+				for (int i = 0; i < 2; i++) {
+					auto pfsIn = snap->open(snap->files()[i], true);
+					stream::string out;
+					stream::copy(out, *pfsIn);
+					if (out.data.compare(this->content[i]) != 0) {
+						problem = createString("file " << i << " changed in snapshot");
+						return;
+					}
+				}
+				numReads++;
+			} while (!stop);
+		} catch (const stream::error& e) {
+			problem = e.what();
+		}
+		return;
+	});
+
+	// Meanwhile move the data around, change it and write it all out
+	try {
+		for (int n = 0; n < 20; n++) {
+			auto ep = this->pArchive->insert(this->findFile(0), this->filename[2],
+				this->content[2].length(), this->insertType, this->insertAttr);
+			auto pfsNew = this->pArchive->open(ep, true);
+			pfsNew->write(this->content[2]);
+			pfsNew->flush();
+			pfsNew.reset();
+
+			auto pfsOld = this->pArchive->open(this->findFile(2), true);
+			pfsOld->write(std::string(this->content[1].length(), 'X'));
+			pfsOld->flush();
+			pfsOld.reset();
+			this->pArchive->flush();
+
+			this->pArchive->remove(ep);
+			this->pArchive->flush();
+		}
+	} catch (...) {
+		stop = true;
+		reader.join();
+		throw;
+	}
+	stop = true;
+	reader.join();
+
+	BOOST_CHECK_MESSAGE(problem.empty(), "Error reading snapshot on another "
+		"thread: " << problem);
+	BOOST_CHECK_GT(numReads, 0);
+}
+
+void test_archive::test_dedup()
+{
+	BOOST_TEST_MESSAGE(this->basename << ": Storing identical files only once");
+
+	auto pFATArchive = std::dynamic_pointer_cast<Archive_FAT>(this->pArchive);
+	if (!pFATArchive || !pFATArchive->canDeduplicate()) return;
+
+	// Add copies of both files to the end of the archive
+	Archive::FileHandle epCopy[2];
+	for (int i = 0; i < 2; i++) {
+		epCopy[i] = this->pArchive->insert(nullptr, this->filename[2 + i],
+			this->content[i].length(), this->insertType, this->insertAttr);
+		BOOST_REQUIRE_MESSAGE(this->pArchive->isValid(epCopy[i]),
+			"Couldn't insert new file in sample archive");
+		auto pfsNew = this->pArchive->open(epCopy[i], true);
+		pfsNew->write(this->content[i]);
+		pfsNew->flush();
+	}
+	this->pArchive->flush();
+	stream::len lenOrig = this->base->data.length();
+
+	// Share the first copy, then all the rest
+	BOOST_CHECK(pFATArchive->deduplicate(epCopy[0]));
+	BOOST_CHECK_EQUAL(pFATArchive->deduplicate(), epCopy[1]->storedSize);
+	this->pArchive->flush();
+	BOOST_CHECK_EQUAL(this->base->data.length(),
+		lenOrig - epCopy[0]->storedSize - epCopy[1]->storedSize);
+
+	// Reopen the archive, so the shared data has to be picked up from the FAT
+	auto pTestType = ArchiveManager::byCode(this->type);
+	BOOST_REQUIRE_MESSAGE(pTestType,
+		createString("Could not find archive type " << this->type));
+	this->populateSuppData();
+	this->pArchive = pTestType->open(stream_wrap(this->base), this->suppData);
+
+	auto readFile = [this](const Archive::FileHandle& ep, bool useFilter) {
+		auto pfsIn = this->pArchive->open(ep, useFilter);
+		stream::string out;
+		stream::copy(out, *pfsIn);
+		return out.data;
+	};
+	for (int i = 0; i < 2; i++) {
+		BOOST_CHECK_MESSAGE(
+			this->is_equal(this->content[i], readFile(this->findFile(2 + i), true)),
+			"Shared file has the wrong content"
+		);
+	}
+
+	// Writing to one file must not change the file it shares data with
+	auto ep0 = this->findFile(0);
+	std::string raw0 = readFile(ep0, false);
+	{
+		auto pfsOut = this->pArchive->open(this->findFile(2), false);
+		pfsOut->write(std::string(raw0.length(), '\xAA'));
+		pfsOut->flush();
+	}
+	BOOST_CHECK_MESSAGE(
+		this->is_equal(raw0, readFile(ep0, false)),
+		"Writing to a shared file changed the other file using the data"
+	);
+
+	// Removing one file must leave the data for the other
+	this->pArchive->remove(this->findFile(1));
+	BOOST_CHECK_MESSAGE(
+		this->is_equal(this->content[1], readFile(this->findFile(3), true)),
+		"Removing a shared file removed the data of the other file using it"
+	);
+}
+
+void test_archive::test_sync()
+{
+	BOOST_TEST_MESSAGE(this->basename << ": Syncing with a newer copy of the archive");
+
+	auto pTestType = ArchiveManager::byCode(this->type);
+	BOOST_REQUIRE_MESSAGE(pTestType,
+		createString("Could not find archive type " << this->type));
+
+	ArchiveSync sync;
+
+	// Sync from a second archive holding the given content, and check the
+	// result is byte for byte the same as that archive.
+	auto syncFrom = [&](std::function<std::string(test_archive&)> fnSource,
+		const std::string& msg)
+	{
+		auto srcBase = std::make_shared<stream::string>();
+		*srcBase << fnSource(*this);
+		std::map<SuppItem, std::shared_ptr<stream::string>> srcSupp;
+		SuppData srcSuppData;
+		for (auto& i : this->suppResult) {
+			if (!i.second) continue;
+			auto suppSS = std::make_shared<stream::string>();
+			*suppSS << fnSource(*i.second);
+			srcSupp[i.first] = suppSS;
+			srcSuppData[i.first] = stream_wrap(suppSS);
+		}
+		auto pSrc = pTestType->open(stream_wrap(srcBase), srcSuppData);
+
+		auto result = sync.sync(*this->pArchive, *pSrc);
+		this->pArchive->flush();
+		BOOST_CHECK_MESSAGE(this->is_content_equal(srcBase->data), msg);
+		for (auto& i : srcSupp) {
+			BOOST_CHECK_MESSAGE(
+				this->is_supp_equal(i.first, i.second->data),
+				"[SuppItem::" << camoto::suppToString(i.first) << "] " << msg
+			);
+		}
+
+		// Nothing should be written the second time around
+		auto again = sync.sync(*this->pArchive, *pSrc);
+		BOOST_CHECK_EQUAL(again.unchanged, pSrc->files().size());
+		BOOST_CHECK_EQUAL(again.lenCopied, 0);
+		return result;
+	};
+
+	// Swapping the files only needs one of them moved, keeping its data
+	auto result = syncFrom(&test_archive::content_21,
+		"Error syncing archive with the files swapped");
+	BOOST_CHECK_EQUAL(result.moved, 1);
+	BOOST_CHECK_EQUAL(result.removed, 0);
+	BOOST_CHECK_EQUAL(result.inserted, 0);
+
+	// A file removed and a different one added
+	syncFrom(&test_archive::content_32,
+		"Error syncing archive with a file replaced");
+}
+
+void test_archive::test_reader()
+{
+	BOOST_TEST_MESSAGE(this->basename << ": Reading file with archfile_reader");
+
+	auto pFAT = std::dynamic_pointer_cast<Archive_FAT>(this->pArchive);
+	if (!pFAT) {
+		BOOST_TEST_MESSAGE(this->basename << ": Not an Archive_FAT, skipping");
+		return;
+	}
+
+	auto ep = this->findFile(1);
+	auto reader = pFAT->openReader(ep);
+	BOOST_REQUIRE_EQUAL(reader->size(), ep->storedSize);
+
+	// The reader gives the stored data, so it can only be compared with the
+	// expected content if there is no filter.
+	stream::string out;
+	stream::copy(out, *reader);
+	if (ep->filter.empty()) {
+		BOOST_CHECK_MESSAGE(
+			this->is_equal(this->content[1], out.data),
+			"Error reading file or wrong file read"
+		);
+	}
+
+	// Removing the first file moves the second one, which the reader must
+	// notice without being opened again.
+	this->pArchive->remove(this->findFile(0));
+	stream::string outMoved;
+	reader->seekg(0, stream::start);
+	stream::copy(outMoved, *reader);
+	BOOST_CHECK_MESSAGE(
+		this->is_equal(out.data, outMoved.data),
+		"Reader returned different data after an earlier file was removed"
+	);
+
+	// Once the file itself is gone, reading must fail
+	this->pArchive->remove(ep);
+	uint8_t buf[1];
+	BOOST_CHECK_THROW(reader->try_read(buf, 1), stream::error);
+}
+
+void test_archive::test_spare_entries()
+{
+	BOOST_TEST_MESSAGE(this->basename << ": Inserting into spare FAT entries");
+
+	// Only some formats can keep spare FAT entries
+	auto attrs = this->pArchive->attributes();
+	unsigned int attrSpare = 0;
+	while (
+		(attrSpare < attrs.size())
+		&& (attrs[attrSpare].name.compare("Spare FAT entries") != 0)
+	) attrSpare++;
+	if (attrSpare == attrs.size()) {
+		BOOST_TEST_MESSAGE(this->basename << ": No spare FAT entries, skipping");
+		return;
+	}
+	BOOST_CHECK_EQUAL(attrs[attrSpare].integerValue, 0);
+
+	auto offsets = [](const Archive::FileVector& files) {
+		std::vector<stream::pos> off;
+		for (auto& i : files) off.push_back(Archive_FAT::FATEntry::cast(i)->iOffset);
+		return off;
+	};
+
+	// Reserving the entries moves the files once
+	this->pArchive->attribute(attrSpare, 2);
+	auto offBefore = offsets(this->pArchive->files());
+
+	// After that, adding a file leaves the others where they are
+	auto ep = this->pArchive->insert(nullptr, this->filename[2],
+		this->content[2].length(), this->insertType, this->insertAttr);
+	auto pfsNew = this->pArchive->open(ep, true);
+	pfsNew->write(this->content[2]);
+	pfsNew->flush();
+	pfsNew = nullptr;
+
+	auto offAfter = offsets(this->pArchive->files());
+	BOOST_REQUIRE_EQUAL(offAfter.size(), offBefore.size() + 1);
+	offAfter.pop_back();
+	BOOST_CHECK(offAfter == offBefore);
+	BOOST_CHECK_EQUAL(this->pArchive->attributes()[attrSpare].integerValue, 1);
+
+	// Removing a file turns its entry back into a spare one
+	offBefore = offsets(this->pArchive->files());
+	this->pArchive->remove(this->pArchive->files()[0]);
+	offAfter = offsets(this->pArchive->files());
+	offBefore.erase(offBefore.begin());
+	BOOST_CHECK(offAfter == offBefore);
+	BOOST_CHECK_EQUAL(this->pArchive->attributes()[attrSpare].integerValue, 2);
+
+	// The spare entries are still there when opened again, and can be used
+	// without moving any file data
+	this->pArchive->flush();
+	this->populateSuppData();
+	auto pArchType = ArchiveManager::byCode(this->type);
+	auto pReopened = pArchType->open(stream_wrap(this->base), this->suppData);
+	BOOST_CHECK_EQUAL(pReopened->attributes()[attrSpare].integerValue, 2);
+
+	offBefore = offsets(pReopened->files());
+	ep = pReopened->insert(nullptr, this->filename[0],
+		this->content[0].length(), this->insertType, this->insertAttr);
+	pfsNew = pReopened->open(ep, true);
+	pfsNew->write(this->content[0]);
+	pfsNew->flush();
+	pfsNew = nullptr;
+	offAfter = offsets(pReopened->files());
+	BOOST_REQUIRE_EQUAL(offAfter.size(), offBefore.size() + 1);
+	offAfter.pop_back();
+	BOOST_CHECK(offAfter == offBefore);
+	BOOST_CHECK_EQUAL(pReopened->attributes()[attrSpare].integerValue, 1);
+	pReopened->flush();
+
+	auto& files = pReopened->files();
+	BOOST_REQUIRE_EQUAL(files.size(), 3);
+	for (unsigned int i = 0; i < 3; i++) {
+		auto file = pReopened->open(files[i], true);
+		stream::string out;
+		stream::copy(out, *file);
+		BOOST_CHECK_MESSAGE(
+			this->is_equal(this->content[(i + 1) % 3], out.data),
+			"Wrong data in file " << i << " after inserting into a spare entry"
+		);
+	}
+}
+
 void test_archive::test_remove()
 {
 	BOOST_TEST_MESSAGE(this->basename << ": Removing file from archive");
@@ -1564,3 +2068,159 @@ void test_archive::test_new_manipulate_zero_length_files()
 		"Error manipulating zero-length files"
 	);
 }
+
+bool test_archive::measureScaling(unsigned int numFiles, ScalingCosts *costs)
+{
+	auto pArchType = ArchiveManager::byCode(this->type);
+	BOOST_REQUIRE_MESSAGE(pArchType, "Could not find archive type " + this->type);
+
+	// Give each file a unique name, keeping the extension of the usual test
+	// files if there's room for it.
+	std::string ext;
+	auto posDot = this->filename[0].rfind('.');
+	if (posDot != std::string::npos) ext = this->filename[0].substr(posDot);
+	auto name = [this, &ext](unsigned int index) {
+		std::string n = createString('F' << std::setw(5) << std::setfill('0')
+			<< index);
+		if (
+			(this->lenMaxFilename <= 0)
+			|| (n.length() + ext.length() <= (unsigned int)this->lenMaxFilename)
+		) {
+			n += ext;
+		}
+		return n;
+	};
+	if ((this->lenMaxFilename > 0) && (this->lenMaxFilename < 6)) {
+		BOOST_TEST_MESSAGE(this->basename << ": Filenames too short for "
+			"scaling test, skipping");
+		return false;
+	}
+
+	stream::len lenFile = (this->lenFilesizeFixed >= 0)
+		? this->lenFilesizeFixed : 8;
+	std::string data(lenFile, 'X');
+
+	// Count the edits the archive makes on its piece table separately from the
+	// I/O they cause on the underlying file once flushed.
+	auto countsEdit = std::make_shared<stream_counts>();
+	auto countsFlush = std::make_shared<stream_counts>();
+	this->base = std::make_shared<stream::string>();
+	this->resetSuppData(true);
+	this->populateSuppData();
+	this->pArchive = pArchType->create(
+		std::make_unique<counting_piece_table>(
+			std::make_unique<counting_stream>(stream_wrap(this->base), countsFlush),
+			countsEdit
+		),
+		this->suppData);
+	this->setAttributes();
+
+	auto insertAt = [&](const Archive::FileHandle& idBeforeThis,
+		unsigned int index)
+	{
+		auto id = this->pArchive->insert(idBeforeThis, name(index), lenFile,
+			this->insertType, this->insertAttr);
+		auto file = this->pArchive->open(id, false);
+		file->write(data);
+		file->flush();
+		return;
+	};
+
+	try {
+		for (unsigned int i = 0; i < numFiles; i++) insertAt(nullptr, i);
+		this->pArchive->flush();
+	} catch (const stream::error& e) {
+		BOOST_TEST_MESSAGE(this->basename << ": Format can't hold " << numFiles
+			<< " files (" << e.what() << "), skipping");
+		return false;
+	}
+
+	// Do each operation on the file in the middle, where it affects the most
+	// entries both before and after it.
+	auto mid = [this]() {
+		auto& files = this->pArchive->files();
+		return files[files.size() / 2];
+	};
+	auto measure = [&](const std::string& op, std::function<void()> fnOp) {
+		*countsEdit = stream_counts();
+		fnOp();
+		(*costs)[op].edit = *countsEdit;
+
+		*countsFlush = stream_counts();
+		this->pArchive->flush();
+		(*costs)[op].flush = *countsFlush;
+		return;
+	};
+
+	measure("insert", [&]() {
+		insertAt(mid(), numFiles);
+	});
+	measure("remove", [&]() {
+		this->pArchive->remove(mid());
+	});
+	if (this->lenMaxFilename >= 0) {
+		measure("rename", [&]() {
+			this->pArchive->rename(mid(), name(numFiles + 1));
+		});
+	}
+	if (this->lenFilesizeFixed < 0) {
+		measure("resize", [&]() {
+			auto id = mid();
+			this->pArchive->resize(id, id->storedSize + 16, id->realSize + 16);
+		});
+	}
+	return true;
+}
+
+void test_archive::checkScaling(unsigned int numSmall, unsigned int numLarge)
+{
+	ScalingCosts costSmall, costLarge;
+	if (!this->measureScaling(numSmall, &costSmall)) return;
+	if (!this->measureScaling(numLarge, &costLarge)) return;
+
+	// Allow for twice the linear growth, plus a fixed amount for small archives
+	// where the overheads outweigh the per-file cost.
+	double factor = 2.0 * numLarge / numSmall;
+	auto check = [&](const std::string& op, const std::string& what,
+		const stream_counts& small, const stream_counts& large)
+	{
+		BOOST_TEST_MESSAGE(this->basename << ": " << op << " " << what << " with "
+			<< numSmall << " files: " << small.ops << " ops, " << small.bytes
+			<< " bytes; with " << numLarge << " files: " << large.ops << " ops, "
+			<< large.bytes << " bytes");
+		BOOST_CHECK_MESSAGE(
+			large.ops <= factor * small.ops + SCALING_SLACK_OPS,
+			"Number of " << what << " operations to " << op << " a file grows too "
+			"quickly with the number of files (" << small.ops << " with "
+			<< numSmall << " files, " << large.ops << " with " << numLarge << ")"
+		);
+		BOOST_CHECK_MESSAGE(
+			large.bytes <= factor * small.bytes + SCALING_SLACK_BYTES,
+			"Amount of " << what << " data to " << op << " a file grows too "
+			"quickly with the number of files (" << small.bytes << " bytes with "
+			<< numSmall << " files, " << large.bytes << " with " << numLarge << ")"
+		);
+		return;
+	};
+	for (const auto& i : costLarge) {
+		const auto& small = costSmall[i.first];
+		const auto& large = i.second;
+		check(i.first, "edit", small.edit, large.edit);
+		check(i.first, "flush", small.flush, large.flush);
+	}
+	return;
+}
+
+void test_archive::test_scaling_1k()
+{
+	BOOST_TEST_MESSAGE(this->basename << ": Comparing I/O with 10 and 1000 files");
+	this->checkScaling(10, 1000);
+}
+
+// Building the archive takes a long time, as each insert still has to update
+// every file's offset, so this is only run when asked for.
+void test_archive::test_scaling_10k()
+{
+	BOOST_TEST_MESSAGE(this->basename << ": Comparing I/O with 1000 and 10000 files");
+	this->checkScaling(1000, 10000);
+}
@@ -72,12 +72,23 @@ class test_archive: public test_main
 
 		virtual void test_isinstance_others();
 		void test_open();
+		void test_probe_open();
 		void test_rename();
+		void test_stack();
 		void test_rename_long();
 		void test_insert_long();
 		void test_insert_mid();
 		void test_insert_end();
 		void test_insert2();
+		void test_insert_batch();
+		void test_snapshot();
+		void test_snapshot_thread();
+		void test_dedup();
+		void test_sync();
+		void test_reader();
+		void test_spare_entries();
+		void test_scaling_1k();
+		void test_scaling_10k();
 		void test_remove();
 		void test_remove2();
 		void test_remove_open();
@@ -142,9 +153,14 @@ class test_archive: public test_main
 		virtual std::string content_1w2() = 0;
 
 		/// Add a test to the suite.  Used by ADD_ARCH_TEST().
+		/**
+		 * @param slow
+		 *   true if the test takes a long time, so should only be run when asked
+		 *   for with --run_test=@slow.  Used by ADD_SLOW_ARCH_TEST().
+		 */
 		void addBoundTest(bool empty, std::function<void()> fnTest,
 			boost::unit_test::const_string file, std::size_t line,
-			boost::unit_test::const_string name);
+			boost::unit_test::const_string name, bool slow = false);
 
 		/// Reset the archive to the initial state and run the given test.
 		/**
@@ -253,6 +269,40 @@ class test_archive: public test_main
 			int newValue, const std::string& content,
 			unsigned int testNumber);
 
+		/// Work done by one operation in measureScaling().
+		struct ScalingCost
+		{
+			stream_counts edit;  ///< Calls made by the archive to its piece table
+			stream_counts flush; ///< I/O on the underlying file when flushed
+		};
+
+		/// Work done by each operation in measureScaling(), indexed by
+		/// operation name.
+		typedef std::map<std::string, ScalingCost> ScalingCosts;
+
+		/// Build an archive with the given number of files, and count how much
+		/// I/O it takes to change one of them.
+		/**
+		 * A new archive is created with numFiles files in it, then a file is
+		 * inserted, removed, renamed and resized in the middle of it.  Each
+		 * change is counted where the archive makes it, on its piece table, and
+		 * then flushed, with the I/O that causes on the underlying file counted
+		 * separately.
+		 *
+		 * @return false if the format can't hold this many files, in which case
+		 *   costs is not filled in.
+		 */
+		bool measureScaling(unsigned int numFiles, ScalingCosts *costs);
+
+		/// Make sure operations don't get more than linearly slower with more
+		/// files.
+		/**
+		 * Compares measureScaling() for two archive sizes and fails if either
+		 * the edits or the flush of any operation grow faster than the number
+		 * of files, with plenty of room for constant overheads.
+		 */
+		void checkScaling(unsigned int numSmall, unsigned int numLarge);
+
 		/// Does the archive content match the parameter?
 		boost::test_tools::predicate_result is_content_equal(const std::string& exp);
 
@@ -408,4 +458,14 @@ class test_archive: public test_main
 		BOOST_TEST_STRINGIZE(fn) \
 	);
 
+/// Add a test_archive member function that takes a long time to run.
+#define ADD_SLOW_ARCH_TEST(empty, fn) \
+	this->test_archive::addBoundTest( \
+		empty, \
+		std::bind(fn, this), \
+		__FILE__, __LINE__, \
+		BOOST_TEST_STRINGIZE(fn), \
+		true \
+	);
+
 #endif // _CAMOTO_GAMEARCHIVE_TEST_ARCHIVE_HPP_
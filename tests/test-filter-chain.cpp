@@ -0,0 +1,178 @@
+/**
+ * @file   test-filter-chain.cpp
+ * @brief  Test code for running multiple filters in one pass.
+ *
+ * Copyright (C) 2010-2016 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <cstring>
+#include "test-filter.hpp"
+#include "../src/filter-bitswap.hpp"
+#include "../src/filter-chain.hpp"
+#include "../src/filter-xor.hpp"
+
+using namespace camoto::gamearchive;
+
+/// Filter that copies its input, noting what it was given.
+class filter_probe: virtual public filter
+{
+	public:
+		filter_probe()
+			:	lenReset(0),
+				overlapped(false)
+		{
+		}
+
+		virtual void reset(stream::len lenInput)
+		{
+			this->lenReset = lenInput;
+			return;
+		}
+
+		virtual void transform(uint8_t *out, stream::len *lenOut,
+			const uint8_t *in, stream::len *lenIn)
+		{
+			stream::len amt = std::min(*lenIn, *lenOut);
+			if ((out < in + amt) && (in < out + amt)) this->overlapped = true;
+			memcpy(out, in, amt);
+			*lenIn = *lenOut = amt;
+			return;
+		}
+
+		stream::len lenReset; ///< Value last passed to reset()
+		bool overlapped;      ///< Was transform() given overlapping buffers?
+};
+
+/// Bitswap then XOR, with the XOR fused onto the bitswap's output.
+class test_filter_chain: public test_filter
+{
+	public:
+		test_filter_chain()
+			:	sameLength(true)
+		{
+		}
+
+		void addTests()
+		{
+			this->test_filter::addTests();
+
+			this->content("normal", 8, STRING_WITH_NULLS(
+				"\x00\x01\x02\x03\xFF\xFF\xFF\xFF"
+			), STRING_WITH_NULLS(
+				"\x00\x81\x42\xC3\xFB\xFA\xF9\xF8"
+			));
+
+			ADD_FILTER_TEST(&test_filter_chain::stage_lengths);
+		}
+
+		/// Each stage must be told its own input length, and get its own buffers.
+		void stage_lengths()
+		{
+			auto fused = std::make_shared<filter_probe>();
+			auto afterFused = std::make_shared<filter_probe>();
+			auto afterChange = std::make_shared<filter_probe>();
+			auto chain = std::make_shared<filter_chain>();
+			chain->add(std::make_shared<filter_bitswap>(), true);
+			chain->add(fused, true);
+			// Could change the length as far as the chain knows
+			chain->add(afterFused, false);
+			chain->add(afterChange, true);
+
+			std::string data(100, '\x01');
+			auto in = std::make_unique<stream::input_filtered>(
+				std::make_unique<stream::string>(data), chain);
+			stream::string out;
+			stream::copy(out, *in);
+
+			BOOST_CHECK_EQUAL(fused->lenReset, 100);
+			BOOST_CHECK_EQUAL(afterFused->lenReset, 100);
+			BOOST_CHECK_EQUAL(afterChange->lenReset, FILTER_CHAIN_LEN_UNKNOWN);
+			BOOST_CHECK_MESSAGE(!fused->overlapped && !afterChange->overlapped,
+				"Fused stage was given the same buffer for input and output");
+			BOOST_CHECK_MESSAGE(
+				this->is_equal(std::string(100, '\x80'), out.data),
+				"Chain with fused stages gave the wrong output"
+			);
+		}
+
+		std::shared_ptr<filter> decoder()
+		{
+			auto chain = std::make_shared<filter_chain>();
+			chain->add(std::make_shared<filter_bitswap>(), true);
+			chain->add(std::make_shared<filter_xor_crypt>(0, 0), this->sameLength);
+			return chain;
+		}
+
+		std::shared_ptr<filter> encoder()
+		{
+			auto chain = std::make_shared<filter_chain>();
+			chain->add(std::make_shared<filter_xor_crypt>(0, 0), true);
+			chain->add(std::make_shared<filter_bitswap>(), this->sameLength);
+			return chain;
+		}
+
+		std::unique_ptr<stream::input> apply_in(
+			std::unique_ptr<stream::input> content)
+		{
+			return std::make_unique<stream::input_filtered>(
+				std::move(content),
+				this->decoder()
+			);
+		}
+
+		std::unique_ptr<stream::output> apply_out(
+			std::unique_ptr<stream::output> content, stream::len *setPrefiltered)
+		{
+			return std::make_unique<stream::output_filtered>(
+				std::move(content),
+				this->encoder(),
+				[setPrefiltered](stream::output_filtered* s, stream::len l) {
+					if (setPrefiltered) *setPrefiltered = l;
+				}
+			);
+		}
+
+		std::unique_ptr<stream::inout> apply_inout(
+			std::unique_ptr<stream::inout> content, stream::len *setPrefiltered)
+		{
+			return std::make_unique<stream::filtered>(
+				std::move(content),
+				this->decoder(),
+				this->encoder(),
+				[setPrefiltered](stream::output_filtered* s, stream::len l) {
+					if (setPrefiltered) *setPrefiltered = l;
+				}
+			);
+		}
+
+	protected:
+		/// Add the second stage as same-length, fusing it onto the first?
+		bool sameLength;
+};
+
+/// Same as test_filter_chain, but with a buffer between the two stages.
+class test_filter_chain_buffered: public test_filter_chain
+{
+	public:
+		test_filter_chain_buffered()
+		{
+			this->sameLength = false;
+		}
+};
+
+IMPLEMENT_TESTS(filter_chain);
+IMPLEMENT_TESTS(filter_chain_buffered);
@@ -18,8 +18,14 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <algorithm>
+#include <chrono>
 #include <camoto/bitstream.hpp>
+#include <camoto/filter-crop.hpp>
+#include <camoto/filter-lzss.hpp>
+#include <camoto/stream_filtered.hpp>
 #include "test-filter.hpp"
+#include "../src/filter-prehistorik.hpp"
 
 using namespace camoto;
 using namespace camoto::gamearchive;
@@ -67,6 +73,158 @@ class test_filter_prehistorik: public test_filter
 			STRING_WITH_NULLS(
 				"Hello hello hello."
 			));
+
+			ADD_FILTER_TEST(&test_filter_prehistorik::same_as_generic);
+			ADD_FILTER_TEST(&test_filter_prehistorik::same_as_unchained);
+			ADD_SLOW_FILTER_TEST(&test_filter_prehistorik::throughput);
+		}
+
+		/// Make up some compressed data, with plenty of back references.
+		/**
+		 * The first WINDOW bytes are all literals, so no back reference reaches
+		 * back past the start of the data.
+		 */
+		std::string makeCompressed(unsigned int numCodes)
+		{
+			std::string data;
+			uint64_t bits = 0;
+			unsigned int numBits = 0;
+			auto write = [&](unsigned int len, unsigned int val) {
+				bits = (bits << len) | val;
+				numBits += len;
+				while (numBits >= 8) {
+					numBits -= 8;
+					data += (char)(bits >> numBits);
+				}
+			};
+
+			uint32_t seed = 1;
+			for (unsigned int i = 0; i < numCodes; i++) {
+				seed = seed * 1103515245 + 12345;
+				unsigned int rnd = seed >> 8;
+				if ((i < filter_prehistorik_unlzss::WINDOW) || (rnd & 1)) {
+					write(1, 0);
+					write(8, 'A' + ((rnd >> 1) % 26));
+				} else {
+					write(1, 1);
+					write(8, (rnd >> 1) & 0xFF);
+					write(2, (rnd >> 9) & 3);
+				}
+			}
+			if (numBits) write(8 - numBits, 0);
+			return data;
+		}
+
+		/// Decompress data through a filter.
+		std::string decompress(std::shared_ptr<filter> f, const std::string& data)
+		{
+			auto in = std::make_unique<stream::input_filtered>(
+				std::make_unique<stream::string>(data), f);
+			stream::string out;
+			stream::copy(out, *in);
+			return out.data;
+		}
+
+		/// Make sure the output matches the generic LZSS filter.
+		void same_as_generic()
+		{
+			auto data = this->makeCompressed(20000);
+			auto exp = this->decompress(
+				std::make_shared<filter_lzss_decompress>(bitstream::bigEndian, 2, 8),
+				data);
+
+			BOOST_CHECK_MESSAGE(
+				this->is_equal(exp, this->decompress(
+					std::make_shared<filter_prehistorik_unlzss>(), data)),
+				"Prehistorik decompressor gave different output to generic LZSS"
+			);
+
+			// Read it again in odd sized pieces, so back references get cut off at
+			// the end of the output buffer and reach back into earlier calls.
+			filter_prehistorik_unlzss f;
+			f.reset(data.length());
+			std::string out;
+			const uint8_t *in = (const uint8_t *)data.data();
+			stream::len lenRemaining = data.length();
+			uint8_t buf[97];
+			for (stream::len lenChunk = 1; ; lenChunk = lenChunk % sizeof(buf) + 1) {
+				stream::len lenIn = std::min<stream::len>(lenChunk, lenRemaining);
+				stream::len lenOut = lenChunk;
+				f.transform(buf, &lenOut, in, &lenIn);
+				if ((lenIn == 0) && (lenOut == 0)) break;
+				in += lenIn;
+				lenRemaining -= lenIn;
+				out.append((const char *)buf, lenOut);
+			}
+			BOOST_CHECK_MESSAGE(
+				this->is_equal(exp, out),
+				"Prehistorik decompressor gave different output when read in pieces"
+			);
+		}
+
+		/// The one-pass chain must match cropping and decompressing separately.
+		/**
+		 * The crop changes the length of the data, and the output is long enough
+		 * to go through the buffer between the two stages many times over.
+		 */
+		void same_as_unchained()
+		{
+			// Four byte decompressed size field, which the filter skips
+			auto data = std::string(4, '\0') + this->makeCompressed(100000);
+
+			auto cropped = std::make_unique<stream::input_filtered>(
+				std::make_unique<stream::string>(data),
+				std::make_shared<filter_crop>(4));
+			auto separate = std::make_unique<stream::input_filtered>(
+				std::move(cropped), std::make_shared<filter_prehistorik_unlzss>());
+			stream::string exp;
+			stream::copy(exp, *separate);
+			BOOST_REQUIRE_GT(exp.data.length(), 65536);
+
+			FilterType_Prehistorik type;
+			auto chained = type.apply(
+				std::unique_ptr<stream::input>(
+					std::make_unique<stream::string>(data)));
+			stream::string out;
+			stream::copy(out, *chained);
+
+			BOOST_CHECK_MESSAGE(
+				this->is_equal(exp.data, out.data),
+				"Chained crop and decompress gave different output to running them "
+				"separately"
+			);
+		}
+
+		/// Compare decompression speed against the generic LZSS filter.
+		/**
+		 * Run with --run_test=@slow --log_level=message to see the results.
+		 */
+		void throughput()
+		{
+			auto data = this->makeCompressed(4 * 1048576);
+
+			auto time = [this, &data](std::shared_ptr<filter> f, std::string *out) {
+				auto start = std::chrono::steady_clock::now();
+				*out = this->decompress(f, data);
+				double secs = std::chrono::duration<double>(
+					std::chrono::steady_clock::now() - start).count();
+				return (secs > 0) ? out->length() / secs / 1048576 : 0;
+			};
+
+			std::string expGeneric, expFast;
+			double mbGeneric = time(
+				std::make_shared<filter_lzss_decompress>(bitstream::bigEndian, 2, 8),
+				&expGeneric);
+			double mbFast = time(
+				std::make_shared<filter_prehistorik_unlzss>(), &expFast);
+
+			BOOST_TEST_MESSAGE("lzss-prehistorik: decompressed "
+				<< expFast.length() / 1048576 << " MB, generic LZSS "
+				<< mbGeneric << " MB/s, Prehistorik decoder " << mbFast << " MB/s");
+			BOOST_CHECK_MESSAGE(
+				expGeneric == expFast,
+				"Prehistorik decompressor gave different output to generic LZSS"
+			);
 		}
 };
 
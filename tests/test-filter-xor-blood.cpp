@@ -202,7 +202,52 @@ class test_filter_xor_blood_stream: public test_filter
 		}
 };
 
+class test_filter_xor_blood_spliced: public test_filter
+{
+	public:
+		test_filter_xor_blood_spliced()
+		{
+			this->reportsPrefiltered = false;
+		}
+
+		void addTests()
+		{
+			this->test_filter::addTests();
+
+			this->content("normal", 8, STRING_WITH_NULLS(
+				"\x00\x01\x02\x03\xFF\xFF\xFF\xFF"
+			), STRING_WITH_NULLS(
+				"\x00\x01\x03\x02\xFF\xFF\xFF\xFF"
+			));
+		}
+
+		std::unique_ptr<stream::input> apply_in(
+			std::unique_ptr<stream::input> content)
+		{
+			return std::make_unique<input_rff_spliced>(std::move(content), 4, 0);
+		}
+
+		std::unique_ptr<stream::output> apply_out(
+			std::unique_ptr<stream::output> content, stream::len *setPrefiltered)
+		{
+			return std::make_unique<stream::output_filtered>(
+				std::move(content),
+				std::make_unique<filter_rff_crypt>(4, 0),
+				[setPrefiltered](stream::output_filtered* s, stream::len l) {
+					if (setPrefiltered) *setPrefiltered = l;
+				}
+			);
+		}
+
+		std::unique_ptr<stream::inout> apply_inout(
+			std::unique_ptr<stream::inout> content, stream::len *setPrefiltered)
+		{
+			return std::make_unique<rff_spliced>(std::move(content), 4, 0);
+		}
+};
+
 IMPLEMENT_TESTS(filter_xor_blood);
 IMPLEMENT_TESTS(filter_xor_blood_partial);
 IMPLEMENT_TESTS(filter_xor_blood_altseed);
+IMPLEMENT_TESTS(filter_xor_blood_spliced);
 IMPLEMENT_TESTS(filter_xor_blood_stream);
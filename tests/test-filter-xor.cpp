@@ -19,6 +19,7 @@
  */
 
 #include "test-filter.hpp"
+#include "../src/cpu-dispatch.hpp"
 #include "../src/filter-xor.hpp"
 
 using namespace camoto::gamearchive;
@@ -39,6 +40,86 @@ class test_filter_xor: public test_filter
 			), STRING_WITH_NULLS(
 				"\x00\x00\x00\x00\xFB\xFA\xF9\xF8"
 			));
+
+			// Long enough to go through the vectorised code, with a partial block
+			// at the end.
+			this->content("long", 150, STRING_WITH_NULLS(
+				"\x05\x2A\x4F\x74\x99\xBE\xE3\x08\x2D\x52\x77\x9C\xC1\xE6\x0B\x30"
+				"\x55\x7A\x9F\xC4\xE9\x0E\x33\x58\x7D\xA2\xC7\xEC\x11\x36\x5B\x80"
+				"\xA5\xCA\xEF\x14\x39\x5E\x83\xA8\xCD\xF2\x17\x3C\x61\x86\xAB\xD0"
+				"\xF5\x1A\x3F\x64\x89\xAE\xD3\xF8\x1D\x42\x67\x8C\xB1\xD6\xFB\x20"
+				"\x45\x6A\x8F\xB4\xD9\xFE\x23\x48\x6D\x92\xB7\xDC\x01\x26\x4B\x70"
+				"\x95\xBA\xDF\x04\x29\x4E\x73\x98\xBD\xE2\x07\x2C\x51\x76\x9B\xC0"
+				"\xE5\x0A\x2F\x54\x79\x9E\xC3\xE8\x0D\x32\x57\x7C\xA1\xC6\xEB\x10"
+				"\x35\x5A\x7F\xA4\xC9\xEE\x13\x38\x5D\x82\xA7\xCC\xF1\x16\x3B\x60"
+				"\x85\xAA\xCF\xF4\x19\x3E\x63\x88\xAD\xD2\xF7\x1C\x41\x66\x8B\xB0"
+				"\xD5\xFA\x1F\x44\x69\x8E"
+			), STRING_WITH_NULLS(
+				"\x05\x2B\x4D\x77\x9D\xBB\xE5\x0F\x25\x5B\x7D\x97\xCD\xEB\x05\x3F"
+				"\x45\x6B\x8D\xD7\xFD\x1B\x25\x4F\x65\xBB\xDD\xF7\x0D\x2B\x45\x9F"
+				"\x85\xEB\xCD\x37\x1D\x7B\xA5\x8F\xE5\xDB\x3D\x17\x4D\xAB\x85\xFF"
+				"\xC5\x2B\x0D\x57\xBD\x9B\xE5\xCF\x25\x7B\x5D\xB7\x8D\xEB\xC5\x1F"
+				"\x05\x2B\xCD\xF7\x9D\xBB\x65\x0F\x25\xDB\xFD\x97\x4D\x6B\x05\x3F"
+				"\xC5\xEB\x8D\x57\x7D\x1B\x25\xCF\xE5\xBB\x5D\x77\x0D\x2B\xC5\x9F"
+				"\x85\x6B\x4D\x37\x1D\xFB\xA5\x8F\x65\x5B\x3D\x17\xCD\xAB\x85\x7F"
+				"\x45\x2B\x0D\xD7\xBD\x9B\x65\x4F\x25\xFB\xDD\xB7\x8D\x6B\x45\x1F"
+				"\x05\x2B\x4D\x77\x9D\xBB\xE5\x0F\x25\x5B\x7D\x97\xCD\xEB\x05\x3F"
+				"\x45\x6B\x8D\xD7\xFD\x1B"
+			));
+
+			ADD_FILTER_TEST(&test_filter_xor::test_kernels);
+		}
+
+		/// Every compiled kernel must give the same result as the generic one.
+		void test_kernels()
+		{
+			BOOST_TEST_MESSAGE("Comparing XOR kernels for each instruction set");
+
+			const Kernels *generic = kernelsFor(ISA::Generic);
+			BOOST_REQUIRE(generic);
+
+			// Room to start at any alignment and still fit a few AVX-512 blocks
+			const unsigned int lenMax = 64 * 4 + 63;
+			uint8_t in[64 + lenMax], expected[64 + lenMax], out[64 + lenMax];
+			for (unsigned int i = 0; i < sizeof(in); i++) in[i] = (uint8_t)(i * 37);
+
+			for (int i = (int)ISA::SSE2; i <= (int)ISA::AVX512; i++) {
+				ISA isa = (ISA)i;
+				const Kernels *k = kernelsFor(isa);
+				if (!k) {
+					BOOST_TEST_MESSAGE("CPU can't run " << isaName(isa)
+						<< " code, skipping");
+					continue;
+				}
+				bool ok = true;
+				// Unaligned starts give partial vectors at the head, and the lengths
+				// cover every size of partial vector at the tail.
+				for (unsigned int head = 0; ok && (head < 64); head++) {
+					for (unsigned int len = 0; ok && (len <= lenMax); len++) {
+						uint8_t key = (uint8_t)(head * 11 + len);
+						generic->xorRamp(expected + head, in + head, len, key);
+						memset(out, 0xAA, sizeof(out));
+						k->xorRamp(out + head, in + head, len, key);
+						if (
+							(memcmp(expected + head, out + head, len) != 0)
+							|| ((head + len < sizeof(out)) && (out[head + len] != 0xAA))
+						) {
+							BOOST_ERROR(isaName(isa) << " kernel differs from generic "
+								"with head offset " << head << " and length " << len);
+							ok = false;
+						}
+
+						// Crypting in place must work too
+						memcpy(out, in, sizeof(out));
+						k->xorRamp(out + head, out + head, len, key);
+						if (memcmp(expected + head, out + head, len) != 0) {
+							BOOST_ERROR(isaName(isa) << " kernel is wrong in place with "
+								"head offset " << head << " and length " << len);
+							ok = false;
+						}
+					}
+				}
+			}
 		}
 
 		std::unique_ptr<stream::input> apply_in(
@@ -50,10 +50,15 @@ class test_filter: public test_main
 		virtual void prepareTest();
 
 	protected:
-		/// Add a test to the suite.  Used by ADD_IMAGE_TEST().
+		/// Add a test to the suite.  Used by ADD_FILTER_TEST().
+		/**
+		 * @param slow
+		 *   true if the test takes a long time, so should only be run when asked
+		 *   for with --run_test=@slow.  Used by ADD_SLOW_FILTER_TEST().
+		 */
 		void addBoundTest(std::function<void()> fnTest,
 			boost::unit_test::const_string file, std::size_t line,
-			boost::unit_test::const_string name);
+			boost::unit_test::const_string name, bool slow = false);
 
 		/// Reset the image to the initial state and run the given test.
 		/**
@@ -141,6 +146,13 @@ class test_filter: public test_main
 	public:
 		/// File type code for this format.
 		std::string type;
+
+		/// Does apply_inout() report the prefiltered size through the callback?
+		/**
+		 * Set to false for filters that write straight through to the target,
+		 * where the target's own length is checked instead.
+		 */
+		bool reportsPrefiltered;
 };
 
 /// Add a test_image member function to the test suite
@@ -151,4 +163,13 @@ class test_filter: public test_main
 		BOOST_TEST_STRINGIZE(fn) \
 	);
 
+/// Add a test_filter member function that takes a long time to run.
+#define ADD_SLOW_FILTER_TEST(fn) \
+	this->test_filter::addBoundTest( \
+		std::bind(fn, this), \
+		__FILE__, __LINE__, \
+		BOOST_TEST_STRINGIZE(fn), \
+		true \
+	);
+
 #endif // _CAMOTO_GAMEARCHIVE_TEST_FILTER_HPP_
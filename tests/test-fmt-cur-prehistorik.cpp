@@ -18,6 +18,7 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <camoto/gamearchive/archive-fat.hpp>
 #include "test-archive.hpp"
 
 class test_cur_prehistorik: public test_archive
@@ -33,6 +34,8 @@ class test_cur_prehistorik: public test_archive
 		{
 			this->test_archive::addTests();
 
+			ADD_ARCH_TEST(false, &test_cur_prehistorik::test_lazy_realsize);
+
 			// c00: Initial state
 			this->isInstance(ArchiveType::Certainty::DefinitelyYes, this->content_12());
 
@@ -262,6 +265,43 @@ class test_cur_prehistorik: public test_archive
 				"This is two.dat"
 			);
 		}
+
+		void test_lazy_realsize()
+		{
+			BOOST_TEST_MESSAGE(this->basename << ": Reading real sizes on demand");
+
+			auto base = std::make_shared<stream::string>();
+			*base << STRING_WITH_NULLS(
+				"\x1E\x00"
+				"\x0f\x00\x00\x00" "ONE.MDI\0"
+				"\x0f\x00\x00\x00" "TWO.DAT\0"
+				"\x00\x00\x00\x00"
+				"\x00\x00\x01\x23" "compressed!"
+				"This is two.dat"
+			);
+			auto counts = std::make_shared<stream_counts>();
+			counts->ops = counts->bytes = 0;
+			auto pArchType = ArchiveManager::byCode(this->type);
+			auto pArchive = pArchType->open(
+				std::make_unique<counting_stream>(stream_wrap(base), counts),
+				this->suppData);
+			stream::len lenOpened = counts->bytes;
+
+			// Finding the uncompressed file shouldn't read the compressed one's size
+			auto idTwo = pArchive->find("TWO.DAT");
+			BOOST_REQUIRE(idTwo);
+			BOOST_CHECK_EQUAL(idTwo->realSize, 15);
+			BOOST_CHECK_EQUAL(counts->bytes, lenOpened);
+
+			// But once it is handed out, its real size must be valid
+			auto& files = pArchive->files();
+			BOOST_REQUIRE_EQUAL(files.size(), 2);
+			BOOST_CHECK_GT(counts->bytes, lenOpened);
+			BOOST_CHECK_EQUAL(files[0]->filter, "lzss-prehistorik");
+			BOOST_CHECK(!Archive_FAT::FATEntry::cast(files[0])->bRealSizePending);
+			BOOST_CHECK_EQUAL(files[0]->realSize, 0x123);
+			BOOST_CHECK_EQUAL(files[1]->realSize, 15);
+		}
 };
 
 IMPLEMENT_TESTS(cur_prehistorik);
@@ -45,6 +45,8 @@ class test_dat_bash_compressed: public test_archive
 		{
 			this->test_archive::addTests();
 
+			ADD_ARCH_TEST(false, &test_dat_bash_compressed::test_insert_smallest);
+
 			// c00: Initial state
 			this->isInstance(ArchiveType::Certainty::DefinitelyYes, this->content_12());
 
@@ -260,6 +262,45 @@ class test_dat_bash_compressed: public test_archive
 					FCONTENT2
 			);
 		}
+
+		void test_insert_smallest()
+		{
+			BOOST_TEST_MESSAGE(this->basename << ": Inserting files that would "
+				"get larger if compressed");
+
+			Archive::FileHandle epb = this->findFile(1);
+
+			std::vector<NewFile> files(2);
+			for (int i = 0; i < 2; i++) {
+				files[i].name = this->filename[2 + i];
+				files[i].type = this->insertType;
+				files[i].attr = this->insertAttr;
+				files[i].content = this->content[2 + i];
+			}
+			insertFiles(*this->pArchive, epb, files, 2, CompressPolicy::Smallest);
+
+			// Both files are larger compressed, so they should be stored instead
+			this->checkData([](test_archive&) {
+				return STRING_WITH_NULLS(
+					"\x01\x00" "\x12\x00"
+						"ONE\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0"
+						"\x0f\x00"
+						FCONTENT1
+					"\x20\x00" "\x11\x00"
+						"THREE.DAT\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0"
+						"\x00\x00"
+						"This is three.dat"
+					"\x20\x00" "\x10\x00"
+						"FOUR.DAT\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0"
+						"\x00\x00"
+						"This is four.dat"
+					"\x20\x00" "\x12\x00"
+						"TWO.DAT\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0"
+						"\x0f\x00"
+						FCONTENT2
+				);
+			}, "Error inserting files with store-if-smaller policy");
+		}
 };
 
 IMPLEMENT_TESTS(dat_bash_compressed);
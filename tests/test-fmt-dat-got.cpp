@@ -361,6 +361,8 @@ class test_dat_got: public test_archive
 		{
 			this->test_archive::addTests();
 
+			ADD_ARCH_TEST(false, &test_dat_got::test_slot_gaps);
+
 			// c00: Initial state
 			this->isInstance(ArchiveType::Certainty::DefinitelyYes, this->content_12());
 
@@ -703,6 +705,83 @@ class test_dat_got: public test_archive
 			);
 #undef CONTENT
 		}
+
+		/// Pad out a cleartext FAT to its full size and encrypt it.
+		std::string fullFAT(std::string fat)
+		{
+			fat.resize(256 * 23, '\0');
+#ifdef USE_XOR
+			for (unsigned int i = 0; i < fat.length(); i++) fat[i] ^= (char)(128 + i);
+#endif
+			return fat;
+		}
+
+		/// Make sure blank slots between files are kept when entries move.
+		void test_slot_gaps()
+		{
+			BOOST_TEST_MESSAGE(this->basename << ": Blank FAT slots between files");
+
+#define BLANK "\0\0\0\0\0\0\0\0\0" "\0\0\0\0" "\0\0\0\0" "\0\0\0\0" "\0\0"
+			auto base = std::make_shared<stream::string>();
+			*base
+				<< this->fullFAT(STRING_WITH_NULLS(
+					"ONE\0\0\0\0\0\0" "\x00\x17\x00\x00" "\x0f\x00\x00\x00" "\x0f\x00\x00\x00" "\x00\x00"
+					BLANK
+					"TWO\0\0\0\0\0\0" "\x0f\x17\x00\x00" "\x0f\x00\x00\x00" "\x0f\x00\x00\x00" "\x00\x00"
+				))
+				<< "This is one.dat"
+				<< "This is two.dat"
+			;
+			auto pArchType = ArchiveManager::byCode(this->type);
+			auto pArchive = pArchType->open(stream_wrap(base), this->suppData);
+			auto files = pArchive->files();
+			BOOST_REQUIRE_EQUAL(files.size(), 2);
+
+			// The gap before the second file should move along with it
+			auto ep = pArchive->insert(files[1], "THREE", 17, FILETYPE_GENERIC,
+				Archive::File::Attribute::Default);
+			auto pfsNew = pArchive->open(ep, true);
+			pfsNew->write("This is three.dat");
+			pfsNew->flush();
+			pfsNew = nullptr;
+			pArchive->flush();
+
+			BOOST_CHECK_MESSAGE(
+				this->is_equal(
+					this->fullFAT(STRING_WITH_NULLS(
+						"ONE\0\0\0\0\0\0" "\x00\x17\x00\x00" "\x0f\x00\x00\x00" "\x0f\x00\x00\x00" "\x00\x00"
+						BLANK
+						"THREE\0\0\0\0"   "\x0f\x17\x00\x00" "\x11\x00\x00\x00" "\x11\x00\x00\x00" "\x00\x00"
+						"TWO\0\0\0\0\0\0" "\x20\x17\x00\x00" "\x0f\x00\x00\x00" "\x0f\x00\x00\x00" "\x00\x00"
+					))
+					+ "This is one.dat"
+					+ "This is three.dat"
+					+ "This is two.dat",
+					base->data
+				),
+				"Error inserting a file after a blank FAT slot"
+			);
+
+			// Removing the first file should blank its slot, and the one left
+			// behind by the last file
+			pArchive->remove(files[0]);
+			pArchive->flush();
+
+			BOOST_CHECK_MESSAGE(
+				this->is_equal(
+					this->fullFAT(STRING_WITH_NULLS(
+						BLANK
+						"THREE\0\0\0\0"   "\x00\x17\x00\x00" "\x11\x00\x00\x00" "\x11\x00\x00\x00" "\x00\x00"
+						"TWO\0\0\0\0\0\0" "\x11\x17\x00\x00" "\x0f\x00\x00\x00" "\x0f\x00\x00\x00" "\x00\x00"
+					))
+					+ "This is three.dat"
+					+ "This is two.dat",
+					base->data
+				),
+				"Error removing a file before a blank FAT slot"
+			);
+#undef BLANK
+		}
 };
 
 IMPLEMENT_TESTS(dat_got);
@@ -30,6 +30,11 @@ class test_glb_raptor: public test_archive
 		{
 			this->type = "glb-raptor";
 			this->lenMaxFilename = 15;
+
+			Attribute spare;
+			spare.type = Attribute::Type::Integer;
+			spare.integerValue = 0; // no spare FAT entries
+			this->attributes.push_back(spare);
 		}
 
 		void addTests()
@@ -33,6 +33,8 @@ class test_grp_duke3d: public test_archive
 		{
 			this->test_archive::addTests();
 
+			ADD_ARCH_TEST(false, &test_grp_duke3d::test_probe_other);
+
 			// c00: Initial state
 			this->isInstance(ArchiveType::Certainty::DefinitelyYes, this->content_12());
 
@@ -58,6 +60,44 @@ class test_grp_duke3d: public test_archive
 			));
 		}
 
+		/// The probe result must not be used for a different archive.
+		void test_probe_other()
+		{
+			BOOST_TEST_MESSAGE(this->basename << ": Opening a different archive "
+				"with a probe result");
+
+			auto pType = ArchiveManager::byCode(this->type);
+			BOOST_REQUIRE(pType);
+			SuppData supp;
+
+			// Same size and header, but the FAT is different.  Only the header
+			// is read by probe() so the FAT must come from the opened stream.
+			std::unique_ptr<ArchiveType::ProbeResult> parsed;
+			stream::string probed(this->content_12());
+			BOOST_REQUIRE_EQUAL(pType->probe(probed, &parsed),
+				ArchiveType::Certainty::DefinitelyYes);
+			auto arch = pType->openProbed(
+				std::make_unique<stream::string>(this->content_21()), supp,
+				std::move(parsed));
+			BOOST_REQUIRE_EQUAL(arch->files().size(), 2);
+			BOOST_CHECK_EQUAL(arch->files()[0]->strName, this->filename[1]);
+			BOOST_CHECK_EQUAL(arch->files()[1]->strName, this->filename[0]);
+
+			// Same size but a different file count, so the probe result must be
+			// ignored entirely.
+			BOOST_REQUIRE_EQUAL(pType->probe(probed, &parsed),
+				ArchiveType::Certainty::DefinitelyYes);
+			std::string other = STRING_WITH_NULLS(
+				"KenSilverman"      "\x01\x00\x00\x00"
+				"ONE.DAT\0\0\0\0\0" "\x2e\x00\x00\x00"
+			);
+			other.append(this->content_12().length() - other.length(), 'X');
+			arch = pType->openProbed(std::make_unique<stream::string>(other), supp,
+				std::move(parsed));
+			BOOST_REQUIRE_EQUAL(arch->files().size(), 1);
+			BOOST_CHECK_EQUAL(arch->files()[0]->storedSize, 0x2e);
+		}
+
 		virtual std::string content_12()
 		{
 			return STRING_WITH_NULLS(
@@ -55,6 +55,11 @@ class test_pcxlib: public test_archive
 			vollabel.textValue = "";
 			vollabel.textMaxLength = 40;
 			this->attributes.push_back(vollabel);
+
+			Attribute spare;
+			spare.type = Attribute::Type::Integer;
+			spare.integerValue = 0; // no spare FAT entries
+			this->attributes.push_back(spare);
 		}
 
 		void addTests()
@@ -40,6 +40,11 @@ class test_pod_tv: public test_archive
 			comment.textValue = "Startup 1.1 Gold";
 			comment.textMaxLength = 80;
 			this->attributes.push_back(comment);
+
+			Attribute spare;
+			spare.type = Attribute::Type::Integer;
+			spare.integerValue = 0; // no spare FAT entries
+			this->attributes.push_back(spare);
 		}
 
 		void addTests()
@@ -90,6 +95,15 @@ class test_pod_tv: public test_archive
 				"This is two.dat"
 			));
 
+			// c05: File count so large the FAT size overflows 32 bits
+			this->isInstance(ArchiveType::Certainty::DefinitelyNo, STRING_WITH_NULLS(
+				"\x67\x66\x66\x06" POD_DESC
+				"ONE.DAT\0\0\0\0\0\0\0\0\0" "\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0" "\x0f\x00\x00\x00" "\xa4\x00\x00\x00"
+				"TWO.DAT\0\0\0\0\0\0\0\0\0" "\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0" "\x0f\x00\x00\x00" "\xb3\x00\x00\x00"
+				"This is one.dat"
+				"This is two.dat"
+			));
+
 			// a01: Shorten comment attribute
 			this->changeAttribute(0, "Hello", STRING_WITH_NULLS(
 				"\x02\x00\x00\x00"
@@ -18,6 +18,7 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <camoto/gamearchive/wad-index.hpp>
 #include "test-archive.hpp"
 
 class test_wad_doom: public test_archive
@@ -33,12 +34,19 @@ class test_wad_doom: public test_archive
 			wadType.type = Attribute::Type::Enum;
 			wadType.enumValue = 0; // IWAD
 			this->attributes.push_back(wadType);
+
+			Attribute spare;
+			spare.type = Attribute::Type::Integer;
+			spare.integerValue = 0; // no spare FAT entries
+			this->attributes.push_back(spare);
 		}
 
 		void addTests()
 		{
 			this->test_archive::addTests();
 
+			ADD_ARCH_TEST(false, &test_wad_doom::test_index);
+
 			// c00: Initial state
 			this->isInstance(ArchiveType::Certainty::DefinitelyYes, this->content_12());
 
@@ -215,6 +223,238 @@ class test_wad_doom: public test_archive
 				"This is two.dat"
 			);
 		}
+
+		void test_index()
+		{
+			BOOST_TEST_MESSAGE(this->basename << ": Looking up lumps via the index");
+
+			// Put ONE.DAT in the sprite namespace and turn TWO.DAT into a map
+			auto epOne = this->findFile(0);
+			auto epTwo = this->findFile(1);
+			this->pArchive->insert(epOne, "S_START", 0, FILETYPE_GENERIC,
+				Archive::File::Attribute::Default);
+			this->pArchive->insert(epTwo, "S_END", 0, FILETYPE_GENERIC,
+				Archive::File::Attribute::Default);
+			auto epThings = this->pArchive->insert(nullptr, "THINGS", 0,
+				FILETYPE_GENERIC, Archive::File::Attribute::Default);
+			auto epBlockmap = this->pArchive->insert(nullptr, "BLOCKMAP", 0,
+				FILETYPE_GENERIC, Archive::File::Attribute::Default);
+
+			auto index = getWADIndex(*this->pArchive);
+			BOOST_REQUIRE(index);
+
+			auto& sprites = index->lumps(WADIndex::Namespace::Sprites);
+			BOOST_REQUIRE_EQUAL(sprites.size(), 1);
+			BOOST_CHECK(sprites[0] == epOne);
+			BOOST_CHECK(index->find(WADIndex::Namespace::Sprites, "one.dat") == epOne);
+			BOOST_CHECK(!index->find(WADIndex::Namespace::Global, "ONE.DAT"));
+			BOOST_CHECK(!index->find(WADIndex::Namespace::Global, "S_START"));
+
+			BOOST_REQUIRE_EQUAL(index->maps().size(), 1);
+			BOOST_CHECK(index->maps()[0] == epTwo);
+			BOOST_CHECK(index->mapLump("two.dat", WADIndex::MapLump::Things)
+				== epThings);
+			BOOST_CHECK(index->mapLump("TWO.DAT", WADIndex::MapLump::Blockmap)
+				== epBlockmap);
+			BOOST_CHECK(!index->mapLump("TWO.DAT", WADIndex::MapLump::Reject));
+
+			// The index should follow the map header when it is renamed
+			this->pArchive->rename(epTwo, "MAP07");
+			index = getWADIndex(*this->pArchive);
+			BOOST_CHECK(index->mapLump("MAP07", WADIndex::MapLump::Blockmap)
+				== epBlockmap);
+			BOOST_CHECK(!index->mapLump("TWO.DAT", WADIndex::MapLump::Blockmap));
+
+			// And drop the map when its lumps are removed
+			this->pArchive->remove(epThings);
+			index = getWADIndex(*this->pArchive);
+			BOOST_CHECK_EQUAL(index->maps().size(), 0);
+
+			// Removed lumps and empty slots in a list of lumps must be left out,
+			// so they can't be found or turn the lump before them into a map
+			auto files = this->pArchive->files();
+			BOOST_REQUIRE_EQUAL(files.size(), 5);
+			auto vacant = std::make_shared<Archive::File>();
+			vacant->bValid = true;
+			vacant->fAttr = Archive::File::Attribute::Vacant;
+			vacant->strName = "THINGS";
+			files.insert(files.begin() + 4, vacant);
+			this->pArchive->remove(epOne);
+			WADIndex stale(files);
+			BOOST_CHECK_EQUAL(stale.lumps(WADIndex::Namespace::Sprites).size(), 0);
+			BOOST_CHECK(!stale.find(WADIndex::Namespace::Sprites, "ONE.DAT"));
+			BOOST_CHECK(!stale.find(WADIndex::Namespace::Global, "THINGS"));
+			BOOST_CHECK_EQUAL(stale.maps().size(), 0);
+		}
+};
+
+/// Same as test_wad_doom, but with the FAT after the lumps as in most real
+/// IWADs and PWADs.
+class test_wad_doom_dirend: public test_wad_doom
+{
+	public:
+		test_wad_doom_dirend()
+		{
+			// New archives put the FAT after the header
+			this->create = false;
+
+			// Spare FAT entries are only offered when the FAT is after the header
+			this->attributes.pop_back();
+		}
+
+		void addTests()
+		{
+			this->test_archive::addTests();
+
+			ADD_ARCH_TEST(false, &test_wad_doom::test_index);
+
+			// c00: Initial state
+			this->isInstance(ArchiveType::Certainty::DefinitelyYes, this->content_12());
+
+			// a01: IWAD -> PWAD
+			this->changeAttribute(0, 1/*PWAD*/, STRING_WITH_NULLS(
+				"PWAD" "\x02\x00\x00\x00" "\x2a\x00\x00\x00"
+				"This is one.dat"
+				"This is two.dat"
+				"\x0c\x00\x00\x00" "\x0f\x00\x00\x00" "ONE.DAT\0"
+				"\x1b\x00\x00\x00" "\x0f\x00\x00\x00" "TWO.DAT\0"
+			));
+		}
+
+		virtual std::string content_12()
+		{
+			return STRING_WITH_NULLS(
+				"IWAD" "\x02\x00\x00\x00" "\x2a\x00\x00\x00"
+				"This is one.dat"
+				"This is two.dat"
+				"\x0c\x00\x00\x00" "\x0f\x00\x00\x00" "ONE.DAT\0"
+				"\x1b\x00\x00\x00" "\x0f\x00\x00\x00" "TWO.DAT\0"
+			);
+		}
+
+		virtual std::string content_1r2()
+		{
+			return STRING_WITH_NULLS(
+				"IWAD" "\x02\x00\x00\x00" "\x2a\x00\x00\x00"
+				"This is one.dat"
+				"This is two.dat"
+				"\x0c\x00\x00\x00" "\x0f\x00\x00\x00" "THREE\0\0\0"
+				"\x1b\x00\x00\x00" "\x0f\x00\x00\x00" "TWO.DAT\0"
+			);
+		}
+
+		virtual std::string content_123()
+		{
+			return STRING_WITH_NULLS(
+				"IWAD" "\x03\x00\x00\x00" "\x3b\x00\x00\x00"
+				"This is one.dat"
+				"This is two.dat"
+				"This is three.dat"
+				"\x0c\x00\x00\x00" "\x0f\x00\x00\x00" "ONE.DAT\0"
+				"\x1b\x00\x00\x00" "\x0f\x00\x00\x00" "TWO.DAT\0"
+				"\x2a\x00\x00\x00" "\x11\x00\x00\x00" "THREE\0\0\0"
+			);
+		}
+
+		virtual std::string content_132()
+		{
+			return STRING_WITH_NULLS(
+				"IWAD" "\x03\x00\x00\x00" "\x3b\x00\x00\x00"
+				"This is one.dat"
+				"This is three.dat"
+				"This is two.dat"
+				"\x0c\x00\x00\x00" "\x0f\x00\x00\x00" "ONE.DAT\0"
+				"\x1b\x00\x00\x00" "\x11\x00\x00\x00" "THREE\0\0\0"
+				"\x2c\x00\x00\x00" "\x0f\x00\x00\x00" "TWO.DAT\0"
+			);
+		}
+
+		virtual std::string content_1342()
+		{
+			return STRING_WITH_NULLS(
+				"IWAD" "\x04\x00\x00\x00" "\x4b\x00\x00\x00"
+				"This is one.dat"
+				"This is three.dat"
+				"This is four.dat"
+				"This is two.dat"
+				"\x0c\x00\x00\x00" "\x0f\x00\x00\x00" "ONE.DAT\0"
+				"\x1b\x00\x00\x00" "\x11\x00\x00\x00" "THREE\0\0\0"
+				"\x2c\x00\x00\x00" "\x10\x00\x00\x00" "FOUR.DAT"
+				"\x3c\x00\x00\x00" "\x0f\x00\x00\x00" "TWO.DAT\0"
+			);
+		}
+
+		virtual std::string content_2()
+		{
+			return STRING_WITH_NULLS(
+				"IWAD" "\x01\x00\x00\x00" "\x1b\x00\x00\x00"
+				"This is two.dat"
+				"\x0c\x00\x00\x00" "\x0f\x00\x00\x00" "TWO.DAT\0"
+			);
+		}
+
+		virtual std::string content_0()
+		{
+			return STRING_WITH_NULLS(
+				"IWAD" "\x00\x00\x00\x00" "\x0c\x00\x00\x00"
+			);
+		}
+
+		virtual std::string content_32()
+		{
+			return STRING_WITH_NULLS(
+				"IWAD" "\x02\x00\x00\x00" "\x2c\x00\x00\x00"
+				"This is three.dat"
+				"This is two.dat"
+				"\x0c\x00\x00\x00" "\x11\x00\x00\x00" "THREE\0\0\0"
+				"\x1d\x00\x00\x00" "\x0f\x00\x00\x00" "TWO.DAT\0"
+			);
+		}
+
+		virtual std::string content_21()
+		{
+			return STRING_WITH_NULLS(
+				"IWAD" "\x02\x00\x00\x00" "\x2a\x00\x00\x00"
+				"This is two.dat"
+				"This is one.dat"
+				"\x0c\x00\x00\x00" "\x0f\x00\x00\x00" "TWO.DAT\0"
+				"\x1b\x00\x00\x00" "\x0f\x00\x00\x00" "ONE.DAT\0"
+			);
+		}
+
+		virtual std::string content_1l2()
+		{
+			return STRING_WITH_NULLS(
+				"IWAD" "\x02\x00\x00\x00" "\x2f\x00\x00\x00"
+				"This is one.dat\0\0\0\0\0"
+				"This is two.dat"
+				"\x0c\x00\x00\x00" "\x14\x00\x00\x00" "ONE.DAT\0"
+				"\x20\x00\x00\x00" "\x0f\x00\x00\x00" "TWO.DAT\0"
+			);
+		}
+
+		virtual std::string content_1s2()
+		{
+			return STRING_WITH_NULLS(
+				"IWAD" "\x02\x00\x00\x00" "\x25\x00\x00\x00"
+				"This is on"
+				"This is two.dat"
+				"\x0c\x00\x00\x00" "\x0a\x00\x00\x00" "ONE.DAT\0"
+				"\x16\x00\x00\x00" "\x0f\x00\x00\x00" "TWO.DAT\0"
+			);
+		}
+
+		virtual std::string content_1w2()
+		{
+			return STRING_WITH_NULLS(
+				"IWAD" "\x02\x00\x00\x00" "\x32\x00\x00\x00"
+				"Now resized to 23 chars"
+				"This is two.dat"
+				"\x0c\x00\x00\x00" "\x17\x00\x00\x00" "ONE.DAT\0"
+				"\x23\x00\x00\x00" "\x0f\x00\x00\x00" "TWO.DAT\0"
+			);
+		}
 };
 
 IMPLEMENT_TESTS(wad_doom);
+IMPLEMENT_TESTS(wad_doom_dirend);
@@ -0,0 +1,76 @@
+#!/bin/sh
+#
+# Check that gamearch --batch writes only one result line per action to
+# stdout, and exits with the most serious error from any of them.
+#
+# Copyright (C) 2010-2016 Adam Nielsen <malvineous@shikadi.net>
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+: ${GAMEARCH:=../examples/gamearch}
+GAMEARCH="$(cd "$(dirname "$GAMEARCH")" && pwd)/$(basename "$GAMEARCH")"
+
+WORK="$(mktemp -d)" || exit 99
+trap 'rm -rf "$WORK"' EXIT
+cd "$WORK" || exit 99
+
+fail() {
+	echo "FAIL: $*" >&2
+	exit 1
+}
+
+printf 'This is one.dat' > one.dat
+printf 'This is two.dat' > two.dat
+"$GAMEARCH" -c -t grp-duke3d test.grp -a ONE.DAT=one.dat -a TWO.DAT=two.dat \
+	> /dev/null 2>&1 || fail "unable to create test archive"
+
+cat > batch.txt <<'BATCH'
+# Comments and blank lines are skipped
+
+--resize=ONE.DAT=4
+--delete=MISSING.DAT
+--resize=TWO.DAT=lots
+--rename=TWO.DAT=THREE.DAT --extract=THREE.DAT=three.dat
+--no-such-option
+BATCH
+
+"$GAMEARCH" -t grp-duke3d test.grp --batch=batch.txt > out.txt 2> err.txt
+ret=$?
+
+cat > expected.txt <<'EXPECTED'
+batch_line=3;action=resize;status=ok
+batch_line=4;action=delete;status=fail;code=4
+batch_line=5;action=resize;status=fail;code=1
+batch_line=6;action=rename;status=ok
+batch_line=6;action=extract;status=ok
+batch_line=7;action=;status=fail;code=1
+EXPECTED
+
+cmp -s expected.txt out.txt || {
+	diff expected.txt out.txt >&2
+	fail "stdout should only hold the batch results"
+}
+
+# A bad parameter is more serious than a missing file, even though the
+# missing file came first.
+[ "$ret" -eq 1 ] || fail "exit status was $ret, expected 1"
+
+grep -q 'deleting: MISSING.DAT' err.txt || fail "progress messages not on stderr"
+
+[ "$(cat three.dat)" = "This is two.dat" ] || fail "wrong data extracted"
+
+"$GAMEARCH" -t grp-duke3d test.grp -x ONE.DAT=one.out > /dev/null 2>&1
+[ "$(cat one.out)" = "This" ] || fail "file was not resized"
+
+exit 0
@@ -0,0 +1,151 @@
+/**
+ * @file   test-stream-bounded.cpp
+ * @brief  Test code for the memory stream that stops past a set size.
+ *
+ * Copyright (C) 2010-2016 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <cstring>
+#include <camoto/stream_filtered.hpp>
+#include "tests.hpp"
+#include "../src/stream-bounded.hpp"
+
+using namespace camoto;
+using namespace camoto::gamearchive;
+
+/// Filter that holds on to all its input until it is flushed.
+class filter_test_hold: virtual public filter
+{
+	public:
+		virtual void reset(stream::len lenInput)
+		{
+			this->held.clear();
+			return;
+		}
+
+		virtual void transform(uint8_t *out, stream::len *lenOut,
+			const uint8_t *in, stream::len *lenIn)
+		{
+			if (*lenIn) {
+				this->held.append((const char *)in, *lenIn);
+				*lenOut = 0;
+				return;
+			}
+			// No more input, so let it all out
+			stream::len amt = std::min<stream::len>(*lenOut, this->held.length());
+			memcpy(out, this->held.data(), amt);
+			this->held.erase(0, amt);
+			*lenOut = amt;
+			return;
+		}
+
+	protected:
+		std::string held; ///< Input not yet passed on
+};
+
+/// Bounded stream that reports what it held when it is destroyed.
+class output_bounded_watched: virtual public output_bounded
+{
+	public:
+		output_bounded_watched(stream::len limit, bool *tooLarge,
+			std::string *data)
+			:	output_bounded(limit),
+				pTooLarge(tooLarge),
+				pData(data)
+		{
+		}
+
+		virtual ~output_bounded_watched()
+		{
+			*this->pTooLarge = this->tooLarge();
+			*this->pData = this->data;
+		}
+
+	protected:
+		bool *pTooLarge;
+		std::string *pData;
+};
+
+class test_stream_bounded: public test_main
+{
+	public:
+		void addTests()
+		{
+			ADD_TEST(&test_stream_bounded::test_under_limit);
+			ADD_TEST(&test_stream_bounded::test_over_limit);
+			ADD_TEST(&test_stream_bounded::test_over_limit_in_destructor);
+			return;
+		}
+
+		/// Data up to the limit must be kept as usual.
+		void test_under_limit()
+		{
+			BOOST_TEST_MESSAGE("Writing up to the limit of a bounded stream");
+
+			output_bounded s(10);
+			s.write("0123456789");
+			s.flush();
+			BOOST_CHECK(!s.tooLarge());
+			BOOST_CHECK_MESSAGE(
+				this->is_equal("0123456789", s.data),
+				"Data written up to the limit was not kept"
+			);
+		}
+
+		/// Going over the limit must be reported without throwing.
+		void test_over_limit()
+		{
+			BOOST_TEST_MESSAGE("Writing past the limit of a bounded stream");
+
+			output_bounded s(10);
+			s.write("01234");
+			BOOST_CHECK_NO_THROW(s.write("56789A"));
+			BOOST_CHECK(s.tooLarge());
+
+			// Later writes are dropped even if they would fit
+			BOOST_CHECK_NO_THROW(s.write("B"));
+			BOOST_CHECK(s.tooLarge());
+			BOOST_CHECK_MESSAGE(
+				this->is_equal("01234", s.data),
+				"Data written past the limit was kept"
+			);
+		}
+
+		/// The limit can be reached while a filtered stream is being destroyed,
+		/// which must not throw.
+		void test_over_limit_in_destructor()
+		{
+			BOOST_TEST_MESSAGE("Going over the limit when a filter is destroyed");
+
+			bool tooLarge = false;
+			std::string data;
+			auto filtered = std::make_unique<stream::output_filtered>(
+				std::make_unique<output_bounded_watched>(10, &tooLarge, &data),
+				std::make_shared<filter_test_hold>(),
+				nullptr
+			);
+			filtered->write("This is longer than ten bytes");
+
+			// Nothing has reached the bounded stream until the filter is flushed,
+			// which happens here in the destructor.
+			BOOST_CHECK_NO_THROW(filtered.reset());
+			BOOST_CHECK(tooLarge);
+			BOOST_CHECK_LE(data.length(), 10);
+		}
+};
+
+IMPLEMENT_TESTS(stream_bounded);
@@ -0,0 +1,262 @@
+/**
+ * @file   test-stream-decode-ahead.cpp
+ * @brief  Test code for decoding a filtered stream on a helper thread.
+ *
+ * Copyright (C) 2010-2016 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <thread>
+#include <camoto/stream_string.hpp>
+#include <camoto/gamearchive/stream_decode_ahead.hpp>
+#include "tests.hpp"
+
+using namespace camoto;
+using namespace camoto::gamearchive;
+
+/// Length of the test data, spanning many of the small buffers used here.
+#define TEST_DATA_LEN  10000
+
+/// Size of each decoded buffer in the tests.
+#define TEST_BUFFER_LEN  1000
+
+/// Filter that XORs each byte with 0x55, and can be told to misbehave.
+class filter_test_xor: virtual public filter
+{
+	public:
+		filter_test_xor()
+			:	failAt(0),
+				stall(false),
+				delay(false),
+				resets(0),
+				calls(0),
+				offset(0)
+		{
+		}
+
+		virtual void reset(stream::len lenInput)
+		{
+			this->resets++;
+			this->offset = 0;
+			return;
+		}
+
+		virtual void transform(uint8_t *out, stream::len *lenOut,
+			const uint8_t *in, stream::len *lenIn)
+		{
+			this->calls++;
+			if (this->delay) {
+				std::this_thread::sleep_for(std::chrono::milliseconds(1));
+			}
+			if (this->stall) {
+				*lenIn = *lenOut = 0;
+				return;
+			}
+			stream::len amt = std::min(*lenIn, *lenOut);
+			if (this->failAt) {
+				if (this->offset >= this->failAt) {
+					throw filter_error("Test filter failing as requested.");
+				}
+				amt = std::min<stream::len>(amt, this->failAt - this->offset);
+			}
+			for (stream::len i = 0; i < amt; i++) out[i] = in[i] ^ 0x55;
+			this->offset += amt;
+			*lenIn = *lenOut = amt;
+			return;
+		}
+
+		stream::pos failAt;          ///< Throw once this much is done, 0 = never
+		bool stall;                  ///< Never consume or produce anything
+		bool delay;                  ///< Sleep on every call
+		std::atomic<int> resets;     ///< Number of reset() calls
+		std::atomic<int> calls;      ///< Number of transform() calls
+
+	protected:
+		stream::pos offset;          ///< Bytes processed since reset()
+};
+
+class test_stream_decode_ahead: public test_main
+{
+	public:
+		void addTests()
+		{
+			ADD_TEST(&test_stream_decode_ahead::test_multi_buffer);
+			ADD_TEST(&test_stream_decode_ahead::test_seek_back);
+			ADD_TEST(&test_stream_decode_ahead::test_cancel);
+			ADD_TEST(&test_stream_decode_ahead::test_filter_throws);
+			ADD_TEST(&test_stream_decode_ahead::test_no_progress);
+			return;
+		}
+
+		test_stream_decode_ahead()
+		{
+			for (unsigned int i = 0; i < TEST_DATA_LEN; i++) {
+				this->encoded += (char)(i * 7);
+				this->decoded += (char)((i * 7) ^ 0x55);
+			}
+		}
+
+		/// Open the test data through a decode-ahead stream.
+		std::unique_ptr<input_decode_ahead> open(
+			std::shared_ptr<filter_test_xor> filt)
+		{
+			return std::make_unique<input_decode_ahead>(
+				std::make_unique<stream::string>(this->encoded), filt,
+				this->decoded.length(), 2, TEST_BUFFER_LEN);
+		}
+
+		/// Reads must carry on across many buffers, at any read size.
+		void test_multi_buffer()
+		{
+			BOOST_TEST_MESSAGE("Reading decoded data spread over many buffers");
+
+			auto filt = std::make_shared<filter_test_xor>();
+			auto s = this->open(filt);
+
+			// Odd sized reads, so they straddle the buffer boundaries
+			std::string result;
+			uint8_t buf[333];
+			stream::len r;
+			while ((r = s->try_read(buf, sizeof(buf))) > 0) {
+				result.append((const char *)buf, r);
+			}
+			BOOST_CHECK_MESSAGE(
+				this->is_equal(this->decoded, result),
+				"Data decoded ahead differs from the expected data"
+			);
+			BOOST_CHECK_EQUAL(s->tellg(), TEST_DATA_LEN);
+			BOOST_CHECK_EQUAL(s->size(), TEST_DATA_LEN);
+			BOOST_CHECK_EQUAL((int)filt->resets, 1);
+		}
+
+		/// Seeking backwards must start decoding again from the beginning.
+		void test_seek_back()
+		{
+			BOOST_TEST_MESSAGE("Seeking backwards in a decode-ahead stream");
+
+			auto filt = std::make_shared<filter_test_xor>();
+			auto s = this->open(filt);
+
+			std::string first = s->read(5000);
+			BOOST_CHECK_MESSAGE(
+				this->is_equal(this->decoded.substr(0, 5000), first),
+				"Wrong data before seeking"
+			);
+
+			s->seekg(100, stream::start);
+			BOOST_CHECK_EQUAL(s->tellg(), 100);
+			BOOST_CHECK_EQUAL((int)filt->resets, 2);
+			BOOST_CHECK_MESSAGE(
+				this->is_equal(this->decoded.substr(100, 2500), s->read(2500)),
+				"Wrong data after seeking backwards"
+			);
+
+			// Forwards again, past several buffers
+			s->seekg(4000, stream::cur);
+			BOOST_CHECK_EQUAL(s->tellg(), 6600);
+			BOOST_CHECK_MESSAGE(
+				this->is_equal(this->decoded.substr(6600), s->read(TEST_DATA_LEN - 6600)),
+				"Wrong data after seeking forwards"
+			);
+			BOOST_CHECK_EQUAL((int)filt->resets, 2);
+
+			BOOST_CHECK_THROW(s->seekg(1, stream::end), stream::seek_error);
+		}
+
+		/// Destroying the stream part way through must stop the helper thread.
+		void test_cancel()
+		{
+			BOOST_TEST_MESSAGE("Cancelling decoding part way through");
+
+			// Big enough that decoding it all would take over a minute
+			std::string big(TEST_DATA_LEN * 100, '\0');
+			auto filt = std::make_shared<filter_test_xor>();
+			filt->delay = true;
+			auto s = std::make_unique<input_decode_ahead>(
+				std::make_unique<stream::string>(big), filt, big.length(), 2, 16);
+
+			uint8_t buf[40];
+			BOOST_REQUIRE_EQUAL(s->try_read(buf, sizeof(buf)), sizeof(buf));
+
+			// Seeking back cancels the helper thread while it is mid-decode
+			s->seekg(0, stream::start);
+			BOOST_REQUIRE_EQUAL(s->try_read(buf, sizeof(buf)), sizeof(buf));
+			BOOST_CHECK_EQUAL(buf[0], 0x55);
+
+			auto start = std::chrono::steady_clock::now();
+			s.reset();
+			double secs = std::chrono::duration<double>(
+				std::chrono::steady_clock::now() - start).count();
+			BOOST_CHECK_LT(secs, 5.0);
+
+			// The filter must not be called again once the stream is gone
+			int calls = filt->calls;
+			std::this_thread::sleep_for(std::chrono::milliseconds(20));
+			BOOST_CHECK_EQUAL((int)filt->calls, calls);
+		}
+
+		/// An exception thrown by the filter must reach the reader.
+		void test_filter_throws()
+		{
+			BOOST_TEST_MESSAGE("Passing a filter error on to the reader");
+
+			auto filt = std::make_shared<filter_test_xor>();
+			filt->failAt = 4321;
+			auto s = this->open(filt);
+
+			// Everything decoded before the failure is still readable, and then
+			// the error is thrown rather than reporting a short file.
+			std::string result;
+			uint8_t buf[100];
+			bool thrown = false;
+			try {
+				stream::len r;
+				while ((r = s->try_read(buf, sizeof(buf))) > 0) {
+					result.append((const char *)buf, r);
+				}
+			} catch (const stream::error&) {
+				thrown = true;
+			}
+			BOOST_CHECK_MESSAGE(thrown, "Filter error was not passed on");
+			BOOST_CHECK_LE(result.length(), 4321);
+			BOOST_CHECK_MESSAGE(
+				this->is_equal(this->decoded.substr(0, result.length()), result),
+				"Data decoded before the filter error is wrong"
+			);
+		}
+
+		/// A filter that stops taking input must be an error, not the end of file.
+		void test_no_progress()
+		{
+			BOOST_TEST_MESSAGE("Reporting a filter that stops making progress");
+
+			auto filt = std::make_shared<filter_test_xor>();
+			filt->stall = true;
+			auto s = this->open(filt);
+
+			uint8_t buf[10];
+			BOOST_CHECK_THROW(s->try_read(buf, sizeof(buf)), stream::error);
+		}
+
+	protected:
+		std::string encoded; ///< Test data before decoding
+		std::string decoded; ///< Test data after decoding
+};
+
+IMPLEMENT_TESTS(stream_decode_ahead);
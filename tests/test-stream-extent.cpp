@@ -0,0 +1,525 @@
+/**
+ * @file   test-stream-extent.cpp
+ * @brief  Test code for the extent-shifting file stream.
+ *
+ * Copyright (C) 2010-2016 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include <camoto/stream_string.hpp>
+#include <camoto/gamearchive/manager.hpp>
+#include <camoto/gamearchive/archive-fat.hpp>
+#include <camoto/gamearchive/stream_extent.hpp>
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+#include "tests.hpp"
+
+using namespace camoto;
+using namespace camoto::gamearchive;
+
+/// Size of the test file, large enough to need several read buffer refills.
+#define TEST_FILE_SIZE (100 * 1024 + 123)
+
+/// Get a filename for a temporary file.
+/**
+ * The file is created in $TMPDIR if set, otherwise the current directory
+ * (the build directory when run by "make check").  /tmp is avoided as it is
+ * often a tmpfs, which can't shift extents, so the fast path would never be
+ * tested.
+ */
+std::string tempFilename()
+{
+#ifdef _WIN32
+	return std::tmpnam(nullptr);
+#else
+	const char *dir = getenv("TMPDIR");
+	std::string name = (dir && *dir) ? dir : ".";
+	name += "/libgamearchive-test-XXXXXX";
+	std::vector<char> buf(name.begin(), name.end());
+	buf.push_back('\0');
+	int fd = ::mkstemp(buf.data());
+	BOOST_REQUIRE_MESSAGE(fd >= 0, "Unable to create temporary file");
+	::close(fd);
+	return buf.data();
+#endif
+}
+
+/// Byte expected at the given offset in the test file.
+uint8_t patternAt(stream::pos off)
+{
+	return (uint8_t)((off * 7) % 251);
+}
+
+/// Temporary file deleted again at the end of each test.
+class temp_file
+{
+	public:
+		temp_file()
+			:	filename(tempFilename())
+		{
+		}
+
+		~temp_file()
+		{
+			std::remove(this->filename.c_str());
+		}
+
+		std::string filename;
+};
+
+class test_stream_extent: public test_main
+{
+	public:
+		void addTests()
+		{
+			ADD_TEST(&test_stream_extent::test_small_reads);
+			ADD_TEST(&test_stream_extent::test_read_after_write);
+			ADD_TEST(&test_stream_extent::test_read_after_truncate);
+			ADD_TEST(&test_stream_extent::test_disabled);
+			ADD_TEST(&test_stream_extent::test_archive_fallback);
+			ADD_TEST(&test_stream_extent::test_aligned_shift);
+			ADD_TEST(&test_stream_extent::test_archive_aligned);
+			ADD_TEST(&test_stream_extent::test_archive_discard);
+			return;
+		}
+
+		/// Create an extent_file holding TEST_FILE_SIZE bytes of patternAt().
+		std::unique_ptr<extent_file> makeFile(const std::string& filename)
+		{
+			auto f = std::make_unique<extent_file>(filename, true);
+			std::string data;
+			data.reserve(TEST_FILE_SIZE);
+			for (stream::pos i = 0; i < TEST_FILE_SIZE; i++) {
+				data += (char)patternAt(i);
+			}
+			f->write(data);
+			f->flush();
+			return f;
+		}
+
+		/// Read in lots of small chunks that don't line up with the read buffer.
+		void test_small_reads()
+		{
+			BOOST_TEST_MESSAGE("Reading an extent_file a few bytes at a time");
+
+			temp_file tmp;
+			auto f = this->makeFile(tmp.filename);
+
+			f->seekg(0, stream::start);
+			uint8_t buf[7];
+			stream::pos off = 0;
+			bool ok = true;
+			while (off < TEST_FILE_SIZE) {
+				stream::len r = f->try_read(buf, sizeof(buf));
+				BOOST_REQUIRE_GT(r, 0);
+				for (stream::len i = 0; i < r; i++) {
+					if (buf[i] != patternAt(off + i)) ok = false;
+				}
+				off += r;
+			}
+			BOOST_CHECK_MESSAGE(ok, "Data read in small chunks was wrong");
+			BOOST_CHECK_EQUAL(off, TEST_FILE_SIZE);
+			BOOST_CHECK_EQUAL(f->try_read(buf, sizeof(buf)), 0);
+
+			// Seek backwards into data that was buffered earlier on
+			f->seekg(1000, stream::start);
+			BOOST_REQUIRE_EQUAL(f->try_read(buf, sizeof(buf)), sizeof(buf));
+			BOOST_CHECK_EQUAL(buf[0], patternAt(1000));
+			BOOST_CHECK_EQUAL(buf[6], patternAt(1006));
+
+			// A read larger than the buffer skips it entirely
+			f->seekg(0, stream::start);
+			std::string all = f->read(TEST_FILE_SIZE);
+			BOOST_REQUIRE_EQUAL(all.length(), TEST_FILE_SIZE);
+			BOOST_CHECK_EQUAL((uint8_t)all[TEST_FILE_SIZE - 1],
+				patternAt(TEST_FILE_SIZE - 1));
+		}
+
+		/// Writes must show up in later reads, even if the area was buffered.
+		void test_read_after_write()
+		{
+			BOOST_TEST_MESSAGE("Reading back buffered data after writing over it");
+
+			temp_file tmp;
+			auto f = this->makeFile(tmp.filename);
+
+			// Pull this area into the read buffer
+			uint8_t buf[10];
+			f->seekg(50000, stream::start);
+			BOOST_REQUIRE_EQUAL(f->try_read(buf, sizeof(buf)), sizeof(buf));
+
+			f->seekp(50002, stream::start);
+			f->write("XYZZY");
+
+			f->seekg(50000, stream::start);
+			BOOST_REQUIRE_EQUAL(f->try_read(buf, sizeof(buf)), sizeof(buf));
+			BOOST_CHECK_EQUAL(buf[1], patternAt(50001));
+			BOOST_CHECK_EQUAL(buf[2], 'X');
+			BOOST_CHECK_EQUAL(buf[6], 'Y');
+			BOOST_CHECK_EQUAL(buf[7], patternAt(50007));
+		}
+
+		/// Truncating must not leave stale data visible past the new end.
+		void test_read_after_truncate()
+		{
+			BOOST_TEST_MESSAGE("Reading past a truncation point");
+
+			temp_file tmp;
+			auto f = this->makeFile(tmp.filename);
+
+			uint8_t buf[10];
+			f->seekg(100, stream::start);
+			BOOST_REQUIRE_EQUAL(f->try_read(buf, sizeof(buf)), sizeof(buf));
+
+			f->truncate(105);
+			BOOST_CHECK_EQUAL(f->size(), 105);
+
+			f->seekg(100, stream::start);
+			BOOST_CHECK_EQUAL(f->try_read(buf, sizeof(buf)), 5);
+
+			// Grow it again, the new space must read back as zeroes
+			f->truncate(200);
+			f->seekg(100, stream::start);
+			BOOST_REQUIRE_EQUAL(f->try_read(buf, sizeof(buf)), sizeof(buf));
+			BOOST_CHECK_EQUAL(buf[4], patternAt(104));
+			BOOST_CHECK_EQUAL(buf[5], 0);
+			BOOST_CHECK_EQUAL(buf[9], 0);
+		}
+
+		/// With extents disabled nothing must be shifted.
+		void test_disabled()
+		{
+			BOOST_TEST_MESSAGE("Refusing extent operations when disabled");
+
+			temp_file tmp;
+			auto f = this->makeFile(tmp.filename);
+			f->disableExtents();
+
+			BOOST_CHECK_EQUAL(f->blockSize(), 0);
+			BOOST_CHECK(!f->isAligned(0, 4096));
+			BOOST_CHECK(!f->insertRange(0, 4096));
+			BOOST_CHECK(!f->removeRange(0, 4096));
+			BOOST_CHECK_EQUAL(f->size(), TEST_FILE_SIZE);
+
+			f->seekg(0, stream::start);
+			uint8_t buf[1];
+			BOOST_REQUIRE_EQUAL(f->try_read(buf, 1), 1);
+			BOOST_CHECK_EQUAL(buf[0], patternAt(0));
+		}
+
+		/// Create a small archive and make the same set of edits to it each time.
+		void editArchive(std::unique_ptr<stream::inout> content)
+		{
+			auto pArchType = ArchiveManager::byCode("wad-doom");
+			BOOST_REQUIRE_MESSAGE(pArchType, "Could not find archive type wad-doom");
+			SuppData suppData;
+			auto pArchive = pArchType->create(std::move(content), suppData);
+
+			// Block-sized files, so the extent path is taken whenever the header
+			// leaves them aligned.
+			auto write = [&pArchive](const Archive::FileHandle& id, char c,
+				stream::len len)
+			{
+				auto f = pArchive->open(id, false);
+				f->write(std::string(len, c));
+				f->flush();
+			};
+			auto one = pArchive->insert(nullptr, "ONE", 4096, FILETYPE_GENERIC,
+				Archive::File::Attribute::Default);
+			write(one, 'A', 4096);
+			auto two = pArchive->insert(nullptr, "TWO", 8192, FILETYPE_GENERIC,
+				Archive::File::Attribute::Default);
+			write(two, 'B', 8192);
+			auto three = pArchive->insert(two, "THREE", 4096, FILETYPE_GENERIC,
+				Archive::File::Attribute::Default);
+			write(three, 'C', 4096);
+			pArchive->flush();
+
+			pArchive->resize(one, 8192, 8192);
+			write(one, 'D', 8192);
+			pArchive->remove(two);
+			pArchive->flush();
+			return;
+		}
+
+		/// Archive edits through the copy fallback match those on a plain stream.
+		void test_archive_fallback()
+		{
+			BOOST_TEST_MESSAGE("Editing an archive with extent operations disabled");
+
+			auto expected = std::make_shared<stream::string>();
+			this->editArchive(stream_wrap(expected));
+
+			temp_file tmp;
+			{
+				auto f = std::make_unique<extent_file>(tmp.filename, true);
+				f->disableExtents();
+				this->editArchive(std::move(f));
+			}
+			{
+				extent_file f(tmp.filename, false);
+				f.seekg(0, stream::start);
+				BOOST_CHECK_MESSAGE(
+					this->is_equal(expected->data, f.read(f.size())),
+					"Archive differs when edited without extent operations"
+				);
+			}
+
+			// And again with them enabled, in case this filesystem supports them
+			temp_file tmpFast;
+			this->editArchive(std::make_unique<extent_file>(tmpFast.filename, true));
+			{
+				extent_file f(tmpFast.filename, false);
+				f.seekg(0, stream::start);
+				BOOST_CHECK_MESSAGE(
+					this->is_equal(expected->data, f.read(f.size())),
+					"Archive differs when edited with extent operations"
+				);
+			}
+		}
+
+		/// Insert and remove whole blocks through the filesystem.
+		void test_aligned_shift()
+		{
+			BOOST_TEST_MESSAGE("Shifting data with aligned extent operations");
+
+			temp_file tmp;
+			auto f = this->makeFile(tmp.filename);
+			stream::len lenBlock = f->blockSize();
+			if ((lenBlock == 0) || (lenBlock * 3 > TEST_FILE_SIZE)) {
+				BOOST_TEST_MESSAGE("Extent operations not available, skipping");
+				return;
+			}
+
+			// Pull the area about to move into the read buffer, so it is known to
+			// be dropped afterwards.
+			uint8_t buf[8];
+			f->seekg(lenBlock, stream::start);
+			BOOST_REQUIRE_EQUAL(f->try_read(buf, sizeof(buf)), sizeof(buf));
+
+			if (!f->insertRange(lenBlock, lenBlock)) {
+				BOOST_TEST_MESSAGE("Filesystem can't insert extents, skipping");
+				return;
+			}
+			BOOST_CHECK_EQUAL(f->size(), TEST_FILE_SIZE + lenBlock);
+
+			// The new block reads back as zeroes, and the data after it has moved
+			f->seekg(lenBlock - 1, stream::start);
+			BOOST_REQUIRE_EQUAL(f->try_read(buf, 2), 2);
+			BOOST_CHECK_EQUAL(buf[0], patternAt(lenBlock - 1));
+			BOOST_CHECK_EQUAL(buf[1], 0);
+			f->seekg(lenBlock * 2, stream::start);
+			BOOST_REQUIRE_EQUAL(f->try_read(buf, sizeof(buf)), sizeof(buf));
+			BOOST_CHECK_EQUAL(buf[0], patternAt(lenBlock));
+			BOOST_CHECK_EQUAL(buf[7], patternAt(lenBlock + 7));
+
+			// Removing the block again must leave the original data
+			BOOST_REQUIRE_MESSAGE(f->removeRange(lenBlock, lenBlock),
+				"Filesystem can insert extents but not remove them");
+			BOOST_CHECK_EQUAL(f->size(), TEST_FILE_SIZE);
+			f->seekg(0, stream::start);
+			std::string all = f->read(TEST_FILE_SIZE);
+			bool ok = true;
+			for (stream::pos i = 0; i < TEST_FILE_SIZE; i++) {
+				if ((uint8_t)all[i] != patternAt(i)) {
+					ok = false;
+					break;
+				}
+			}
+			BOOST_CHECK_MESSAGE(ok, "Data wrong after inserting and removing a block");
+		}
+
+		/// Make a set of edits to an archive with its files kept aligned.
+		void editAligned(std::unique_ptr<stream::inout> content,
+			stream::len lenBlock)
+		{
+			auto pArchType = ArchiveManager::byCode("wad-doom");
+			BOOST_REQUIRE_MESSAGE(pArchType, "Could not find archive type wad-doom");
+			SuppData suppData;
+			auto pArchive = pArchType->create(std::move(content), suppData);
+			auto pFAT = std::dynamic_pointer_cast<Archive_FAT>(pArchive);
+			BOOST_REQUIRE(pFAT);
+
+			// Spare FAT entries stop the FAT from pushing the files out of line
+			auto attrs = pArchive->attributes();
+			unsigned int attrSpare = 0;
+			while (
+				(attrSpare < attrs.size())
+				&& (attrs[attrSpare].name.compare("Spare FAT entries") != 0)
+			) attrSpare++;
+			BOOST_REQUIRE(attrSpare < attrs.size());
+			pArchive->attribute(attrSpare, 8);
+			pFAT->setAlignment(lenBlock);
+
+			auto write = [&pArchive](const Archive::FileHandle& id, char c) {
+				auto f = pArchive->open(id, false);
+				f->write(std::string(id->storedSize, c));
+				f->flush();
+			};
+			auto checkAligned = [&pArchive, lenBlock](const char *when) {
+				for (auto& i : pArchive->files()) {
+					auto fat = Archive_FAT::FATEntry::cast(i);
+					if (fat->storedSize == 0) continue;
+					BOOST_CHECK_MESSAGE(fat->iOffset % lenBlock == 0,
+						fat->strName << " is not aligned " << when);
+				}
+			};
+
+			auto one = pArchive->insert(nullptr, "ONE", lenBlock, FILETYPE_GENERIC,
+				Archive::File::Attribute::Default);
+			write(one, 'A');
+			auto two = pArchive->insert(nullptr, "TWO", lenBlock * 2,
+				FILETYPE_GENERIC, Archive::File::Attribute::Default);
+			write(two, 'B');
+			checkAligned("after appending");
+
+			// Both of these take the fast path on filesystems that support it
+			auto three = pArchive->insert(two, "THREE", lenBlock, FILETYPE_GENERIC,
+				Archive::File::Attribute::Default);
+			write(three, 'C');
+			pArchive->remove(one);
+			checkAligned("after an aligned insert and remove");
+
+			// Odd sizes are padded so the files after them stay aligned
+			auto four = pArchive->insert(two, "FOUR", 100, FILETYPE_GENERIC,
+				Archive::File::Attribute::Default);
+			write(four, 'D');
+			pArchive->resize(three, lenBlock + 1, lenBlock + 1);
+			write(three, 'E');
+			checkAligned("after inserting and resizing unaligned files");
+			pArchive->remove(four);
+			checkAligned("after removing a padded file");
+			pArchive->flush();
+			return;
+		}
+
+		/// Aligned archive edits give the same result with and without extents.
+		void test_archive_aligned()
+		{
+			BOOST_TEST_MESSAGE("Editing an archive with its files aligned to blocks");
+
+			temp_file tmp;
+			auto f = std::make_unique<extent_file>(tmp.filename, true);
+			stream::len lenBlock = f->blockSize();
+			if (lenBlock == 0) {
+				BOOST_TEST_MESSAGE("Extent operations not available, skipping");
+				return;
+			}
+			this->editAligned(std::move(f), lenBlock);
+
+			auto expected = std::make_shared<stream::string>();
+			this->editAligned(stream_wrap(expected), lenBlock);
+
+			extent_file result(tmp.filename, false);
+			result.seekg(0, stream::start);
+			BOOST_CHECK_MESSAGE(
+				this->is_equal(expected->data, result.read(result.size())),
+				"Aligned archive differs when edited with extent operations"
+			);
+		}
+
+		/// Open an aligned POD file and insert a block-sized file into the middle.
+		std::shared_ptr<Archive> insertAligned(
+			std::unique_ptr<stream::inout> content, stream::len lenBlock)
+		{
+			auto pArchType = ArchiveManager::byCode("pod-tv");
+			BOOST_REQUIRE_MESSAGE(pArchType, "Could not find archive type pod-tv");
+			SuppData suppData;
+			auto pArchive = pArchType->open(std::move(content), suppData);
+			auto pFAT = std::dynamic_pointer_cast<Archive_FAT>(pArchive);
+			BOOST_REQUIRE(pFAT);
+			pFAT->setAlignment(lenBlock);
+
+			auto& files = pArchive->files();
+			BOOST_REQUIRE_EQUAL(files.size(), 2);
+			auto id = pArchive->insert(files[1], "NEW", lenBlock, FILETYPE_GENERIC,
+				Archive::File::Attribute::Default);
+			auto f = pArchive->open(id, false);
+			f->write(std::string(lenBlock, 'N'));
+			f->flush();
+			return pArchive;
+		}
+
+		/// An edit that is never flushed must leave the file on disk untouched.
+		void test_archive_discard()
+		{
+			BOOST_TEST_MESSAGE("Discarding an aligned archive edit without flushing");
+
+			temp_file tmp;
+			stream::len lenBlock;
+			{
+				auto f = std::make_unique<extent_file>(tmp.filename, true);
+				lenBlock = f->blockSize();
+				if (lenBlock == 0) {
+					BOOST_TEST_MESSAGE("Extent operations not available, skipping");
+					return;
+				}
+				auto pArchType = ArchiveManager::byCode("pod-tv");
+				BOOST_REQUIRE_MESSAGE(pArchType, "Could not find archive type pod-tv");
+				SuppData suppData;
+				auto pArchive = pArchType->create(std::move(f), suppData);
+				auto pFAT = std::dynamic_pointer_cast<Archive_FAT>(pArchive);
+				BOOST_REQUIRE(pFAT);
+				pFAT->setAlignment(lenBlock);
+				for (auto c : {'A', 'B'}) {
+					auto id = pArchive->insert(nullptr, std::string(1, c), lenBlock,
+						FILETYPE_GENERIC, Archive::File::Attribute::Default);
+					auto file = pArchive->open(id, false);
+					file->write(std::string(lenBlock, c));
+					file->flush();
+				}
+				pArchive->flush();
+			}
+			std::string original;
+			{
+				extent_file f(tmp.filename, false);
+				f.seekg(0, stream::start);
+				original = f.read(f.size());
+			}
+
+			// Throw the edited archive away without flushing it
+			this->insertAligned(std::make_unique<extent_file>(tmp.filename, false),
+				lenBlock);
+			{
+				extent_file f(tmp.filename, false);
+				f.seekg(0, stream::start);
+				BOOST_CHECK_MESSAGE(
+					this->is_equal(original, f.read(f.size())),
+					"Archive changed on disk without being flushed"
+				);
+			}
+
+			// Once flushed it must match the same edit made in memory
+			auto expected = std::make_shared<stream::string>();
+			expected->data = original;
+			this->insertAligned(stream_wrap(expected), lenBlock)->flush();
+			this->insertAligned(std::make_unique<extent_file>(tmp.filename, false),
+				lenBlock)->flush();
+			{
+				extent_file f(tmp.filename, false);
+				f.seekg(0, stream::start);
+				BOOST_CHECK_MESSAGE(
+					this->is_equal(expected->data, f.read(f.size())),
+					"Aligned archive differs when flushed with extent operations"
+				);
+			}
+		}
+};
+
+IMPLEMENT_TESTS(stream_extent);
@@ -0,0 +1,390 @@
+/**
+ * @file   test-stream-piece.cpp
+ * @brief  Test code for the piece table stream.
+ *
+ * Copyright (C) 2010-2016 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <random>
+#include <camoto/stream_string.hpp>
+#include <camoto/gamearchive/manager.hpp>
+#include <camoto/gamearchive/stream_piece.hpp>
+#include "tests.hpp"
+
+using namespace camoto;
+using namespace camoto::gamearchive;
+
+/// Initial content of the parent stream in each test.
+#define PARENT_DATA "0123456789ABCDEFGHIJ"
+
+/// Piece table that can report how many pieces it is made of.
+class piece_table_probe: public piece_table
+{
+	public:
+		piece_table_probe(std::unique_ptr<stream::inout> parent)
+			:	piece_table(std::move(parent))
+		{
+		}
+
+		unsigned int pieces() const
+		{
+			return count(this->root.get());
+		}
+
+		/// Amount of pending data moved out to the temporary file.
+		stream::len spilled() const
+		{
+			return this->store->lenSpilled;
+		}
+
+	protected:
+		static unsigned int count(const Node *node)
+		{
+			if (!node) return 0;
+			return 1 + count(node->left.get()) + count(node->right.get());
+		}
+};
+
+class test_stream_piece: public test_main
+{
+	public:
+		void addTests()
+		{
+			ADD_TEST(&test_stream_piece::test_overwrite_split);
+			ADD_TEST(&test_stream_piece::test_insert_across_pieces);
+			ADD_TEST(&test_stream_piece::test_remove_across_pieces);
+			ADD_TEST(&test_stream_piece::test_coalesce_writes);
+			ADD_TEST(&test_stream_piece::test_coalesce_remove);
+			ADD_TEST(&test_stream_piece::test_flush_commits);
+			ADD_TEST(&test_stream_piece::test_random_edits);
+			ADD_TEST(&test_stream_piece::test_spill);
+			ADD_TEST(&test_stream_piece::test_archive_spill);
+			return;
+		}
+
+		void prepareTest()
+		{
+			this->base = std::make_shared<stream::string>();
+			this->base->data = PARENT_DATA;
+			this->pieces = std::make_unique<piece_table_probe>(
+				stream_wrap(this->base));
+			return;
+		}
+
+		/// Read the whole piece table back.
+		std::string content()
+		{
+			this->pieces->seekg(0, stream::start);
+			return this->pieces->read(this->pieces->size());
+		}
+
+		/// Overwrite in the middle of a piece, which must split it in three.
+		void test_overwrite_split()
+		{
+			BOOST_TEST_MESSAGE("Overwriting data in the middle of a piece");
+			this->prepareTest();
+
+			this->pieces->seekp(5, stream::start);
+			this->pieces->write("xyz");
+			BOOST_CHECK_MESSAGE(
+				this->is_equal("01234xyz89ABCDEFGHIJ", this->content()),
+				"Overwrite did not replace the right bytes"
+			);
+			BOOST_CHECK_EQUAL(this->pieces->pieces(), 3);
+
+			// Overwrite across the end of the new piece and into the parent data
+			this->pieces->seekp(6, stream::start);
+			this->pieces->write("----");
+			BOOST_CHECK_MESSAGE(
+				this->is_equal("01234x----ABCDEFGHIJ", this->content()),
+				"Overwrite spanning two pieces did not replace the right bytes"
+			);
+
+			// Nothing is written to the parent until flush()
+			BOOST_CHECK_MESSAGE(
+				this->is_equal(PARENT_DATA, this->base->data),
+				"Parent stream was changed before flush()"
+			);
+		}
+
+		/// Insert at and within piece boundaries.
+		void test_insert_across_pieces()
+		{
+			BOOST_TEST_MESSAGE("Inserting data at and between piece boundaries");
+			this->prepareTest();
+
+			this->pieces->seekp(4, stream::start);
+			this->pieces->write("ab");
+			// Exactly on the boundary between the new piece and the parent data
+			this->pieces->seekp(6, stream::start);
+			this->pieces->insert(2);
+			// In the middle of the written piece
+			this->pieces->seekp(5, stream::start);
+			this->pieces->insert(1);
+
+			BOOST_CHECK_MESSAGE(
+				this->is_equal(STRING_WITH_NULLS("0123a\0b\0\0" "6789ABCDEFGHIJ"),
+					this->content()),
+				"Inserted zero bytes ended up in the wrong place"
+			);
+			BOOST_CHECK_EQUAL(this->pieces->size(), 23);
+
+			// Inserting past the end of the data is the same as extending it
+			this->pieces->seekp(0, stream::end);
+			this->pieces->insert(1);
+			BOOST_CHECK_EQUAL(this->pieces->size(), 24);
+		}
+
+		/// Remove a span covering parts of several pieces.
+		void test_remove_across_pieces()
+		{
+			BOOST_TEST_MESSAGE("Removing data spanning several pieces");
+			this->prepareTest();
+
+			this->pieces->seekp(4, stream::start);
+			this->pieces->write("ab");
+			this->pieces->seekp(10, stream::start);
+			this->pieces->insert(3);
+			// Starts in the parent data, covers the written piece and the zeroes,
+			// and ends in the parent data again.
+			this->pieces->seekp(2, stream::start);
+			this->pieces->remove(13);
+
+			BOOST_CHECK_MESSAGE(
+				this->is_equal("01CDEFGHIJ", this->content()),
+				"Wrong data left after removing across pieces"
+			);
+
+			// Removing past the end must fail without changing anything
+			this->pieces->seekp(8, stream::start);
+			BOOST_CHECK_THROW(this->pieces->remove(3), stream::error);
+			BOOST_CHECK_EQUAL(this->pieces->size(), 10);
+		}
+
+		/// Sequential writes must not add a new piece each time.
+		void test_coalesce_writes()
+		{
+			BOOST_TEST_MESSAGE("Joining pieces from sequential writes");
+			this->prepareTest();
+
+			this->pieces->seekp(0, stream::end);
+			for (int i = 0; i < 100; i++) this->pieces->write("x");
+			BOOST_CHECK_EQUAL(this->pieces->pieces(), 2);
+
+			// Same again, overwriting existing data
+			this->pieces->seekp(2, stream::start);
+			for (int i = 0; i < 10; i++) this->pieces->write("y");
+			BOOST_CHECK_EQUAL(this->pieces->pieces(), 4);
+
+			// Consecutive inserts join up too
+			this->pieces->seekp(50, stream::start);
+			this->pieces->insert(5);
+			this->pieces->insert(5);
+			BOOST_CHECK_EQUAL(this->pieces->pieces(), 6);
+
+			BOOST_CHECK_EQUAL(this->pieces->size(), 130);
+			std::string expected = "01" + std::string(10, 'y') + "CDEFGHIJ"
+				+ std::string(30, 'x') + std::string(10, '\0') + std::string(70, 'x');
+			BOOST_CHECK_MESSAGE(
+				this->is_equal(expected, this->content()),
+				"Wrong data after joining pieces"
+			);
+		}
+
+		/// Undoing an insert must join the pieces either side of it again.
+		void test_coalesce_remove()
+		{
+			BOOST_TEST_MESSAGE("Joining pieces after removing the data between them");
+			this->prepareTest();
+
+			this->pieces->seekp(7, stream::start);
+			this->pieces->insert(4);
+			BOOST_CHECK_EQUAL(this->pieces->pieces(), 3);
+			this->pieces->remove(4);
+			BOOST_CHECK_EQUAL(this->pieces->pieces(), 1);
+			BOOST_CHECK_MESSAGE(
+				this->is_equal(PARENT_DATA, this->content()),
+				"Wrong data after inserting and removing the same span"
+			);
+		}
+
+		/// flush() must write everything to the parent and collapse the pieces.
+		void test_flush_commits()
+		{
+			BOOST_TEST_MESSAGE("Committing changes on flush");
+			this->prepareTest();
+
+			auto counts = std::make_shared<stream_counts>();
+			counts->ops = 0;
+			counts->bytes = 0;
+			this->pieces = std::make_unique<piece_table_probe>(
+				std::make_unique<counting_stream>(stream_wrap(this->base), counts));
+
+			this->pieces->seekp(3, stream::start);
+			this->pieces->remove(2);
+			this->pieces->write("pq");
+			this->pieces->seekp(0, stream::end);
+			this->pieces->insert(2);
+			this->pieces->seekp(0, stream::start);
+			this->pieces->insert(1);
+			BOOST_CHECK_EQUAL(counts->ops, 0);
+			BOOST_CHECK_MESSAGE(
+				this->is_equal(PARENT_DATA, this->base->data),
+				"Parent stream was changed before flush()"
+			);
+
+			this->pieces->flush();
+			std::string expected = STRING_WITH_NULLS("\0" "012pq789ABCDEFGHIJ\0\0");
+			BOOST_CHECK_MESSAGE(
+				this->is_equal(expected, this->base->data),
+				"Parent stream has the wrong content after flush()"
+			);
+			BOOST_CHECK_EQUAL(this->pieces->pieces(), 1);
+			BOOST_CHECK_MESSAGE(
+				this->is_equal(expected, this->content()),
+				"Piece table has the wrong content after flush()"
+			);
+
+			// A second flush with nothing changed must not touch the data
+			counts->ops = 0;
+			this->pieces->flush();
+			BOOST_CHECK_EQUAL(counts->bytes, 0);
+		}
+
+		/// Compare a long run of random edits against a plain string.
+		void test_random_edits()
+		{
+			BOOST_TEST_MESSAGE("Making random edits");
+			this->prepareTest();
+
+			std::string model = PARENT_DATA;
+			std::minstd_rand rng(1234);
+			for (int i = 0; i < 2000; i++) {
+				stream::pos off = rng() % (model.length() + 1);
+				stream::len len = 1 + rng() % 16;
+				switch (rng() % 4) {
+					case 0: {
+						std::string data(len, (char)('a' + i % 26));
+						this->pieces->seekp(off, stream::start);
+						this->pieces->write(data);
+						model.replace(off, len, data);
+						break;
+					}
+					case 1:
+						this->pieces->seekp(off, stream::start);
+						this->pieces->insert(len);
+						model.insert(off, len, '\0');
+						break;
+					case 2:
+						len = std::min<stream::len>(len, model.length() - off);
+						this->pieces->seekp(off, stream::start);
+						this->pieces->remove(len);
+						model.erase(off, len);
+						break;
+					case 3:
+						if (i % 10 == 0) this->pieces->flush();
+						break;
+				}
+			}
+			BOOST_CHECK_MESSAGE(
+				this->is_equal(model, this->content()),
+				"Random edits gave the wrong result"
+			);
+			this->pieces->flush();
+			BOOST_CHECK_MESSAGE(
+				this->is_equal(model, this->base->data),
+				"Random edits were not written out correctly"
+			);
+		}
+
+		/// Data past the memory limit must go to the temporary file and back.
+		void test_spill()
+		{
+			BOOST_TEST_MESSAGE("Moving pending data out to a temporary file");
+			this->prepareTest();
+			this->pieces->setMemoryLimit(64);
+
+			std::string expected = PARENT_DATA;
+			this->pieces->seekp(0, stream::end);
+			for (int i = 0; i < 100; i++) {
+				std::string block(37, (char)('a' + i % 26));
+				this->pieces->write(block);
+				expected += block;
+			}
+			// Overwrite across data that has been spilled and data still in memory
+			this->pieces->seekp(3690, stream::start);
+			this->pieces->write("0123456789");
+			expected.replace(3690, 10, "0123456789");
+
+			BOOST_CHECK_GT(this->pieces->spilled(), 3000);
+			BOOST_CHECK_MESSAGE(
+				this->is_equal(expected, this->content()),
+				"Pending data read back wrongly from the temporary file"
+			);
+			this->pieces->flush();
+			BOOST_CHECK_MESSAGE(
+				this->is_equal(expected, this->base->data),
+				"Pending data in the temporary file was not written out correctly"
+			);
+		}
+
+		/// The memory limit passed when opening an archive must be used.
+		void test_archive_spill()
+		{
+			BOOST_TEST_MESSAGE("Adding a file to an archive opened with a small "
+				"memory limit");
+
+			auto pArchType = ArchiveManager::byCode("wad-doom");
+			BOOST_REQUIRE_MESSAGE(pArchType, "Could not find archive type wad-doom");
+			auto base = std::make_shared<stream::string>();
+			SuppData suppData;
+			std::string data;
+			for (int i = 0; i < 65536 + 123; i++) data += (char)(i * 7 % 251);
+			{
+				auto pArchive = pArchType->createBuffered(stream_wrap(base), suppData,
+					256);
+				auto id = pArchive->insert(nullptr, "BIG", data.length(),
+					FILETYPE_GENERIC, Archive::File::Attribute::Default);
+				auto f = pArchive->open(id, false);
+				f->write(data);
+				f->flush();
+
+				// Read it back before it has been written out
+				f->seekg(0, stream::start);
+				BOOST_CHECK_MESSAGE(
+					this->is_equal(data, f->read(data.length())),
+					"Unsaved file data read back wrongly"
+				);
+				pArchive->flush();
+			}
+
+			auto pArchive = pArchType->openBuffered(stream_wrap(base), suppData,
+				256);
+			auto id = pArchive->find("BIG");
+			BOOST_REQUIRE_MESSAGE(pArchive->isValid(id), "File missing after flush");
+			auto f = pArchive->open(id, false);
+			BOOST_CHECK_MESSAGE(
+				this->is_equal(data, f->read(data.length())),
+				"File data wrong after being written out from a temporary file"
+			);
+		}
+
+	protected:
+		std::shared_ptr<stream::string> base;
+		std::unique_ptr<piece_table_probe> pieces;
+};
+
+IMPLEMENT_TESTS(stream_piece);
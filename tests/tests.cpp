@@ -47,6 +47,114 @@ std::unique_ptr<stream::sub> stream_wrap(std::shared_ptr<stream::inout> base)
 	);
 }
 
+counting_stream::counting_stream(std::unique_ptr<stream::inout> parent,
+	std::shared_ptr<stream_counts> counts)
+	:	parent(std::move(parent)),
+		counts(counts)
+{
+}
+
+stream::len counting_stream::try_read(uint8_t *buffer, stream::len len)
+{
+	stream::len r = this->parent->try_read(buffer, len);
+	this->counts->ops++;
+	this->counts->bytes += r;
+	return r;
+}
+
+void counting_stream::seekg(stream::delta off, stream::seek_from from)
+{
+	this->parent->seekg(off, from);
+	return;
+}
+
+stream::pos counting_stream::tellg() const
+{
+	return this->parent->tellg();
+}
+
+stream::len counting_stream::size() const
+{
+	return this->parent->size();
+}
+
+stream::len counting_stream::try_write(const uint8_t *buffer, stream::len len)
+{
+	stream::len w = this->parent->try_write(buffer, len);
+	this->counts->ops++;
+	this->counts->bytes += w;
+	return w;
+}
+
+void counting_stream::seekp(stream::delta off, stream::seek_from from)
+{
+	this->parent->seekp(off, from);
+	return;
+}
+
+stream::pos counting_stream::tellp() const
+{
+	return this->parent->tellp();
+}
+
+void counting_stream::truncate(stream::len size)
+{
+	this->parent->truncate(size);
+	this->counts->ops++;
+	return;
+}
+
+void counting_stream::flush()
+{
+	this->parent->flush();
+	return;
+}
+
+counting_piece_table::counting_piece_table(
+	std::unique_ptr<stream::inout> parent, std::shared_ptr<stream_counts> counts)
+	:	piece_table(std::move(parent)),
+		counts(counts)
+{
+}
+
+stream::len counting_piece_table::try_read(uint8_t *buffer, stream::len len)
+{
+	stream::len r = this->piece_table::try_read(buffer, len);
+	this->counts->ops++;
+	this->counts->bytes += r;
+	return r;
+}
+
+stream::len counting_piece_table::try_write(const uint8_t *buffer,
+	stream::len len)
+{
+	stream::len w = this->piece_table::try_write(buffer, len);
+	this->counts->ops++;
+	this->counts->bytes += w;
+	return w;
+}
+
+void counting_piece_table::truncate(stream::len size)
+{
+	this->piece_table::truncate(size);
+	this->counts->ops++;
+	return;
+}
+
+void counting_piece_table::insert(stream::len len)
+{
+	this->piece_table::insert(len);
+	this->counts->ops++;
+	return;
+}
+
+void counting_piece_table::remove(stream::len len)
+{
+	this->piece_table::remove(len);
+	this->counts->ops++;
+	return;
+}
+
 test_main::test_main()
 	: outputWidth(16)
 {
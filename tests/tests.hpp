@@ -22,9 +22,11 @@
 #define _CAMOTO_GAMEARCHIVE_TESTS_HPP_
 
 #include <memory>
+#include <functional>
 #include <boost/test/unit_test.hpp>
 #include <camoto/util.hpp>
 #include <camoto/stream_sub.hpp>
+#include <camoto/gamearchive/stream_piece.hpp>
 
 /// Allow a string constant to be passed around with embedded nulls
 #define STRING_WITH_NULLS(x)  std::string((x), sizeof((x)) - 1)
@@ -33,6 +35,68 @@
 /// violating unique_ptr requirements.
 std::unique_ptr<camoto::stream::sub> stream_wrap(std::shared_ptr<camoto::stream::inout> base);
 
+/// Number of operations passed through a counting_stream.
+struct stream_counts
+{
+	unsigned long ops;          ///< Reads, writes, truncates, inserts and removes
+	camoto::stream::len bytes;  ///< Bytes read and written
+};
+
+/// Stream that counts the reads and writes passed through to another one.
+/**
+ * This is used to check how much work an operation does on the underlying
+ * file, so the tests can fail if it grows faster than it should.
+ */
+class counting_stream: virtual public camoto::stream::inout
+{
+	public:
+		counting_stream(std::unique_ptr<camoto::stream::inout> parent,
+			std::shared_ptr<stream_counts> counts);
+
+		virtual camoto::stream::len try_read(uint8_t *buffer,
+			camoto::stream::len len);
+		virtual void seekg(camoto::stream::delta off,
+			camoto::stream::seek_from from);
+		virtual camoto::stream::pos tellg() const;
+		virtual camoto::stream::len size() const;
+
+		virtual camoto::stream::len try_write(const uint8_t *buffer,
+			camoto::stream::len len);
+		virtual void seekp(camoto::stream::delta off,
+			camoto::stream::seek_from from);
+		virtual camoto::stream::pos tellp() const;
+		virtual void truncate(camoto::stream::len size);
+		virtual void flush();
+
+	protected:
+		std::unique_ptr<camoto::stream::inout> parent;
+		std::shared_ptr<stream_counts> counts;
+};
+
+/// Piece table that counts the calls made to it.
+/**
+ * Archive_FAT uses a piece table passed to it as its content stream, so this
+ * counts every edit an archive makes, before the piece table merges them
+ * together.  A counting_stream below it counts what is written out on flush.
+ */
+class counting_piece_table: public camoto::gamearchive::piece_table
+{
+	public:
+		counting_piece_table(std::unique_ptr<camoto::stream::inout> parent,
+			std::shared_ptr<stream_counts> counts);
+
+		virtual camoto::stream::len try_read(uint8_t *buffer,
+			camoto::stream::len len);
+		virtual camoto::stream::len try_write(const uint8_t *buffer,
+			camoto::stream::len len);
+		virtual void truncate(camoto::stream::len size);
+		virtual void insert(camoto::stream::len len);
+		virtual void remove(camoto::stream::len len);
+
+	protected:
+		std::shared_ptr<stream_counts> counts;
+};
+
 /// Base class for all tests
 class test_main
 {
@@ -73,6 +137,19 @@ class suite_test_tmpl {
 		}
 };
 
+/// Add a test_main member function to the suite.
+/**
+ * This is for suites that don't need any setup done before each test.
+ */
+#define ADD_TEST(fn) \
+	this->ts->add( \
+		boost::unit_test::make_test_case( \
+			std::bind(fn, this), \
+			BOOST_TEST_STRINGIZE(fn), \
+			__FILE__, __LINE__ \
+		) \
+	);
+
 /// Add the tests for a given format
 #define IMPLEMENT_TESTS(fmt) \
 	class suite_ ## fmt: public suite_test_tmpl<test_ ## fmt> { \